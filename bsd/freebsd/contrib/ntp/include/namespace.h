@@ -106,6 +106,7 @@
 #define  clamp_systime _ntp_clamp_systime
 #define  clear_all _ntp_clear_all
 #define  clear_globals _ntp_clear_globals
+#define  clear_recvbuff_stats _ntp_clear_recvbuff_stats
 #define  clktypes _ntp_clktypes
 #define  clock_codec _ntp_clock_codec
 #define  clock_filter _ntp_clock_filter
@@ -225,6 +226,7 @@
 #define  findpeer_calls _ntp_findpeer_calls
 #define  flash2 _ntp_flash2
 #define  flash3 _ntp_flash3
+#define  flush_xmit_queue _ntp_flush_xmit_queue
 #define  force_step_once _ntp_force_step_once
 #define  format_errmsg _ntp_format_errmsg
 #define  freerecvbuf _ntp_freerecvbuf
@@ -244,12 +246,14 @@
 #define  getconfig _ntp_getconfig
 #define  get_ext_sys_var _ntp_get_ext_sys_var
 #define  get_free_recv_buffer _ntp_get_free_recv_buffer
+#define  get_free_recv_buffer_small _ntp_get_free_recv_buffer_small
 #define  get_full_recv_buffer _ntp_get_full_recv_buffer
 #define  getinterface _ntp_getinterface
 #define  getnameinfo_sometime _ntp_getnameinfo_sometime
 #define  getnetnum _ntp_getnetnum
 #define  get_packet_mode _ntp_get_packet_mode
 #define  get_systime _ntp_get_systime
+#define  get_systime_fast _ntp_get_systime_fast
 #define  gmprettydate _ntp_gmprettydate
 #define  grow_assoc_cache _ntp_grow_assoc_cache
 #define  g_varlist _ntp_g_varlist
@@ -279,6 +283,8 @@
 #define  init_peer _ntp_init_peer
 #define  init_proto _ntp_init_proto
 #define  init_recvbuff _ntp_init_recvbuff
+#define  init_recvbuff_slab _ntp_init_recvbuff_slab
+#define  init_recvbuff_small _ntp_init_recvbuff_small
 #define  init_request _ntp_init_request
 #define  init_restrict _ntp_init_restrict
 #define  init_systime _ntp_init_systime
@@ -578,18 +584,31 @@
 #define  mon_age _ntp_mon_age
 #define  mon_clearinterface _ntp_mon_clearinterface
 #define  mon_enabled _ntp_mon_enabled
-#define  mon_hash _ntp_mon_hash
+#define  mon_getaddr _ntp_mon_getaddr
 #define  mon_hash_bits _ntp_mon_hash_bits
-#define  mon_mru_list _ntp_mon_mru_list
+#define  mon_hash_bucket _ntp_mon_hash_bucket
+#define  mon_hash_longest _ntp_mon_hash_longest
+#define  mon_hash_lookups _ntp_mon_hash_lookups
+#define  mon_hash_probes _ntp_mon_hash_probes
+#define  mon_hash_split _ntp_mon_hash_split
+#define  mon_lookup _ntp_mon_lookup
+#define  mon_mem _ntp_mon_mem
+#define  mon_mem_alloc _ntp_mon_mem_alloc
+#define  mon_mru_limited _ntp_mon_mru_limited
+#define  mon_oldest _ntp_mon_oldest
+#define  mon_ptr _ntp_mon_ptr
+#define  mon_sketch_limited _ntp_mon_sketch_limited
 #define  mon_start _ntp_mon_start
 #define  mon_stop _ntp_mon_stop
 #define  months _ntp_months
+#define  mon_ts _ntp_mon_ts
 #define  move_fd _ntp_move_fd
 #define  mprintf _ntp_mprintf
 #define  mprintf_clock_stats _ntp_mprintf_clock_stats
 #define  mprintf_event _ntp_mprintf_event
 #define  mru_alloc _ntp_mru_alloc
 #define  mru_entries _ntp_mru_entries
+#define  mru_entries6 _ntp_mru_entries6
 #define  mru_incalloc _ntp_mru_incalloc
 #define  mru_initalloc _ntp_mru_initalloc
 #define  mrulist_interrupted _ntp_mrulist_interrupted
@@ -798,6 +817,9 @@
 #define  peer_free_count _ntp_peer_free_count
 #define  peer_hash _ntp_peer_hash
 #define  peer_hash_count _ntp_peer_hash_count
+#define  peer_hash_longest _ntp_peer_hash_longest
+#define  peer_hash_size _ntp_peer_hash_size
+#define  peer_keyed _ntp_peer_keyed
 #define  peer_list _ntp_peer_list
 #define  peer_ntpdate _ntp_peer_ntpdate
 #define  peer_preempt _ntp_peer_preempt
@@ -823,6 +845,7 @@
 #define  process_control _ntp_process_control
 #define  process_packet _ntp_process_packet
 #define  process_private _ntp_process_private
+#define  promote_recv_buffer _ntp_promote_recv_buffer
 #define  prompt _ntp_prompt
 #define  proto_clr_stats _ntp_proto_clr_stats
 #define  proto_config _ntp_proto_config
@@ -841,6 +864,11 @@
 #define  record_peer_stats _ntp_record_peer_stats
 #define  record_proto_stats _ntp_record_proto_stats
 #define  record_raw_stats _ntp_record_raw_stats
+#define  recvbuff_dwell _ntp_recvbuff_dwell
+#define  recvbuff_exhaustions _ntp_recvbuff_exhaustions
+#define  recvbuff_hiwater _ntp_recvbuff_hiwater
+#define  recvbuff_promotions _ntp_recvbuff_promotions
+#define  recvbuff_slab_size _ntp_recvbuff_slab_size
 #define  refid_str _ntp_refid_str
 #define  refnumtoa _ntp_refnumtoa
 #define  refresh_all_peerinterfaces _ntp_refresh_all_peerinterfaces
@@ -852,13 +880,20 @@
 #define  req_child_exit _ntp_req_child_exit
 #define  rereadkeys _ntp_rereadkeys
 #define  res_access_flags _ntp_res_access_flags
+#define  res_cache_hits _ntp_res_cache_hits
+#define  res_cache_misses _ntp_res_cache_misses
 #define  reset_auth_stats _ntp_reset_auth_stats
 #define  reset_entries _ntp_reset_entries
 #define  res_match_flags _ntp_res_match_flags
+#define  restrict_default_only _ntp_restrict_default_only
+#define  restrict_generation _ntp_restrict_generation
 #define  restrictions _ntp_restrictions
 #define  restrictlist4 _ntp_restrictlist4
 #define  restrictlist6 _ntp_restrictlist6
+#define  restrict_sort_lists _ntp_restrict_sort_lists
 #define  restrict_source _ntp_restrict_source
+#define  rx_slab _ntp_rx_slab
+#define  rx_small _ntp_rx_small
 #define  sau_from_netaddr _ntp_sau_from_netaddr
 #define  saveconfigdir _ntp_saveconfigdir
 #define  saved_argc _ntp_saved_argc
@@ -869,6 +904,7 @@
 #define  send_blocking_req_internal _ntp_send_blocking_req_internal
 #define  send_blocking_resp_internal _ntp_send_blocking_resp_internal
 #define  sendpkt _ntp_sendpkt
+#define  sendpkt_deferred _ntp_sendpkt_deferred
 #define  send_via_ntp_signd _ntp_send_via_ntp_signd
 #define  sequence _ntp_sequence
 #define  server_entry _ntp_server_entry
@@ -882,8 +918,12 @@
 #define  set_tod_using _ntp_set_tod_using
 #define  setup_logfile _ntp_setup_logfile
 #define  set_var _ntp_set_var
+#define  shard_publish _ntp_shard_publish
+#define  shard_stats _ntp_shard_stats
+#define  shard_workers _ntp_shard_workers
 #define  show_error_msg _ntp_show_error_msg
 #define  showhostnames _ntp_showhostnames
+#define  small_recvbuffs _ntp_small_recvbuffs
 #define  sockaddr_masktoprefixlen _ntp_sockaddr_masktoprefixlen
 #define  sockfd _ntp_sockfd
 #define  sock_hash _ntp_sock_hash
@@ -919,11 +959,17 @@
 #define  sys_cohort _ntp_sys_cohort
 #define  sys_declined _ntp_sys_declined
 #define  sys_epoch _ntp_sys_epoch
+#define  sys_fastpath _ntp_sys_fastpath
+#define  sys_fastpath_pkts _ntp_sys_fastpath_pkts
+#define  sys_fasttime _ntp_sys_fasttime
 #define  sys_floor _ntp_sys_floor
 #define  sys_fuzz _ntp_sys_fuzz
 #define  sys_fuzz_nsec _ntp_sys_fuzz_nsec
 #define  sys_ident _ntp_sys_ident
 #define  sys_ifnum _ntp_sys_ifnum
+#define  sys_incselect _ntp_sys_incselect
+#define  sys_inplace _ntp_sys_inplace
+#define  sys_inplace_pkts _ntp_sys_inplace_pkts
 #define  sys_jitter _ntp_sys_jitter
 #define  sys_kodsent _ntp_sys_kodsent
 #define  sys_lamport _ntp_sys_lamport
@@ -967,13 +1013,23 @@
 #define  sys_ttlmax _ntp_sys_ttlmax
 #define  sysvarlen _ntp_sysvarlen
 #define  sysvars _ntp_sysvars
+#define  sys_xmt_template _ntp_sys_xmt_template
 #define  tc_counter _ntp_tc_counter
 #define  text_mmap _ntp_text_mmap
 #define  text_munmap _ntp_text_munmap
 #define  timer _ntp_timer
 #define  timer_clr_stats _ntp_timer_clr_stats
+#define  timer_event_arm _ntp_timer_event_arm
+#define  timer_event_cancel _ntp_timer_event_cancel
+#define  timer_fast _ntp_timer_fast
+#define  timer_fast_alarm _ntp_timer_fast_alarm
+#define  timer_fast_peer _ntp_timer_fast_peer
+#define  timer_fast_unpeer _ntp_timer_fast_unpeer
+#define  timer_fast_wait _ntp_timer_fast_wait
 #define  timer_interfacetimeout _ntp_timer_interfacetimeout
 #define  timer_overflows _ntp_timer_overflows
+#define  timer_peer _ntp_timer_peer
+#define  timer_throttle _ntp_timer_throttle
 #define  timer_timereset _ntp_timer_timereset
 #define  timer_xmtcalls _ntp_timer_xmtcalls
 #define  time_to_vint64 _ntp_time_to_vint64
@@ -981,11 +1037,15 @@
 #define  total_peer_structs _ntp_total_peer_structs
 #define  total_recvbuffs _ntp_total_recvbuffs
 #define  transmit _ntp_transmit
+#define  transmit_fast _ntp_transmit_fast
 #define  trunc_left _ntp_trunc_left
 #define  trunc_os_clock _ntp_trunc_os_clock
 #define  trunc_right _ntp_trunc_right
 #define  tvout _ntp_tvout
 #define  tvsout _ntp_tvsout
+#define  tx_batch _ntp_tx_batch
+#define  tx_flushes _ntp_tx_flushes
+#define  tx_flush_pkts _ntp_tx_flush_pkts
 #define  ucmpv64 _ntp_ucmpv64
 #define  unexpected_error_cnt _ntp_unexpected_error_cnt
 #define  uninit_util _ntp_uninit_util
@@ -993,6 +1053,7 @@
 #define  unpeer_crypto_early _ntp_unpeer_crypto_early
 #define  unpeer_crypto_nak_early _ntp_unpeer_crypto_nak_early
 #define  unpeer_digest_early _ntp_unpeer_digest_early
+#define  update_xmt_template _ntp_update_xmt_template
 #define  valid_NAK _ntp_valid_NAK
 #define  varfmt _ntp_varfmt
 #define  Version _ntp_Version
@@ -249,43 +249,43 @@ struct interface {
 #define TEST15		0x4000
 #define TEST16		0x8000
 
+/*
+ * An event on the timer wheel (see ntp_timer.c), embedded in the
+ * structure it belongs to.  fire() is called from timer() once
+ * current_time reaches due.  A NULL link.f marks an unarmed event.
+ */
+typedef struct timer_event_tag timer_event;
+struct timer_event_tag {
+	DECL_DLIST_LINK(timer_event, link);
+	u_long	due;		/* current_time to fire at */
+	void	(*fire)(timer_event *);
+};
+
 /*
  * The peer structure. Holds state information relating to the guys
  * we are peering with. Most of this stuff is from section 3.2 of the
  * spec.
+ *
+ * The members are laid out hot to cold.  findpeer() on each packet,
+ * clock_select() on each update and the poll scheduling only read
+ * the first few cache lines, the clock filter the next ones; the
+ * configuration, names and statistics counters follow at the end.
+ * The structures come from contiguous, cache line aligned blocks (see
+ * getmorepeermem()), so walking peer_list stays within few pages.
  */
 struct peer {
+	/*
+	 * Hot section: lookup and selection
+	 */
 	struct peer *p_link;	/* link pointer in free & peer lists */
 	struct peer *adr_link;	/* link pointer in address hash */
-	struct peer *aid_link;	/* link pointer in associd hash */
-	struct peer *ilink;	/* list of peers for interface */
-	sockaddr_u srcadr;	/* address of remote host */
-	char *	hostname;	/* if non-NULL, remote name */
-	struct addrinfo *addrs;	/* hostname query result */
-	struct addrinfo *ai;	/* position within addrs */
 	endpt *	dstadr;		/* local address */
-	associd_t associd;	/* association ID */
-	u_char	version;	/* version number */
-	u_char	hmode;		/* local association mode */
-	u_char	hpoll;		/* local poll interval */
-	u_char	minpoll;	/* min poll interval */
-	u_char	maxpoll;	/* max poll interval */
+	sockaddr_u srcadr;	/* address of remote host */
 	u_int	flags;		/* association flags */
+	u_char	hmode;		/* local association mode */
 	u_char	cast_flags;	/* additional flags */
-	u_char	last_event;	/* last peer error code */
-	u_char	num_events;	/* number of error events */
-	u_int32	ttl;		/* ttl/refclock mode */
-	char	*ident;		/* group identifier name */
-
-	/*
-	 * Variables used by reference clock support
-	 */
-#ifdef REFCLOCK
-	struct refclockproc *procptr; /* refclock structure pointer */
-	u_char	refclktype;	/* reference clock type */
-	u_char	refclkunit;	/* reference clock unit number */
-	u_char	sstclktype;	/* clock type for system status word */
-#endif /* REFCLOCK */
+	u_char	version;	/* version number */
+	u_char	hpoll;		/* local poll interval */
 
 	/*
 	 * Variables set by received packet
@@ -295,74 +295,45 @@ struct peer {
 	u_char	stratum;	/* remote stratum */
 	u_char	ppoll;		/* remote poll interval */
 	s_char	precision;	/* remote clock precision */
+	associd_t associd;	/* association ID */
+	u_int32	refid;		/* remote reference ID */
 	double	rootdelay;	/* roundtrip delay to primary source */
 	double	rootdisp;	/* dispersion to primary source */
-	u_int32	refid;		/* remote reference ID */
-	l_fp	reftime;	/* update epoch */
-
-	/*
-	 * Variables used by authenticated client
-	 */
-	keyid_t keyid;		/* current key ID */
-#ifdef AUTOKEY
-#define clear_to_zero opcode
-	u_int32	opcode;		/* last request opcode */
-	associd_t assoc;	/* peer association ID */
-	u_int32	crypto;		/* peer status word */
-	EVP_PKEY *pkey;		/* public key */
-	const EVP_MD *digest;	/* message digest algorithm */
-	char	*subject;	/* certificate subject name */
-	char	*issuer;	/* certificate issuer name */
-	struct cert_info *xinfo; /* issuer certificate */
-	keyid_t	pkeyid;		/* previous key ID */
-	keyid_t	hcookie;	/* host cookie */
-	keyid_t	pcookie;	/* peer cookie */
-	const struct pkey_info *ident_pkey; /* identity key */
-	BIGNUM	*iffval;	/* identity challenge (IFF, GQ, MV) */
-	const BIGNUM *grpkey;	/* identity challenge key (GQ) */
-	struct value cookval;	/* receive cookie values */
-	struct value recval;	/* receive autokey values */
-	struct exten *cmmd;	/* extension pointer */
-	u_long	refresh;	/* next refresh epoch */
-
-	/*
-	 * Variables used by authenticated server
-	 */
-	keyid_t	*keylist;	/* session key ID list */
-	int	keynumber;	/* current key number */
-	struct value encrypt;	/* send encrypt values */
-	struct value sndval;	/* send autokey values */
-#else	/* !AUTOKEY follows */
-#define clear_to_zero status
-#endif	/* !AUTOKEY */
+	u_long	update;		/* receive epoch */
 
 	/*
 	 * Ephemeral state variables
 	 */
+#define clear_to_zero status
 	u_char	status;		/* peer status */
 	u_char	new_status;	/* under-construction status */
+	int	selidx;		/* clock_select() candidate index */
 	u_char	reach;		/* reachability register */
 	int	flash;		/* protocol error test tally bits */
+	double	offset;		/* peer clock offset */
+	double	delay;		/* peer roundtrip delay */
+	double	jitter;		/* peer jitter (squares) */
+	double	disp;		/* peer dispersion */
 	u_long	epoch;		/* reference epoch */
 	int	burst;		/* packets remaining in burst */
 	int	retry;		/* retry counter */
 	int	flip;		/* interleave mode control */
+
+	/*
+	 * Warm section: the clock filter and timestamps
+	 */
 	int	filter_nextpt;	/* index into filter shift register */
+	u_char	filter_order[NTP_SHIFT]; /* filter sort index */
 	double	filter_delay[NTP_SHIFT]; /* delay shift register */
 	double	filter_offset[NTP_SHIFT]; /* offset shift register */
 	double	filter_disp[NTP_SHIFT]; /* dispersion shift register */
 	u_long	filter_epoch[NTP_SHIFT]; /* epoch shift register */
-	u_char	filter_order[NTP_SHIFT]; /* filter sort index */
 	l_fp	rec;		/* receive time stamp */
 	l_fp	xmt;		/* transmit time stamp */
 	l_fp	dst;		/* destination timestamp */
 	l_fp	aorg;		/* origin timestamp */
 	l_fp	borg;		/* alternate origin timestamp */
 	l_fp	bxmt;		/* most recent broadcast transmit timestamp */
-	double	offset;		/* peer clock offset */
-	double	delay;		/* peer roundtrip delay */
-	double	jitter;		/* peer jitter (squares) */
-	double	disp;		/* peer dispersion */
 	double	xleave;		/* interleave delay */
 	double	bias;		/* programmed offset bias */
 
@@ -377,15 +348,80 @@ struct peer {
 	int	t34_bytes;	/* inbound packet length */
 	double	r34;		/* inbound data rate */
 
+#ifdef AUTOKEY
+	/*
+	 * Variables used by authenticated client
+	 */
+	u_int32	opcode;		/* last request opcode */
+	associd_t assoc;	/* peer association ID */
+	u_int32	crypto;		/* peer status word */
+	EVP_PKEY *pkey;		/* public key */
+	const EVP_MD *digest;	/* message digest algorithm */
+	char	*subject;	/* certificate subject name */
+	char	*issuer;	/* certificate issuer name */
+	struct cert_info *xinfo; /* issuer certificate */
+	keyid_t	pkeyid;		/* previous key ID */
+	keyid_t	hcookie;	/* host cookie */
+	keyid_t	pcookie;	/* peer cookie */
+	const struct pkey_info *ident_pkey; /* identity key */
+	BIGNUM	*iffval;	/* identity challenge (IFF, GQ, MV) */
+	const BIGNUM *grpkey;	/* identity challenge key (GQ) */
+	struct value cookval;	/* receive cookie values */
+	struct value recval;	/* receive autokey values */
+	struct exten *cmmd;	/* extension pointer */
+	u_long	refresh;	/* next refresh epoch */
+
+	/*
+	 * Variables used by authenticated server
+	 */
+	keyid_t	*keylist;	/* session key ID list */
+	int	keynumber;	/* current key number */
+	struct value encrypt;	/* send encrypt values */
+	struct value sndval;	/* send autokey values */
+#endif	/* AUTOKEY */
+
 	/*
 	 * End of clear-to-zero area
 	 */
-	u_long	update;		/* receive epoch */
-#define end_clear_to_zero update
+#define end_clear_to_zero unreach
 	int	unreach;	/* watchdog counter */
 	int	throttle;	/* rate control */
+	u_long	throttle_time;	/* throttle last brought up to date */
 	u_long	outdate;	/* send time last packet */
 	u_long	nextdate;	/* send time next packet */
+	timer_event poll_event;	/* fires at nextdate */
+	struct peer *fast_link;	/* link pointer in sub-second list */
+	u_int	poll_ms;	/* sub-second poll interval, or 0 */
+	u_long	fast_due;	/* uptime (ms) of next sub-second poll */
+
+	/*
+	 * Cold section: configuration and the remaining links
+	 */
+	struct peer *aid_link;	/* link pointer in associd hash */
+	struct peer *name_link;	/* link pointer in hostname hash */
+	struct peer *sol_link;	/* link pointer in solicit list */
+	struct peer *ilink;	/* list of peers for interface */
+	char *	hostname;	/* if non-NULL, remote name */
+	struct addrinfo *addrs;	/* hostname query result */
+	struct addrinfo *ai;	/* position within addrs */
+	u_char	minpoll;	/* min poll interval */
+	u_char	maxpoll;	/* max poll interval */
+	u_char	last_event;	/* last peer error code */
+	u_char	num_events;	/* number of error events */
+	u_int32	ttl;		/* ttl/refclock mode */
+	char	*ident;		/* group identifier name */
+	l_fp	reftime;	/* update epoch */
+	keyid_t keyid;		/* current key ID */
+
+	/*
+	 * Variables used by reference clock support
+	 */
+#ifdef REFCLOCK
+	struct refclockproc *procptr; /* refclock structure pointer */
+	u_char	refclktype;	/* reference clock type */
+	u_char	refclkunit;	/* reference clock unit number */
+	u_char	sstclktype;	/* clock type for system status word */
+#endif /* REFCLOCK */
 
 	/*
 	 * Statistic counters
@@ -776,21 +812,42 @@ struct pkt {
 /*
  * Structure used optionally for monitoring when this is turned on.
  */
+typedef u_int32 mon_idx;		/* slab index of an entry, 0 none */
+#define	MON_IDX_V6	0x80000000U	/* in the IPv6 slabs */
+
 typedef struct mon_data	mon_entry;
 struct mon_data {
-	mon_entry *	hash_next;	/* next structure in hash list */
-	DECL_DLIST_LINK(mon_entry, mru);/* MRU list link pointers */
-	struct interface * lcladr;	/* address on which this arrived */
-	l_fp		first;		/* first time seen */
-	l_fp		last;		/* last time seen */
+	mon_idx		hash_next;	/* next structure in hash list */
+	mon_idx		mru_newer;	/* MRU list links */
+	mon_idx		mru_older;
+	u_int32		first;		/* first time seen, see mon_ts() */
+	u_int32		last;		/* last time seen, ditto */
 	int		leak;		/* leaky bucket accumulator */
 	int		count;		/* total packet count */
+	u_int32		lcl_ifnum;	/* ifnum of the local address */
 	u_short		flags;		/* restrict flags */
 	u_char		vn_mode;	/* packet mode & version */
 	u_char		cast_flags;	/* flags MDF_?CAST */
-	sockaddr_u	rmtadr;		/* address of remote host */
+	u_short		port;		/* remote port, network order */
+	u_short		v6;		/* a mon_entry6 */
 };
 
+/*
+ * The entries proper, with the remote address of their family.
+ */
+typedef struct mon_entry4_tag {
+	mon_entry	e;
+	struct in_addr	addr;
+} mon_entry4;
+
+typedef struct mon_entry6_tag {
+	mon_entry	e;
+	struct in6_addr	addr;
+} mon_entry6;
+
+/* nominal size of an entry for the "mru" memory options */
+#define	MON_ENTRY_SIZE	sizeof(mon_entry4)
+
 /*
  * Values for cast_flags in mon_entry and struct peer.  mon_entry uses
  * only the first three, MDF_UCAST, MDF_MCAST, and MDF_BCAST.
@@ -837,11 +894,13 @@ typedef struct res_addr6_tag {
 typedef struct restrict_u_tag	restrict_u;
 struct restrict_u_tag {
 	restrict_u *	link;		/* link to next entry */
+	restrict_u *	nlink;		/* next entry of the same prefix */
 	u_int32		count;		/* number of packets matched */
 	u_short		rflags;		/* restrict (accesslist) flags */
 	u_short		mflags;		/* match flags */
 	short		ippeerlimit;	/* IP peer limit */
 	u_long		expire;		/* valid until time */
+	timer_event	expire_event;	/* fires at expire */
 	union {				/* variant starting here */
 		res_addr4 v4;
 		res_addr6 v6;
@@ -917,6 +976,7 @@ restrict_ops {
 struct endpoint {
 	double	val;			/* offset of endpoint */
 	int	type;			/* interval entry/exit */
+	associd_t assoc;		/* association of endpoint */
 };
 
 /*
@@ -362,6 +362,9 @@ extern  void	mfp_mul		(int32 *, u_int32 *, int32, u_int32, int32, u_int32);
 extern	void	set_sys_fuzz	(double);
 extern	void	init_systime	(void);
 extern	void	get_systime	(l_fp *);
+#ifdef __rtems__
+extern	void	get_systime_fast(l_fp *);
+#endif /* __rtems__ */
 extern	int	step_systime	(double);
 extern	int	adj_systime	(double);
 extern	int	clamp_systime	(void);
@@ -82,6 +82,23 @@ typedef enum {
 } nic_rule_action;
 
 
+/*
+ * Upper bound of datagrams a server shard task drains from one socket
+ * per wakeup (see shard_main in ntp_io.c).
+ */
+#define RX_BATCH_MAX	16
+
+/*
+ * Upper bound of replies held by sendpkt_deferred() before they are
+ * flushed (see tx_batch in ntp_io.c).
+ */
+#define TX_BATCH_MAX	32
+
+/*
+ * Upper bound of server shard tasks (see shard_workers in ntp_io.c).
+ */
+#define SHARD_MAX	16
+
 extern int	qos;
 SOCKET		move_fd(SOCKET fd);
 isc_boolean_t	get_broadcastclient_flag(void);
@@ -128,6 +128,10 @@ extern	void	io_unsetbclient	(void);
 extern	void	io_multicast_add(sockaddr_u *);
 extern	void	io_multicast_del(sockaddr_u *);
 extern	void	sendpkt 	(sockaddr_u *, struct interface *, int, struct pkt *, int);
+extern	void	sendpkt_deferred(sockaddr_u *, struct interface *, struct pkt *, int);
+extern	void	flush_xmit_queue(void);
+extern	void	shard_publish	(void);
+extern	u_int	shard_stats	(u_long *, u_long *, u_long *);
 #ifdef DEBUG
 extern	void	collect_timing  (struct recvbuf *, const char *, int, l_fp *);
 #endif
@@ -156,9 +160,18 @@ extern	u_int	sys_tai;
 extern 	int	freq_cnt;
 
 /* ntp_monitor.c */
-#define MON_HASH_SIZE		((size_t)1U << mon_hash_bits)
-#define MON_HASH_MASK		(MON_HASH_SIZE - 1)
-#define	MON_HASH(addr)		(sock_hash(addr) & MON_HASH_MASK)
+/* buckets in use, see the linear hashing in ntp_monitor.c */
+#define MON_HASH_SIZE		(((size_t)1U << mon_hash_bits) + mon_hash_split)
+#define	MON_HASH(addr)		mon_hash_bucket(addr)
+extern	u_int	mon_hash_bucket	(const sockaddr_u *);
+extern	u_int	mon_hash_longest(void);
+extern	mon_entry *mon_ptr	(mon_idx);
+extern	mon_entry *mon_lookup	(const sockaddr_u *);
+extern	mon_entry *mon_oldest	(void);
+extern	void	mon_ts		(u_int32, l_fp *);
+extern	void	mon_getaddr	(const mon_entry *, sockaddr_u *);
+extern	size_t	mon_mem		(void);
+extern	size_t	mon_mem_alloc	(void);
 extern	void	init_mon	(void);
 extern	void	mon_start	(int);
 extern	void	mon_stop	(int);
@@ -189,6 +202,7 @@ extern	void	clear_all	(void);
 extern	int	score_all	(struct peer *);
 extern	struct peer *findmanycastpeer(struct recvbuf *);
 extern	void	peer_cleanup	(void);
+extern	u_int	peer_hash_longest(int);
 
 /* ntp_crypto.c */
 #ifdef AUTOKEY
@@ -219,11 +233,15 @@ extern struct value tai_leap;
 
 /* ntp_proto.c */
 extern	void	transmit	(struct peer *);
+#ifdef __rtems__
+extern	void	transmit_fast	(struct peer *);
+#endif /* __rtems__ */
 extern	void	receive 	(struct recvbuf *);
 extern	void	peer_clear	(struct peer *, const char *);
 extern	void 	process_packet	(struct peer *, struct pkt *, u_int);
 extern	void	clock_select	(void);
 extern	void	set_sys_leap	(u_char);
+extern	void	update_xmt_template(void);
 
 extern	u_long	leapsec;	/* seconds to next leap (proximity class) */
 extern  int     leapdif;        /* TAI difference step at next leap second*/
@@ -261,6 +279,9 @@ extern	void	restrictions	(sockaddr_u *, r4addr *);
 extern	void	hack_restrict	(restrict_op, sockaddr_u *, sockaddr_u *,
 				 short, u_short, u_short, u_long);
 extern	void	restrict_source	(sockaddr_u *, int, u_long);
+extern	int	restrict_default_only(u_short *);
+extern	u_int32	restrict_generation(void);
+extern	void	restrict_sort_lists(void);
 extern	void	dump_restricts	(void);
 
 /* ntp_timer.c */
@@ -269,6 +290,17 @@ extern	void	reinit_timer	(void);
 extern	void	timer		(void);
 extern	void	timer_clr_stats (void);
 extern	void	timer_interfacetimeout (u_long);
+extern	void	timer_event_arm	(timer_event *, u_long);
+extern	void	timer_event_cancel (timer_event *);
+extern	void	timer_peer	(struct peer *);
+extern	int	timer_throttle	(struct peer *);
+#ifdef __rtems__
+extern	void	timer_fast	(void);
+extern	void	timer_fast_peer	(struct peer *);
+extern	void	timer_fast_unpeer (struct peer *);
+extern	int	timer_fast_wait	(int);
+extern	int	timer_fast_alarm (int);
+#endif /* __rtems__ */
 extern	volatile int interface_interval;
 extern	u_long	orphwait;		/* orphan wait time */
 #ifdef AUTOKEY
@@ -379,6 +411,12 @@ extern u_long	packets_notsent; 	/* total number of packets which couldn't be sen
 extern volatile u_long handler_calls;	/* number of calls to interrupt handler */
 extern volatile u_long handler_pkts;	/* number of pkts received by handler */
 extern u_long	io_timereset;		/* time counters were reset */
+extern u_int	tx_batch;		/* replies held before a forced flush */
+extern u_long	tx_flushes;		/* flushes sending at least one reply */
+extern u_long	tx_flush_pkts;		/* replies sent by flushes */
+extern u_int	rx_slab;		/* preallocated recvbufs */
+extern u_int	rx_small;		/* small class recvbufs */
+extern u_int	shard_workers;		/* server shard tasks */
 
 /* ntp_io.c */
 extern  int	disable_dynamic_updates;
@@ -431,11 +469,15 @@ extern double	sys_jitter;		/* system jitter (s) */
 
 /* ntp_monitor.c */
 extern u_char	mon_hash_bits;		/* log2 size of hash table */
-extern mon_entry ** mon_hash;		/* MRU hash table */
-extern mon_entry mon_mru_list;		/* mru listhead */
+extern u_int	mon_hash_split;		/* next hash bucket to split */
+extern u_long	mon_hash_lookups;	/* MRU hash lookups */
+extern u_long	mon_hash_probes;	/* entries compared by lookups */
+extern u_long	mon_sketch_limited;	/* packets limited by the sketch */
+extern u_long	mon_mru_limited;	/* packets limited by MRU entries */
 extern u_int	mon_enabled;		/* MON_OFF (0) or other MON_* */
 extern u_int	mru_alloc;		/* mru list + free list count */
 extern u_int	mru_entries;		/* mru list count */
+extern u_int	mru_entries6;		/* IPv6 part of mru_entries */
 extern u_int	mru_peakentries;	/* highest mru_entries */
 extern u_int	mru_initalloc;		/* entries to preallocate */
 extern u_int	mru_incalloc;		/* allocation batch factor */
@@ -445,10 +487,11 @@ extern u_int	mru_maxdepth; 		/* MRU size hard limit */
 extern int	mon_age;		/* preemption limit */
 
 /* ntp_peer.c */
-extern struct peer *peer_hash[NTP_HASH_SIZE];	/* peer hash table */
-extern int	peer_hash_count[NTP_HASH_SIZE];	/* count of in each bucket */
-extern struct peer *assoc_hash[NTP_HASH_SIZE];	/* association ID hash table */
-extern int	assoc_hash_count[NTP_HASH_SIZE];/* count of in each bucket */
+extern struct peer **peer_hash;		/* peer hash table */
+extern int	*peer_hash_count;	/* count of in each bucket */
+extern struct peer **assoc_hash;	/* association ID hash table */
+extern int	*assoc_hash_count;	/* count of in each bucket */
+extern u_int	peer_hash_size;		/* buckets in each hash table */
 extern struct peer *peer_list;		/* peer structures list */
 extern int	peer_count;		/* count in peer_list */
 extern int	peer_free_count;	/* count in peer_free */
@@ -464,6 +507,9 @@ extern u_long	peer_demobilizations;	/* number of structs freed to free list */
 extern int	total_peer_structs;	/* number of peer structs in circulation */
 extern int	peer_associations;	/* mobilized associations */
 extern int	peer_preempt;		/* preemptable associations */
+#ifdef __rtems__
+extern int	peer_keyed;		/* associations with a key */
+#endif /* __rtems__ */
 
 /* ntp_proto.c */
 /*
@@ -471,6 +517,7 @@ extern int	peer_preempt;		/* preemptable associations */
  * specification.
  */
 extern u_char	sys_leap;		/* system leap indicator */
+extern u_char	xmt_leap;		/* leap indicator sent in replies */
 extern u_char	sys_stratum;		/* system stratum */
 extern s_char	sys_precision;		/* local clock precision */
 extern double	sys_rootdelay;		/* roundtrip delay to primary source */
@@ -479,6 +526,21 @@ extern u_int32	sys_refid;		/* reference id */
 extern l_fp	sys_reftime;		/* last update time */
 extern struct peer *sys_peer;		/* current peer */
 
+/*
+ * The system variables as sent in server replies, in network byte
+ * order.  Rebuilt by update_xmt_template() whenever they change.
+ */
+typedef struct xmt_template_tag {
+	u_char	leap;			/* xmt_leap */
+	u_char	stratum;		/* wire format */
+	s_char	precision;
+	u_fp	rootdelay;
+	u_fp	rootdisp;
+	u_int32	refid;
+	l_fp	reftime;
+} xmt_template;
+extern xmt_template sys_xmt_template;
+
 /*
  * Nonspecified system state variables.
  */
@@ -505,6 +567,8 @@ extern u_long	sys_badauth;		/* bad authentication */
 extern u_long	sys_badlength;		/* bad length or format */
 extern u_long	sys_declined;		/* declined */
 extern u_long	sys_kodsent;		/* KoD sent */
+extern u_long	sys_fastpath_pkts;	/* client requests on the fast path */
+extern u_long	sys_inplace_pkts;	/* replies built in the receive buffer */
 extern u_long	sys_lamport;		/* Lamport violation */
 extern u_long	sys_limitrejected;	/* rate exceeded */
 extern u_long	sys_newversion;		/* current version  */
@@ -520,6 +584,9 @@ extern keyid_t	info_auth_keyid;	/* keyid used to authenticate requests */
 extern u_long	auth_timereset;
 
 /* ntp_restrict.c */
+extern u_long	res_cache_hits;		/* restrict decision cache */
+extern u_long	res_cache_misses;
+/* only valid after restrict_sort_lists() */
 extern restrict_u *	restrictlist4;	/* IPv4 restriction list */
 extern restrict_u *	restrictlist6;	/* IPv6 restriction list */
 extern int		ntp_minpkt;
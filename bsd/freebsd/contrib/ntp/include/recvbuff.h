@@ -14,6 +14,9 @@
 #define RECV_LOWAT	3	/* when we're down to three buffers get more */
 #define RECV_INC	5	/* get 5 more at a time */
 #define RECV_TOOMANY	40	/* this is way too many buffers */
+#define RECV_SMALL_INIT	32	/* small class buffers, see RX_SMALL_SIZE */
+#define RECV_RING_SIZE	256	/* lock-free free ring capacity, power of 2 */
+#define RECV_DWELL_BUCKETS 7	/* <10us, <100us, ... <1s, >=1s */
 
 #if defined HAVE_IO_COMPLETION_PORT
 # include "ntp_iocompletionport.h"
@@ -44,6 +47,13 @@ extern HANDLE	get_recv_buff_event(void);
  */   
 #define	RX_BUFF_SIZE	1200		/* hail Mary */
 
+/*
+ *  Nearly all traffic is a plain NTP header, optionally followed by a
+ *  MAC.  Receive buffers of the small class only carry that much; mode
+ *  6/7 and extension field packets go to the large class.
+ */
+#define	RX_SMALL_SIZE	(LEN_PKT_NOMAC + MAX_MAC_LEN)
+
 
 typedef struct recvbuf recvbuf_t;
 
@@ -68,17 +78,39 @@ struct recvbuf {
 	l_fp		recv_time;	/* time of arrival */
 	void		(*receiver)(struct recvbuf *); /* callback */
 	int		recv_length;	/* number of octets received */
+	int used;		/* reference count */
+	u_int32		alloc_us;	/* taken from a slab free list */
+	u_short		recv_size;	/* octets available in recv_space */
+	/* must be last, small class buffers end after RX_SMALL_SIZE */
 	union {
 		struct pkt	X_recv_pkt;
 		u_char		X_recv_buffer[RX_BUFF_SIZE];
 	} recv_space;
 #define	recv_pkt		recv_space.X_recv_pkt
 #define	recv_buffer		recv_space.X_recv_buffer
-	int used;		/* reference count */
 };
 
+/* allocation size of a small class recvbuf */
+#define	RECVBUF_SMALL_SIZE	(offsetof(recvbuf_t, recv_space) + RX_SMALL_SIZE)
+
+/*
+ * Where <stdatomic.h> is available the free list and the full list are
+ * lock-free: any task may get a free buffer, fill it and pass it to
+ * add_full_recv_buffer(), or return it with freerecvbuf().  The full
+ * list has a single consumer, so get_full_recv_buffer() and
+ * purge_recv_buffers_for_fd() must only be called from the ntpd main
+ * loop.
+ */
 extern	void	init_recvbuff(int);
 
+/* Preallocate a fixed pool of recvbufs in one block, never grown.
+ */
+extern	void	init_recvbuff_slab(int);
+
+/* Add recvbufs of the small class (RX_SMALL_SIZE octets).
+ */
+extern	void	init_recvbuff_small(int);
+
 /* freerecvbuf - make a single recvbuf available for reuse
  */
 extern	void	freerecvbuf(struct recvbuf *);
@@ -95,6 +127,15 @@ extern	struct recvbuf *get_free_recv_buffer(void);
 /* signal unsafe - may malloc, never returs NULL */
 extern	struct recvbuf *get_free_recv_buffer_alloc(void);
 
+/* Prefer a small class buffer, falls back to a large one.  Check
+ * recv_size before reading into it.
+ */
+extern	struct recvbuf *get_free_recv_buffer_small(void);
+
+/* Move a datagram that overflowed a small buffer into a large one.
+ */
+extern	struct recvbuf *promote_recv_buffer(struct recvbuf *, const void *);
+
 /*   Add a buffer to the full list
  */
 extern	void	add_full_recv_buffer(struct recvbuf *);
@@ -104,6 +145,13 @@ extern u_long free_recvbuffs(void);
 extern u_long full_recvbuffs(void);		
 extern u_long total_recvbuffs(void);
 extern u_long lowater_additions(void);
+extern u_long recvbuff_slab_size(void);		/* 0 without slab */
+extern u_long small_recvbuffs(void);		/* small class buffers */
+extern u_long recvbuff_promotions(void);	/* small moved to large */
+extern u_long recvbuff_hiwater(void);		/* most buffers in use */
+extern u_long recvbuff_exhaustions(void);	/* free list empty */
+extern void   recvbuff_dwell(u_long *);		/* RECV_DWELL_BUCKETS */
+extern void   clear_recvbuff_stats(void);
 		
 /*  Returns the next buffer in the full list.
  *
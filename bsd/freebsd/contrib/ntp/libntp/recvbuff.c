@@ -5,6 +5,7 @@
 #endif
 
 #include <stdio.h>
+#include <time.h>
 
 #include "ntp_assert.h"
 #include "ntp_syslog.h"
@@ -13,19 +14,116 @@
 #include "recvbuff.h"
 #include "iosignal.h"
 
+#if defined(HAVE_STDATOMIC_H) && !defined(SYS_WINNT)
+/*
+ * Lock-free queues, see the comment below.
+ */
+# define RECVBUFF_LOCKFREE
+# include <stdatomic.h>
+#endif
+
 
 /*
  * Memory allocation
  */
-static u_long volatile full_recvbufs;	/* recvbufs on full_recv_fifo */
-static u_long volatile free_recvbufs;	/* recvbufs on free_recv_list */
-static u_long volatile total_recvbufs;	/* total recvbufs currently in use */
-static u_long volatile lowater_adds;	/* number of times we have added memory */
-static u_long volatile buffer_shortfall;/* number of missed free receive buffers
+#ifdef RECVBUFF_LOCKFREE
+typedef atomic_ulong		rb_counter;
+# define CTR_GET(c)		atomic_load_explicit(&(c), memory_order_relaxed)
+# define CTR_SET(c, v)		atomic_store_explicit(&(c), (v), memory_order_relaxed)
+# define CTR_ADD(c, v)		atomic_fetch_add_explicit(&(c), (v), memory_order_relaxed)
+# define CTR_SUB(c, v)		atomic_fetch_sub_explicit(&(c), (v), memory_order_relaxed)
+#else
+typedef u_long volatile		rb_counter;
+# define CTR_GET(c)		(c)
+# define CTR_SET(c, v)		((c) = (v))
+# define CTR_ADD(c, v)		((c) += (v))
+# define CTR_SUB(c, v)		((c) -= (v))
+#endif
+
+static rb_counter full_recvbufs;	/* recvbufs on full_recv_fifo */
+static rb_counter free_recvbufs;	/* recvbufs on the free lists */
+static rb_counter total_recvbufs;	/* total recvbufs currently in use */
+static rb_counter lowater_adds;		/* number of times we have added memory */
+static rb_counter buffer_shortfall;	/* number of missed free receive buffers
 					   between replenishments */
 
+static rb_counter recv_hiwater;		/* most recvbufs in use at once */
+static rb_counter recv_exhausted;	/* free list found empty */
+static rb_counter recv_dwell[RECV_DWELL_BUCKETS]; /* time in use, slab only */
+static rb_counter recv_promoted;	/* small recvbufs moved to large */
+
+/*
+ * Preallocated blocks.  With init_recvbuff_slab() all large recvbufs
+ * are carved from one cache aligned block at startup and
+ * create_buffers() never touches the heap again.  The small class is
+ * always carved that way.  Blocks are kept for the next ntpd run.
+ */
+#define RECV_CACHE_LINE	64
+#define RECV_ALIGN(n)	(((n) + RECV_CACHE_LINE - 1) \
+			 & ~(size_t)(RECV_CACHE_LINE - 1))
+#define RECV_STRIDE	RECV_ALIGN(sizeof(recvbuf_t))
+#define RECV_SMALL_STRIDE RECV_ALIGN(RECVBUF_SMALL_SIZE)
+
+typedef struct recv_block_tag {
+	void *	mem;		/* as allocated */
+	u_long	cap;		/* buffers mem can hold */
+} recv_block;
+
+static recv_block	slab_block;
+static recv_block	small_block;
+static u_long	recv_slab_bufs;		/* large in slab, 0 without slab */
+static u_long	small_recvbufs;		/* small class recvbufs */
+
 static DECL_FIFO_ANCHOR(recvbuf_t) full_recv_fifo;
-static recvbuf_t *		   free_recv_list;
+
+#ifdef RECVBUFF_LOCKFREE
+/*
+ * Without locks the buffers may be produced by any number of tasks
+ * (e.g. high priority receive tasks that timestamp and queue packets)
+ * while a single task, the ntpd main loop, consumes them:
+ *
+ * - Producers push full buffers onto the LIFO full_recv_stack with a
+ *   compare-and-swap.  The consumer takes the whole stack with one
+ *   exchange, reverses it and appends it to full_recv_fifo, which only
+ *   the consumer touches.  Arrival order is preserved and the push
+ *   only CAS loop is free of ABA problems.
+ *
+ * - Free buffers are kept in a bounded multi-producer/multi-consumer
+ *   ring (one sequence number per cell) since both sides may be used
+ *   from several tasks.  RECV_RING_SIZE bounds the number of buffers.
+ */
+static _Atomic(recvbuf_t *)	full_recv_stack;
+
+typedef struct recv_cell_tag {
+	atomic_size_t	seq;
+	recvbuf_t *	data;
+} recv_cell;
+
+typedef struct recv_pool_tag {
+	recv_cell	ring[RECV_RING_SIZE];
+	atomic_size_t	head;		/* next cell to dequeue */
+	atomic_size_t	tail;		/* next cell to enqueue */
+} recv_pool;
+
+static void		drain_full_stack(void);
+#else
+typedef struct recv_pool_tag {
+	recvbuf_t *	list;
+} recv_pool;
+#endif
+
+/*
+ * One free list per size class, see RX_SMALL_SIZE.
+ */
+static recv_pool	free_recv_pool[2];
+#define LARGE_POOL	(&free_recv_pool[0])
+#define SMALL_POOL	(&free_recv_pool[1])
+#define POOL_OF(rb)	(((rb)->recv_size == RX_SMALL_SIZE) \
+			     ? SMALL_POOL			\
+			     : LARGE_POOL)
+
+static int		free_pool_put(recv_pool *, recvbuf_t *);
+static recvbuf_t *	free_pool_get(recv_pool *);
 	
 #if defined(SYS_WINNT)
 
@@ -50,31 +148,163 @@ static void uninit_recvbuff(void);
 u_long
 free_recvbuffs (void)
 {
-	return free_recvbufs;
+	return CTR_GET(free_recvbufs);
 }
 
 u_long
 full_recvbuffs (void)
 {
-	return full_recvbufs;
+	return CTR_GET(full_recvbufs);
 }
 
 u_long
 total_recvbuffs (void)
 {
-	return total_recvbufs;
+	return CTR_GET(total_recvbufs);
 }
 
 u_long
 lowater_additions(void)
 {
-	return lowater_adds;
+	return CTR_GET(lowater_adds);
+}
+
+u_long
+recvbuff_hiwater(void)
+{
+	return CTR_GET(recv_hiwater);
+}
+
+u_long
+recvbuff_exhaustions(void)
+{
+	return CTR_GET(recv_exhausted);
+}
+
+u_long
+recvbuff_slab_size(void)
+{
+	return recv_slab_bufs;
+}
+
+u_long
+small_recvbuffs(void)
+{
+	return small_recvbufs;
+}
+
+u_long
+recvbuff_promotions(void)
+{
+	return CTR_GET(recv_promoted);
+}
+
+void
+recvbuff_dwell(u_long *hist)
+{
+	int	i;
+
+	for (i = 0; i < RECV_DWELL_BUCKETS; i++)
+		hist[i] = CTR_GET(recv_dwell[i]);
+}
+
+void
+clear_recvbuff_stats(void)
+{
+	int	i;
+
+	CTR_SET(recv_hiwater,
+		CTR_GET(total_recvbufs) - CTR_GET(free_recvbufs));
+	CTR_SET(recv_exhausted, 0);
+	CTR_SET(recv_promoted, 0);
+	for (i = 0; i < RECV_DWELL_BUCKETS; i++)
+		CTR_SET(recv_dwell[i], 0);
+}
+
+/*
+ * Microsecond timestamps for the dwell histogram, only deltas are used.
+ */
+static inline u_int32
+recv_clock_us(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int32)ts.tv_sec * 1000000u + (u_int32)(ts.tv_nsec / 1000);
+}
+
+/*
+ * note_in_use - track the high-water mark of buffers in use
+ */
+static void
+note_in_use(void)
+{
+	u_long	inuse;
+	u_long	hw;
+
+	inuse = CTR_GET(total_recvbufs) - CTR_GET(free_recvbufs);
+	hw = CTR_GET(recv_hiwater);
+#ifdef RECVBUFF_LOCKFREE
+	while (inuse > hw &&
+	       !atomic_compare_exchange_weak_explicit(&recv_hiwater, &hw,
+			inuse, memory_order_relaxed, memory_order_relaxed))
+		/* retry */;
+#else
+	if (inuse > hw)
+		recv_hiwater = inuse;
+#endif
+}
+
+/*
+ * note_dwell - account the time a slab buffer spent out of the free
+ *		list: <10us, <100us, ... <1s, longer.
+ */
+static void
+note_dwell(const recvbuf_t *rb)
+{
+	u_int32	dwell;
+	u_int32	lim;
+	int	b;
+
+	dwell = recv_clock_us() - rb->alloc_us;
+	for (b = 0, lim = 10; b < RECV_DWELL_BUCKETS - 1 && dwell >= lim;
+	     b++, lim *= 10)
+		/* next decade */;
+	CTR_ADD(recv_dwell[b], 1);
 }
 
 static inline void 
 initialise_buffer(recvbuf_t *buff)
 {
-	ZERO(*buff);
+	u_short	size;
+
+	/* a small recvbuf ends after RX_SMALL_SIZE octets of recv_space */
+	size = buff->recv_size;
+	memset(buff, 0, offsetof(recvbuf_t, recv_space) + size);
+	buff->recv_size = size;
+}
+
+
+/*
+ * carve_block - get room for nbufs recvbufs of the given stride from
+ *		 blk, reusing the memory of an earlier run if it is large
+ *		 enough.  Returns the cache aligned base.
+ */
+static u_char *
+carve_block(
+	recv_block *	blk,
+	int		nbufs,
+	size_t		stride
+	)
+{
+	if (blk->cap < (u_long)nbufs) {
+		free(blk->mem);
+		blk->mem = emalloc_zero((size_t)nbufs * stride +
+					RECV_CACHE_LINE - 1);
+		blk->cap = (u_long)nbufs;
+	}
+	return (u_char *)(((uintptr_t)blk->mem + RECV_CACHE_LINE - 1)
+			  & ~(uintptr_t)(RECV_CACHE_LINE - 1));
 }
 
 static void
@@ -83,8 +313,20 @@ create_buffers(int nbufs)
 	register recvbuf_t *bufp;
 	int i, abuf;
 
-	abuf = nbufs + buffer_shortfall;
-	buffer_shortfall = 0;
+	/* a slab is never grown */
+	if (recv_slab_bufs > 0)
+		return;
+
+	abuf = nbufs + CTR_GET(buffer_shortfall);
+	CTR_SET(buffer_shortfall, 0);
+#ifdef RECVBUFF_LOCKFREE
+	if ((u_long)abuf > RECV_RING_SIZE + small_recvbufs -
+			   CTR_GET(total_recvbufs))
+		abuf = RECV_RING_SIZE + small_recvbufs -
+		       CTR_GET(total_recvbufs);
+	if (abuf <= 0)
+		return;
+#endif
 
 #ifndef DEBUG
 	bufp = eallocarray(abuf, sizeof(*bufp));
@@ -99,24 +341,57 @@ create_buffers(int nbufs)
 		 */
 		bufp = emalloc_zero(sizeof(*bufp));
 #endif
-		LINK_SLIST(free_recv_list, bufp, link);
+		bufp->recv_size = RX_BUFF_SIZE;
+		free_pool_put(LARGE_POOL, bufp);
 		bufp++;
-		free_recvbufs++;
-		total_recvbufs++;
+		CTR_ADD(free_recvbufs, 1);
+		CTR_ADD(total_recvbufs, 1);
 	}
-	lowater_adds++;
+	CTR_ADD(lowater_adds, 1);
 }
 
-void
-init_recvbuff(int nbufs)
+static void
+init_recv_lists(void)
 {
+	recv_pool *	pool;
+#ifdef RECVBUFF_LOCKFREE
+	size_t		i;
+#endif
+
+	for (pool = free_recv_pool;
+	     pool < free_recv_pool + COUNTOF(free_recv_pool);
+	     pool++) {
+#ifdef RECVBUFF_LOCKFREE
+		for (i = 0; i < RECV_RING_SIZE; i++)
+			atomic_init(&pool->ring[i].seq, i);
+		atomic_init(&pool->head, 0);
+		atomic_init(&pool->tail, 0);
+#else
+		pool->list = NULL;
+#endif
+	}
+#ifdef RECVBUFF_LOCKFREE
+	atomic_init(&full_recv_stack, NULL);
+#endif
+	ZERO(full_recv_fifo);
 
 	/*
 	 * Init buffer free list and stat counters
 	 */
-	free_recvbufs = total_recvbufs = 0;
-	full_recvbufs = lowater_adds = 0;
+	CTR_SET(free_recvbufs, 0);
+	CTR_SET(total_recvbufs, 0);
+	CTR_SET(full_recvbufs, 0);
+	CTR_SET(lowater_adds, 0);
+	recv_slab_bufs = 0;
+	small_recvbufs = 0;
+	clear_recvbuff_stats();
+}
+
 
+void
+init_recvbuff(int nbufs)
+{
+	init_recv_lists();
 	create_buffers(nbufs);
 
 #if defined(SYS_WINNT)
@@ -129,21 +404,100 @@ init_recvbuff(int nbufs)
 }
 
 
+/*
+ * init_recvbuff_slab - like init_recvbuff(), but all nbufs buffers
+ *			come from one preallocated block and the pool
+ *			never grows.
+ */
+void
+init_recvbuff_slab(int nbufs)
+{
+	u_char *	base;
+	recvbuf_t *	bufp;
+	int		i;
+
+#ifdef RECVBUFF_LOCKFREE
+	if (nbufs > RECV_RING_SIZE)
+		nbufs = RECV_RING_SIZE;
+#endif
+	if (nbufs <= 0) {
+		init_recvbuff(RECV_INIT);
+		return;
+	}
+	init_recv_lists();
+
+	base = carve_block(&slab_block, nbufs, RECV_STRIDE);
+	for (i = 0; i < nbufs; i++) {
+		bufp = (recvbuf_t *)(base + (size_t)i * RECV_STRIDE);
+		bufp->recv_size = RX_BUFF_SIZE;
+		free_pool_put(LARGE_POOL, bufp);
+	}
+	CTR_SET(free_recvbufs, nbufs);
+	CTR_SET(total_recvbufs, nbufs);
+	CTR_SET(lowater_adds, 1);
+	recv_slab_bufs = (u_long)nbufs;
+
+#if defined(SYS_WINNT)
+	InitializeCriticalSection(&RecvLock);
+#endif
+}
+
+
+/*
+ * init_recvbuff_small - add nbufs recvbufs of the small class, which
+ *			 only hold RX_SMALL_SIZE octets.  Call after
+ *			 init_recvbuff() or init_recvbuff_slab().
+ */
+void
+init_recvbuff_small(int nbufs)
+{
+	u_char *	base;
+	recvbuf_t *	bufp;
+	int		i;
+
+	if (nbufs > RECV_RING_SIZE)
+		nbufs = RECV_RING_SIZE;
+	if (nbufs <= 0)
+		return;
+
+	base = carve_block(&small_block, nbufs, RECV_SMALL_STRIDE);
+	for (i = 0; i < nbufs; i++) {
+		bufp = (recvbuf_t *)(base + (size_t)i * RECV_SMALL_STRIDE);
+		bufp->recv_size = RX_SMALL_SIZE;
+		free_pool_put(SMALL_POOL, bufp);
+	}
+	CTR_ADD(free_recvbufs, nbufs);
+	CTR_ADD(total_recvbufs, nbufs);
+	small_recvbufs = (u_long)nbufs;
+}
+
+
 #ifdef DEBUG
 static void
 uninit_recvbuff(void)
 {
 	recvbuf_t *rbunlinked;
 
+	free(small_block.mem);
+	small_block.mem = NULL;
+	if (recv_slab_bufs > 0) {
+		free(slab_block.mem);
+		slab_block.mem = NULL;
+		return;
+	}
+#ifdef RECVBUFF_LOCKFREE
+	drain_full_stack();
+#endif
 	for (;;) {
 		UNLINK_FIFO(rbunlinked, full_recv_fifo, link);
 		if (rbunlinked == NULL)
 			break;
-		free(rbunlinked);
+		if (rbunlinked->recv_size != RX_SMALL_SIZE)
+			free(rbunlinked);
 	}
 
 	for (;;) {
-		UNLINK_HEAD_SLIST(rbunlinked, free_recv_list, link);
+		rbunlinked = free_pool_get(LARGE_POOL);
 		if (rbunlinked == NULL)
 			break;
 		free(rbunlinked);
@@ -152,6 +506,135 @@ uninit_recvbuff(void)
 #endif	/* DEBUG */
 
 
+#ifdef RECVBUFF_LOCKFREE
+/*
+ * free_pool_put - enqueue a free recvbuf, FALSE if the ring is full
+ */
+static int
+free_pool_put(
+	recv_pool *	pool,
+	recvbuf_t *	rb
+	)
+{
+	recv_cell *	cell;
+	size_t		pos;
+	size_t		seq;
+	intptr_t	dif;
+
+	pos = atomic_load_explicit(&pool->tail, memory_order_relaxed);
+	for (;;) {
+		cell = &pool->ring[pos & (RECV_RING_SIZE - 1)];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)pos;
+		if (0 == dif) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &pool->tail, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return FALSE;
+		} else {
+			pos = atomic_load_explicit(&pool->tail,
+						   memory_order_relaxed);
+		}
+	}
+	cell->data = rb;
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+	return TRUE;
+}
+
+
+/*
+ * free_pool_get - dequeue a free recvbuf, NULL if the ring is empty
+ */
+static recvbuf_t *
+free_pool_get(
+	recv_pool *	pool
+	)
+{
+	recv_cell *	cell;
+	recvbuf_t *	rb;
+	size_t		pos;
+	size_t		seq;
+	intptr_t	dif;
+
+	pos = atomic_load_explicit(&pool->head, memory_order_relaxed);
+	for (;;) {
+		cell = &pool->ring[pos & (RECV_RING_SIZE - 1)];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		dif = (intptr_t)seq - (intptr_t)(pos + 1);
+		if (0 == dif) {
+			if (atomic_compare_exchange_weak_explicit(
+				    &pool->head, &pos, pos + 1,
+				    memory_order_relaxed,
+				    memory_order_relaxed))
+				break;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&pool->head,
+						   memory_order_relaxed);
+		}
+	}
+	rb = cell->data;
+	atomic_store_explicit(&cell->seq, pos + RECV_RING_SIZE,
+			      memory_order_release);
+
+	return rb;
+}
+
+
+/*
+ * drain_full_stack - move everything the producers pushed so far to
+ *		      the tail of full_recv_fifo.  Consumer only.
+ */
+static void
+drain_full_stack(void)
+{
+	recvbuf_t *	list;
+	recvbuf_t *	rev;
+	recvbuf_t *	next;
+
+	list = atomic_exchange_explicit(&full_recv_stack, NULL,
+					memory_order_acquire);
+	rev = NULL;
+	for (; list != NULL; list = next) {
+		next = list->link;
+		list->link = rev;
+		rev = list;
+	}
+	for (; rev != NULL; rev = next) {
+		next = rev->link;
+		LINK_FIFO(full_recv_fifo, rev, link);
+	}
+}
+#else	/* !RECVBUFF_LOCKFREE */
+static int
+free_pool_put(
+	recv_pool *	pool,
+	recvbuf_t *	rb
+	)
+{
+	LINK_SLIST(pool->list, rb, link);
+	return TRUE;
+}
+
+
+static recvbuf_t *
+free_pool_get(
+	recv_pool *	pool
+	)
+{
+	recvbuf_t *	rb;
+
+	UNLINK_HEAD_SLIST(rb, pool->list, link);
+	return rb;
+}
+#endif	/* !RECVBUFF_LOCKFREE */
+
+
 /*
  * freerecvbuf - make a single recvbuf available for reuse
  */
@@ -163,8 +646,12 @@ freerecvbuf(recvbuf_t *rb)
 		rb->used--;
 		if (rb->used != 0)
 			msyslog(LOG_ERR, "******** freerecvbuff non-zero usage: %d *******", rb->used);
-		LINK_SLIST(free_recv_list, rb, link);
-		free_recvbufs++;
+		else if (recv_slab_bufs > 0)
+			note_dwell(rb);
+		if (free_pool_put(POOL_OF(rb), rb))
+			CTR_ADD(free_recvbufs, 1);
+		else
+			msyslog(LOG_ERR, "freerecvbuf: free ring overflow");
 		UNLOCK();
 	}
 }
@@ -173,30 +660,51 @@ freerecvbuf(recvbuf_t *rb)
 void
 add_full_recv_buffer(recvbuf_t *rb)
 {
+#ifdef RECVBUFF_LOCKFREE
+	recvbuf_t *	head;
+#endif
+
 	if (rb == NULL) {
 		msyslog(LOG_ERR, "add_full_recv_buffer received NULL buffer");
 		return;
 	}
 	LOCK();
+#ifdef RECVBUFF_LOCKFREE
+	head = atomic_load_explicit(&full_recv_stack, memory_order_relaxed);
+	do {
+		rb->link = head;
+	} while (!atomic_compare_exchange_weak_explicit(&full_recv_stack,
+			&head, rb, memory_order_release,
+			memory_order_relaxed));
+#else
 	LINK_FIFO(full_recv_fifo, rb, link);
-	full_recvbufs++;
+#endif
+	CTR_ADD(full_recvbufs, 1);
 	UNLOCK();
 }
 
 
-recvbuf_t *
-get_free_recv_buffer(void)
+static recvbuf_t *
+get_free_recv_buffer_from(
+	recv_pool *	pool
+	)
 {
 	recvbuf_t *buffer;
 
 	LOCK();
-	UNLINK_HEAD_SLIST(buffer, free_recv_list, link);
+	buffer = free_pool_get(pool);
+	if (NULL == buffer && pool != LARGE_POOL)
+		buffer = free_pool_get(LARGE_POOL);
 	if (buffer != NULL) {
-		free_recvbufs--;
+		CTR_SUB(free_recvbufs, 1);
 		initialise_buffer(buffer);
 		buffer->used++;
+		if (recv_slab_bufs > 0)
+			buffer->alloc_us = recv_clock_us();
+		note_in_use();
 	} else {
-		buffer_shortfall++;
+		CTR_ADD(buffer_shortfall, 1);
+		CTR_ADD(recv_exhausted, 1);
 	}
 	UNLOCK();
 
@@ -204,6 +712,50 @@ get_free_recv_buffer(void)
 }
 
 
+recvbuf_t *
+get_free_recv_buffer(void)
+{
+	return get_free_recv_buffer_from(LARGE_POOL);
+}
+
+
+recvbuf_t *
+get_free_recv_buffer_small(void)
+{
+	return get_free_recv_buffer_from(SMALL_POOL);
+}
+
+
+/*
+ * promote_recv_buffer - move a datagram that did not fit the small
+ *			 recvbuf rb into a large one.  The first
+ *			 RX_SMALL_SIZE octets are in rb, the remaining
+ *			 rb->recv_length - RX_SMALL_SIZE octets in tail.
+ *			 rb is released; NULL if no large buffer is free.
+ */
+recvbuf_t *
+promote_recv_buffer(
+	recvbuf_t *	rb,
+	const void *	tail
+	)
+{
+	recvbuf_t *	big;
+
+	big = get_free_recv_buffer();
+	if (big != NULL) {
+		big->recv_srcadr = rb->recv_srcadr;
+		big->recv_length = rb->recv_length;
+		memcpy(big->recv_buffer, rb->recv_buffer, RX_SMALL_SIZE);
+		memcpy(big->recv_buffer + RX_SMALL_SIZE, tail,
+		       (size_t)rb->recv_length - RX_SMALL_SIZE);
+		CTR_ADD(recv_promoted, 1);
+	}
+	freerecvbuf(rb);
+
+	return big;
+}
+
+
 #ifdef HAVE_IO_COMPLETION_PORT
 recvbuf_t *
 get_free_recv_buffer_alloc(void)
@@ -237,7 +789,8 @@ get_full_recv_buffer(void)
 	 * fixes malloc() interrupted by SIGIO risk
 	 * (Bug 889)
 	 */
-	if (NULL == free_recv_list || buffer_shortfall > 0) {
+	if (0 == CTR_GET(free_recvbufs) ||
+	    CTR_GET(buffer_shortfall) > 0) {
 		/*
 		 * try to get us some more buffers
 		 */
@@ -248,9 +801,13 @@ get_full_recv_buffer(void)
 	/*
 	 * try to grab a full buffer
 	 */
+#ifdef RECVBUFF_LOCKFREE
+	if (NULL == HEAD_FIFO(full_recv_fifo))
+		drain_full_stack();
+#endif
 	UNLINK_FIFO(rbuf, full_recv_fifo, link);
 	if (rbuf != NULL)
-		full_recvbufs--;
+		CTR_SUB(full_recvbufs, 1);
 	UNLOCK();
 
 	return rbuf;
@@ -272,6 +829,9 @@ purge_recv_buffers_for_fd(
 
 	LOCK();
 
+#ifdef RECVBUFF_LOCKFREE
+	drain_full_stack();
+#endif
 	for (rbufp = HEAD_FIFO(full_recv_fifo);
 	     rbufp != NULL;
 	     rbufp = next) {
@@ -285,7 +845,7 @@ purge_recv_buffers_for_fd(
 			UNLINK_MID_FIFO(punlinked, full_recv_fifo,
 					rbufp, link, recvbuf_t);
 			INSIST(punlinked == rbufp);
-			full_recvbufs--;
+			CTR_SUB(full_recvbufs, 1);
 			freerecvbuf(rbufp);
 		}
 	}
@@ -301,6 +861,11 @@ isc_boolean_t has_full_recv_buffer(void)
 {
 	if (HEAD_FIFO(full_recv_fifo) != NULL)
 		return (ISC_TRUE);
+#ifdef RECVBUFF_LOCKFREE
+	else if (atomic_load_explicit(&full_recv_stack,
+				      memory_order_relaxed) != NULL)
+		return (ISC_TRUE);
+#endif
 	else
 		return (ISC_FALSE);
 }
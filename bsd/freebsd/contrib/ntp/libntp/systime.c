@@ -29,6 +29,10 @@
 #ifdef HAVE_UTMPX_H
 # include <utmpx.h>
 #endif /* HAVE_UTMPX_H */
+#ifdef __rtems__
+#include <sys/time.h>
+#include <rtems.h>
+#endif /* __rtems__ */
 
 int	allow_panic = FALSE;		/* allow panic correction (-g) */
 int	enable_panic_check = TRUE;	/* Can we check allow_panic's state? */
@@ -109,6 +113,29 @@ int using_sigio;
 CRITICAL_SECTION get_systime_cs;
 #endif
 
+#ifdef __rtems__
+/*
+ * get_systime() hands over to get_systime_fast() when this is set.
+ */
+int	sys_fasttime = FALSE;
+
+static u_int32	fast_fuzz;	/* sys_fuzz in l_fp fraction units */
+static u_int32	fast_seed;	/* fuzz generator state */
+
+/*
+ * The prior result and lamport_violated are shared by both readings,
+ * so that timestamps keep increasing when sys_fasttime is switched.
+ * The os time each one kept last is dropped at the switch instead,
+ * as it may predate a step.
+ */
+static struct timespec	ts_last;	/* last sampled os time */
+static struct timespec	ts_prev;	/* prior os time */
+static l_fp		lfp_prev;	/* prior result */
+static uint64_t		raw_last;	/* same for get_systime_fast() */
+static uint64_t		raw_prev;
+static int		fast_last;	/* get_systime_fast() ran last */
+#endif /* __rtems__ */
+
 
 void
 set_sys_fuzz(
@@ -122,6 +149,13 @@ set_sys_fuzz(
 	 * short-falling fuzz advance
 	 */
 	sys_fuzz_nsec = (long)ceil(sys_fuzz * 1e9);
+#ifdef __rtems__
+	if (sys_fuzz >= 1.0)
+		fast_fuzz = U_INT32_MAX;
+	else
+		fast_fuzz = (u_int32)ceil(sys_fuzz * FRAC);
+	fast_seed = (u_int32)ntp_random() | 1;
+#endif /* __rtems__ */
 }
 
 
@@ -176,9 +210,11 @@ get_systime(
 	l_fp *now		/* system time */
 	)
 {
+#ifndef __rtems__
         static struct timespec  ts_last;        /* last sampled os time */
 	static struct timespec	ts_prev;	/* prior os time */
 	static l_fp		lfp_prev;	/* prior result */
+#endif /* __rtems__ */
 	struct timespec ts;	/* seconds and nanoseconds */
 	struct timespec ts_min;	/* earliest permissible */
 	struct timespec ts_lam;	/* lamport fictional increment */
@@ -187,6 +223,17 @@ get_systime(
 	l_fp	lfpfuzz;
 	l_fp	lfpdelta;
 
+#ifdef __rtems__
+	if (sys_fasttime && !trunc_os_clock) {
+		get_systime_fast(now);
+		return;
+	}
+	if (fast_last) {
+		ZERO(ts_last);
+		ZERO(ts_prev);
+		fast_last = FALSE;
+	}
+#endif /* __rtems__ */
 	get_ostime(&ts);
 	DEBUG_REQUIRE(systime_init_done);
 	ENTER_GET_SYSTIME_CRITSEC();
@@ -281,6 +328,91 @@ get_systime(
 }
 
 
+#ifdef __rtems__
+/*
+ * get_systime_fast - get_systime() without floating point.
+ *
+ * The timecounter is read as a bintime, whose upper 32 fraction bits
+ * are an l_fp fraction already, and the fuzz is scaled from a
+ * xorshift generator by the precomputed fast_fuzz. Timestamps are
+ * kept 64-bit so that the minimum advance and the postcondition of
+ * get_systime() are integer compares. Differences are taken signed
+ * so that the NTP era rollover does not upset them.
+ */
+void
+get_systime_fast(
+	l_fp *now		/* system time */
+	)
+{
+	struct bintime	bt;
+	uint64_t	raw;
+	uint64_t	res;
+	uint64_t	res_prev;
+	u_int32		x;
+	int		violated;
+
+	if (!fast_last) {
+		raw_last = 0;
+		raw_prev = 0;
+		fast_last = TRUE;
+	}
+	rtems_clock_get_realtime_bintime(&bt);
+	raw = ((uint64_t)(u_int32)(bt.sec + JAN_1970) << 32) |
+	    (bt.frac >> 32);
+
+	/* a step back of more than 50 ms is a Lamport violation */
+	if (   raw_last != 0
+	    && (int64_t)(raw - raw_last) < -(int64_t)(U_INT32_MAX / 20)) {
+		lamport_violated = TRUE;
+		sys_lamport++;
+	}
+	violated = lamport_violated;
+	raw_last = raw;
+
+	if (   raw_prev != 0
+	    && !violated
+	    && (int64_t)(raw - (raw_prev + fast_fuzz)) < 0) {
+		if ((int64_t)(raw_prev + fast_fuzz - raw) >=
+		    ((int64_t)1 << 32)) {
+			msyslog(LOG_ERR,
+				"get_systime Lamport advance exceeds one second");
+			exit(1);
+		}
+		raw = raw_prev + fast_fuzz;
+	}
+	raw_prev = raw;
+
+	x = fast_seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	fast_seed = x;
+	res = raw + (((uint64_t)x * fast_fuzz) >> 32);
+
+	res_prev = ((uint64_t)lfp_prev.l_ui << 32) | lfp_prev.l_uf;
+	if (   res_prev != 0
+	    && !violated
+	    && fast_fuzz != 0
+	    && (int64_t)(res - res_prev) <= 0) {
+		res = res_prev + 1;
+		sys_tsrounding++;
+	}
+	lfp_prev.l_ui = (u_int32)(res >> 32);
+	lfp_prev.l_uf = (u_int32)res;
+	lamport_violated = FALSE;
+
+	*now = lfp_prev;
+}
+
+
+void
+rtems_ntpd_set_fast_systime(int enable)
+{
+	sys_fasttime = (enable != 0);
+}
+#endif /* __rtems__ */
+
+
 /*
  * adj_systime - adjust system time by the argument.
  */
@@ -2533,7 +2533,7 @@ config_access(
 		case T_Incmem:
 			if (0 <= my_opt->value.i)
 				mru_incalloc = (my_opt->value.u * 1024U)
-						/ sizeof(mon_entry);
+						/ MON_ENTRY_SIZE;
 			else
 				range_err = TRUE;
 			break;
@@ -2548,7 +2548,7 @@ config_access(
 		case T_Initmem:
 			if (0 <= my_opt->value.i)
 				mru_initalloc = (my_opt->value.u * 1024U)
-						 / sizeof(mon_entry);
+						 / MON_ENTRY_SIZE;
 			else
 				range_err = TRUE;
 			break;
@@ -2574,7 +2574,7 @@ config_access(
 		case T_Maxmem:
 			if (0 <= my_opt->value.i)
 				mru_maxdepth = (my_opt->value.u * 1024U) /
-					       sizeof(mon_entry);
+					       MON_ENTRY_SIZE;
 			else
 				mru_maxdepth = UINT_MAX;
 			break;
@@ -230,7 +230,38 @@ static const struct ctl_proc control_codes[] = {
 #define	CS_WANDER_THRESH	91
 #define	CS_LEAPSMEARINTV	92
 #define	CS_LEAPSMEAROFFS	93
-#define	CS_MAX_NOAUTOKEY	CS_LEAPSMEAROFFS
+#define	CS_IO_TXBATCH		94
+#define	CS_IO_TXFLUSHES		95
+#define	CS_IO_TXFLUSHFILL	96
+#define	CS_RBUF_SLAB		97
+#define	CS_RBUF_HIWATER		98
+#define	CS_RBUF_EXHAUSTED	99
+#define	CS_RBUF_DWELL		100
+#define	CS_RBUF_SMALL		101
+#define	CS_RBUF_PROMOTED	102
+#define	CS_SHARDS		103
+#define	CS_SHARD_SERVED		104
+#define	CS_SHARD_FORWARDED	105
+#define	CS_SHARD_DROPPED	106
+#define	CS_SS_FASTPATH		107
+#define	CS_SS_FULLPATH		108
+#define	CS_SS_INPLACE		109
+#define	CS_SS_RESCACHE_HIT	110
+#define	CS_SS_RESCACHE_MISS	111
+#define	CS_MRU_BUCKETS		112
+#define	CS_MRU_LONGEST		113
+#define	CS_MRU_AVGPROBE		114
+#define	CS_MRU_V4BYTES		115
+#define	CS_MRU_V6BYTES		116
+#define	CS_MRU_SKLIMITED	117
+#define	CS_MRU_LIMITED		118
+#define	CS_PEER_BUCKETS		119
+#define	CS_PEER_LONGEST		120
+#define	CS_ASSOC_LONGEST	121
+#define	CS_NAME_LONGEST		122
+#define	CS_MRU_ALLOCMEM		123
+#define	CS_MRU_ENTRYBYTES	124
+#define	CS_MAX_NOAUTOKEY	CS_MRU_ENTRYBYTES
 #ifdef AUTOKEY
 #define	CS_FLAGS		(1 + CS_MAX_NOAUTOKEY)
 #define	CS_HOST			(2 + CS_MAX_NOAUTOKEY)
@@ -431,6 +462,37 @@ static const struct ctl_var sys_var[] = {
 
 	{ CS_LEAPSMEARINTV,	RO, "leapsmearinterval" },    /* 92 */
 	{ CS_LEAPSMEAROFFS,	RO, "leapsmearoffset" },      /* 93 */
+	{ CS_IO_TXBATCH,	RO, "io_txbatch" },	/* 94 */
+	{ CS_IO_TXFLUSHES,	RO, "io_txflushes" },	/* 95 */
+	{ CS_IO_TXFLUSHFILL,	RO, "io_txflushfill" },	/* 96 */
+	{ CS_RBUF_SLAB,		RO, "rbuf_slab" },	/* 97 */
+	{ CS_RBUF_HIWATER,	RO, "rbuf_hiwater" },	/* 98 */
+	{ CS_RBUF_EXHAUSTED,	RO, "rbuf_exhausted" },	/* 99 */
+	{ CS_RBUF_DWELL,	RO, "rbuf_dwell" },	/* 100 */
+	{ CS_RBUF_SMALL,	RO, "rbuf_small" },	/* 101 */
+	{ CS_RBUF_PROMOTED,	RO, "rbuf_promoted" },	/* 102 */
+	{ CS_SHARDS,		RO, "shards" },		/* 103 */
+	{ CS_SHARD_SERVED,	RO, "shard_served" },	/* 104 */
+	{ CS_SHARD_FORWARDED,	RO, "shard_forwarded" },/* 105 */
+	{ CS_SHARD_DROPPED,	RO, "shard_dropped" },	/* 106 */
+	{ CS_SS_FASTPATH,	RO, "ss_fastpath" },	/* 107 */
+	{ CS_SS_FULLPATH,	RO, "ss_fullpath" },	/* 108 */
+	{ CS_SS_INPLACE,	RO, "ss_inplace" },	/* 109 */
+	{ CS_SS_RESCACHE_HIT,	RO, "ss_rescache_hit" },	/* 110 */
+	{ CS_SS_RESCACHE_MISS,	RO, "ss_rescache_miss" },	/* 111 */
+	{ CS_MRU_BUCKETS,	RO, "mru_buckets" },	/* 112 */
+	{ CS_MRU_LONGEST,	RO, "mru_longest" },	/* 113 */
+	{ CS_MRU_AVGPROBE,	RO, "mru_avgprobe" },	/* 114 */
+	{ CS_MRU_V4BYTES,	RO, "mru_v4bytes" },	/* 115 */
+	{ CS_MRU_V6BYTES,	RO, "mru_v6bytes" },	/* 116 */
+	{ CS_MRU_SKLIMITED,	RO, "mru_sklimited" },	/* 117 */
+	{ CS_MRU_LIMITED,	RO, "mru_limited" },	/* 118 */
+	{ CS_PEER_BUCKETS,	RO, "peer_buckets" },	/* 119 */
+	{ CS_PEER_LONGEST,	RO, "peer_longest" },	/* 120 */
+	{ CS_ASSOC_LONGEST,	RO, "assoc_longest" },	/* 121 */
+	{ CS_NAME_LONGEST,	RO, "name_longest" },	/* 122 */
+	{ CS_MRU_ALLOCMEM,	RO, "mru_allocmem" },	/* 123 */
+	{ CS_MRU_ENTRYBYTES,	RO, "mru_entrybytes" },	/* 124 */
 
 #ifdef AUTOKEY
 	{ CS_FLAGS,	RO, "flags" },		/* 1 + CS_MAX_NOAUTOKEY */
@@ -442,7 +504,7 @@ static const struct ctl_var sys_var[] = {
 	{ CS_IDENT,	RO, "ident" },		/* 7 + CS_MAX_NOAUTOKEY */
 	{ CS_DIGEST,	RO, "digest" },		/* 8 + CS_MAX_NOAUTOKEY */
 #endif	/* AUTOKEY */
-	{ 0,		EOV, "" }		/* 94/102 */
+	{ 0,		EOV, "" }		/* 125/133 */
 };
 
 static struct ctl_var *ext_sys_var = NULL;
@@ -1962,6 +2024,10 @@ ctl_putsys(
 	double kb;
 	double dtemp;
 	const char *ss;
+	u_long dwell[RECV_DWELL_BUCKETS];
+	u_long shard[3];
+	char *sp;
+	int i;
 #ifdef AUTOKEY
 	struct cert_info *cp;
 #endif	/* AUTOKEY */
@@ -2215,7 +2281,7 @@ ctl_putsys(
 		break;
 
 	case CS_MRU_MEM:
-		kb = mru_entries * (sizeof(mon_entry) / 1024.);
+		kb = mon_mem() / 1024.;
 		u = (u_int)kb;
 		if (kb - u >= 0.5)
 			u++;
@@ -2238,8 +2304,57 @@ ctl_putsys(
 		ctl_putuint(sys_var[varid].text, mru_maxdepth);
 		break;
 
+	case CS_MRU_BUCKETS:
+		ctl_putuint(sys_var[varid].text,
+			    (0 == mon_hash_bits) ? 0 : MON_HASH_SIZE);
+		break;
+
+	case CS_MRU_LONGEST:
+		ctl_putuint(sys_var[varid].text, mon_hash_longest());
+		break;
+
+	case CS_MRU_AVGPROBE:
+		ctl_putdbl(sys_var[varid].text,
+			   (mon_hash_lookups)
+			       ? (double)mon_hash_probes / mon_hash_lookups
+			       : 0.);
+		break;
+
+	case CS_MRU_V4BYTES:
+		ctl_putuint(sys_var[varid].text, sizeof(mon_entry4));
+		break;
+
+	case CS_MRU_V6BYTES:
+		ctl_putuint(sys_var[varid].text, sizeof(mon_entry6));
+		break;
+
+	case CS_MRU_ALLOCMEM:
+		kb = mon_mem_alloc() / 1024.;
+		u = (u_int)kb;
+		if (kb - u >= 0.5)
+			u++;
+		ctl_putuint(sys_var[varid].text, u);
+		break;
+
+	case CS_MRU_ENTRYBYTES:
+		/* all of the allocation over the entries in use */
+		ctl_putuint(sys_var[varid].text,
+			    (0 == mru_entries)
+				? 0
+				: (mon_mem_alloc() + mru_entries / 2) /
+				  mru_entries);
+		break;
+
+	case CS_MRU_SKLIMITED:
+		ctl_putuint(sys_var[varid].text, mon_sketch_limited);
+		break;
+
+	case CS_MRU_LIMITED:
+		ctl_putuint(sys_var[varid].text, mon_mru_limited);
+		break;
+
 	case CS_MRU_MAXMEM:
-		kb = mru_maxdepth * (sizeof(mon_entry) / 1024.);
+		kb = mru_maxdepth * (MON_ENTRY_SIZE / 1024.);
 		u = (u_int)kb;
 		if (kb - u >= 0.5)
 			u++;
@@ -2303,6 +2418,43 @@ ctl_putsys(
 		ctl_putuint(sys_var[varid].text, sys_processed);
 		break;
 
+	case CS_SS_FASTPATH:
+		ctl_putuint(sys_var[varid].text, sys_fastpath_pkts);
+		break;
+
+	case CS_SS_FULLPATH:
+		ctl_putuint(sys_var[varid].text,
+			    sys_received - sys_fastpath_pkts);
+		break;
+
+	case CS_SS_INPLACE:
+		ctl_putuint(sys_var[varid].text, sys_inplace_pkts);
+		break;
+
+	case CS_SS_RESCACHE_HIT:
+		ctl_putuint(sys_var[varid].text, res_cache_hits);
+		break;
+
+	case CS_SS_RESCACHE_MISS:
+		ctl_putuint(sys_var[varid].text, res_cache_misses);
+		break;
+
+	case CS_PEER_BUCKETS:
+		ctl_putuint(sys_var[varid].text, peer_hash_size);
+		break;
+
+	case CS_PEER_LONGEST:
+		ctl_putuint(sys_var[varid].text, peer_hash_longest(0));
+		break;
+
+	case CS_ASSOC_LONGEST:
+		ctl_putuint(sys_var[varid].text, peer_hash_longest(1));
+		break;
+
+	case CS_NAME_LONGEST:
+		ctl_putuint(sys_var[varid].text, peer_hash_longest(2));
+		break;
+
 	case CS_BCASTDELAY:
 		ctl_putdbl(sys_var[varid].text, sys_bdelay * 1e3);
 		break;
@@ -2515,6 +2667,35 @@ ctl_putsys(
 		ctl_putuint(sys_var[varid].text, lowater_additions());
 		break;
 
+	case CS_RBUF_SLAB:
+		ctl_putuint(sys_var[varid].text, recvbuff_slab_size());
+		break;
+
+	case CS_RBUF_HIWATER:
+		ctl_putuint(sys_var[varid].text, recvbuff_hiwater());
+		break;
+
+	case CS_RBUF_EXHAUSTED:
+		ctl_putuint(sys_var[varid].text, recvbuff_exhaustions());
+		break;
+
+	case CS_RBUF_SMALL:
+		ctl_putuint(sys_var[varid].text, small_recvbuffs());
+		break;
+
+	case CS_RBUF_PROMOTED:
+		ctl_putuint(sys_var[varid].text, recvbuff_promotions());
+		break;
+
+	case CS_RBUF_DWELL:
+		recvbuff_dwell(dwell);
+		sp = str;
+		for (i = 0; i < RECV_DWELL_BUCKETS; i++)
+			sp += snprintf(sp, sizeof(str) - (sp - str), "%s%lu",
+				       (i) ? " " : "", dwell[i]);
+		ctl_putstr(sys_var[varid].text, str, sp - str);
+		break;
+
 	case CS_IO_DROPPED:
 		ctl_putuint(sys_var[varid].text, packets_dropped);
 		break;
@@ -2543,6 +2724,33 @@ ctl_putsys(
 		ctl_putuint(sys_var[varid].text, handler_pkts);
 		break;
 
+	case CS_IO_TXBATCH:
+		ctl_putuint(sys_var[varid].text, tx_batch);
+		break;
+
+	case CS_IO_TXFLUSHES:
+		ctl_putuint(sys_var[varid].text, tx_flushes);
+		break;
+
+	case CS_IO_TXFLUSHFILL:
+		ctl_putdbl(sys_var[varid].text, (tx_flushes)
+			       ? (double)tx_flush_pkts / tx_flushes
+			       : 0.);
+		break;
+
+	case CS_SHARDS:
+		ctl_putuint(sys_var[varid].text,
+			    shard_stats(&shard[0], &shard[1], &shard[2]));
+		break;
+
+	case CS_SHARD_SERVED:
+	case CS_SHARD_FORWARDED:
+	case CS_SHARD_DROPPED:
+		shard_stats(&shard[0], &shard[1], &shard[2]);
+		ctl_putuint(sys_var[varid].text,
+			    shard[varid - CS_SHARD_SERVED]);
+		break;
+
 	case CS_TIMERSTATS_RESET:
 		ctl_putuint(sys_var[varid].text,
 			    current_time - timer_timereset);
@@ -2701,7 +2909,7 @@ ctl_putpeer(
 		break;
 
 	case CP_RATE:
-		ctl_putuint(peer_var[id].text, p->throttle);
+		ctl_putuint(peer_var[id].text, timer_throttle(p));
 		break;
 
 	case CP_LEAP:
@@ -3847,6 +4055,8 @@ send_mru_entry(
 	u_int	which;
 	u_int	remaining;
 	const char * pch;
+	sockaddr_u rmtadr;
+	l_fp	ts;
 
 	remaining = COUNTOF(sent);
 	ZERO(sent);
@@ -3861,18 +4071,21 @@ send_mru_entry(
 
 		case 0:
 			snprintf(tag, sizeof(tag), addr_fmt, count);
-			pch = sptoa(&mon->rmtadr);
+			mon_getaddr(mon, &rmtadr);
+			pch = sptoa(&rmtadr);
 			ctl_putunqstr(tag, pch, strlen(pch));
 			break;
 
 		case 1:
 			snprintf(tag, sizeof(tag), last_fmt, count);
-			ctl_putts(tag, &mon->last);
+			mon_ts(mon->last, &ts);
+			ctl_putts(tag, &ts);
 			break;
 
 		case 2:
 			snprintf(tag, sizeof(tag), first_fmt, count);
-			ctl_putts(tag, &mon->first);
+			mon_ts(mon->first, &ts);
+			ctl_putts(tag, &ts);
 			break;
 
 		case 3:
@@ -4049,7 +4262,8 @@ static void read_mru_list(
 	int			nonce_valid;
 	size_t			i;
 	int			priors;
-	u_short			hash;
+	sockaddr_u		rmtadr;
+	l_fp			ts;
 	mon_entry *		mon;
 	mon_entry *		prior_mon;
 	l_fp			now;
@@ -4190,14 +4404,12 @@ static void read_mru_list(
 	 */
 	mon = NULL;
 	for (i = 0; i < (size_t)priors; i++) {
-		hash = MON_HASH(&addr[i]);
-		for (mon = mon_hash[hash];
-		     mon != NULL;
-		     mon = mon->hash_next)
-			if (ADDR_PORT_EQ(&mon->rmtadr, &addr[i]))
-				break;
+		mon = mon_lookup(&addr[i]);
 		if (mon != NULL) {
-			if (L_ISEQU(&mon->last, &last[i]))
+			mon_getaddr(mon, &rmtadr);
+			mon_ts(mon->last, &ts);
+			if (ADDR_PORT_EQ(&rmtadr, &addr[i]) &&
+			    L_ISEQU(&ts, &last[i]))
 				break;
 			mon = NULL;
 		}
@@ -4212,8 +4424,10 @@ static void read_mru_list(
 			return;
 		}
 		/* confirm the prior entry used as starting point */
-		ctl_putts("last.older", &mon->last);
-		pch = sptoa(&mon->rmtadr);
+		mon_ts(mon->last, &ts);
+		ctl_putts("last.older", &ts);
+		mon_getaddr(mon, &rmtadr);
+		pch = sptoa(&rmtadr);
 		ctl_putunqstr("addr.older", pch, strlen(pch));
 
 		/*
@@ -4222,9 +4436,9 @@ static void read_mru_list(
 		 * that case return the starting point entry.
 		 */
 		if (limit > 1)
-			mon = PREV_DLIST(mon_mru_list, mon, mru);
+			mon = mon_ptr(mon->mru_newer);
 	} else {	/* start with the oldest */
-		mon = TAIL_DLIST(mon_mru_list, mru);
+		mon = mon_oldest();
 	}
 
 	/*
@@ -4236,7 +4450,7 @@ static void read_mru_list(
 	prior_mon = NULL;
 	for (count = 0;
 	     mon != NULL && res_frags < frags && count < limit;
-	     mon = PREV_DLIST(mon_mru_list, mon, mru)) {
+	     mon = mon_ptr(mon->mru_newer)) {
 
 		if (mon->count < mincount)
 			continue;
@@ -4244,10 +4458,12 @@ static void read_mru_list(
 			continue;
 		if (resany && !(resany & mon->flags))
 			continue;
-		if (maxlstint > 0 && now.l_ui - mon->last.l_ui >
-		    maxlstint)
-			continue;
-		if (lcladr != NULL && mon->lcladr != lcladr)
+		if (maxlstint > 0) {
+			mon_ts(mon->last, &ts);
+			if (now.l_ui - ts.l_ui > maxlstint)
+				continue;
+		}
+		if (lcladr != NULL && mon->lcl_ifnum != lcladr->ifnum)
 			continue;
 
 		send_mru_entry(mon, count);
@@ -4266,8 +4482,10 @@ static void read_mru_list(
 			send_random_tag_value(count - 1);
 		ctl_putts("now", &now);
 		/* if any entries were returned confirm the last */
-		if (prior_mon != NULL)
-			ctl_putts("last.newest", &prior_mon->last);
+		if (prior_mon != NULL) {
+			mon_ts(prior_mon->last, &ts);
+			ctl_putts("last.newest", &ts);
+		}
 	}
 	ctl_flushpkt(0);
 }
@@ -4567,6 +4785,7 @@ read_addr_restrictions(
 	u_int idx;
 
 	idx = 0;
+	restrict_sort_lists();
 	send_restrict_list(restrictlist4, FALSE, &idx);
 	send_restrict_list(restrictlist6, TRUE, &idx);
 	ctl_flushpkt(0);
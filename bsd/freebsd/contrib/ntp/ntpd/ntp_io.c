@@ -172,6 +172,33 @@ volatile u_long handler_calls;	/* number of calls to interrupt handler */
 volatile u_long handler_pkts;	/* number of pkts received by handler */
 u_long io_timereset;		/* time counters were reset */
 
+u_int	rx_slab;		/* preallocated recvbufs, 0 for a growing pool */
+u_int	rx_small = RECV_SMALL_INIT; /* recvbufs of the small class */
+u_int	shard_workers;		/* server shard tasks, see SERVER_SHARDS */
+
+/*
+ * Deferred transmit.  With tx_batch nonzero, replies handed to
+ * sendpkt_deferred() while a receive batch is processed are held in
+ * txq[] and sent together by flush_xmit_queue() (sendmmsg() where
+ * available) once the full recvbuf list has been drained.
+ */
+u_int	tx_batch;		/* replies held before a forced flush */
+u_long	tx_flushes;		/* flushes sending at least one reply */
+u_long	tx_flush_pkts;		/* replies sent by flushes */
+
+typedef struct txq_entry_tag {
+	sockaddr_u	dest;
+	endpt *		src;
+	int		len;
+	union {
+		struct pkt	pkt;
+		u_char		buf[LEN_PKT_NOMAC + MAX_MAC_LEN];
+	} u;
+} txq_entry;
+
+static txq_entry	txq[TX_BATCH_MAX];
+static u_int		txq_count;
+
 /*
  * Interface stuff
  */
@@ -193,12 +220,62 @@ int disable_dynamic_updates;		/* scan interfaces once only */
 static	struct refclockio *refio;
 #endif /* REFCLOCK */
 
+#ifdef __rtems__
+#include <rtems/libio_.h>
+#include <rtems/ntpd.h>
+#endif /* __rtems__ */
+
+/*
+ * poll() event backend.  The descriptors to watch are kept in a
+ * compact array maintained by maintain_activefds(), so a wakeup costs
+ * O(active descriptors) instead of building and scanning fd_sets up to
+ * the highest descriptor.  The owner of a descriptor (endpoint,
+ * refclock, asyncio reader or blocking child) is looked up once when
+ * it first becomes readable and cached next to it, so input is
+ * dispatched without walking the endpoint and reader lists.
+ *
+ * Only stacks whose config.h defines USE_POLL_IO get it, as poll() on
+ * sockets is not a given (the legacy stack only has select()), and
+ * NTP_SELECT_IO keeps select() where it would be used.
+ */
+#if defined(USE_POLL_IO) && \
+    (!defined(HAVE_POLL_H) || defined(HAVE_SIGNALED_IO) || \
+     defined(HAVE_IO_COMPLETION_PORT) || defined(SIM) || \
+     defined(NTP_SELECT_IO))
+# undef USE_POLL_IO
+#endif
+
+#ifdef USE_POLL_IO
+# include <poll.h>
+
+typedef enum {
+	FDO_UNKNOWN = 0,	/* not looked up yet */
+	FDO_NETWORK,		/* endpt, fd or bfd */
+	FDO_REFCLOCK,		/* struct refclockio */
+	FDO_ASYNCIO,		/* struct asyncio_reader */
+	FDO_CHILD,		/* blocking_child response pipe */
+	FDO_SHARD,		/* shard wakeup pipe */
+	FDO_INVALID		/* POLLNVAL, drop the descriptor */
+} fd_owner_type;
+
+typedef struct fd_owner_tag {
+	fd_owner_type	type;
+	void *		ptr;
+	int		fd;
+} fd_owner;
+
+static struct pollfd *	pollfds;	/* descriptors to poll() */
+static fd_owner *	pollowners;	/* owners, parallel to pollfds */
+static fd_owner *	pollready;	/* input_handler_poll() scratch */
+static u_int		npollfds;
+static u_int		pollfds_alloc;
+static u_int		pollfds_removed;/* bumped on every removal */
+#else
 /*
  * File descriptor masks etc. for call to select
  * Not needed for I/O Completion Ports or anything outside this file
  */
 #ifdef __rtems__
-#include <rtems/libio_.h>
 static size_t rtems_ntpd_fds_size;
 static int rtems_fd_set_alloc(fd_set **setp) {
 	if (*setp == NULL) {
@@ -218,8 +295,86 @@ static fd_set *activefds_prealloc;
 #else /* __rtems__ */
 static fd_set activefds;
 #endif /* __rtems__ */
+#endif /* !USE_POLL_IO */
 static int maxactivefd;
 
+#if defined(__rtems__) && defined(USE_POLL_IO) && \
+    defined(HAVE_PTHREADS) && defined(HAVE_STDATOMIC_H) && \
+    (defined(SO_REUSEPORT_LB) || defined(SO_REUSEPORT))
+/*
+ * Server shards.  With shard_workers nonzero, that many worker tasks
+ * are started, each pinned to a processor and with its own socket
+ * per local unicast address in the same SO_REUSEPORT(_LB) group as
+ * the ntpd socket, so the stack spreads incoming datagrams over them.
+ * A worker answers plain client (mode 3) requests itself from
+ * shard_hdr, a seqlock protected copy of the system variables that
+ * the main task republishes when they change.  Anything else (server
+ * replies, authenticated or mode 6/7 traffic, datagrams from our own
+ * addresses, and all requests while restrictions need per-client
+ * state) is put on the full recvbuf list for the main task, which
+ * keeps peer and clock discipline, and the main task is woken through
+ * shard_wake_fds.  Requests answered by a worker never reach
+ * ntp_monitor(), so those clients are missing from the MRU list and
+ * the sys_* packet counters; they are only counted here (shard_stats).
+ */
+# define SERVER_SHARDS
+# include <rtems.h>
+# include <pthread.h>
+# include <stdatomic.h>
+# include "ntp_leapsec.h"
+# ifdef SO_REUSEPORT_LB
+#  define SO_SHARD	SO_REUSEPORT_LB
+# else
+#  define SO_SHARD	SO_REUSEPORT
+# endif
+
+typedef struct shard_hdr_tag {
+	u_char	li;		/* xmt_leap */
+	u_char	stratum;	/* wire format */
+	s_char	precision;
+	u_char	minpoll;	/* ntp_minpoll */
+	u_short	rflags;		/* default restrictions */
+	u_char	serve;		/* workers may answer mode 3 */
+	u_int32	refid;
+	u_fp	rootdelay;	/* network order */
+	u_fp	rootdisp;	/* network order */
+	l_fp	reftime;	/* network order */
+} shard_hdr;
+
+typedef struct shard_worker_tag {
+	pthread_t	thread;
+	u_int		nsock;
+	struct pollfd *	pfd;	/* [0] stop pipe, then sockets */
+	endpt **	ep;	/* endpoint of each pfd[] socket */
+	atomic_ulong	served;	/* relaxed, reset by io_clr_stats() */
+	atomic_ulong	forwarded;
+	atomic_ulong	dropped;
+} shard_worker;
+
+static shard_hdr	shard_snap;
+static atomic_uint	shard_seq;	/* odd while shard_snap changes */
+static xmt_template	shard_pub_tmpl;	/* inputs of the last shard_snap */
+static u_int32		shard_pub_gen;	/* restrict_generation() */
+static u_char		shard_pub_minpoll;
+static u_char		shard_pub_smear;
+static int		shard_pub_keyed;	/* peer_keyed */
+static shard_worker *	shards[SHARD_MAX];
+static u_int		nshards;	/* workers running */
+static u_int		shard_want;	/* shard_workers at init_io() */
+static sockaddr_u *	shard_local;	/* our addresses, for the workers */
+static u_int		shard_nlocal;
+static int		shard_stop_fds[2] = { -1, -1 };
+static int		shard_wake_fds[2] = { -1, -1 };
+static u_long		shard_served_done;	/* by stopped workers */
+static u_long		shard_forwarded_done;
+static u_long		shard_dropped_done;
+
+static void	shard_start	(void);
+static void	shard_stop	(void);
+static void	shard_update_hdr(void);
+static void	shard_drain_wake(void);
+#endif /* SERVER_SHARDS */
+
 /*
  * bit alternating value to detect verified interfaces during an update cycle
  */
@@ -227,6 +382,7 @@ static  u_short		sys_interphase = 0;
 
 static endpt *	new_interface(endpt *);
 static void	add_interface(endpt *);
+static void	record_sent_pkt(endpt *, sockaddr_u *, struct pkt *, int);
 static int	update_interfaces(u_short, interface_receiver_t,
 				  void *);
 static void	remove_interface(endpt *);
@@ -304,7 +460,8 @@ static	SOCKET	open_socket	(sockaddr_u *, int, int, endpt *);
 static	void	set_reuseaddr	(int);
 static	isc_boolean_t	socket_broadcast_enable	 (struct interface *, SOCKET, sockaddr_u *);
 
-#if !defined(HAVE_IO_COMPLETION_PORT) && !defined(HAVE_SIGNALED_IO)
+#if !defined(HAVE_IO_COMPLETION_PORT) && !defined(HAVE_SIGNALED_IO) && \
+    !defined(USE_POLL_IO)
 static	char *	fdbits		(int, const fd_set *);
 #endif
 #ifdef  OS_MISSES_SPECIFIC_ROUTE_UPDATES
@@ -360,11 +517,20 @@ static int		cmp_addr_distance(const sockaddr_u *,
  */
 #if !defined(HAVE_IO_COMPLETION_PORT)
 static inline int	read_network_packet	(SOCKET, struct interface *, l_fp);
+static void		queue_network_packet	(struct recvbuf *, SOCKET,
+						 struct interface *, l_fp);
 static void		ntpd_addremove_io_fd	(int, int, int);
+static void		read_network_input	(SOCKET, endpt *, l_fp);
+#ifdef USE_POLL_IO
+static void		input_handler_poll	(const l_fp *, int);
+static int/*BOOL*/	find_fd_owner		(fd_owner *);
+#else
 static void 		input_handler_scan	(const l_fp*, const fd_set*);
 static int/*BOOL*/	sanitize_fdset		(int errc);
+#endif
 #ifdef REFCLOCK
 static inline int	read_refclock_packet	(SOCKET, struct refclockio *, l_fp);
+static void		read_refclock_input	(struct refclockio *, l_fp);
 #endif
 #ifdef HAVE_SIGNALED_IO
 static void 		input_handler		(l_fp*);
@@ -377,6 +543,18 @@ static int rtems_ntp_already_opened;
 #define already_opened rtems_ntp_already_opened
 void rtems_ntp_io_globals_fini(void);
 void rtems_ntp_io_globals_fini(void) {
+#ifdef SERVER_SHARDS
+	shard_stop();
+	if (shard_wake_fds[0] >= 0) {
+		maintain_activefds(shard_wake_fds[0], TRUE);
+		close(shard_wake_fds[0]);
+		close(shard_wake_fds[1]);
+		shard_wake_fds[0] = shard_wake_fds[1] = -1;
+	}
+	shard_served_done = 0;
+	shard_forwarded_done = 0;
+	shard_dropped_done = 0;
+#endif /* SERVER_SHARDS */
 	while (ep_list != NULL) {
 		remove_interface(ep_list);
 	}
@@ -405,18 +583,117 @@ void rtems_ntp_io_globals_fini(void) {
 	handler_calls = 0;
 	handler_pkts = 0;
 	io_timereset = 0;
+	tx_flushes = 0;
+	tx_flush_pkts = 0;
+	txq_count = 0;
 	broadcast_client_enabled = 0;
 	sys_ifnum = 0;
 	ninterfaces = 0;
 	disable_dynamic_updates = 0;
 	sys_interphase = 0;
+#ifdef USE_POLL_IO
+	npollfds = 0;
+#else
 	if (activefds_prealloc != NULL) {
 		memset(activefds_prealloc, 0, rtems_ntpd_fds_size);
 	}
+#endif
 	maxactivefd = 0;
 }
+
+void
+rtems_ntpd_set_tx_batch(int count)
+{
+	/* queued replies go out with the next flush of the ntpd task */
+	if (count < 0)
+		count = 0;
+	else if (count > TX_BATCH_MAX)
+		count = TX_BATCH_MAX;
+	tx_batch = (u_int)count;
+}
+
+void
+rtems_ntpd_set_recv_slab(int count)
+{
+	if (count < 0)
+		count = 0;
+	else if (count > RECV_RING_SIZE)
+		count = RECV_RING_SIZE;
+	rx_slab = (u_int)count;
+}
+
+void
+rtems_ntpd_set_recv_small(int count)
+{
+	if (count < 0)
+		count = 0;
+	else if (count > RECV_RING_SIZE)
+		count = RECV_RING_SIZE;
+	rx_small = (u_int)count;
+}
+
+int
+rtems_ntpd_set_workers(int count)
+{
+	if (count < 0)
+		count = 0;
+	else if (count > SHARD_MAX)
+		count = SHARD_MAX;
+#ifndef SERVER_SHARDS
+	if (count > 0) {
+		errno = ENOTSUP;
+		return -1;
+	}
+#endif
+	shard_workers = (u_int)count;
+	return 0;
+}
 #endif /* __rtems__ */
-#ifndef HAVE_IO_COMPLETION_PORT
+#ifdef USE_POLL_IO
+void
+maintain_activefds(
+	int fd,
+	int closing
+	)
+{
+	u_int	i;
+
+	if (fd < 0) {
+		msyslog(LOG_ERR, "maintain_activefds: bad fd %d", fd);
+		return;
+	}
+	for (i = 0; i < npollfds; i++)
+		if (pollfds[i].fd == fd)
+			break;
+
+	if (!closing) {
+		if (i < npollfds)
+			return;
+		if (npollfds == pollfds_alloc) {
+			pollfds_alloc += 8;
+			pollfds = erealloc(pollfds, pollfds_alloc *
+					   sizeof(pollfds[0]));
+			pollowners = erealloc(pollowners, pollfds_alloc *
+					      sizeof(pollowners[0]));
+			pollready = erealloc(pollready, pollfds_alloc *
+					     sizeof(pollready[0]));
+		}
+		ZERO(pollfds[npollfds]);
+		pollfds[npollfds].fd = fd;
+		pollfds[npollfds].events = POLLIN;
+		ZERO(pollowners[npollfds]);
+		pollowners[npollfds].fd = fd;
+		npollfds++;
+		maxactivefd = max(fd, maxactivefd);
+	} else if (i < npollfds) {
+		/* keep the array compact, order does not matter */
+		npollfds--;
+		pollfds[i] = pollfds[npollfds];
+		pollowners[i] = pollowners[npollfds];
+		pollfds_removed++;
+	}
+}
+#elif !defined(HAVE_IO_COMPLETION_PORT)
 void
 maintain_activefds(
 	int fd,
@@ -531,7 +808,15 @@ void
 init_io(void)
 {
 	/* Init buffer free list and stat counters */
-	init_recvbuff(RECV_INIT);
+	if (rx_slab > 0)
+		init_recvbuff_slab(rx_slab);
+	else
+		init_recvbuff(RECV_INIT);
+	init_recvbuff_small(rx_small);
+#ifdef SERVER_SHARDS
+	/* the sockets must be opened knowing about the shards */
+	shard_want = shard_workers;
+#endif
 	/* update interface every 5 minutes as default */
 	interface_interval = 300;
 
@@ -589,7 +874,11 @@ io_open_sockets(void)
 
 	init_async_notifications();
 
+#ifdef USE_POLL_IO
+	DPRINTF(3, ("io_open_sockets: %u active fds\n", npollfds));
+#else
 	DPRINTF(3, ("io_open_sockets: maxactivefd %d\n", maxactivefd));
+#endif
 }
 
 
@@ -1069,6 +1358,13 @@ remove_interface(
 	endpt **	pmclisthead;
 	sockaddr_u	resmask;
 
+	/* deferred replies may still reference this endpoint */
+	flush_xmit_queue();
+#ifdef SERVER_SHARDS
+	/* so do the shards, restarted by interface_update() */
+	shard_stop();
+#endif
+
 	UNLINK_SLIST(unlinked, ep_list, ep, elink, endpt);
 	if (!ep->ignore_packets && INT_MULTICAST & ep->flags) {
 		pmclisthead = (AF_INET == ep->family)
@@ -1615,6 +1911,12 @@ interface_update(
 	new_interface_found = update_interfaces(NTP_PORT, receiver, data);
 	UNBLOCKIO();
 
+#ifdef SERVER_SHARDS
+	if (new_interface_found)
+		shard_stop();
+	shard_start();
+#endif
+
 	if (!new_interface_found)
 		return;
 
@@ -2146,7 +2448,7 @@ create_sockets(
 	u_short port
 	)
 {
-#ifdef __rtems__
+#if defined(__rtems__) && !defined(USE_POLL_IO)
 	rtems_activefds_alloc();
 #endif /* __rtems__ */
 #ifndef HAVE_IO_COMPLETION_PORT
@@ -2154,7 +2456,9 @@ create_sockets(
 	 * I/O Completion Ports don't care about the select and FD_SET
 	 */
 	maxactivefd = 0;
-#ifndef __rtems__
+#ifdef USE_POLL_IO
+	npollfds = 0;
+#elif !defined(__rtems__)
 	FD_ZERO(&activefds);
 #endif /* __rtems__ */
 #endif
@@ -2171,6 +2475,10 @@ create_sockets(
 	 */
 	set_reuseaddr(0);
 
+#ifdef SERVER_SHARDS
+	shard_start();
+#endif
+
 	DPRINTF(2, ("create_sockets: Total interfaces = %d\n", ninterfaces));
 
 	return ninterfaces;
@@ -3044,6 +3352,17 @@ open_socket(
 			closesocket(fd);
 			return INVALID_SOCKET;
 		}
+#ifdef SERVER_SHARDS
+	/*
+	 * the shard sockets join the group of this one, see
+	 * shard_start()
+	 */
+	if (shard_want > 0 && !(interf->flags & INT_WILDCARD) &&
+	    setsockopt(fd, SOL_SOCKET, SO_SHARD, &on, sizeof(on)))
+		msyslog(LOG_ERR,
+			"setsockopt SO_REUSEPORT fails for address %s: %m",
+			stoa(addr));
+#endif
 #ifdef SO_EXCLUSIVEADDRUSE
 	/*
 	 * setting SO_EXCLUSIVEADDRUSE on the wildcard we open
@@ -3226,7 +3545,6 @@ sendpkt(
 	int	cc;
 	int	rc;
 	u_char	cttl;
-	l_fp	fp_zero = { { 0 }, 0 };
 
 	ismcast = IS_MCAST(dest);
 	if (!ismcast)
@@ -3311,6 +3629,23 @@ sendpkt(
 			src = src->mclink;
 	} while (ismcast && src != NULL);
 
+	record_sent_pkt(src, dest, pkt, len);
+}
+
+
+/*
+ * record_sent_pkt - raw statistics for a packet handed to the stack
+ */
+static void
+record_sent_pkt(
+	endpt *		src,
+	sockaddr_u *	dest,
+	struct pkt *	pkt,
+	int		len
+	)
+{
+	l_fp	fp_zero = { { 0 }, 0 };
+
 	/* HMS: pkt->rootdisp is usually random here */
 	record_raw_stats(src ? &src->sin : NULL, dest,
 			&pkt->org, &pkt->rec, &pkt->xmt, &fp_zero,
@@ -3321,13 +3656,133 @@ sendpkt(
 			pkt->ppoll, pkt->precision,
 			pkt->rootdelay, pkt->rootdisp, pkt->refid,
 			len - MIN_V4_PKT_LEN, (u_char *)&pkt->exten);
+}
 
-	return;
+
+/*
+ * sendpkt_deferred - queue a unicast reply for flush_xmit_queue().
+ * Falls back to sendpkt() when deferral is off, the destination is
+ * multicast or the packet does not fit a queue slot.
+ */
+void
+sendpkt_deferred(
+	sockaddr_u *		dest,
+	struct interface *	ep,
+	struct pkt *		pkt,
+	int			len
+	)
+{
+#if defined(SIM) || defined(HAVE_IO_COMPLETION_PORT)
+	sendpkt(dest, ep, 0, pkt, len);
+#else
+	txq_entry *	qe;
+
+	if (0 == tx_batch || NULL == ep || IS_MCAST(dest) ||
+	    (size_t)len > sizeof(qe->u.buf)) {
+		sendpkt(dest, ep, 0, pkt, len);
+		return;
+	}
+	if (txq_count >= tx_batch)
+		flush_xmit_queue();
+
+	qe = &txq[txq_count++];
+	qe->dest = *dest;
+	qe->src = ep;
+	qe->len = len;
+	memcpy(qe->u.buf, pkt, (size_t)len);
+#endif
+}
+
+
+/*
+ * flush_xmit_queue - send all replies queued by sendpkt_deferred()
+ */
+void
+flush_xmit_queue(void)
+{
+#if !defined(SIM) && !defined(HAVE_IO_COMPLETION_PORT)
+	txq_entry *	qe;
+	u_int		i;
+	u_int		j;
+	u_int		run;
+	int		cc;
+	u_char		ok[TX_BATCH_MAX];
+# ifdef HAVE_SENDMMSG
+	static struct mmsghdr	msgv[TX_BATCH_MAX];
+	static struct iovec	iovv[TX_BATCH_MAX];
+# endif
+
+	if (0 == txq_count)
+		return;
+
+	for (i = 0; i < txq_count; i += run) {
+		/*
+		 * Replies go out in runs sharing a source socket,
+		 * which is the common case for a busy server.
+		 */
+		for (run = 1; i + run < txq_count; run++)
+			if (txq[i + run].src != txq[i].src)
+				break;
+# ifdef HAVE_SENDMMSG
+		for (j = 0; j < run; j++) {
+			qe = &txq[i + j];
+			iovv[j].iov_base = qe->u.buf;
+			iovv[j].iov_len = (size_t)qe->len;
+			ZERO(msgv[j]);
+			msgv[j].msg_hdr.msg_name = &qe->dest;
+			msgv[j].msg_hdr.msg_namelen = SOCKLEN(&qe->dest);
+			msgv[j].msg_hdr.msg_iov = &iovv[j];
+			msgv[j].msg_hdr.msg_iovlen = 1;
+		}
+		/*
+		 * sendmmsg() stops at the first datagram it cannot
+		 * send.  Skip that one and go on with the rest, as
+		 * sendpkt() would have for separate replies.
+		 */
+		for (j = 0; j < run; ) {
+			cc = sendmmsg(txq[i].src->fd, &msgv[j], run - j, 0);
+			if (cc <= 0) {
+				ok[j++] = FALSE;
+				continue;
+			}
+			while (cc-- > 0)
+				ok[j++] = TRUE;
+		}
+# else
+		for (j = 0; j < run; j++) {
+			qe = &txq[i + j];
+			ok[j] = (-1 != sendto(qe->src->fd, (char *)qe->u.buf,
+					      (u_int)qe->len, 0, &qe->dest.sa,
+					      SOCKLEN(&qe->dest)));
+		}
+# endif
+		for (j = 0; j < run; j++) {
+			qe = &txq[i + j];
+			DPRINTF(2, ("flush_xmit_queue(%d, dst=%s, src=%s, len=%d)%s\n",
+				    qe->src->fd, stoa(&qe->dest),
+				    stoa(&qe->src->sin), qe->len,
+				    ok[j] ? "" : " FAILED"));
+			if (ok[j]) {
+				qe->src->sent++;
+				packets_sent++;
+			} else {
+				qe->src->notsent++;
+				packets_notsent++;
+			}
+			record_sent_pkt(qe->src, &qe->dest, &qe->u.pkt,
+					qe->len);
+		}
+	}
+
+	tx_flushes++;
+	tx_flush_pkts += txq_count;
+	txq_count = 0;
+#endif	/* !SIM && !HAVE_IO_COMPLETION_PORT */
 }
 
 
 #if !defined(HAVE_IO_COMPLETION_PORT)
-#if !defined(HAVE_SIGNALED_IO)
+#if !defined(HAVE_SIGNALED_IO) && !defined(USE_POLL_IO)
 /*
  * fdbits - generate ascii representation of fd_set (FAU debug support)
  * HFDF format - highest fd first.
@@ -3561,18 +4016,24 @@ read_network_packet(
 	register struct recvbuf *rb;
 #ifdef HAVE_PACKET_TIMESTAMP
 	struct msghdr msghdr;
-	struct iovec iovec;
+	struct iovec iovec[2];
 	char control[CMSG_BUFSIZE];
+	static u_char rx_tail[RX_BUFF_SIZE - RX_SMALL_SIZE];
 #endif
 
 	/*
 	 * Get a buffer and read the frame.  If we
 	 * haven't got a buffer, or this is received
 	 * on a disallowed socket, just dump the
-	 * packet.
+	 * packet.  With recvmsg() a small buffer is tried
+	 * first, anything beyond it is scattered to rx_tail.
 	 */
 
+#ifndef HAVE_PACKET_TIMESTAMP
 	rb = get_free_recv_buffer();
+#else
+	rb = get_free_recv_buffer_small();
+#endif
 	if (NULL == rb || itf->ignore_packets) {
 		char buf[RX_BUFF_SIZE];
 		sockaddr_u from;
@@ -3602,12 +4063,14 @@ read_network_packet(
 				   sizeof(rb->recv_space), 0,
 				   &rb->recv_srcadr.sa, &fromlen);
 #else
-	iovec.iov_base        = &rb->recv_space;
-	iovec.iov_len         = sizeof(rb->recv_space);
+	iovec[0].iov_base     = &rb->recv_space;
+	iovec[0].iov_len      = rb->recv_size;
+	iovec[1].iov_base     = rx_tail;
+	iovec[1].iov_len      = RX_BUFF_SIZE - rb->recv_size;
 	msghdr.msg_name       = &rb->recv_srcadr;
 	msghdr.msg_namelen    = fromlen;
-	msghdr.msg_iov        = &iovec;
-	msghdr.msg_iovlen     = 1;
+	msghdr.msg_iov        = iovec;
+	msghdr.msg_iovlen     = (rb->recv_size < RX_BUFF_SIZE) ? 2 : 1;
 	msghdr.msg_control    = (void *)&control;
 	msghdr.msg_controllen = sizeof(control);
 	msghdr.msg_flags      = 0;
@@ -3636,6 +4099,35 @@ read_network_packet(
 	DPRINTF(3, ("read_network_packet: fd=%d length %d from %s\n",
 		    fd, buflen, stoa(&rb->recv_srcadr)));
 
+#ifdef HAVE_PACKET_TIMESTAMP
+	if (buflen > rb->recv_size) {
+		rb = promote_recv_buffer(rb, rx_tail);
+		if (NULL == rb) {
+			packets_dropped++;
+			return (buflen);
+		}
+	}
+
+	/* pick up a network time stamp if possible */
+	ts = fetch_timestamp(rb, &msghdr, ts);
+#endif
+	queue_network_packet(rb, fd, itf, ts);
+	return (buflen);
+}
+
+
+/*
+ * queue_network_packet - screen a datagram just read into a recvbuf
+ * and put it on the full list.  The buffer is consumed either way.
+ */
+static void
+queue_network_packet(
+	struct recvbuf *	rb,
+	SOCKET			fd,
+	struct interface *	itf,
+	l_fp			ts
+	)
+{
 #ifdef ENABLE_BUG3020_FIX
 	if (ISREFCLOCKADR(&rb->recv_srcadr)) {
 		msyslog(LOG_ERR, "recvfrom(%s) fd=%d: refclock srcadr on a network interface!",
@@ -3644,7 +4136,7 @@ read_network_packet(
 			    fd));
 		packets_dropped++;
 		freerecvbuf(rb);
-		return (buflen);
+		return;
 	}
 #endif
 
@@ -3666,7 +4158,7 @@ read_network_packet(
 			packets_dropped++;
 			DPRINTF(2, ("DROPPING that packet\n"));
 			freerecvbuf(rb);
-			return buflen;
+			return;
 		}
 		DPRINTF(2, ("processing that packet\n"));
 	}
@@ -3677,10 +4169,6 @@ read_network_packet(
 	 */
 	rb->dstadr = itf;
 	rb->fd = fd;
-#ifdef HAVE_PACKET_TIMESTAMP
-	/* pick up a network time stamp if possible */
-	ts = fetch_timestamp(rb, &msghdr, ts);
-#endif
 	rb->recv_time = ts;
 	rb->receiver = receive;
 
@@ -3688,16 +4176,46 @@ read_network_packet(
 
 	itf->received++;
 	packets_received++;
-	return (buflen);
 }
 
+
 /*
  * attempt to handle io (select()/signaled IO)
  */
 void
 io_handler(void)
 {
-#  ifndef HAVE_SIGNALED_IO
+#  ifdef USE_POLL_IO
+	int nfound;
+
+	++handler_calls;
+#   if !defined(VMS) && !defined(SYS_VXWORKS) && !defined(__rtems__)
+	nfound = poll(pollfds, npollfds, -1);
+#   else
+	/* make poll() wake up after one second */
+#    ifdef __rtems__
+	nfound = poll(pollfds, npollfds, timer_fast_wait(1000));
+	alarm_flag = timer_fast_alarm(nfound <= 0);
+#    else /* __rtems__ */
+	nfound = poll(pollfds, npollfds, 1000);
+	alarm_flag = nfound <= 0;
+#    endif /* __rtems__ */
+#   endif
+	if (nfound > 0) {
+		l_fp ts;
+
+		get_systime(&ts);
+
+		input_handler_poll(&ts, nfound);
+	} else if (nfound == -1 && errno != EINTR) {
+		msyslog(LOG_ERR, "poll() error: %m");
+	}
+#   ifdef DEBUG
+	else {
+		DPRINTF(3, ("poll() returned %d: %m\n", nfound));
+	}
+#   endif /* DEBUG */
+#  elif !defined(HAVE_SIGNALED_IO)
 #if __rtems__
 	#define rdfdes (*rdfdes_prealloc)
 	static fd_set *rdfdes_prealloc;
@@ -3744,12 +4262,23 @@ io_handler(void)
 	/* make select() wake up after one second */
 	{
 		struct timeval t1;
+#ifdef __rtems__
+		int timeout = timer_fast_wait(1000);
+
+		t1.tv_sec  = timeout / 1000;
+		t1.tv_usec = (timeout % 1000) * 1000;
+		nfound = select(maxactivefd + 1,
+				&rdfdes, NULL, NULL,
+				&t1);
+		alarm_flag = timer_fast_alarm(nfound <= 0);
+#else /* __rtems__ */
 		t1.tv_sec  = 1;
 		t1.tv_usec = 0;
 		nfound = select(maxactivefd + 1,
 				&rdfdes, NULL, NULL,
 				&t1);
 		alarm_flag = nfound <= 0;
+#endif /* __rtems__ */
 	}
 #   endif	/* VMS, VxWorks */
 	if (nfound < 0 && sanitize_fdset(errno)) {
@@ -3819,6 +4348,7 @@ input_handler(
 #endif /* HAVE_SIGNALED_IO */
 
 
+#ifndef USE_POLL_IO
 /*
  * Try to sanitize the global FD set
  *
@@ -3882,7 +4412,6 @@ input_handler_scan(
 	const fd_set *	pfds
 	)
 {
-	int		buflen;
 	u_int		idx;
 	int		doing;
 	SOCKET		fd;
@@ -3895,8 +4424,6 @@ input_handler_scan(
 	endpt *		ep;
 #ifdef REFCLOCK
 	struct refclockio *rp;
-	int		saved_errno;
-	const char *	clk;
 #endif
 #ifdef HAS_ROUTING_SOCKET
 	struct asyncio_reader *	asyncio_reader;
@@ -3912,35 +4439,8 @@ input_handler_scan(
 	 */
 	
 	for (rp = refio; rp != NULL; rp = rp->next) {
-		fd = rp->fd;
-		
-		if (!FD_ISSET(fd, pfds))
-			continue;
-		buflen = read_refclock_packet(fd, rp, ts);
-		/*
-		 * The first read must succeed after select() indicates
-		 * readability, or we've reached a permanent EOF.
-		 * http://bugs.ntp.org/1732 reported ntpd munching CPU
-		 * after a USB GPS was unplugged because select was
-		 * indicating EOF but ntpd didn't remove the descriptor
-		 * from the activefds set.
-		 */
-		if (buflen < 0 && EAGAIN != errno) {
-			saved_errno = errno;
-			clk = refnumtoa(&rp->srcclock->srcadr);
-			errno = saved_errno;
-			msyslog(LOG_ERR, "%s read: %m", clk);
-			maintain_activefds(fd, TRUE);
-		} else if (0 == buflen) {
-			clk = refnumtoa(&rp->srcclock->srcadr);
-			msyslog(LOG_ERR, "%s read EOF", clk);
-			maintain_activefds(fd, TRUE);
-		} else {
-			/* drain any remaining refclock input */
-			do {
-				buflen = read_refclock_packet(fd, rp, ts);
-			} while (buflen > 0);
-		}
+		if (FD_ISSET(rp->fd, pfds))
+			read_refclock_input(rp, ts);
 	}
 #endif /* REFCLOCK */
 
@@ -3958,11 +4458,9 @@ input_handler_scan(
 			}
 			if (fd < 0)
 				continue;
-			if (FD_ISSET(fd, pfds))
-				do {
-					buflen = read_network_packet(
-							fd, ep, ts);
-				} while (buflen > 0);
+			if (!FD_ISSET(fd, pfds))
+				continue;
+			read_network_input(fd, ep, ts);
 			/* Check more interfaces */
 		}
 	}
@@ -4011,51 +4509,292 @@ input_handler_scan(
 			lfptoms(&ts_e, 6));
 #endif /* DEBUG_TIMING */
 }
-#endif /* !HAVE_IO_COMPLETION_PORT */
+#endif /* !USE_POLL_IO */
+
 
 /*
- * find an interface suitable for the src address
+ * read_network_input - read everything pending on a readable socket
  */
-endpt *
-select_peerinterface(
-	struct peer *	peer,
-	sockaddr_u *	srcadr,
-	endpt *		dstadr
+static void
+read_network_input(
+	SOCKET	fd,
+	endpt *	ep,
+	l_fp	ts
 	)
 {
-	endpt *ep;
-#ifndef SIM
-	endpt *wild;
+	int	buflen;
 
-	wild = ANY_INTERFACE_CHOOSE(srcadr);
+	do {
+		buflen = read_network_packet(fd, ep, ts);
+	} while (buflen > 0);
+}
+
+
+#ifdef REFCLOCK
+/*
+ * read_refclock_input - read everything pending on a readable refclock
+ */
+static void
+read_refclock_input(
+	struct refclockio *	rp,
+	l_fp			ts
+	)
+{
+	SOCKET		fd;
+	int		buflen;
+	int		saved_errno;
+	const char *	clk;
 
+	fd = rp->fd;
+	buflen = read_refclock_packet(fd, rp, ts);
 	/*
-	 * Initialize the peer structure and dance the interface jig.
-	 * Reference clocks step the loopback waltz, the others
-	 * squaredance around the interface list looking for a buddy. If
-	 * the dance peters out, there is always the wildcard interface.
-	 * This might happen in some systems and would preclude proper
-	 * operation with public key cryptography.
+	 * The first read must succeed after select() indicates
+	 * readability, or we've reached a permanent EOF.
+	 * http://bugs.ntp.org/1732 reported ntpd munching CPU
+	 * after a USB GPS was unplugged because select was
+	 * indicating EOF but ntpd didn't remove the descriptor
+	 * from the activefds set.
 	 */
-	if (ISREFCLOCKADR(srcadr)) {
-		ep = loopback_interface;
-	} else if (peer->cast_flags &
-		   (MDF_BCLNT | MDF_ACAST | MDF_MCAST | MDF_BCAST)) {
-		ep = findbcastinter(srcadr);
-		if (ep != NULL)
-			DPRINTF(4, ("Found *-cast interface %s for address %s\n",
-				stoa(&ep->sin), stoa(srcadr)));
-		else
-			DPRINTF(4, ("No *-cast local address found for address %s\n",
-				stoa(srcadr)));
+	if (buflen < 0 && EAGAIN != errno) {
+		saved_errno = errno;
+		clk = refnumtoa(&rp->srcclock->srcadr);
+		errno = saved_errno;
+		msyslog(LOG_ERR, "%s read: %m", clk);
+		maintain_activefds(fd, TRUE);
+	} else if (0 == buflen) {
+		clk = refnumtoa(&rp->srcclock->srcadr);
+		msyslog(LOG_ERR, "%s read EOF", clk);
+		maintain_activefds(fd, TRUE);
 	} else {
-		ep = dstadr;
-		if (NULL == ep)
-			ep = wild;
+		/* drain any remaining refclock input */
+		do {
+			buflen = read_refclock_packet(fd, rp, ts);
+		} while (buflen > 0);
 	}
-	/*
-	 * If it is a multicast address, findbcastinter() may not find
-	 * it.  For unicast, we get to find the interface when dstadr is
+}
+#endif /* REFCLOCK */
+
+
+#ifdef USE_POLL_IO
+/*
+ * find_fd_owner - fill in the owner of po->fd, FALSE if nobody claims
+ *		   it (yet).
+ */
+static int/*BOOL*/
+find_fd_owner(
+	fd_owner *	po
+	)
+{
+	endpt *			ep;
+	u_int			idx;
+	blocking_child *	c;
+#ifdef REFCLOCK
+	struct refclockio *	rp;
+#endif
+#ifdef HAS_ROUTING_SOCKET
+	struct asyncio_reader *	ar;
+#endif
+
+#ifdef SERVER_SHARDS
+	if (po->fd == shard_wake_fds[0]) {
+		po->type = FDO_SHARD;
+		po->ptr = NULL;
+		return TRUE;
+	}
+#endif
+	for (ep = ep_list; ep != NULL; ep = ep->elink)
+		if (ep->fd == po->fd ||
+		    ((INT_BCASTOPEN & ep->flags) && ep->bfd == po->fd)) {
+			po->type = FDO_NETWORK;
+			po->ptr = ep;
+			return TRUE;
+		}
+#ifdef REFCLOCK
+	for (rp = refio; rp != NULL; rp = rp->next)
+		if (rp->fd == po->fd) {
+			po->type = FDO_REFCLOCK;
+			po->ptr = rp;
+			return TRUE;
+		}
+#endif
+#ifdef HAS_ROUTING_SOCKET
+	for (ar = asyncio_reader_list; ar != NULL; ar = ar->link)
+		if (ar->fd == po->fd) {
+			po->type = FDO_ASYNCIO;
+			po->ptr = ar;
+			return TRUE;
+		}
+#endif
+	for (idx = 0; idx < blocking_children_alloc; idx++) {
+		c = blocking_children[idx];
+		if (c != NULL && c->resp_read_pipe == po->fd) {
+			po->type = FDO_CHILD;
+			po->ptr = c;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+
+/*
+ * input_handler_poll - dispatch the descriptors poll() found ready
+ */
+static void
+input_handler_poll(
+	const l_fp *	cts,
+	int		nready
+	)
+{
+	fd_owner *	po;
+	u_int		i;
+	u_int		j;
+	u_int		n;
+	u_int		removed;
+	l_fp		ts;
+	blocking_child *c;
+#if defined(DEBUG_TIMING)
+	l_fp		ts_e;
+#endif
+
+	++handler_pkts;
+	ts = *cts;
+
+	/*
+	 * Collect the ready descriptors first, the handlers may add
+	 * or remove descriptors and so reorder pollfds[].
+	 */
+	n = 0;
+	for (i = 0; i < npollfds && nready > 0; i++) {
+		if (0 == pollfds[i].revents)
+			continue;
+		nready--;
+		if (POLLNVAL & pollfds[i].revents) {
+			pollready[n].fd = pollfds[i].fd;
+			pollready[n].type = FDO_INVALID;
+			pollready[n++].ptr = NULL;
+			continue;
+		}
+		if (FDO_UNKNOWN == pollowners[i].type &&
+		    !find_fd_owner(&pollowners[i]))
+			continue;
+		pollready[n++] = pollowners[i];
+	}
+	removed = pollfds_removed;
+
+	for (i = 0; i < n; i++) {
+		po = &pollready[i];
+		if (removed != pollfds_removed) {
+			/* a handler closed something, still there? */
+			for (j = 0; j < npollfds; j++)
+				if (pollowners[j].fd == po->fd)
+					break;
+			if (j == npollfds ||
+			    (FDO_INVALID != po->type &&
+			     pollowners[j].ptr != po->ptr))
+				continue;
+		}
+		switch (po->type) {
+
+		case FDO_NETWORK:
+			read_network_input(po->fd, po->ptr, ts);
+			break;
+
+#ifdef REFCLOCK
+		case FDO_REFCLOCK:
+			read_refclock_input(po->ptr, ts);
+			break;
+#endif
+
+#ifdef HAS_ROUTING_SOCKET
+		case FDO_ASYNCIO:
+			/* callback may unlink and free the reader */
+			(*((struct asyncio_reader *)po->ptr)->receiver)(
+				po->ptr);
+			break;
+#endif
+
+		case FDO_CHILD:
+			c = po->ptr;
+			++c->resp_ready_seen;
+			++blocking_child_ready_seen;
+			break;
+
+#ifdef SERVER_SHARDS
+		case FDO_SHARD:
+			/* the datagrams are on the full list already */
+			shard_drain_wake();
+			break;
+#endif
+
+		case FDO_INVALID:
+			msyslog(LOG_ERR,
+				"Removing bad file descriptor %d from poll set",
+				po->fd);
+			maintain_activefds(po->fd, TRUE);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+#if defined(DEBUG_TIMING)
+	get_systime(&ts_e);
+	L_SUB(&ts_e, &ts);
+	collect_timing(NULL, "input handler", 1, &ts_e);
+	if (debug > 3)
+		msyslog(LOG_DEBUG,
+			"input_handler: Processed a gob of fd's in %s msec",
+			lfptoms(&ts_e, 6));
+#endif /* DEBUG_TIMING */
+}
+#endif /* USE_POLL_IO */
+#endif /* !HAVE_IO_COMPLETION_PORT */
+
+/*
+ * find an interface suitable for the src address
+ */
+endpt *
+select_peerinterface(
+	struct peer *	peer,
+	sockaddr_u *	srcadr,
+	endpt *		dstadr
+	)
+{
+	endpt *ep;
+#ifndef SIM
+	endpt *wild;
+
+	wild = ANY_INTERFACE_CHOOSE(srcadr);
+
+	/*
+	 * Initialize the peer structure and dance the interface jig.
+	 * Reference clocks step the loopback waltz, the others
+	 * squaredance around the interface list looking for a buddy. If
+	 * the dance peters out, there is always the wildcard interface.
+	 * This might happen in some systems and would preclude proper
+	 * operation with public key cryptography.
+	 */
+	if (ISREFCLOCKADR(srcadr)) {
+		ep = loopback_interface;
+	} else if (peer->cast_flags &
+		   (MDF_BCLNT | MDF_ACAST | MDF_MCAST | MDF_BCAST)) {
+		ep = findbcastinter(srcadr);
+		if (ep != NULL)
+			DPRINTF(4, ("Found *-cast interface %s for address %s\n",
+				stoa(&ep->sin), stoa(srcadr)));
+		else
+			DPRINTF(4, ("No *-cast local address found for address %s\n",
+				stoa(srcadr)));
+	} else {
+		ep = dstadr;
+		if (NULL == ep)
+			ep = wild;
+	}
+	/*
+	 * If it is a multicast address, findbcastinter() may not find
+	 * it.  For unicast, we get to find the interface when dstadr is
 	 * given to us as the wildcard (ANY_INTERFACE_CHOOSE).  Either
 	 * way, try a little harder.
 	 */
@@ -4484,10 +5223,600 @@ io_clr_stats(void)
 
 	handler_calls = 0;
 	handler_pkts = 0;
+	tx_flushes = 0;
+	tx_flush_pkts = 0;
+	clear_recvbuff_stats();
+#ifdef SERVER_SHARDS
+	{
+		u_int	i;
+
+		for (i = 0; i < nshards; i++) {
+			atomic_store_explicit(&shards[i]->served, 0,
+					      memory_order_relaxed);
+			atomic_store_explicit(&shards[i]->forwarded, 0,
+					      memory_order_relaxed);
+			atomic_store_explicit(&shards[i]->dropped, 0,
+					      memory_order_relaxed);
+		}
+		shard_served_done = 0;
+		shard_forwarded_done = 0;
+		shard_dropped_done = 0;
+	}
+#endif
 	io_timereset = current_time;
 }
 
 
+/*
+ * shard_stats - server shard counters for the control protocol
+ */
+u_int
+shard_stats(
+	u_long *	served,
+	u_long *	forwarded,
+	u_long *	dropped
+	)
+{
+#ifdef SERVER_SHARDS
+	u_int	i;
+
+	*served = shard_served_done;
+	*forwarded = shard_forwarded_done;
+	*dropped = shard_dropped_done;
+	for (i = 0; i < nshards; i++) {
+		*served += atomic_load_explicit(&shards[i]->served,
+						memory_order_relaxed);
+		*forwarded += atomic_load_explicit(&shards[i]->forwarded,
+						   memory_order_relaxed);
+		*dropped += atomic_load_explicit(&shards[i]->dropped,
+						 memory_order_relaxed);
+	}
+	return nshards;
+#else
+	*served = *forwarded = *dropped = 0;
+	return 0;
+#endif
+}
+
+
+/*
+ * shard_publish - hand the current system variables to the server
+ *		   shards if they changed since the last time.  Main
+ *		   task only.
+ */
+void
+shard_publish(void)
+{
+#ifdef SERVER_SHARDS
+	u_char	smear;
+
+	if (0 == nshards)
+		return;
+	smear = FALSE;
+#ifdef LEAP_SMEAR
+	smear = (leap_smear.in_progress != 0);
+#endif
+	if (   restrict_generation() == shard_pub_gen
+	    && ntp_minpoll == shard_pub_minpoll
+	    && peer_keyed == shard_pub_keyed
+	    && smear == shard_pub_smear
+	    && !memcmp(&sys_xmt_template, &shard_pub_tmpl,
+		       sizeof(shard_pub_tmpl)))
+		return;
+	shard_update_hdr();
+#endif
+}
+
+
+#ifdef SERVER_SHARDS
+/*
+ * shard_update_hdr - rewrite shard_snap under the seqlock
+ */
+static void
+shard_update_hdr(void)
+{
+	u_short	rflags;
+	u_int	seq;
+
+	seq = atomic_load_explicit(&shard_seq, memory_order_relaxed);
+	atomic_store_explicit(&shard_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	shard_snap.li = sys_xmt_template.leap;
+	shard_snap.stratum = sys_xmt_template.stratum;
+	shard_snap.precision = sys_xmt_template.precision;
+	shard_snap.minpoll = ntp_minpoll;
+	shard_snap.refid = sys_xmt_template.refid;
+	shard_snap.rootdelay = sys_xmt_template.rootdelay;
+	shard_snap.rootdisp = sys_xmt_template.rootdisp;
+	shard_snap.reftime = sys_xmt_template.reftime;
+	/*
+	 * The workers neither see the MRU list nor any restrict entry
+	 * but the defaults, so they only serve when that is enough.
+	 * Nor do they see the associations, so a keyed one, which
+	 * drops requests without its key (Bug 3454), stops them.
+	 */
+	shard_snap.serve = restrict_default_only(&rflags) &&
+	    !(rflags & (RES_IGNORE | RES_DONTSERVE | RES_DONTTRUST |
+			RES_LIMITED | RES_MSSNTP | RES_FLAKE)) &&
+	    0 == peer_keyed;
+#ifdef LEAP_SMEAR
+	if (leap_smear.in_progress)
+		shard_snap.serve = FALSE;
+#endif
+	shard_snap.rflags = rflags;
+
+	atomic_store_explicit(&shard_seq, seq + 2, memory_order_release);
+
+	memcpy(&shard_pub_tmpl, &sys_xmt_template, sizeof(shard_pub_tmpl));
+	shard_pub_gen = restrict_generation();
+	shard_pub_minpoll = ntp_minpoll;
+	shard_pub_keyed = peer_keyed;
+	shard_pub_smear = FALSE;
+#ifdef LEAP_SMEAR
+	shard_pub_smear = (leap_smear.in_progress != 0);
+#endif
+}
+
+
+/*
+ * shard_read_hdr - consistent copy of shard_snap for a worker.  The
+ *		    update takes a few stores, so a worker gives up
+ *		    after SHARD_READ_TRIES attempts rather than spin on a
+ *		    main task that was preempted in the middle of one;
+ *		    FALSE then has the caller forward the datagram.
+ */
+#define SHARD_READ_TRIES	64
+
+static int
+shard_read_hdr(
+	shard_hdr *	h
+	)
+{
+	u_int	seq;
+	int	tries;
+
+	for (tries = 0; tries < SHARD_READ_TRIES; tries++) {
+		seq = atomic_load_explicit(&shard_seq, memory_order_acquire);
+		if (seq & 1)
+			continue;
+		*h = shard_snap;
+		atomic_thread_fence(memory_order_acquire);
+		if (seq == atomic_load_explicit(&shard_seq,
+						memory_order_relaxed))
+			return TRUE;
+	}
+	return FALSE;
+}
+
+
+/*
+ * shard_time - the worker's version of get_systime(), which keeps
+ *		state of its own and may not be used off the main task.
+ *		No fuzz is added.
+ */
+static l_fp
+shard_time(
+	struct msghdr *	msghdr
+	)
+{
+	struct timespec	now;
+#ifdef HAVE_BINTIME
+	struct cmsghdr *cmsghdr;
+	struct bintime	pbt;
+	l_fp		ts;
+
+	for (cmsghdr = CMSG_FIRSTHDR(msghdr); cmsghdr != NULL;
+	     cmsghdr = CMSG_NXTHDR(msghdr, cmsghdr)) {
+		if (SOL_SOCKET != cmsghdr->cmsg_level ||
+		    SCM_BINTIME != cmsghdr->cmsg_type)
+			continue;
+		memcpy(&pbt, CMSG_DATA(cmsghdr), sizeof(pbt));
+		ts.l_ui = (u_int32)pbt.sec + JAN_1970;
+		ts.l_uf = (u_int32)(pbt.frac >> 32);
+		return ts;
+	}
+#else
+	UNUSED_ARG(msghdr);
+#endif
+	clock_gettime(CLOCK_REALTIME, &now);
+	return tspec_stamp_to_lfp(now);
+}
+
+
+/*
+ * shard_reply - answer a plain client request from the snapshot,
+ *		 FALSE if the main task has to see the datagram.
+ *
+ * The main task ignores requests from our own addresses (the
+ * RESM_INTERFACE restrictions), so those are left to it.  Nothing
+ * here updates the MRU list, see SERVER_SHARDS.
+ */
+static int/*BOOL*/
+shard_reply(
+	SOCKET			fd,
+	const struct pkt *	rpkt,
+	int			len,
+	sockaddr_u *		from,
+	l_fp			rec
+	)
+{
+	shard_hdr	h;
+	struct pkt	xpkt;
+	struct timespec	now;
+	l_fp		xmt;
+	int		version;
+	u_int		i;
+
+	if (LEN_PKT_NOMAC != len || MODE_CLIENT != PKT_MODE(rpkt->li_vn_mode))
+		return FALSE;
+	if (!shard_read_hdr(&h) || !h.serve)
+		return FALSE;
+	for (i = 0; i < shard_nlocal; i++)
+		if (SOCK_EQ(from, &shard_local[i]))
+			return FALSE;
+	version = PKT_VERSION(rpkt->li_vn_mode);
+	if (version > NTP_VERSION || version < NTP_OLDVERSION ||
+	    ((RES_VERSION & h.rflags) && NTP_VERSION != version))
+		return FALSE;
+
+	xpkt.li_vn_mode = PKT_LI_VN_MODE(h.li, version, MODE_SERVER);
+	xpkt.stratum = h.stratum;
+	xpkt.ppoll = max(rpkt->ppoll, h.minpoll);
+	xpkt.precision = h.precision;
+	xpkt.refid = h.refid;
+	xpkt.rootdelay = h.rootdelay;
+	xpkt.rootdisp = h.rootdisp;
+	xpkt.reftime = h.reftime;
+	xpkt.org = rpkt->xmt;
+	HTONL_FP(&rec, &xpkt.rec);
+	clock_gettime(CLOCK_REALTIME, &now);
+	xmt = tspec_stamp_to_lfp(now);
+	HTONL_FP(&xmt, &xpkt.xmt);
+
+	/* a failed send is a lost datagram like any other */
+	sendto(fd, (void *)&xpkt, LEN_PKT_NOMAC, 0, &from->sa,
+	       SOCKLEN(from));
+	return TRUE;
+}
+
+
+/*
+ * shard_forward - queue a datagram the worker does not answer for the
+ *		   main task, FALSE if it had to be dropped.
+ */
+static int/*BOOL*/
+shard_forward(
+	SOCKET		fd,
+	endpt *		ep,
+	const void *	buf,
+	int		len,
+	sockaddr_u *	from,
+	l_fp		ts
+	)
+{
+	recvbuf_t *	rb;
+
+	if ((size_t)len > sizeof(rb->recv_space))
+		return FALSE;
+	/* Bug 2672, see queue_network_packet() */
+	if (AF_INET6 == ep->family &&
+	    IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(from)) &&
+	    !IN6_IS_ADDR_LOOPBACK(PSOCK_ADDR6(&ep->sin)))
+		return FALSE;
+	rb = get_free_recv_buffer();
+	if (NULL == rb)
+		return FALSE;
+	memcpy(&rb->recv_space, buf, len);
+	rb->recv_length = len;
+	rb->recv_srcadr = *from;
+	rb->dstadr = ep;
+	rb->fd = fd;
+	rb->recv_time = ts;
+	rb->receiver = receive;
+	add_full_recv_buffer(rb);
+
+	return TRUE;
+}
+
+
+/*
+ * shard_main - server shard worker task
+ */
+static void *
+shard_main(
+	void *	arg
+	)
+{
+	shard_worker *	w;
+	struct msghdr	msghdr;
+	struct iovec	iovec;
+	sockaddr_u	from;
+	u_int		i;
+	int		n;
+	int		len;
+	int		woken;
+	l_fp		ts;
+	union {
+		struct pkt	pkt;
+		u_char		buf[RX_BUFF_SIZE];
+	} rx;
+	char		control[CMSG_BUFSIZE];
+
+	w = arg;
+	for (;;) {
+		if (poll(w->pfd, w->nsock + 1, -1) < 0) {
+			if (EINTR == errno)
+				continue;
+			break;
+		}
+		/* stop pipe closed */
+		if (w->pfd[0].revents)
+			break;
+		woken = FALSE;
+		for (i = 1; i <= w->nsock; i++) {
+			if (0 == w->pfd[i].revents)
+				continue;
+			for (n = 0; n < RX_BATCH_MAX; n++) {
+				iovec.iov_base = &rx;
+				iovec.iov_len = sizeof(rx);
+				ZERO(msghdr);
+				msghdr.msg_name = &from;
+				msghdr.msg_namelen = sizeof(from);
+				msghdr.msg_iov = &iovec;
+				msghdr.msg_iovlen = 1;
+				msghdr.msg_control = control;
+				msghdr.msg_controllen = sizeof(control);
+				len = recvmsg(w->pfd[i].fd, &msghdr, 0);
+				if (len <= 0)
+					break;
+				ts = shard_time(&msghdr);
+				if (shard_reply(w->pfd[i].fd, &rx.pkt, len,
+						&from, ts)) {
+					atomic_fetch_add_explicit(&w->served,
+						1, memory_order_relaxed);
+				} else if (shard_forward(w->pfd[i].fd,
+						w->ep[i], &rx, len, &from,
+						ts)) {
+					atomic_fetch_add_explicit(
+						&w->forwarded, 1,
+						memory_order_relaxed);
+					woken = TRUE;
+				} else {
+					atomic_fetch_add_explicit(&w->dropped,
+						1, memory_order_relaxed);
+				}
+			}
+		}
+		if (woken && write(shard_wake_fds[1], "", 1) < 0) {
+			/* pipe full, the main task is awake anyway */
+		}
+	}
+	return NULL;
+}
+
+
+/*
+ * shard_open_socket - open a worker socket in the group of ep->fd
+ */
+static SOCKET
+shard_open_socket(
+	endpt *	ep
+	)
+{
+	SOCKET	fd;
+	int	on = 1;
+
+	fd = socket(ep->family, SOCK_DGRAM, 0);
+	if (INVALID_SOCKET == fd)
+		return INVALID_SOCKET;
+	if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+	    setsockopt(fd, SOL_SOCKET, SO_SHARD, &on, sizeof(on))) {
+		closesocket(fd);
+		return INVALID_SOCKET;
+	}
+#ifdef IPV6_V6ONLY
+	if (AF_INET6 == ep->family)
+		setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &on, sizeof(on));
+#endif
+#ifdef HAVE_BINTIME
+	setsockopt(fd, SOL_SOCKET, SO_BINTIME, &on, sizeof(on));
+#endif
+	if (bind(fd, &ep->sin.sa, SOCKLEN(&ep->sin)) < 0) {
+		msyslog(LOG_ERR, "shard bind %s failed: %m",
+			stoa(&ep->sin));
+		closesocket(fd);
+		return INVALID_SOCKET;
+	}
+	make_socket_nonblocking(fd);
+
+	return fd;
+}
+
+
+/*
+ * shard_pin - bind worker idx to a processor, leaving the first one
+ *	       to the main task as long as there are enough.
+ */
+static void
+shard_pin(
+	pthread_t	thread,
+	u_int		idx
+	)
+{
+	cpu_set_t	set;
+	uint32_t	ncpu;
+	int		rc;
+
+	ncpu = rtems_scheduler_get_processor_maximum();
+	if (ncpu < 2)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET((1 + idx) % ncpu, &set);
+	rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if (rc != 0)
+		msyslog(LOG_NOTICE, "shard %u: processor affinity: %s",
+			idx, strerror(rc));
+}
+
+
+/*
+ * shard_start - start the server shards, unless running already
+ */
+static void
+shard_start(void)
+{
+	shard_worker *	w;
+	endpt *		ep;
+	SOCKET		fd;
+	u_int		neps;
+	u_int		i;
+	int		rc;
+
+	if (0 == shard_want || nshards > 0)
+		return;
+
+	neps = 0;
+	for (ep = ep_list; ep != NULL; ep = ep->elink)
+		if (INVALID_SOCKET != ep->fd && !ep->ignore_packets &&
+		    !(INT_WILDCARD & ep->flags))
+			neps++;
+	if (0 == neps)
+		return;
+
+	/* every address of ours, the workers leave those alone */
+	shard_nlocal = 0;
+	for (ep = ep_list; ep != NULL; ep = ep->elink)
+		if (!(INT_WILDCARD & ep->flags))
+			shard_nlocal++;
+	shard_local = emalloc_zero(shard_nlocal * sizeof(shard_local[0]));
+	i = 0;
+	for (ep = ep_list; ep != NULL; ep = ep->elink)
+		if (!(INT_WILDCARD & ep->flags))
+			shard_local[i++] = ep->sin;
+
+	if (shard_wake_fds[0] < 0) {
+		if (pipe(shard_wake_fds) < 0) {
+			msyslog(LOG_ERR, "shard wakeup pipe: %m");
+			goto nolocal;
+		}
+		make_socket_nonblocking(shard_wake_fds[0]);
+		make_socket_nonblocking(shard_wake_fds[1]);
+		maintain_activefds(shard_wake_fds[0], FALSE);
+	}
+	if (pipe(shard_stop_fds) < 0) {
+		msyslog(LOG_ERR, "shard stop pipe: %m");
+		goto nolocal;
+	}
+
+	/* the workers must not see a stale snapshot */
+	shard_update_hdr();
+
+	for (i = 0; i < shard_want; i++) {
+		w = emalloc_zero(sizeof(*w));
+		w->pfd = emalloc_zero((1 + neps) * sizeof(w->pfd[0]));
+		w->ep = emalloc_zero((1 + neps) * sizeof(w->ep[0]));
+		w->pfd[0].fd = shard_stop_fds[0];
+		w->pfd[0].events = POLLIN;
+		for (ep = ep_list; ep != NULL; ep = ep->elink) {
+			if (INVALID_SOCKET == ep->fd ||
+			    ep->ignore_packets ||
+			    (INT_WILDCARD & ep->flags))
+				continue;
+			fd = shard_open_socket(ep);
+			if (INVALID_SOCKET == fd)
+				continue;
+			w->nsock++;
+			w->pfd[w->nsock].fd = fd;
+			w->pfd[w->nsock].events = POLLIN;
+			w->ep[w->nsock] = ep;
+		}
+		rc = (w->nsock > 0)
+			 ? pthread_create(&w->thread, NULL, shard_main, w)
+			 : EINVAL;
+		if (rc != 0) {
+			if (w->nsock > 0)
+				msyslog(LOG_ERR, "shard %u: %s", i,
+					strerror(rc));
+			while (w->nsock > 0)
+				closesocket(w->pfd[w->nsock--].fd);
+			free(w->pfd);
+			free(w->ep);
+			free(w);
+			break;
+		}
+		shard_pin(w->thread, i);
+		shards[nshards++] = w;
+	}
+	msyslog(LOG_INFO, "%u server shard(s) on %u address(es)",
+		nshards, neps);
+	if (nshards > 0) {
+		msyslog(LOG_NOTICE, "clients answered by server shards are not in the MRU list");
+		return;
+	}
+	close(shard_stop_fds[0]);
+	close(shard_stop_fds[1]);
+  nolocal:
+	free(shard_local);
+	shard_local = NULL;
+	shard_nlocal = 0;
+}
+
+
+/*
+ * shard_stop - stop the server shards and drop what they queued
+ */
+static void
+shard_stop(void)
+{
+	shard_worker *	w;
+	u_int		i;
+
+	if (0 == nshards)
+		return;
+
+	/* wakes all workers */
+	close(shard_stop_fds[1]);
+	for (i = 0; i < nshards; i++) {
+		w = shards[i];
+		pthread_join(w->thread, NULL);
+		while (w->nsock > 0) {
+			purge_recv_buffers_for_fd(w->pfd[w->nsock].fd);
+			closesocket(w->pfd[w->nsock--].fd);
+		}
+		shard_served_done += atomic_load_explicit(&w->served,
+					memory_order_relaxed);
+		shard_forwarded_done += atomic_load_explicit(&w->forwarded,
+					memory_order_relaxed);
+		shard_dropped_done += atomic_load_explicit(&w->dropped,
+					memory_order_relaxed);
+		free(w->pfd);
+		free(w->ep);
+		free(w);
+		shards[i] = NULL;
+	}
+	close(shard_stop_fds[0]);
+	nshards = 0;
+	free(shard_local);
+	shard_local = NULL;
+	shard_nlocal = 0;
+}
+
+
+/*
+ * shard_drain_wake - empty the shard wakeup pipe
+ */
+static void
+shard_drain_wake(void)
+{
+	char	buf[64];
+
+	while (read(shard_wake_fds[0], buf, sizeof(buf)) > 0)
+		continue;
+}
+#endif /* SERVER_SHARDS */
+
+
 #ifdef REFCLOCK
 /*
  * io_addclock - add a reference clock to the list and arrange that we
@@ -1015,6 +1015,7 @@ adj_host_clock(
 	 * time constant is clamped at 2.
 	 */
 	sys_rootdisp += clock_phi;
+	update_xmt_template();
 #ifndef LOCKCLOCK
 	if (!ntp_enable || mode_ntpdate)
 		return;
@@ -19,6 +19,13 @@
 #ifdef HAVE_SYS_IOCTL_H
 # include <sys/ioctl.h>
 #endif
+#ifdef __rtems__
+#include <rtems.h>
+#include <stdatomic.h>
+#include <rtems/ntpd.h>
+#include "timespecops.h"
+#define	MON_SNAPSHOT
+#endif /* __rtems__ */
 
 /*
  * Record statistics based on source address, mode and version. The
@@ -39,40 +46,139 @@
  * tail for the MRU list, unlinking from the hash table, and
  * reinitializing.
  *
+ * To fit more clients in a given amount of memory, entries are packed:
+ * IPv4 and IPv6 entries come from slabs of their own, each with just
+ * the address it needs, they refer to each other by 32-bit mon_idx
+ * slab indices, and the times are 24.8 fixed point seconds since the
+ * epoch of the table (mon_epoch) instead of l_fp.  The epoch moves
+ * forward about every 48 days, see mon_reltime().  Entries freed in
+ * one family are not handed to the other, so in the worst case of all
+ * traffic moving from one family to the other the entries allocated
+ * can reach twice mru_maxdepth.
+ *
+ * Entries may also be kept for networks instead of hosts, with the
+ * prefix lengths mon_prefix4 and mon_prefix6.  The rate limits then
+ * apply to each network as a whole, and a client spreading its
+ * requests over the addresses of, say, a /64 takes just one entry.
+ *
+ * Other tasks may copy the entries with rtems_ntpd_mru_snapshot() while
+ * ntpd keeps changing them.  Changes are made under the mon_seq
+ * seqlock, and slabs and slab directories are not freed while
+ * monitoring, so a reader at worst sees an entry twice or misses one
+ * which moved.
+ *
+ * Optionally a count-min sketch of fixed size sits in front of the
+ * MRU list, see mon_sketch_count().  Sources without an entry are
+ * counted there, and only those which send often enough to matter to
+ * rate limiting get one.  A flood from many (spoofed) addresses then
+ * leaves the MRU list alone.
+ *
  * INC_MONLIST is the default allocation granularity in entries.
  * INIT_MONLIST is the default initial allocation in entries.
  */
 #ifdef MONMEMINC		/* old name */
 # define	INC_MONLIST	MONMEMINC
 #elif !defined(INC_MONLIST)
-# define	INC_MONLIST	(4 * 1024 / sizeof(mon_entry))
+# define	INC_MONLIST	(4 * 1024 / MON_ENTRY_SIZE)
 #endif
 #ifndef INIT_MONLIST
-# define	INIT_MONLIST	(4 * 1024 / sizeof(mon_entry))
+# define	INIT_MONLIST	(4 * 1024 / MON_ENTRY_SIZE)
 #endif
 #ifndef MRU_MAXDEPTH_DEF
-# define MRU_MAXDEPTH_DEF	(1024 * 1024 / sizeof(mon_entry))
+# define MRU_MAXDEPTH_DEF	(1024 * 1024 / MON_ENTRY_SIZE)
 #endif
 
 /*
- * Hashing stuff
+ * Entries per slab, and the fixed point scale of the entry times.
  */
+#define	MON_SLAB_BITS		7
+#define	MON_SLAB_ENTRIES	(1U << MON_SLAB_BITS)
+#define	MON_SLAB_MASK		(MON_SLAB_ENTRIES - 1)
+#define	MON_TIME_FRAC		8		/* fraction bits */
+#define	MON_TIME_REBASE		(1U << 22)	/* seconds */
+
+/*
+ * Hashing stuff.  The address hash is keyed with a random seed chosen
+ * whenever monitoring starts, so remote hosts cannot pick addresses
+ * which pile up in one bucket.  The table grows by linear hashing:
+ * while there are more than MON_HASH_LOAD entries per bucket, bucket
+ * mon_hash_split is split in two for each new entry, so the table
+ * grows without ever rehashing all of it.  Addresses use the low
+ * mon_hash_bits bits of the hash, or one bit more for the buckets
+ * below mon_hash_split which were split already.
+ */
+#define	MON_HASH_LOAD		4	/* average entries per bucket */
+#define	MON_HASH_MINBITS	4
+#define	MON_HASH_MAXBITS	30
+
 u_char	mon_hash_bits;
+u_int	mon_hash_split;			/* next bucket to split */
+static	u_int	mon_hash_alloc;		/* buckets allocated */
+static	u_int32	mon_hash_seed[2];
+u_long	mon_hash_lookups;		/* ntp_monitor() lookups */
+u_long	mon_hash_probes;		/* entries compared by those */
 
 /*
- * Pointers to the hash table and the MRU list.  Memory for the hash
- * table is allocated only if monitoring is enabled.
+ * Count-min sketch of the sources without an entry.  Each of the
+ * MON_SKETCH_ROWS rows has 1 << mon_sketch_bits saturating counters,
+ * indexed by the address hash.  All counters are halved every
+ * NTP_SHIFT << ntp_minpoll seconds, so a source polling once in that
+ * time counts about 2.  Sources counting MON_SKETCH_PROMOTE or more
+ * get an MRU entry.  Above MON_SKETCH_LIMIT a source sends faster
+ * than the average headway allows.  The sketch is off if
+ * mon_sketch_bits is 0.
  */
-mon_entry **	mon_hash;	/* MRU hash table */
-mon_entry	mon_mru_list;	/* mru listhead */
+#define	MON_SKETCH_ROWS		4
+#define	MON_SKETCH_MINBITS	8
+#define	MON_SKETCH_MAXBITS	16
+#define	MON_SKETCH_PROMOTE	4
+#define	MON_SKETCH_LIMIT	(2 * NTP_SHIFT)
+
+static	u_char	mon_sketch_bits;	/* log2 counters per row */
+static	u_char	mon_sketch_inuse;	/* bits of mon_sketch */
+static	u_short	*mon_sketch;		/* the counters, row by row */
+static	u_long	mon_sketch_aged;	/* current_time of last halving */
+u_long	mon_sketch_limited;		/* packets limited by the sketch */
+u_long	mon_mru_limited;		/* packets limited by MRU entries */
+
+/*
+ * The hash table and the MRU list.  Memory for the hash table is
+ * allocated only if monitoring is enabled.
+ */
+static	mon_idx *	mon_hash;	/* MRU hash table */
+static	mon_idx		mon_mru_newest;	/* head of the MRU list */
+static	mon_idx		mon_mru_oldest;	/* tail of the MRU list */
+static	l_fp		mon_epoch;	/* time 0 of the entry times */
+
+/*
+ * The slabs, indexed by family (0 for IPv4, 1 for IPv6).
+ */
+static	u_char **	mon_slab[2];	/* MON_SLAB_ENTRIES entries each */
+static	u_int		mon_slabs[2];
+static	u_int		mon_slab_cap[2];	/* room in mon_slab[] */
+static	const size_t	mon_esize[2] = {
+	sizeof(mon_entry4), sizeof(mon_entry6)
+};
 
 /*
  * List of free structures structures, and counters of in-use and total
  * structures. The free structures are linked with the hash_next field.
  */
-static  mon_entry *mon_free;		/* free list or null if none */
+static	mon_idx	mon_free[2];		/* free lists or 0 if none */
+
+#ifdef MON_SNAPSHOT
+/*
+ * The seqlock for readers in other tasks, odd while entries change.
+ * Slab directories replaced by larger ones are kept until the daemon
+ * exits, readers may still look at them.
+ */
+static	atomic_uint	mon_seq;
+static	u_char **	mon_slab_old[2][32];
+static	u_int		mon_slab_nold[2];
+#endif
 	u_int mru_alloc;		/* mru list + free list count */
 	u_int mru_entries;		/* mru list count */
+	u_int mru_entries6;		/* IPv6 part of mru_entries */
 	u_int mru_peakentries;		/* highest mru_entries seen */
 	u_int mru_initalloc = INIT_MONLIST;/* entries to preallocate */
 	u_int mru_incalloc = INC_MONLIST;/* allocation batch factor */
@@ -87,6 +193,14 @@ static	u_int mon_mem_increments;	/* times called malloc() */
 int	ntp_minpkt = NTP_MINPKT;	/* minimum (log 2 s) */
 u_char	ntp_minpoll = NTP_MINPOLL;	/* increment (log 2 s) */
 
+/*
+ * Prefix lengths of the addresses entries are kept for.  With less
+ * than a full address all hosts of a network share one entry and so
+ * one leaky bucket, see mon_key().
+ */
+static	u_char	mon_prefix4 = 32;	/* IPv4 prefix length */
+static	u_char	mon_prefix6 = 128;	/* IPv6 prefix length */
+
 /*
  * Initialization state.  We may be monitoring, we may not.  If
  * we aren't, we may not even have allocated any memory yet.
@@ -110,12 +224,53 @@ void rtems_ntp_monitor_globals_fini(void) {
 	mru_maxage = 64;
 	mru_maxdepth = MRU_MAXDEPTH_DEF;
 	mon_age = 3000;
+	mon_hash_lookups = 0;
+	mon_hash_probes = 0;
+	free(mon_sketch);
+	mon_sketch = NULL;
+	mon_sketch_inuse = 0;
+	while (mon_slab_nold[0] > 0)
+		free(mon_slab_old[0][--mon_slab_nold[0]]);
+	while (mon_slab_nold[1] > 0)
+		free(mon_slab_old[1][--mon_slab_nold[1]]);
+	mon_sketch_limited = 0;
+	mon_mru_limited = 0;
+}
+
+void
+rtems_ntpd_set_limit_prefix(int prefixlen4, int prefixlen6)
+{
+	mon_prefix4 = (u_char)max(0, min(prefixlen4, 32));
+	mon_prefix6 = (u_char)max(0, min(prefixlen6, 128));
+}
+
+void
+rtems_ntpd_set_mru_sketch(int width)
+{
+	u_char	bits;
+
+	if (width <= 0) {
+		mon_sketch_bits = 0;
+		return;
+	}
+	bits = MON_SKETCH_MINBITS;
+	while (bits < MON_SKETCH_MAXBITS && (1 << bits) < width)
+		bits++;
+	mon_sketch_bits = bits;
 }
 #endif /* __rtems__ */
-static	void		mon_getmoremem(void);
-static	void		remove_from_hash(mon_entry *);
-static	inline void	mon_free_entry(mon_entry *);
-static	inline void	mon_reclaim_entry(mon_entry *);
+static	void		mon_getmoremem(int);
+static	void		mon_hash_grow(void);
+static	mon_idx		mon_take(int);
+static	void		remove_from_hash(mon_idx, mon_entry *);
+static	void		mon_unlink_mru(mon_entry *);
+static	void		mon_link_mru(mon_idx, mon_entry *);
+static	inline void	mon_free_entry(mon_idx, mon_entry *);
+static	inline void	mon_reclaim_entry(mon_idx, mon_entry *);
+static	u_int		mon_sketch_count(u_int32);
+static	inline void	mon_write_begin(void);
+static	inline void	mon_write_end(void);
+static	const sockaddr_u *mon_key(const sockaddr_u *, sockaddr_u *);
 
 
 /*
@@ -129,7 +284,504 @@ init_mon(void)
 	 * until mon_start().
 	 */
 	mon_enabled = MON_OFF;
-	INIT_DLIST(mon_mru_list, mru);
+	mon_mru_newest = 0;
+	mon_mru_oldest = 0;
+}
+
+
+/*
+ * mon_write_begin - start changing entries, see mon_seq
+ */
+static inline void
+mon_write_begin(void)
+{
+#ifdef MON_SNAPSHOT
+	u_int	seq;
+
+	seq = atomic_load_explicit(&mon_seq, memory_order_relaxed);
+	atomic_store_explicit(&mon_seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+#endif
+}
+
+
+/*
+ * mon_write_end - done changing entries
+ */
+static inline void
+mon_write_end(void)
+{
+#ifdef MON_SNAPSHOT
+	u_int	seq;
+
+	seq = atomic_load_explicit(&mon_seq, memory_order_relaxed);
+	atomic_store_explicit(&mon_seq, seq + 1, memory_order_release);
+#endif
+}
+
+
+/*
+ * mon_ptr - the entry of a slab index, NULL for 0
+ */
+mon_entry *
+mon_ptr(
+	mon_idx	idx
+	)
+{
+	int	v6;
+	u_int	n;
+
+	if (0 == idx)
+		return NULL;
+
+	v6 = !!(MON_IDX_V6 & idx);
+	n = (idx & ~MON_IDX_V6) - 1;
+	return (void *)(mon_slab[v6][n >> MON_SLAB_BITS] +
+			(n & MON_SLAB_MASK) * mon_esize[v6]);
+}
+
+
+/*
+ * mon_oldest - the tail of the MRU list, NULL if it is empty
+ */
+mon_entry *
+mon_oldest(void)
+{
+	return mon_ptr(mon_mru_oldest);
+}
+
+
+/*
+ * mon_ts_at - l_fp time of an entry time with a given epoch
+ */
+static inline void
+mon_ts_at(
+	u_int32		reltime,
+	const l_fp *	epoch,
+	l_fp *		ts
+	)
+{
+	l_fp	rel;
+
+	rel.l_ui = reltime >> MON_TIME_FRAC;
+	rel.l_uf = reltime << (32 - MON_TIME_FRAC);
+	*ts = *epoch;
+	L_ADD(ts, &rel);
+}
+
+
+/*
+ * mon_ts - l_fp time of an entry time
+ */
+void
+mon_ts(
+	u_int32	reltime,
+	l_fp *	ts
+	)
+{
+	mon_ts_at(reltime, &mon_epoch, ts);
+}
+
+
+/*
+ * mon_reltime - entry time of an l_fp time.  Times before the epoch
+ *		 are taken as the epoch.  Before the entry times run out
+ *		 of bits the epoch is moved forward, and times of
+ *		 entries older than the new epoch are set to it.
+ */
+static u_int32
+mon_reltime(
+	const l_fp *	ts
+	)
+{
+	l_fp		rel;
+	mon_entry *	mon;
+	u_int32		shift;
+
+	rel = *ts;
+	L_SUB(&rel, &mon_epoch);
+	if (L_ISNEG(&rel))
+		return 0;
+
+	if (rel.l_ui >= 2 * MON_TIME_REBASE) {
+		mon_write_begin();
+		mon_epoch.l_ui += MON_TIME_REBASE;
+		rel.l_ui -= MON_TIME_REBASE;
+		shift = MON_TIME_REBASE << MON_TIME_FRAC;
+		for (mon = mon_ptr(mon_mru_newest);
+		     mon != NULL;
+		     mon = mon_ptr(mon->mru_older)) {
+			mon->first = (mon->first > shift)
+					 ? mon->first - shift
+					 : 0;
+			mon->last = (mon->last > shift)
+					? mon->last - shift
+					: 0;
+		}
+		mon_write_end();
+	}
+
+	return rel.l_ui << MON_TIME_FRAC | rel.l_uf >> (32 - MON_TIME_FRAC);
+}
+
+
+/*
+ * mon_getaddr - the remote address and port of an entry
+ */
+void
+mon_getaddr(
+	const mon_entry *	mon,
+	sockaddr_u *		addr
+	)
+{
+	ZERO_SOCK(addr);
+	if (mon->v6) {
+		AF(addr) = AF_INET6;
+		SOCK_ADDR6(addr) = ((const mon_entry6 *)mon)->addr;
+	} else {
+		AF(addr) = AF_INET;
+		NSRCADR(addr) = ((const mon_entry4 *)mon)->addr.s_addr;
+	}
+	NSRCPORT(addr) = mon->port;
+}
+
+
+/*
+ * mon_addr_eq - TRUE if an entry is for the address of a host
+ */
+static inline int
+mon_addr_eq(
+	const mon_entry *	mon,
+	const sockaddr_u *	addr
+	)
+{
+	if (IS_IPV6(addr))
+		return mon->v6 &&
+		       !memcmp(&((const mon_entry6 *)mon)->addr,
+			       PSOCK_ADDR6(addr), sizeof(struct in6_addr));
+	return !mon->v6 &&
+	       ((const mon_entry4 *)mon)->addr.s_addr == NSRCADR(addr);
+}
+
+
+/*
+ * mon_hash_addr - HalfSipHash-1-3 of the family and address of a host
+ *		   with the seed as key
+ */
+#define	MON_ROTL(x, b)	(u_int32)(((x) << (b)) | ((x) >> (32 - (b))))
+#define	MON_SIPROUND()						\
+	do {							\
+		v0 += v1; v1 = MON_ROTL(v1, 5); v1 ^= v0;	\
+		v0 = MON_ROTL(v0, 16);				\
+		v2 += v3; v3 = MON_ROTL(v3, 8); v3 ^= v2;	\
+		v0 += v3; v3 = MON_ROTL(v3, 7); v3 ^= v0;	\
+		v2 += v1; v1 = MON_ROTL(v1, 13); v1 ^= v2;	\
+		v2 = MON_ROTL(v2, 16);				\
+	} while (0)
+
+static u_int32
+mon_hash_addr(
+	int		v6,
+	const void *	addr
+	)
+{
+	u_int32	w[5];
+	u_int32	v0, v1, v2, v3;
+	size_t	n;
+	size_t	i;
+
+	if (v6) {
+		memcpy(w, addr, 4 * sizeof(w[0]));
+		n = 4;
+	} else {
+		memcpy(w, addr, sizeof(w[0]));
+		n = 1;
+	}
+	w[n] = (u_int32)(n * sizeof(w[0])) << 24 |
+	       ((v6) ? AF_INET6 : AF_INET);
+	n++;
+
+	v0 = mon_hash_seed[0];
+	v1 = mon_hash_seed[1];
+	v2 = 0x6c796765 ^ mon_hash_seed[0];
+	v3 = 0x74656462 ^ mon_hash_seed[1];
+	for (i = 0; i < n; i++) {
+		v3 ^= w[i];
+		MON_SIPROUND();
+		v0 ^= w[i];
+	}
+	v2 ^= 0xff;
+	MON_SIPROUND();
+	MON_SIPROUND();
+	MON_SIPROUND();
+
+	return v1 ^ v3;
+}
+
+
+static inline u_int
+mon_hash_index(
+	u_int32	hash
+	)
+{
+	u_int	bucket;
+
+	bucket = hash & ((1U << mon_hash_bits) - 1);
+	if (bucket < mon_hash_split)
+		bucket = hash & ((2U << mon_hash_bits) - 1);
+
+	return bucket;
+}
+
+
+static inline u_int32
+mon_hash_sock(
+	const sockaddr_u *addr
+	)
+{
+	if (IS_IPV6(addr))
+		return mon_hash_addr(TRUE, PSOCK_ADDR6(addr));
+	return mon_hash_addr(FALSE, &NSRCADR(addr));
+}
+
+
+/*
+ * mon_hash_bucket - hash bucket of a host address, see MON_HASH()
+ */
+u_int
+mon_hash_bucket(
+	const sockaddr_u *addr
+	)
+{
+	return mon_hash_index(mon_hash_sock(addr));
+}
+
+
+/*
+ * mon_entry_bucket - hash bucket of an entry
+ */
+static u_int
+mon_entry_bucket(
+	const mon_entry *mon
+	)
+{
+	if (mon->v6)
+		return mon_hash_index(mon_hash_addr(TRUE,
+				&((const mon_entry6 *)mon)->addr));
+	return mon_hash_index(mon_hash_addr(FALSE,
+				&((const mon_entry4 *)mon)->addr));
+}
+
+
+/*
+ * mon_lookup - the entry for the address of a host, or NULL
+ */
+mon_entry *
+mon_lookup(
+	const sockaddr_u *addr
+	)
+{
+	mon_entry *	mon;
+
+	if (NULL == mon_hash)
+		return NULL;
+
+	for (mon = mon_ptr(mon_hash[MON_HASH(addr)]);
+	     mon != NULL;
+	     mon = mon_ptr(mon->hash_next))
+		if (mon_addr_eq(mon, addr))
+			break;
+
+	return mon;
+}
+
+
+/*
+ * mon_hash_grow - split the next bucket of the linear hash.  The
+ *		   bucket array is doubled when it is full.
+ */
+static void
+mon_hash_grow(void)
+{
+	mon_entry *	mon;
+	mon_idx		idx;
+	mon_idx		next;
+	u_int		lo;
+	u_int		hi;
+	u_int		bucket;
+
+	lo = mon_hash_split;
+	hi = lo + (1U << mon_hash_bits);
+	if (hi >= mon_hash_alloc) {
+		mon_hash = erealloc_zero(mon_hash,
+				2 * mon_hash_alloc * sizeof(*mon_hash),
+				mon_hash_alloc * sizeof(*mon_hash));
+		mon_hash_alloc *= 2;
+	}
+
+	idx = mon_hash[lo];
+	mon_hash[lo] = 0;
+	if (++mon_hash_split == (1U << mon_hash_bits)) {
+		mon_hash_bits++;
+		mon_hash_split = 0;
+	}
+	/* each lands in lo or hi */
+	for (; idx != 0; idx = next) {
+		mon = mon_ptr(idx);
+		next = mon->hash_next;
+		bucket = mon_entry_bucket(mon);
+		mon->hash_next = mon_hash[bucket];
+		mon_hash[bucket] = idx;
+	}
+}
+
+
+/*
+ * mon_sketch_count - count a packet of a source without an entry in
+ *		      the sketch and return the estimate of its count.
+ *		      Only the smallest counters are incremented
+ *		      (conservative update), the others already count
+ *		      other sources as well.
+ */
+static u_int
+mon_sketch_count(
+	u_int32	hash
+	)
+{
+	u_short *	row;
+	u_int		col[MON_SKETCH_ROWS];
+	u_int		mask;
+	u_int		step;
+	u_int		est;
+	u_int		shift;
+	size_t		n;
+	size_t		i;
+
+	n = (size_t)MON_SKETCH_ROWS << mon_sketch_inuse;
+	if (current_time - mon_sketch_aged >=
+	    ((u_long)NTP_SHIFT << ntp_minpoll)) {
+		shift = (current_time - mon_sketch_aged) /
+			((u_long)NTP_SHIFT << ntp_minpoll);
+		shift = min(shift, 16);
+		for (i = 0; i < n; i++)
+			mon_sketch[i] >>= shift;
+		mon_sketch_aged = current_time;
+	}
+
+	/* the rows use the hash with different odd strides */
+	mask = (1U << mon_sketch_inuse) - 1;
+	step = (hash >> 16) | 1;
+	est = USHRT_MAX;
+	for (i = 0; i < MON_SKETCH_ROWS; i++) {
+		col[i] = (hash + (u_int32)i * step) & mask;
+		row = &mon_sketch[i << mon_sketch_inuse];
+		est = min(est, row[col[i]]);
+	}
+	if (est < USHRT_MAX) {
+		for (i = 0; i < MON_SKETCH_ROWS; i++) {
+			row = &mon_sketch[i << mon_sketch_inuse];
+			if (row[col[i]] == est)
+				row[col[i]]++;
+		}
+		est++;
+	}
+
+	return est;
+}
+
+
+/*
+ * mon_key - the address an entry is kept for a host, which is the
+ *	     address itself or its network of mon_prefix4 or
+ *	     mon_prefix6 bits, in which case it is masked into buf
+ */
+static const sockaddr_u *
+mon_key(
+	const sockaddr_u *	addr,
+	sockaddr_u *		buf
+	)
+{
+	u_char *	pb;
+	u_int		plen;
+	u_int		i;
+
+	if (IS_IPV6(addr)) {
+		plen = mon_prefix6;
+		if (plen >= 128)
+			return addr;
+		*buf = *addr;
+		pb = (u_char *)PSOCK_ADDR6(buf);
+		for (i = plen / 8 + 1; i < 16; i++)
+			pb[i] = 0;
+		pb[plen / 8] &= (u_char)(0xff00U >> (plen % 8));
+	} else {
+		plen = mon_prefix4;
+		if (plen >= 32)
+			return addr;
+		*buf = *addr;
+		NSRCADR(buf) &= (plen) ? htonl(~0U << (32 - plen)) : 0;
+	}
+
+	return buf;
+}
+
+
+/*
+ * mon_hash_longest - length of the longest hash chain
+ */
+u_int
+mon_hash_longest(void)
+{
+	mon_entry *	mon;
+	u_int		longest;
+	u_int		len;
+	size_t		i;
+
+	longest = 0;
+	if (NULL == mon_hash)
+		return longest;
+
+	for (i = 0; i < MON_HASH_SIZE; i++) {
+		len = 0;
+		for (mon = mon_ptr(mon_hash[i]);
+		     mon != NULL;
+		     mon = mon_ptr(mon->hash_next))
+			len++;
+		longest = max(longest, len);
+	}
+
+	return longest;
+}
+
+
+/*
+ * mon_mem - octets of the entries on the MRU list
+ */
+size_t
+mon_mem(void)
+{
+	return (mru_entries - mru_entries6) * sizeof(mon_entry4) +
+	       mru_entries6 * sizeof(mon_entry6);
+}
+
+
+/*
+ * mon_mem_alloc - octets allocated for the MRU list: the slabs with
+ *		   their free entries, the slab directories and the hash
+ *		   table.  The sketch has a fixed size and is not counted.
+ */
+size_t
+mon_mem_alloc(void)
+{
+	size_t	octets;
+	int	v6;
+
+	octets = mon_hash_alloc * sizeof(*mon_hash);
+	for (v6 = 0; v6 <= 1; v6++)
+		octets += (size_t)mon_slabs[v6] * MON_SLAB_ENTRIES *
+			      mon_esize[v6] +
+			  mon_slab_cap[v6] * sizeof(*mon_slab[v6]);
+	return octets;
 }
 
 
@@ -139,76 +791,182 @@ init_mon(void)
  */
 static void
 remove_from_hash(
-	mon_entry *mon
+	mon_idx		idx,
+	mon_entry *	mon
 	)
 {
-	u_int hash;
-	mon_entry *punlinked;
+	mon_idx *	pidx;
 
 	mru_entries--;
-	hash = MON_HASH(&mon->rmtadr);
-	UNLINK_SLIST(punlinked, mon_hash[hash], mon, hash_next,
-		     mon_entry);
-	ENSURE(punlinked == mon);
+	if (mon->v6)
+		mru_entries6--;
+	pidx = &mon_hash[mon_entry_bucket(mon)];
+	while (*pidx != idx) {
+		ENSURE(*pidx != 0);
+		pidx = &mon_ptr(*pidx)->hash_next;
+	}
+	*pidx = mon->hash_next;
+}
+
+
+/*
+ * mon_unlink_mru - remove an entry from the MRU list
+ */
+static void
+mon_unlink_mru(
+	mon_entry *	mon
+	)
+{
+	if (mon->mru_newer)
+		mon_ptr(mon->mru_newer)->mru_older = mon->mru_older;
+	else
+		mon_mru_newest = mon->mru_older;
+	if (mon->mru_older)
+		mon_ptr(mon->mru_older)->mru_newer = mon->mru_newer;
+	else
+		mon_mru_oldest = mon->mru_newer;
+	mon->mru_newer = 0;
+	mon->mru_older = 0;
+}
+
+
+/*
+ * mon_link_mru - put an entry at the head of the MRU list
+ */
+static void
+mon_link_mru(
+	mon_idx		idx,
+	mon_entry *	mon
+	)
+{
+	mon->mru_newer = 0;
+	mon->mru_older = mon_mru_newest;
+	if (mon_mru_newest)
+		mon_ptr(mon_mru_newest)->mru_newer = idx;
+	else
+		mon_mru_oldest = idx;
+	mon_mru_newest = idx;
 }
 
 
 static inline void
 mon_free_entry(
-	mon_entry *m
+	mon_idx		idx,
+	mon_entry *	m
 	)
 {
-	ZERO(*m);
-	LINK_SLIST(mon_free, m, hash_next);
+	int	v6;
+
+	v6 = !!(MON_IDX_V6 & idx);
+	memset(m, 0, mon_esize[v6]);
+	m->hash_next = mon_free[v6];
+	mon_free[v6] = idx;
 }
 
 
 /*
  * mon_reclaim_entry - Remove an entry from the MRU list and from the
- *		       hash array, then zero-initialize it.  Indirectly
- *		       decrements mru_entries.
-
- * The entry is prepared to be reused.  Before return, in
- * remove_from_hash(), mru_entries is decremented.  It is the caller's
- * responsibility to increment it again.
+ *		       hash array, then put it on its free list.
+ *		       Indirectly decrements mru_entries.
+ *
+ * Before return, in remove_from_hash(), mru_entries is decremented.
  */
 static inline void
 mon_reclaim_entry(
-	mon_entry *m
+	mon_idx		idx,
+	mon_entry *	m
 	)
 {
 	DEBUG_INSIST(NULL != m);
 
-	UNLINK_DLIST(m, mru);
-	remove_from_hash(m);
-	ZERO(*m);
+	mon_unlink_mru(m);
+	remove_from_hash(idx, m);
+	mon_free_entry(idx, m);
 }
 
 
 /*
- * mon_getmoremem - get more memory and put it on the free list
+ * mon_getmoremem - get more memory and put it on the free list of a
+ *		    family, in whole slabs
  */
 static void
-mon_getmoremem(void)
+mon_getmoremem(
+	int	v6
+	)
 {
-	mon_entry *chunk;
-	u_int entries;
+	u_char **	dir;
+	u_char *	slab;
+	u_int		entries;
+	u_int		slabs;
+	u_int		first;
+	u_int		i;
 
 	entries = (0 == mon_mem_increments)
 		      ? mru_initalloc
 		      : mru_incalloc;
 
 	if (entries) {
-		chunk = eallocarray(entries, sizeof(*chunk));
-		mru_alloc += entries;
-		for (chunk += entries; entries; entries--)
-			mon_free_entry(--chunk);
+		slabs = (entries + MON_SLAB_ENTRIES - 1) >> MON_SLAB_BITS;
+		if (mon_slabs[v6] + slabs > mon_slab_cap[v6]) {
+			mon_slab_cap[v6] = max(2 * mon_slab_cap[v6],
+					       mon_slabs[v6] + slabs);
+			dir = emalloc(mon_slab_cap[v6] * sizeof(*dir));
+			if (mon_slabs[v6] > 0)
+				memcpy(dir, mon_slab[v6],
+				       mon_slabs[v6] * sizeof(*dir));
+#ifdef MON_SNAPSHOT
+			if (mon_slab[v6] != NULL) {
+				INSIST(mon_slab_nold[v6] <
+				       COUNTOF(mon_slab_old[v6]));
+				mon_slab_old[v6][mon_slab_nold[v6]++] =
+				    mon_slab[v6];
+			}
+#else
+			free(mon_slab[v6]);
+#endif
+			mon_slab[v6] = dir;
+		}
+		while (slabs--) {
+			slab = emalloc_zero(MON_SLAB_ENTRIES *
+					    mon_esize[v6]);
+			mon_slab[v6][mon_slabs[v6]] = slab;
+			first = (mon_slabs[v6] << MON_SLAB_BITS) + 1;
+			mon_slabs[v6]++;
+			for (i = MON_SLAB_ENTRIES; i > 0; i--)
+				mon_free_entry(
+				    (first + i - 1) |
+				    ((v6) ? MON_IDX_V6 : 0),
+				    (void *)(slab + (i - 1) *
+					     mon_esize[v6]));
+			mru_alloc += MON_SLAB_ENTRIES;
+		}
 
 		mon_mem_increments++;
 	}
 }
 
 
+/*
+ * mon_take - an entry of a family from its free list, which is filled
+ *	      if it is empty
+ */
+static mon_idx
+mon_take(
+	int	v6
+	)
+{
+	mon_idx	idx;
+
+	if (0 == mon_free[v6])
+		mon_getmoremem(v6);
+	idx = mon_free[v6];
+	INSIST(idx != 0);
+	mon_free[v6] = mon_ptr(idx)->hash_next;
+
+	return idx;
+}
+
+
 /*
  * mon_start - start up the monitoring software
  */
@@ -217,30 +975,44 @@ mon_start(
 	int mode
 	)
 {
-	size_t octets;
-	u_int min_hash_slots;
-
 	if (MON_OFF == mode)		/* MON_OFF is 0 */
 		return;
 	if (mon_enabled) {
 		mon_enabled |= mode;
 		return;
 	}
+	mon_write_begin();
 	if (0 == mon_mem_increments)
-		mon_getmoremem();
+		mon_getmoremem(FALSE);
 	/*
-	 * Select the MRU hash table size to limit the average count
-	 * per bucket at capacity (mru_maxdepth) to 8, if possible
-	 * given our hash is limited to 16 bits.
+	 * Start with a small MRU hash table, ntp_monitor() grows it
+	 * along with the MRU list.  A table left from an earlier run is
+	 * empty and is kept at its size.  With no entries in the table
+	 * this is the time to pick a new seed and epoch.
 	 */
-	min_hash_slots = (mru_maxdepth / 8) + 1;
-	mon_hash_bits = 0;
-	while (min_hash_slots >>= 1)
-		mon_hash_bits++;
-	mon_hash_bits = max(4, mon_hash_bits);
-	mon_hash_bits = min(16, mon_hash_bits);
-	octets = sizeof(*mon_hash) * MON_HASH_SIZE;
-	mon_hash = erealloc_zero(mon_hash, octets, 0);
+	if (NULL == mon_hash) {
+		mon_hash_alloc = 1U << MON_HASH_MINBITS;
+		mon_hash = erealloc_zero(NULL,
+				mon_hash_alloc * sizeof(*mon_hash), 0);
+	}
+	mon_hash_bits = MON_HASH_MINBITS;
+	mon_hash_split = 0;
+	mon_hash_seed[0] = (u_int32)ntp_random() << 16 ^ (u_int32)ntp_random();
+	mon_hash_seed[1] = (u_int32)ntp_random() << 16 ^ (u_int32)ntp_random();
+	get_systime(&mon_epoch);
+	if (mon_sketch_inuse != mon_sketch_bits) {
+		free(mon_sketch);
+		mon_sketch = NULL;
+		mon_sketch_inuse = mon_sketch_bits;
+		if (mon_sketch_inuse)
+			mon_sketch = emalloc_zero(sizeof(*mon_sketch) *
+				(MON_SKETCH_ROWS << mon_sketch_inuse));
+	} else if (mon_sketch != NULL) {
+		zero_mem(mon_sketch, sizeof(*mon_sketch) *
+			 (MON_SKETCH_ROWS << mon_sketch_inuse));
+	}
+	mon_sketch_aged = current_time;
+	mon_write_end();
 
 	mon_enabled = mode;
 }
@@ -254,7 +1026,9 @@ mon_stop(
 	int mode
 	)
 {
-	mon_entry *mon;
+	mon_entry *	mon;
+	mon_idx		idx;
+	mon_idx		next;
 
 	if (MON_OFF == mon_enabled)
 		return;
@@ -270,14 +1044,20 @@ mon_stop(
 	 * without bothering to remove each from either the MRU list or
 	 * the hash table.
 	 */
-	ITER_DLIST_BEGIN(mon_mru_list, mon, mru, mon_entry)
-		mon_free_entry(mon);
-	ITER_DLIST_END()
+	mon_write_begin();
+	for (idx = mon_mru_newest; idx != 0; idx = next) {
+		mon = mon_ptr(idx);
+		next = mon->mru_older;
+		mon_free_entry(idx, mon);
+	}
 
 	/* empty the MRU list and hash table. */
 	mru_entries = 0;
-	INIT_DLIST(mon_mru_list, mru);
+	mru_entries6 = 0;
+	mon_mru_newest = 0;
+	mon_mru_oldest = 0;
 	zero_mem(mon_hash, sizeof(*mon_hash) * MON_HASH_SIZE);
+	mon_write_end();
 }
 
 
@@ -290,19 +1070,20 @@ mon_clearinterface(
 	endpt *lcladr
 	)
 {
-	mon_entry *mon;
+	mon_entry *	mon;
+	mon_idx		idx;
+	mon_idx		next;
 
-	/* iterate mon over mon_mru_list */
-	ITER_DLIST_BEGIN(mon_mru_list, mon, mru, mon_entry)
-		if (mon->lcladr == lcladr) {
-			/* remove from mru list */
-			UNLINK_DLIST(mon, mru);
-			/* remove from hash list, adjust mru_entries */
-			remove_from_hash(mon);
-			/* put on free list */
-			mon_free_entry(mon);
-		}
-	ITER_DLIST_END()
+	/* iterate mon over the MRU list */
+	mon_write_begin();
+	for (idx = mon_mru_newest; idx != 0; idx = next) {
+		mon = mon_ptr(idx);
+		next = mon->mru_older;
+		if (mon->lcl_ifnum == lcladr->ifnum)
+			/* remove from both lists, adjust mru_entries */
+			mon_reclaim_entry(idx, mon);
+	}
+	mon_write_end();
 }
 
 
@@ -327,12 +1108,18 @@ ntp_monitor(
 	u_short	flags
 	)
 {
-	l_fp		interval_fp;
 	struct pkt *	pkt;
+	const sockaddr_u *src;
+	sockaddr_u	srcbuf;
 	mon_entry *	mon;
 	mon_entry *	oldest;
+	mon_idx		idx;
 	int		oldest_age;
+	int		v6;
+	u_int32		now;
+	u_int32		srchash;
 	u_int		hash;
+	u_int		est;
 	u_short		restrict_mask;
 	u_char		mode;
 	u_char		version;
@@ -347,35 +1134,42 @@ ntp_monitor(
 		return ~(RES_LIMITED | RES_KOD) & flags;
 
 	pkt = &rbufp->recv_pkt;
-	hash = MON_HASH(&rbufp->recv_srcadr);
+	src = mon_key(&rbufp->recv_srcadr, &srcbuf);
+	srchash = mon_hash_sock(src);
+	hash = mon_hash_index(srchash);
 	mode = PKT_MODE(pkt->li_vn_mode);
 	version = PKT_VERSION(pkt->li_vn_mode);
-	mon = mon_hash[hash];
+	now = mon_reltime(&rbufp->recv_time);
+	idx = mon_hash[hash];
+	mon = NULL;
 
 	/*
 	 * We keep track of all traffic for a given IP in one entry,
 	 * otherwise cron'ed ntpdate or similar evades RES_LIMITED.
 	 */
 
-	for (; mon != NULL; mon = mon->hash_next)
-		if (SOCK_EQ(&mon->rmtadr, &rbufp->recv_srcadr))
+	mon_hash_lookups++;
+	for (; idx != 0; idx = mon->hash_next) {
+		mon_hash_probes++;
+		mon = mon_ptr(idx);
+		if (mon_addr_eq(mon, src))
 			break;
+	}
 
-	if (mon != NULL) {
-		interval_fp = rbufp->recv_time;
-		L_SUB(&interval_fp, &mon->last);
+	if (idx != 0) {
 		/* add one-half second to round up */
-		L_ADDUF(&interval_fp, 0x80000000);
-		interval = interval_fp.l_i;
-		mon->last = rbufp->recv_time;
-		NSRCPORT(&mon->rmtadr) = NSRCPORT(&rbufp->recv_srcadr);
+		interval = ((int32)(now - mon->last) +
+			    (1 << (MON_TIME_FRAC - 1))) >> MON_TIME_FRAC;
+		mon_write_begin();
+		mon->last = now;
+		mon->port = NSRCPORT(&rbufp->recv_srcadr);
 		mon->count++;
 		restrict_mask = flags;
 		mon->vn_mode = VN_MODE(version, mode);
 
 		/* Shuffle to the head of the MRU list. */
-		UNLINK_DLIST(mon, mru);
-		LINK_DLIST(mon_mru_list, mon, mru);
+		mon_unlink_mru(mon);
+		mon_link_mru(idx, mon);
 
 		/*
 		 * At this point the most recent arrival is first in the
@@ -414,6 +1208,9 @@ ntp_monitor(
 			restrict_mask &= ~RES_KOD;
 
 		mon->flags = restrict_mask;
+		mon_write_end();
+		if (RES_LIMITED & restrict_mask)
+			mon_mru_limited++;
 
 		return mon->flags;
 	}
@@ -450,65 +1247,397 @@ ntp_monitor(
 	 * Whichever of "mru maxmem" or "mru maxdepth" occurs last in
 	 * ntp.conf controls.  Similarly for "mru initalloc" and "mru
 	 * initmem", and for "mru incalloc" and "mru incmem".
+	 *
+	 * With the sketch, a source counting less than
+	 * MON_SKETCH_PROMOTE is answered without an entry.  One which
+	 * counts more than MON_SKETCH_LIMIT but finds the MRU list full
+	 * is limited here, as it would be with an entry.
 	 */
+	est = 0;
+	if (mon_sketch != NULL) {
+		est = mon_sketch_count(srchash);
+		if (est < MON_SKETCH_PROMOTE)
+			return ~(RES_LIMITED | RES_KOD) & flags;
+	}
+	v6 = IS_IPV6(src);
+	mon_write_begin();
 	if (mru_entries < mru_mindepth) {
-		if (NULL == mon_free)
-			mon_getmoremem();
-		UNLINK_HEAD_SLIST(mon, mon_free, hash_next);
+		idx = mon_take(v6);
 	} else {
-		oldest = TAIL_DLIST(mon_mru_list, mru);
+		oldest = mon_ptr(mon_mru_oldest);
 		oldest_age = 0;		/* silence uninit warning */
 		if (oldest != NULL) {
-			interval_fp = rbufp->recv_time;
-			L_SUB(&interval_fp, &oldest->last);
 			/* add one-half second to round up */
-			L_ADDUF(&interval_fp, 0x80000000);
-			oldest_age = interval_fp.l_i;
+			oldest_age = ((int32)(now - oldest->last) +
+				      (1 << (MON_TIME_FRAC - 1)))
+				     >> MON_TIME_FRAC;
 		}
+		/*
+		 * A reclaimed entry goes to the free list of its own
+		 * family, so free entries of one family do not mean
+		 * room below mru_maxdepth.  Allocating by family can
+		 * reach twice mru_maxdepth when the mix shifts over.
+		 */
 		/* note -1 is legal for mru_maxage (disables) */
 		if (oldest != NULL && mru_maxage < oldest_age) {
-			mon_reclaim_entry(oldest);
-			mon = oldest;
-		} else if (mon_free != NULL || mru_alloc <
-			   mru_maxdepth) {
-			if (NULL == mon_free)
-				mon_getmoremem();
-			UNLINK_HEAD_SLIST(mon, mon_free, hash_next);
+			mon_reclaim_entry(mon_mru_oldest, oldest);
+			idx = mon_take(v6);
+		} else if ((mon_free[v6] != 0 &&
+			    mru_entries < mru_maxdepth) ||
+			   mru_alloc < mru_maxdepth) {
+			idx = mon_take(v6);
 		/* Preempt from the MRU list if old enough. */
 		} else if (ntp_random() / (2. * FRAC) >
 			   (double)oldest_age / mon_age) {
+			mon_write_end();
+			if (est > MON_SKETCH_LIMIT &&
+			    (RES_LIMITED & flags)) {
+				mon_sketch_limited++;
+				return ~RES_KOD & flags;
+			}
 			return ~(RES_LIMITED | RES_KOD) & flags;
 		} else {
-			mon_reclaim_entry(oldest);
-			mon = oldest;
+			mon_reclaim_entry(mon_mru_oldest, oldest);
+			idx = mon_take(v6);
 		}
 	}
 
+	mon = mon_ptr(idx);
 	INSIST(mon != NULL);
 
 	/*
 	 * Got one, initialize it
 	 */
 	mru_entries++;
+	if (v6)
+		mru_entries6++;
 	mru_peakentries = max(mru_peakentries, mru_entries);
-	mon->last = rbufp->recv_time;
+	mon->last = now;
 	mon->first = mon->last;
 	mon->count = 1;
 	mon->flags = ~(RES_LIMITED | RES_KOD) & flags;
 	mon->leak = 0;
-	memcpy(&mon->rmtadr, &rbufp->recv_srcadr, sizeof(mon->rmtadr));
+	mon->v6 = (u_short)v6;
+	if (v6)
+		((mon_entry6 *)mon)->addr = SOCK_ADDR6(src);
+	else
+		((mon_entry4 *)mon)->addr.s_addr = NSRCADR(src);
+	mon->port = NSRCPORT(&rbufp->recv_srcadr);
 	mon->vn_mode = VN_MODE(version, mode);
-	mon->lcladr = rbufp->dstadr;
+	mon->lcl_ifnum = rbufp->dstadr->ifnum;
 	mon->cast_flags = (u_char)(((rbufp->dstadr->flags &
-	    INT_MCASTOPEN) && rbufp->fd == mon->lcladr->fd) ? MDF_MCAST
-	    : rbufp->fd == mon->lcladr->bfd ? MDF_BCAST : MDF_UCAST);
+	    INT_MCASTOPEN) && rbufp->fd == rbufp->dstadr->fd) ? MDF_MCAST
+	    : rbufp->fd == rbufp->dstadr->bfd ? MDF_BCAST : MDF_UCAST);
 
 	/*
 	 * Drop him into front of the hash table. Also put him on top of
 	 * the MRU list.
 	 */
-	LINK_SLIST(mon_hash[hash], mon, hash_next);
-	LINK_DLIST(mon_mru_list, mon, mru);
+	mon->hash_next = mon_hash[hash];
+	mon_hash[hash] = idx;
+	mon_link_mru(idx, mon);
+
+	if (   mru_entries > MON_HASH_LOAD * MON_HASH_SIZE
+	    && mon_hash_bits < MON_HASH_MAXBITS)
+		mon_hash_grow();
+	mon_write_end();
 
 	return mon->flags;
 }
+
+
+#ifdef MON_SNAPSHOT
+/*
+ * mon_read_begin - sequence number to read entries with, waiting a
+ *		    clock tick at a time while ntpd changes them
+ */
+static inline u_int
+mon_read_begin(void)
+{
+	u_int	seq;
+
+	for (;;) {
+		seq = atomic_load_explicit(&mon_seq, memory_order_acquire);
+		if (!(seq & 1))
+			return seq;
+		rtems_task_wake_after(1);
+	}
+}
+
+
+/*
+ * mon_read_end - TRUE if nothing changed since mon_read_begin()
+ */
+static inline int
+mon_read_end(
+	u_int	seq
+	)
+{
+	atomic_thread_fence(memory_order_acquire);
+	return seq == atomic_load_explicit(&mon_seq, memory_order_relaxed);
+}
+
+
+/*
+ * mon_walk - call a function with a copy of each MRU entry from
+ *	      another task, until it returns nonzero.
+ *
+ * The slabs are walked rather than the MRU list, which changes order
+ * with nearly every packet.  Each entry is copied on its own under the
+ * seqlock, so ntpd is never held up for longer than a copy takes.
+ */
+static int
+mon_walk(
+	int	(*visit)(const mon_entry *, const l_fp *, void *),
+	void *	arg
+	)
+{
+	union {
+		mon_entry	e;
+		mon_entry4	e4;
+		mon_entry6	e6;
+	}		copy;
+	u_char **	dir;
+	u_char *	slab;
+	l_fp		epoch;
+	u_int		slabs;
+	u_int		seq;
+	u_int		s;
+	u_int		i;
+	int		v6;
+	int		rc;
+
+	for (v6 = 0; v6 < 2; v6++) {
+		for (s = 0; ; s++) {
+			/*
+			 * A directory holds at least as many slabs as
+			 * were counted with it, and is not freed.
+			 */
+			do {
+				seq = mon_read_begin();
+				slabs = mon_slabs[v6];
+				dir = mon_slab[v6];
+			} while (!mon_read_end(seq));
+			if (s >= slabs)
+				break;
+			slab = dir[s];
+
+			for (i = 0; i < MON_SLAB_ENTRIES; i++) {
+				do {
+					seq = mon_read_begin();
+					memcpy(&copy, slab + i * mon_esize[v6],
+					       mon_esize[v6]);
+					epoch = mon_epoch;
+				} while (!mon_read_end(seq));
+
+				/* free entries are zeroed */
+				if (copy.e.count <= 0)
+					continue;
+				rc = (*visit)(&copy.e, &epoch, arg);
+				if (rc)
+					return rc;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+typedef struct mon_snapshot_tag {
+	rtems_ntpd_mru_entry *	entries;
+	size_t			max;
+	size_t			n;
+} mon_snapshot;
+
+static int
+mon_snapshot_visit(
+	const mon_entry *	mon,
+	const l_fp *		epoch,
+	void *			arg
+	)
+{
+	mon_snapshot *		ss;
+	rtems_ntpd_mru_entry *	out;
+	sockaddr_u		addr;
+	l_fp			ts;
+
+	ss = arg;
+	if (ss->n >= ss->max)
+		return 1;
+
+	out = &ss->entries[ss->n++];
+	memset(out, 0, sizeof(*out));
+	mon_getaddr(mon, &addr);
+	memcpy(&out->addr, &addr, min(sizeof(out->addr), sizeof(addr)));
+	mon_ts_at(mon->first, epoch, &ts);
+	out->first = lfp_stamp_to_tspec(ts, NULL);
+	mon_ts_at(mon->last, epoch, &ts);
+	out->last = lfp_stamp_to_tspec(ts, NULL);
+	out->count = (uint32_t)mon->count;
+	out->restrict_flags = mon->flags;
+	out->mode = PKT_MODE(mon->vn_mode);
+	out->version = PKT_VERSION(mon->vn_mode);
+
+	return 0;
+}
+
+
+size_t
+rtems_ntpd_mru_snapshot(
+	rtems_ntpd_mru_entry *	entries,
+	size_t			max
+	)
+{
+	mon_snapshot	ss;
+
+	ss.entries = entries;
+	ss.max = max;
+	ss.n = 0;
+	mon_walk(mon_snapshot_visit, &ss);
+
+	return ss.n;
+}
+
+
+/*
+ * Binary export, see rtems_ntpd_mru_record.  Records are collected in
+ * a buffer and written MON_EXPORT_BATCH at a time.
+ */
+#define	MON_EXPORT_BATCH	64
+
+typedef struct mon_export_tag {
+	int			fd;
+	l_fp			ref;	/* reference time of the ages */
+	size_t			n;	/* records in rec[] */
+	size_t			total;
+	rtems_ntpd_mru_record	rec[MON_EXPORT_BATCH];
+} mon_export;
+
+static int
+mon_export_write(
+	int		fd,
+	const void *	buf,
+	size_t		len
+	)
+{
+	const char *	p;
+	ssize_t		rc;
+
+	for (p = buf; len > 0; p += rc, len -= (size_t)rc) {
+		rc = write(fd, p, len);
+		if (rc < 0 && EINTR == errno)
+			rc = 0;
+		else if (rc <= 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * mon_export_age - 24.8 fixed point seconds of a time before the
+ *		    reference time, 0 for later times
+ */
+static uint32_t
+mon_export_age(
+	const l_fp *	ref,
+	u_int32		reltime,
+	const l_fp *	epoch
+	)
+{
+	l_fp	age;
+	l_fp	ts;
+
+	mon_ts_at(reltime, epoch, &ts);
+	age = *ref;
+	L_SUB(&age, &ts);
+	if (L_ISNEG(&age))
+		return 0;
+	if (age.l_ui >= (1U << (32 - MON_TIME_FRAC)))
+		return UINT32_MAX;
+
+	return age.l_ui << MON_TIME_FRAC | age.l_uf >> (32 - MON_TIME_FRAC);
+}
+
+static int
+mon_export_visit(
+	const mon_entry *	mon,
+	const l_fp *		epoch,
+	void *			arg
+	)
+{
+	mon_export *		ex;
+	rtems_ntpd_mru_record *	rec;
+
+	ex = arg;
+	rec = &ex->rec[ex->n++];
+	memset(rec, 0, sizeof(*rec));
+	if (mon->v6) {
+		rec->family = 6;
+		memcpy(rec->addr, &((const mon_entry6 *)mon)->addr,
+		       sizeof(rec->addr));
+	} else {
+		/* IPv4-mapped */
+		rec->family = 4;
+		rec->addr[10] = 0xff;
+		rec->addr[11] = 0xff;
+		memcpy(&rec->addr[12], &((const mon_entry4 *)mon)->addr,
+		       4);
+	}
+	rec->port = mon->port;
+	rec->vn_mode = mon->vn_mode;
+	rec->restrict_flags = htons(mon->flags);
+	rec->count = htonl((uint32_t)mon->count);
+	rec->first_age = htonl(mon_export_age(&ex->ref, mon->first, epoch));
+	rec->last_age = htonl(mon_export_age(&ex->ref, mon->last, epoch));
+
+	if (ex->n < COUNTOF(ex->rec))
+		return 0;
+	ex->total += ex->n;
+	ex->n = 0;
+	return mon_export_write(ex->fd, ex->rec, sizeof(ex->rec));
+}
+
+
+ssize_t
+rtems_ntpd_mru_export(
+	int	fd
+	)
+{
+	rtems_ntpd_mru_header	hdr;
+	mon_export *		ex;
+	struct timespec		now;
+	ssize_t			total;
+	int			rc;
+
+	ex = malloc(sizeof(*ex));
+	if (NULL == ex)
+		return -1;
+	ex->fd = fd;
+	ex->n = 0;
+	ex->total = 0;
+	clock_gettime(CLOCK_REALTIME, &now);
+	ex->ref = tspec_stamp_to_lfp(now);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, RTEMS_NTPD_MRU_MAGIC, sizeof(hdr.magic));
+	hdr.version = htons(RTEMS_NTPD_MRU_VERSION);
+	hdr.record_size = htons(sizeof(rtems_ntpd_mru_record));
+	hdr.ref_seconds = htonl(ex->ref.l_ui);
+	hdr.ref_fraction = htonl(ex->ref.l_uf);
+
+	rc = mon_export_write(fd, &hdr, sizeof(hdr));
+	if (0 == rc)
+		rc = mon_walk(mon_export_visit, ex);
+	if (0 == rc && ex->n > 0) {
+		ex->total += ex->n;
+		rc = mon_export_write(fd, ex->rec,
+				      ex->n * sizeof(ex->rec[0]));
+	}
+	total = (0 == rc) ? (ssize_t)ex->total : -1;
+	free(ex);
+
+	return total;
+}
+#endif /* MON_SNAPSHOT */
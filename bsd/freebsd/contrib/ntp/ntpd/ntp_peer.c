@@ -8,6 +8,7 @@
 #endif
 
 #include <stdio.h>
+#include <ctype.h>
 #include <sys/types.h>
 
 #include "ntpd.h"
@@ -68,8 +69,17 @@ int AM[AM_MODES][AM_MODES] = {
  *
  * - peer_list is a single list with all peers, suitable for scanning
  *   operations over all peers.
- * - peer_adr_hash is an array of lists indexed by hashed peer address.
- * - peer_aid_hash is an array of lists indexed by hashed associd.
+ * - peer_hash is an array of lists indexed by hashed peer address.
+ * - assoc_hash is an array of lists indexed by hashed associd.
+ * - name_hash is an array of lists indexed by hashed hostname, holding
+ *   the peers which have one.
+ *
+ * The hash tables share peer_hash_size buckets.  They start out with
+ * NTP_HASH_SIZE buckets and are doubled by peer_hash_resize() whenever
+ * the associations outnumber PEER_HASH_LOAD per bucket, so the chains
+ * stay short with hundreds of pool and ephemeral associations.  The
+ * manycastclient and pool associations are also kept on solicit_list
+ * so responses to their solicitations need not scan peer_list.
  *
  * They also maintain a free list of peer structures, peer_free.
  *
@@ -81,11 +91,19 @@ int AM[AM_MODES][AM_MODES] = {
 /*
  * Peer hash tables
  */
-struct peer *peer_hash[NTP_HASH_SIZE];	/* peer hash table */
-int	peer_hash_count[NTP_HASH_SIZE];	/* peers in each bucket */
-struct peer *assoc_hash[NTP_HASH_SIZE];	/* association ID hash table */
-int	assoc_hash_count[NTP_HASH_SIZE];/* peers in each bucket */
+#define	PEER_HASH_LOAD		2	/* peers per bucket before growing */
+#define	PEER_HASH_MAX		65536	/* sock_hash() yields 16 bits */
+#define	PEER_HASH_ADDR(src)	(sock_hash(src) & (peer_hash_size - 1))
+#define	PEER_HASH_AID(aid)	((aid) & (peer_hash_size - 1))
+
+struct peer **peer_hash;		/* peer hash table */
+int	*peer_hash_count;		/* peers in each bucket */
+struct peer **assoc_hash;		/* association ID hash table */
+int	*assoc_hash_count;		/* peers in each bucket */
+static struct peer **name_hash;		/* hostname hash table */
+u_int	peer_hash_size;			/* buckets in each table */
 struct peer *peer_list;			/* peer structures list */
+static struct peer *solicit_list;	/* manycastclient and pool peers */
 static struct peer *peer_free;		/* peer structures free list */
 int	peer_free_count;		/* count of free structures */
 
@@ -97,10 +115,21 @@ static associd_t current_association_ID; /* association ID */
 static associd_t initial_association_ID; /* association ID */
 
 /*
- * Memory allocation watermarks.
+ * Memory allocation watermarks.  The peer structures come in blocks
+ * which double in size up to MAX_PEER_ALLOC, so the peers share few
+ * contiguous runs of memory.  The blocks are aligned to PEER_ALIGN and
+ * each structure is padded to a multiple of it, so the hot section at
+ * the start of a peer begins a cache line.
  */
-#define	INIT_PEER_ALLOC		8	/* static preallocation */
-#define	INC_PEER_ALLOC		4	/* add N more when empty */
+#define	INIT_PEER_ALLOC		8	/* first block */
+#define	MAX_PEER_ALLOC		256	/* largest block */
+#define	PEER_ALIGN		64	/* cache line size */
+
+typedef union peer_slot_tag {
+	struct peer	p;
+	u_char		pad[(sizeof(struct peer) + PEER_ALIGN - 1) &
+			    ~(size_t)(PEER_ALIGN - 1)];
+} peer_slot;
 
 /*
  * Miscellaneous statistic counters which may be queried.
@@ -113,7 +142,10 @@ u_long	peer_demobilizations;		/* structs freed to free list */
 int	total_peer_structs;		/* peer structs */
 int	peer_associations;		/* mobilized associations */
 int	peer_preempt;			/* preemptable associations */
-static struct peer init_peer_alloc[INIT_PEER_ALLOC]; /* init alloc */
+#ifdef __rtems__
+int	peer_keyed;			/* associations with a key */
+#endif /* __rtems__ */
+static void *	peer_blocks;		/* list of allocated blocks */
 
 static struct peer *	findexistingpeer_name(const char *, u_short,
 					      struct peer *, int);
@@ -123,17 +155,38 @@ static struct peer *	findexistingpeer_addr(sockaddr_u *,
 static void		free_peer(struct peer *, int);
 static void		getmorepeermem(void);
 static int		score(struct peer *);
+static u_int		peer_name_hash(const char *);
+static void		peer_hash_link(struct peer *);
+static void		peer_hash_resize(u_int);
 
 
 #ifdef __rtems__
 #define RTEMS_NTP_CLEAR(_var) memset(&_var, 0, sizeof(_var))
 void rtems_ntp_peer_globals_fini(void);
 void rtems_ntp_peer_globals_fini(void) {
-	/* we cannot clean up the peers list because eallocarray keeps
-	 * no base to free; move to free */
+	void *block;
+
 	while (peer_list != NULL) {
 		unpeer(peer_list);
 	}
+	while (peer_blocks != NULL) {
+		block = peer_blocks;
+		peer_blocks = *(void **)block;
+		free(block);
+	}
+	peer_free = NULL;
+	peer_free_count = 0;
+	free(peer_hash);
+	free(peer_hash_count);
+	free(assoc_hash);
+	free(assoc_hash_count);
+	free(name_hash);
+	peer_hash = NULL;
+	peer_hash_count = NULL;
+	assoc_hash = NULL;
+	assoc_hash_count = NULL;
+	name_hash = NULL;
+	peer_hash_size = 0;
 	current_association_ID = 0;
 	initial_association_ID = 0;
 	peer_timereset = 0;
@@ -142,9 +195,9 @@ void rtems_ntp_peer_globals_fini(void) {
 	peer_allocations = 0;
 	peer_demobilizations = 0;
 	total_peer_structs = 0;
-	total_peer_structs = 0;
 	peer_associations = 0;
 	peer_preempt = 0;
+	peer_keyed = 0;
 }
 #endif /* __rtems__ */
 /*
@@ -156,15 +209,17 @@ void rtems_ntp_peer_globals_fini(void) {
 void
 init_peer(void)
 {
-	int i;
+	/*
+	 * Initialize peer free list with the first block.
+	 */
+	if (0 == total_peer_structs)
+		getmorepeermem();
 
 	/*
-	 * Initialize peer free list from static allocation.
+	 * Initialize the hash tables
 	 */
-	for (i = COUNTOF(init_peer_alloc) - 1; i >= 0; i--)
-		LINK_SLIST(peer_free, &init_peer_alloc[i], p_link);
-	total_peer_structs = COUNTOF(init_peer_alloc);
-	peer_free_count = COUNTOF(init_peer_alloc);
+	if (NULL == peer_hash)
+		peer_hash_resize(NTP_HASH_SIZE);
 
 	/*
 	 * Initialize our first association ID
@@ -183,15 +238,143 @@ static void
 getmorepeermem(void)
 {
 	int i;
-	struct peer *peers;
+	int n;
+	void *block;
+	peer_slot *peers;
+
+	n = max(INIT_PEER_ALLOC, min(total_peer_structs, MAX_PEER_ALLOC));
+
+	/*
+	 * The block starts with the link to the previous one, followed
+	 * by the aligned structures.
+	 */
+	block = emalloc_zero(sizeof(void *) + PEER_ALIGN +
+			     n * sizeof(*peers));
+	*(void **)block = peer_blocks;
+	peer_blocks = block;
+	peers = (peer_slot *)(((uintptr_t)block + sizeof(void *) +
+			       PEER_ALIGN - 1) &
+			      ~(uintptr_t)(PEER_ALIGN - 1));
+
+	for (i = n - 1; i >= 0; i--)
+		LINK_SLIST(peer_free, &peers[i].p, p_link);
+
+	total_peer_structs += n;
+	peer_free_count += n;
+}
+
+
+/*
+ * peer_name_hash - hash a hostname, ignoring case as the lookups do
+ */
+static u_int
+peer_name_hash(
+	const char *	hostname
+	)
+{
+	u_int32	hash;
+
+	hash = 2166136261U;		/* FNV-1a */
+	while (*hostname != '\0') {
+		hash ^= (u_char)tolower((u_char)*hostname++);
+		hash *= 16777619U;
+	}
+	return (hash ^ (hash >> 16)) & (peer_hash_size - 1);
+}
 
-	peers = eallocarray(INC_PEER_ALLOC, sizeof(*peers));
 
-	for (i = INC_PEER_ALLOC - 1; i >= 0; i--)
-		LINK_SLIST(peer_free, &peers[i], p_link);
+/*
+ * peer_hash_link - put a peer in the hash tables
+ */
+static void
+peer_hash_link(
+	struct peer *	p
+	)
+{
+	u_int	hash;
 
-	total_peer_structs += INC_PEER_ALLOC;
-	peer_free_count += INC_PEER_ALLOC;
+	hash = PEER_HASH_ADDR(&p->srcadr);
+	LINK_SLIST(peer_hash[hash], p, adr_link);
+	peer_hash_count[hash]++;
+	hash = PEER_HASH_AID(p->associd);
+	LINK_SLIST(assoc_hash[hash], p, aid_link);
+	assoc_hash_count[hash]++;
+	if (p->hostname != NULL) {
+		hash = peer_name_hash(p->hostname);
+		LINK_SLIST(name_hash[hash], p, name_link);
+	}
+}
+
+
+/*
+ * peer_hash_resize - reallocate the hash tables with size buckets and
+ *		      rehash all peers into them
+ */
+static void
+peer_hash_resize(
+	u_int	size
+	)
+{
+	struct peer *p;
+
+	DEBUG_REQUIRE(size > 0 && !(size & (size - 1)));
+
+	free(peer_hash);
+	free(peer_hash_count);
+	free(assoc_hash);
+	free(assoc_hash_count);
+	free(name_hash);
+	peer_hash = emalloc_zero(size * sizeof(*peer_hash));
+	peer_hash_count = emalloc_zero(size * sizeof(*peer_hash_count));
+	assoc_hash = emalloc_zero(size * sizeof(*assoc_hash));
+	assoc_hash_count = emalloc_zero(size * sizeof(*assoc_hash_count));
+	name_hash = emalloc_zero(size * sizeof(*name_hash));
+	peer_hash_size = size;
+
+	for (p = peer_list; p != NULL; p = p->p_link)
+		peer_hash_link(p);
+
+	DPRINTF(1, ("peer_hash_resize: %u buckets for %d peers\n",
+		    size, peer_associations));
+}
+
+
+/*
+ * peer_hash_longest - return the longest chain in the address (0),
+ *		       association ID (1) or hostname (2) hash table
+ */
+u_int
+peer_hash_longest(
+	int	which
+	)
+{
+	struct peer *p;
+	u_int	longest;
+	u_int	len;
+	u_int	i;
+
+	longest = 0;
+	for (i = 0; i < peer_hash_size; i++) {
+		switch (which) {
+
+		case 0:
+			len = peer_hash_count[i];
+			break;
+
+		case 1:
+			len = assoc_hash_count[i];
+			break;
+
+		default:
+			len = 0;
+			for (p = name_hash[i]; p != NULL; p = p->name_link)
+				len++;
+			break;
+		}
+		if (len > longest)
+			longest = len;
+	}
+	return longest;
 }
 
 
@@ -206,12 +389,11 @@ findexistingpeer_name(
 	struct peer *p;
 
 	if (NULL == start_peer)
-		p = peer_list;
+		p = name_hash[peer_name_hash(hostname)];
 	else
-		p = start_peer->p_link;
-	for (; p != NULL; p = p->p_link)
-		if (p->hostname != NULL
-		    && (-1 == mode || p->hmode == mode)
+		p = start_peer->name_link;
+	for (; p != NULL; p = p->name_link)
+		if ((-1 == mode || p->hmode == mode)
 		    && (AF_UNSPEC == hname_fam
 			|| AF_UNSPEC == AF(&p->srcadr)
 			|| hname_fam == AF(&p->srcadr))
@@ -251,7 +433,7 @@ findexistingpeer_addr(
 	 * MDF_BCLNT with the same srcadr (remote, unicast address).
 	 */
 	if (NULL == start_peer)
-		peer = peer_hash[NTP_HASH_ADDR(addr)];
+		peer = peer_hash[PEER_HASH_ADDR(addr)];
 	else
 		peer = start_peer->adr_link;
 	
@@ -336,7 +518,7 @@ findpeer(
 
 	findpeer_calls++;
 	srcadr = &rbufp->recv_srcadr;
-	hash = NTP_HASH_ADDR(srcadr);
+	hash = PEER_HASH_ADDR(srcadr);
 	for (p = peer_hash[hash]; p != NULL; p = p->adr_link) {
 
 		/* [Bug 3072] ensure interface of peer matches */
@@ -398,7 +580,7 @@ findpeerbyassoc(
 	u_int hash;
 
 	assocpeer_calls++;
-	hash = assoc & NTP_HASH_MASK;
+	hash = PEER_HASH_AID(assoc);
 	for (p = assoc_hash[hash]; p != NULL; p = p->aid_link)
 		if (assoc == p->associd)
 			break;
@@ -506,8 +688,12 @@ free_peer(
 	struct peer *	unlinked;
 	int		hash;
 
+	timer_event_cancel(&p->poll_event);
+#ifdef __rtems__
+	timer_fast_unpeer(p);
+#endif /* __rtems__ */
 	if (unlink_peer) {
-		hash = NTP_HASH_ADDR(&p->srcadr);
+		hash = PEER_HASH_ADDR(&p->srcadr);
 		peer_hash_count[hash]--;
 
 		UNLINK_SLIST(unlinked, peer_hash[hash], p, adr_link,
@@ -521,7 +707,7 @@ free_peer(
 		/*
 		 * Remove him from the association hash as well.
 		 */
-		hash = p->associd & NTP_HASH_MASK;
+		hash = PEER_HASH_AID(p->associd);
 		assoc_hash_count[hash]--;
 
 		UNLINK_SLIST(unlinked, assoc_hash[hash], p, aid_link,
@@ -533,6 +719,20 @@ free_peer(
 				stoa(&p->srcadr));
 		}
 
+		/* And from the hostname hash and solicit list. */
+		if (p->hostname != NULL) {
+			hash = peer_name_hash(p->hostname);
+			UNLINK_SLIST(unlinked, name_hash[hash], p,
+				     name_link, struct peer);
+			if (NULL == unlinked)
+				msyslog(LOG_ERR,
+					"peer %s not in hostname table!",
+					stoa(&p->srcadr));
+		}
+		if (MDF_SOLICIT_MASK & p->cast_flags)
+			UNLINK_SLIST(unlinked, solicit_list, p,
+				     sol_link, struct peer);
+
 		/* Remove him from the overall list. */
 		UNLINK_SLIST(unlinked, peer_list, p, p_link,
 			     struct peer);
@@ -572,6 +772,10 @@ unpeer(
 	peer_associations--;
 	if (FLAG_PREEMPT & peer->flags)
 		peer_preempt--;
+#ifdef __rtems__
+	if (peer->keyid != 0)
+		peer_keyed--;
+#endif /* __rtems__ */
 #ifdef REFCLOCK
 	/*
 	 * If this peer is actually a clock, shut it down first
@@ -798,7 +1002,6 @@ newpeer(
 	)
 {
 	struct peer *	peer;
-	u_int		hash;
 	int		ip_count = 0;
 
 
@@ -1018,15 +1221,21 @@ DPRINTF(1, ("newpeer(%s) found no existing and %d other associations\n",
 	}
 
 	/*
-	 * Put the new peer in the hash tables.
+	 * Put the new peer in the hash tables, growing them first if
+	 * the chains would get too long.
 	 */
-	hash = NTP_HASH_ADDR(&peer->srcadr);
-	LINK_SLIST(peer_hash[hash], peer, adr_link);
-	peer_hash_count[hash]++;
-	hash = peer->associd & NTP_HASH_MASK;
-	LINK_SLIST(assoc_hash[hash], peer, aid_link);
-	assoc_hash_count[hash]++;
+	if (peer_associations > PEER_HASH_LOAD * (int)peer_hash_size
+	    && peer_hash_size < PEER_HASH_MAX)
+		peer_hash_resize(2 * peer_hash_size);
+	peer_hash_link(peer);
 	LINK_SLIST(peer_list, peer, p_link);
+	if (MDF_SOLICIT_MASK & peer->cast_flags)
+		LINK_SLIST(solicit_list, peer, sol_link);
+#ifdef __rtems__
+	timer_fast_peer(peer);
+	if (peer->keyid != 0)
+		peer_keyed++;
+#endif /* __rtems__ */
 
 	restrict_source(&peer->srcadr, 0, 0);
 	mprintf_event(PEVNT_MOBIL, peer, "assoc %d", peer->associd);
@@ -1112,12 +1321,10 @@ findmanycastpeer(
 	 * timestamps are unique for such.
 	 */
 	pkt = &rbufp->recv_pkt;
-	for (peer = peer_list; peer != NULL; peer = peer->p_link)
-		if (MDF_SOLICIT_MASK & peer->cast_flags) {
-			NTOHL_FP(&pkt->org, &p_org);
-			if (L_ISEQU(&p_org, &peer->aorg))
-				break;
-		}
+	NTOHL_FP(&pkt->org, &p_org);
+	for (peer = solicit_list; peer != NULL; peer = peer->sol_link)
+		if (L_ISEQU(&p_org, &peer->aorg))
+			break;
 
 	return peer;
 }
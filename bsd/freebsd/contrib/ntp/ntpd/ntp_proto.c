@@ -89,6 +89,7 @@ typedef struct peer_select_tag {
 	double		synch;	/* sync distance */
 	double		error;	/* jitter */
 	double		seljit;	/* selection jitter */
+	int		ends;	/* endpoints kept from the last pass */
 } peer_select;
 
 /*
@@ -172,6 +173,27 @@ u_long	sys_badauth;		/* bad authentication */
 u_long	sys_declined;		/* declined */
 u_long	sys_limitrejected;	/* rate exceeded */
 u_long	sys_kodsent;		/* KoD sent */
+u_long	sys_fastpath_pkts;	/* answered by receive_fast() */
+u_long	sys_inplace_pkts;	/* replies built in the receive buffer */
+xmt_template sys_xmt_template;	/* server reply header */
+
+/*
+ * Plain client requests are answered by receive_fast() instead of the
+ * full receive() if this is set.
+ */
+int	sys_fastpath = FALSE;
+
+/*
+ * Server replies are written over the request in its receive buffer
+ * and sent from there unless this is cleared.
+ */
+int	sys_inplace = TRUE;
+
+/*
+ * clock_select() starts from the endpoint order of its last pass and
+ * computes the select jitter in linear time when this is set.
+ */
+int	sys_incselect = FALSE;
 
 /*
  * Mechanism knobs: how soon do we peer_clear() or unpeer()?
@@ -192,9 +214,11 @@ int dynamic_interleave = DYNAMIC_INTERLEAVE;	/* Bug 2978 mitigation */
 int kiss_code_check(u_char hisleap, u_char hisstratum, u_char hismode, u_int32 refid);
 nak_code	valid_NAK	(struct peer *peer, struct recvbuf *rbufp, u_char hismode);
 static	double	root_distance	(struct peer *);
+static	int	endpoint_cmp	(const void *, const void *);
 static	void	clock_combine	(peer_select *, int, int);
 static	void	peer_xmit	(struct peer *);
 static	void	fast_xmit	(struct recvbuf *, int, keyid_t, int);
+static	int	receive_fast	(struct recvbuf *);
 static	void	pool_xmit	(struct peer *);
 static	void	clock_update	(struct peer *);
 static	void	measure_precision(void);
@@ -216,11 +240,10 @@ const char *	amtoa		(int am);
 #ifdef __rtems__
 #define RTEMS_NTP_CLEAR(_var) memset(&_var, 0, sizeof(_var))
 static struct endpoint *endpoint = NULL;
-static int *indx = NULL;
+static int *reach = NULL;
 static peer_select *peers = NULL;
-static u_int endpoint_size = 0;
-static u_int peers_size = 0;
-static u_int indx_size = 0;
+static int select_size = 0;
+static int select_last = 0;
 void rtems_ntp_proto_globals_fini(void);
 void rtems_ntp_proto_globals_fini(void) {
 	sys_leap = 0;
@@ -232,6 +255,7 @@ void rtems_ntp_proto_globals_fini(void) {
 	sys_rootdisp = 0.0;
 	sys_refid = 0;
 	RTEMS_NTP_CLEAR(sys_reftime);
+	RTEMS_NTP_CLEAR(sys_xmt_template);
 	sys_peer = NULL;
 	sys_bclient = 0;
 	sys_bdelay = 0.0;
@@ -274,6 +298,8 @@ void rtems_ntp_proto_globals_fini(void) {
 	sys_declined = 0U;
 	sys_limitrejected = 0U;
 	sys_kodsent = 0U;
+	sys_fastpath_pkts = 0U;
+	sys_inplace_pkts = 0U;
 	peer_clear_digest_early	= 1;
 	unpeer_crypto_early = 1;
 	unpeer_crypto_nak_early	= 1;
@@ -281,10 +307,28 @@ void rtems_ntp_proto_globals_fini(void) {
 	dynamic_interleave = DYNAMIC_INTERLEAVE;
 	free(endpoint);
 	endpoint = NULL;
-	indx = NULL;
-	endpoint_size = 0;
-	peers_size = 0;
-	indx_size = 0;
+	peers = NULL;
+	reach = NULL;
+	select_size = 0;
+	select_last = 0;
+}
+
+void
+rtems_ntpd_set_fast_path(int enable)
+{
+	sys_fastpath = (enable != 0);
+}
+
+void
+rtems_ntpd_set_incremental_select(int enable)
+{
+	sys_incselect = (enable != 0);
+}
+
+void
+rtems_ntpd_set_inplace_reply(int enable)
+{
+	sys_inplace = (enable != 0);
 }
 #endif /* __rtems__ */
 void
@@ -316,6 +360,26 @@ set_sys_leap(
 		}
 #endif	/* LEAP_SMEAR */
 	}
+	update_xmt_template();
+}
+
+
+/*
+ * update_xmt_template - convert the system variables for server
+ * replies once, so fast_xmit() only has to copy them.  Call after
+ * any change of xmt_leap, sys_stratum, sys_precision, sys_rootdelay,
+ * sys_rootdisp, sys_refid or sys_reftime.
+ */
+void
+update_xmt_template(void)
+{
+	sys_xmt_template.leap = xmt_leap;
+	sys_xmt_template.stratum = STRATUM_TO_PKT(sys_stratum);
+	sys_xmt_template.precision = sys_precision;
+	sys_xmt_template.rootdelay = HTONS_FP(DTOFP(sys_rootdelay));
+	sys_xmt_template.rootdisp = HTONS_FP(DTOUFP(sys_rootdisp));
+	sys_xmt_template.refid = sys_refid;
+	HTONL_FP(&sys_reftime, &sys_xmt_template.reftime);
 }
 
 
@@ -633,6 +697,30 @@ transmit(
 }
 
 
+#ifdef __rtems__
+/*
+ * transmit_fast - send a sub-second poll
+ *
+ * The reachability, timeout and burst accounting of transmit() stays
+ * with the regular polls at the poll interval, which keep going. Nor
+ * is the poll charged to the rate throttle, which is sized for them.
+ */
+void
+transmit_fast(
+	struct peer *peer	/* peer structure pointer */
+	)
+{
+	int	throttle;
+
+	if (peer->hmode == MODE_BCLIENT)
+		return;
+	throttle = timer_throttle(peer);
+	peer_xmit(peer);
+	peer->throttle = throttle;
+}
+#endif /* __rtems__ */
+
+
 const char *
 amtoa(
 	int am
@@ -658,6 +746,105 @@ amtoa(
 }
 
 
+/*
+ * receive_fast - answer an unauthenticated client (mode 3) request
+ *		  without the full receive() machinery.
+ *
+ * Only requests from an address without any association are taken.
+ * For those findpeer() finds nothing, and without a MAC the
+ * authentication layers, including the keyed association check of
+ * Bug 3454, have nothing to contribute.  What remains is done here in
+ * the order receive() does it: the restrictions, the version check,
+ * the MRU list and rate limiting, then fast_xmit().  The same counters
+ * are bumped.  Returns FALSE without side effects for anything else,
+ * which then takes the full path.
+ */
+static int
+receive_fast(
+	struct recvbuf *rbufp
+	)
+{
+	struct pkt *	pkt;
+	r4addr		r4a;
+	u_short		restrict_mask;
+	u_char		hisversion;
+	l_fp		p_org;
+	l_fp		p_rec;
+	l_fp		p_xmt;
+	int		ip_count;
+
+	pkt = &rbufp->recv_pkt;
+	hisversion = PKT_VERSION(pkt->li_vn_mode);
+	if (   LEN_PKT_NOMAC != rbufp->recv_length
+	    || MODE_CLIENT != PKT_MODE(pkt->li_vn_mode)
+	    || hisversion > NTP_VERSION
+	    || hisversion < NTP_OLDVERSION
+	    || 0 == SRCPORT(&rbufp->recv_srcadr)
+	    || (INT_MCASTOPEN & rbufp->dstadr->flags))
+		return FALSE;
+
+	/* any association with this address, keyed or not */
+	ip_count = 0;
+	if (   NULL != findexistingpeer(&rbufp->recv_srcadr, NULL, NULL,
+					-1, 0, &ip_count)
+	    || ip_count > 0)
+		return FALSE;
+
+	sys_received++;
+	sys_fastpath_pkts++;
+	restrictions(&rbufp->recv_srcadr, &r4a);
+	restrict_mask = r4a.rflags;
+	if (restrict_mask & (RES_IGNORE | RES_DONTSERVE)) {
+		sys_restricted++;
+		return TRUE;			/* no time serve */
+	}
+	if (   (restrict_mask & RES_FLAKE)
+	    && (double)ntp_random() / 0x7fffffff < .1) {
+		sys_restricted++;
+		return TRUE;			/* no flakeway */
+	}
+	if (hisversion == NTP_VERSION) {
+		sys_newversion++;
+	} else if (!(restrict_mask & RES_VERSION)) {
+		sys_oldversion++;
+	} else {
+		sys_badlength++;
+		return TRUE;			/* old version */
+	}
+	if (restrict_mask & RES_DONTTRUST) {
+		sys_restricted++;
+		return TRUE;			/* no MAC */
+	}
+
+	restrict_mask = ntp_monitor(rbufp, restrict_mask);
+	if (restrict_mask & RES_LIMITED) {
+		sys_limitrejected++;
+		if (restrict_mask & RES_KOD)
+			fast_xmit(rbufp, MODE_SERVER, 0, restrict_mask);
+		return TRUE;			/* rate exceeded */
+	}
+	restrict_mask &= ~(RES_KOD | RES_MSSNTP);
+
+	if (stats_control) {
+		NTOHL_FP(&pkt->org, &p_org);
+		NTOHL_FP(&pkt->rec, &p_rec);
+		NTOHL_FP(&pkt->xmt, &p_xmt);
+		record_raw_stats(&rbufp->recv_srcadr,
+		    &rbufp->dstadr->sin,
+		    &p_org, &p_rec, &p_xmt, &rbufp->recv_time,
+		    PKT_LEAP(pkt->li_vn_mode), hisversion, MODE_CLIENT,
+		    PKT_TO_STRATUM(pkt->stratum), pkt->ppoll,
+		    pkt->precision,
+		    FPTOD(NTOHS_FP(pkt->rootdelay)),
+		    FPTOD(NTOHS_FP(pkt->rootdisp)),
+		    pkt->refid, 0, (u_char *)&pkt->exten);
+	}
+	fast_xmit(rbufp, MODE_SERVER, 0, restrict_mask);
+
+	return TRUE;
+}
+
+
 /*
  * receive - receive procedure called for each packet received
  */
@@ -718,6 +905,8 @@ receive(
 	 * Bogus port check is before anything, since it probably
 	 * reveals a clogging attack.
 	 */
+	if (sys_fastpath && receive_fast(rbufp))
+		return;
 	sys_received++;
 	if (0 == SRCPORT(&rbufp->recv_srcadr)) {
 		sys_badlength++;
@@ -1475,8 +1664,10 @@ receive(
 		 * accelerate the next poll for the pool solicitor so
 		 * the pool will fill promptly.
 		 */
-		if (peer2->cast_flags & MDF_POOL)
+		if (peer2->cast_flags & MDF_POOL) {
 			peer2->nextdate = current_time + 1;
+			timer_peer(peer2);
+		}
 
 		/*
 		 * Further processing of the solicitation response would
@@ -2269,6 +2460,7 @@ receive(
 			peer->minpoll = peer->ppoll;
 		peer->burst = peer->retry = 0;
 		peer->throttle = (NTP_SHIFT + 1) * (1 << peer->minpoll);
+		peer->throttle_time = current_time;
 		poll_update(peer, pkt->ppoll);
 		return;				/* kiss-o'-death */
 	}
@@ -2475,6 +2667,7 @@ receive(
 			peer->nextdate++;
 		else
 			peer->nextdate--;
+		timer_peer(peer);
 	}
 }
 
@@ -2714,6 +2907,7 @@ process_packet(
 			}
 		}
 		peer->nextdate = current_time + (1u << peer->ppoll) - 2u;
+		timer_peer(peer);
 		p_del = peer->delay;
 		p_offset += p_del / 2;
 
@@ -2889,6 +3083,7 @@ clock_update(
 		sys_rootdisp = sys_mindisp;
 	sys_rootdelay = peer->delay + peer->rootdelay;
 	sys_reftime = peer->dst;
+	update_xmt_template();
 
 	DPRINTF(1, ("clock_update: at %lu sample %lu associd %d\n",
 		    current_time, peer->epoch, peer->associd));
@@ -2934,6 +3129,7 @@ clock_update(
 		sys_rootdelay = 0;
 		sys_rootdisp = 0;
 		L_CLR(&sys_reftime);
+		update_xmt_template();
 		sys_jitter = LOGTOD(sys_precision);
 		leapsec_reset_frame();
 		break;
@@ -3051,11 +3247,13 @@ poll_update(
 	 * slink away. If called from the poll process, delay 1 s for a
 	 * reference clock, otherwise 2 s.
 	 */
-	utemp = current_time + max(peer->throttle - (NTP_SHIFT - 1) *
+	utemp = current_time + max(timer_throttle(peer) - (NTP_SHIFT - 1) *
 	    (1 << peer->minpoll), ntp_minpkt);
 	if (peer->burst > 0) {
-		if (peer->nextdate > current_time)
+		if (peer->nextdate > current_time) {
+			timer_peer(peer);
 			return;
+		}
 #ifdef REFCLOCK
 		else if (peer->flags & FLAG_REFCLOCK)
 			peer->nextdate = current_time + RESP_DELAY;
@@ -3110,6 +3308,7 @@ poll_update(
 		    peer->burst, peer->retry, peer->throttle,
 		    utemp - current_time, peer->nextdate -
 		    current_time));
+	timer_peer(peer);
 }
 
 
@@ -3204,6 +3403,7 @@ peer_clear(
 	} else {
 		peer->nextdate += ntp_random() % peer->minpoll;
 	}
+	timer_peer(peer);
 #ifdef AUTOKEY
 	peer->refresh = current_time + (1 << NTP_REFRESH);
 #endif	/* AUTOKEY */
@@ -3394,6 +3594,37 @@ clock_filter(
 }
 
 
+/*
+ * endpoint_cmp - order interval endpoints by offset
+ *
+ * Equal offsets are ordered lower ends first, so intervals which only
+ * touch count as overlapping in both scans, and then by association
+ * for an order which does not depend on the sort.  The selection
+ * sort used before left equal offsets in an order which depended on
+ * how it moved them, so with equal endpoints the interval may now
+ * differ from earlier versions.
+ */
+static int
+endpoint_cmp(
+	const void *	a,
+	const void *	b
+	)
+{
+	const struct endpoint *ea = a;
+	const struct endpoint *eb = b;
+
+	if (ea->val < eb->val)
+		return -1;
+	if (ea->val > eb->val)
+		return 1;
+	if (ea->type != eb->type)
+		return (ea->type < eb->type) ? -1 : 1;
+	if (ea->assoc != eb->assoc)
+		return (ea->assoc < eb->assoc) ? -1 : 1;
+	return 0;
+}
+
+
 /*
  * clock_select - find the pick-of-the-litter clock
  *
@@ -3413,6 +3644,7 @@ clock_select(void)
 	int	speer;
 	double	d, e, f, g;
 	double	high, low;
+	double	c, s1, s2, x;
 	double	speermet;
 	double	orphmet = 2.0 * U_INT32_MAX; /* 2x is greater than */
 	struct endpoint endp;
@@ -3427,40 +3659,51 @@ clock_select(void)
 #endif /* REFCLOCK */
 #ifndef __rtems__
 	static struct endpoint *endpoint = NULL;
-	static int *indx = NULL;
+	static int *reach = NULL;
 	static peer_select *peers = NULL;
-	static u_int endpoint_size = 0;
-	static u_int peers_size = 0;
-	static u_int indx_size = 0;
+	static int select_size = 0;
+	static int select_last = 0;
 #endif /* __rtems__ */
-	size_t octets;
+	size_t endpoint_size, peers_size, reach_size;
+	int	*lo_reach, *hi_reach;
+	int	incsel;		/* sys_incselect for this pass */
 
 	/*
-	 * Initialize and create endpoint, index and peer lists big
+	 * Initialize and create endpoint, reach and peer lists big
 	 * enough to handle all associations.
 	 */
 	osys_peer = sys_peer;
 	sys_survivors = 0;
+	incsel = sys_incselect;
 #ifdef LOCKCLOCK
 	set_sys_leap(LEAP_NOTINSYNC);
 	sys_stratum = STRATUM_UNSPEC;
 	memcpy(&sys_refid, "DOWN", 4);
+	update_xmt_template();
 #endif /* LOCKCLOCK */
 
 	/*
 	 * Allocate dynamic space depending on the number of
-	 * associations.
+	 * associations. The space is kept between calls and only
+	 * grows, so the steady state runs without the allocator.
 	 */
 	nlist = 1;
 	for (peer = peer_list; peer != NULL; peer = peer->p_link)
 		nlist++;
-	endpoint_size = ALIGNED_SIZE(nlist * 2 * sizeof(*endpoint));
-	peers_size = ALIGNED_SIZE(nlist * sizeof(*peers));
-	indx_size = ALIGNED_SIZE(nlist * 2 * sizeof(*indx));
-	octets = endpoint_size + peers_size + indx_size;
-	endpoint = erealloc(endpoint, octets);
-	peers = INC_ALIGNED_PTR(endpoint, endpoint_size);
-	indx = INC_ALIGNED_PTR(peers, peers_size);
+	if (nlist > select_size) {
+		select_size = max(nlist, 2 * select_size);
+		endpoint_size = ALIGNED_SIZE(select_size * 2 *
+		    sizeof(*endpoint));
+		peers_size = ALIGNED_SIZE(select_size * sizeof(*peers));
+		reach_size = ALIGNED_SIZE(select_size * 2 *
+		    sizeof(*reach));
+		endpoint = erealloc(endpoint,
+		    endpoint_size + peers_size + reach_size);
+		peers = INC_ALIGNED_PTR(endpoint, endpoint_size);
+		reach = INC_ALIGNED_PTR(peers, peers_size);
+	}
+	lo_reach = reach;
+	hi_reach = reach + select_size;
 
 	/*
 	 * Initially, we populate the island with all the rifraff peers
@@ -3554,49 +3797,82 @@ clock_select(void)
 		 */
 		peer->new_status = CTL_PST_SEL_SANE;
 		f = root_distance(peer);
+		peer->selidx = nlist;
 		peers[nlist].peer = peer;
 		peers[nlist].error = peer->jitter;
 		peers[nlist].synch = f;
+		peers[nlist].ends = 0;
 		nlist++;
 
 		/*
 		 * Insert each interval endpoint on the unsorted
-		 * endpoint[] list.
+		 * endpoint[] list. In incremental mode the list
+		 * still holds the last pass and is rebuilt below.
 		 */
+		if (incsel)
+			continue;
 		e = peer->offset;
 		endpoint[nl2].type = -1;	/* lower end */
 		endpoint[nl2].val = e - f;
+		endpoint[nl2].assoc = peer->associd;
 		nl2++;
 		endpoint[nl2].type = 1;		/* upper end */
 		endpoint[nl2].val = e + f;
+		endpoint[nl2].assoc = peer->associd;
 		nl2++;
 	}
+
 	/*
-	 * Construct sorted indx[] of endpoint[] indexes ordered by
-	 * offset.
-	 */
-	for (i = 0; i < nl2; i++)
-		indx[i] = i;
-	for (i = 0; i < nl2; i++) {
-		endp = endpoint[indx[i]];
-		e = endp.val;
-		k = i;
-		for (j = i + 1; j < nl2; j++) {
-			endp = endpoint[indx[j]];
-			if (endp.val < e) {
-				e = endp.val;
-				k = j;
-			}
+	 * Sort endpoint[] by offset.
+	 *
+	 * In incremental mode the endpoints of the candidates are
+	 * refreshed in the order of the last pass, which drops those
+	 * that left and appends those that arrived. Between passes
+	 * only a few endpoints change places, so an insertion sort
+	 * is close to linear. The result is the same either way.
+	 */
+	if (incsel) {
+		for (i = 0; i < select_last; i++) {
+			peer = findpeerbyassoc(endpoint[i].assoc);
+			if (   peer == NULL
+			    || peer->selidx >= nlist
+			    || peers[peer->selidx].peer != peer)
+				continue;
+			k = peer->selidx;
+			peers[k].ends++;
+			endp = endpoint[i];
+			endp.val = peer->offset + endp.type * peers[k].synch;
+			endpoint[nl2++] = endp;
+		}
+		for (i = 0; i < nlist; i++) {
+			if (peers[i].ends != 0)
+				continue;
+			peer = peers[i].peer;
+			e = peer->offset;
+			f = peers[i].synch;
+			endpoint[nl2].type = -1;
+			endpoint[nl2].val = e - f;
+			endpoint[nl2].assoc = peer->associd;
+			nl2++;
+			endpoint[nl2].type = 1;
+			endpoint[nl2].val = e + f;
+			endpoint[nl2].assoc = peer->associd;
+			nl2++;
 		}
-		if (k != i) {
-			j = indx[k];
-			indx[k] = indx[i];
-			indx[i] = j;
+		for (i = 1; i < nl2; i++) {
+			endp = endpoint[i];
+			for (j = i; j > 0 &&
+			    endpoint_cmp(&endpoint[j - 1], &endp) > 0; j--)
+				endpoint[j] = endpoint[j - 1];
+			endpoint[j] = endp;
 		}
+	} else {
+		qsort(endpoint, nl2, sizeof(*endpoint), endpoint_cmp);
 	}
+	select_last = nl2;
 	for (i = 0; i < nl2; i++)
 		DPRINTF(3, ("select: endpoint %2d %.6f\n",
-			endpoint[indx[i]].type, endpoint[indx[i]].val));
+			endpoint[i].type, endpoint[i].val));
 
 	/*
 	 * This is the actual algorithm that cleaves the truechimers
@@ -3619,7 +3895,28 @@ clock_select(void)
 	 * number of falsetickers. Upon exit, the truechimers are the
 	 * survivors with offsets not less than low and not greater than
 	 * high. There may be none of them.
-	 */
+	 *
+	 * Both scans are done once up front: lo_reach[n] is the first
+	 * endpoint from the low end where n intervals overlap and
+	 * hi_reach[n] the first from the high end. A scan that never
+	 * gets there stops at the far end of the list.
+	 */
+	for (n = 1; n <= nlist; n++) {
+		lo_reach[n] = nl2 - 1;
+		hi_reach[n] = 0;
+	}
+	n = k = 0;
+	for (i = 0; i < nl2; i++) {
+		n -= endpoint[i].type;
+		while (k < n)
+			lo_reach[++k] = i;
+	}
+	n = k = 0;
+	for (j = nl2 - 1; j >= 0; j--) {
+		n += endpoint[j].type;
+		while (k < n)
+			hi_reach[++k] = j;
+	}
 	low = 1e9;
 	high = -1e9;
 	for (allow = 0; 2 * allow < nlist; allow++) {
@@ -3628,20 +3925,8 @@ clock_select(void)
 		 * Bound the interval (low, high) as the smallest
 		 * interval containing points from the most sources.
 		 */
-		n = 0;
-		for (i = 0; i < nl2; i++) {
-			low = endpoint[indx[i]].val;
-			n -= endpoint[indx[i]].type;
-			if (n >= nlist - allow)
-				break;
-		}
-		n = 0;
-		for (j = nl2 - 1; j >= 0; j--) {
-			high = endpoint[indx[j]].val;
-			n += endpoint[indx[j]].type;
-			if (n >= nlist - allow)
-				break;
-		}
+		low = endpoint[lo_reach[nlist - allow]].val;
+		high = endpoint[hi_reach[nlist - allow]].val;
 
 		/*
 		 * If an interval containing truechimers is found, stop.
@@ -3736,8 +4021,26 @@ clock_select(void)
 	 * with the worst metric is greater than the minimum peer
 	 * jitter. Stop if we are about to discard a TRUE or PREFER
 	 * peer, who of course have the immunity idol.
+	 *
+	 * In incremental mode the sum of squared offset differences of
+	 * each peer is taken from the sums over the offsets relative
+	 * to their mean, which takes one pass per round instead of
+	 * one per peer. It agrees with the direct sum up to rounding.
 	 */
+	c = s1 = s2 = 0;
 	while (1) {
+		if (incsel && nlist > 1) {
+			c = 0;
+			for (i = 0; i < nlist; i++)
+				c += peers[i].peer->offset;
+			c /= nlist;
+			s1 = s2 = 0;
+			for (i = 0; i < nlist; i++) {
+				x = peers[i].peer->offset - c;
+				s1 += x;
+				s2 += x * x;
+			}
+		}
 		d = 1e9;
 		e = -1e9;
 		g = 0;
@@ -3746,7 +4049,12 @@ clock_select(void)
 			if (peers[i].error < d)
 				d = peers[i].error;
 			peers[i].seljit = 0;
-			if (nlist > 1) {
+			if (nlist > 1 && incsel) {
+				x = peers[i].peer->offset - c;
+				f = nlist * x * x - 2 * x * s1 + s2;
+				peers[i].seljit = SQRT(max(f, 0) /
+				    (nlist - 1));
+			} else if (nlist > 1) {
 				f = 0;
 				for (j = 0; j < nlist; j++)
 					f += DIFF(peers[j].peer->offset,
@@ -4084,7 +4392,8 @@ peer_xmit(
 			sys_ttl[(peer->ttl >= sys_ttlmax) ? sys_ttlmax : peer->ttl],
 			&xpkt, sendlen);
 		peer->sent++;
-		peer->throttle += (1 << peer->minpoll) - 2;
+		peer->throttle = timer_throttle(peer) +
+		    (1 << peer->minpoll) - 2;
 
 		/*
 		 * Capture a-posteriori timestamps
@@ -4396,7 +4705,7 @@ peer_xmit(
 		sys_ttl[(peer->ttl >= sys_ttlmax) ? sys_ttlmax : peer->ttl],
 		&xpkt, sendlen);
 	peer->sent++;
-	peer->throttle += (1 << peer->minpoll) - 2;
+	peer->throttle = timer_throttle(peer) + (1 << peer->minpoll) - 2;
 
 	/*
 	 * Capture a-posteriori timestamps
@@ -4449,39 +4758,28 @@ leap_smear_add_offs(
 
 
 /*
- * fast_xmit - Send packet for nonpersistent association. Note that
- * neither the source or destination can be a broadcast address.
+ * fast_xmit_fill - build the reply header for fast_xmit(). The reply
+ * may be the receive buffer itself, so every request field used is
+ * read before the reply overwrites it.
  */
 static void
-fast_xmit(
+fast_xmit_fill(
 	struct recvbuf *rbufp,	/* receive packet pointer */
+	struct pkt *xpkt,	/* transmit packet, may be &rbufp->recv_pkt */
 	int	xmode,		/* receive mode */
-	keyid_t	xkeyid,		/* transmit key ID */
 	int	flags		/* restrict mask */
 	)
 {
-	struct pkt xpkt;	/* transmit packet structure */
 	struct pkt *rpkt;	/* receive packet structure */
-	l_fp	xmt_tx, xmt_ty;
-	size_t	sendlen;
-#ifdef AUTOKEY
-	u_int32	temp32;
-#endif
+	l_fp	org;		/* request transmit time */
+	u_char	version;
+	u_char	ppoll;
+	l_fp	xmt_tx;
 
-	/*
-	 * Initialize transmit packet header fields from the receive
-	 * buffer provided. We leave the fields intact as received, but
-	 * set the peer poll at the maximum of the receive peer poll and
-	 * the system minimum poll (ntp_minpoll). This is for KoD rate
-	 * control and not strictly specification compliant, but doesn't
-	 * break anything.
-	 *
-	 * If the gazinta was from a multicast address, the gazoutta
-	 * must go out another way.
-	 */
 	rpkt = &rbufp->recv_pkt;
-	if (rbufp->dstadr->flags & INT_MCASTOPEN)
-		rbufp->dstadr = findinterface(&rbufp->recv_srcadr);
+	org = rpkt->xmt;
+	version = PKT_VERSION(rpkt->li_vn_mode);
+	ppoll = max(rpkt->ppoll, ntp_minpoll);
 
 	/*
 	 * If this is a kiss-o'-death (KoD) packet, show leap
@@ -4492,18 +4790,20 @@ fast_xmit(
 	 */
 	if (flags & RES_KOD) {
 		sys_kodsent++;
-		xpkt.li_vn_mode = PKT_LI_VN_MODE(LEAP_NOTINSYNC,
-		    PKT_VERSION(rpkt->li_vn_mode), xmode);
-		xpkt.stratum = STRATUM_PKT_UNSPEC;
-		xpkt.ppoll = max(rpkt->ppoll, ntp_minpoll);
-		xpkt.precision = rpkt->precision;
-		memcpy(&xpkt.refid, "RATE", 4);
-		xpkt.rootdelay = rpkt->rootdelay;
-		xpkt.rootdisp = rpkt->rootdisp;
-		xpkt.reftime = rpkt->reftime;
-		xpkt.org = rpkt->xmt;
-		xpkt.rec = rpkt->xmt;
-		xpkt.xmt = rpkt->xmt;
+		xpkt->li_vn_mode = PKT_LI_VN_MODE(LEAP_NOTINSYNC,
+		    version, xmode);
+		xpkt->stratum = STRATUM_PKT_UNSPEC;
+		xpkt->ppoll = ppoll;
+		memcpy(&xpkt->refid, "RATE", 4);
+		if (xpkt != rpkt) {
+			xpkt->precision = rpkt->precision;
+			xpkt->rootdelay = rpkt->rootdelay;
+			xpkt->rootdisp = rpkt->rootdisp;
+			xpkt->reftime = rpkt->reftime;
+		}
+		xpkt->org = org;
+		xpkt->rec = org;
+		xpkt->xmt = org;
 
 	/*
 	 * This is a normal packet. Use the system variables.
@@ -4521,41 +4821,43 @@ fast_xmit(
 		 * If we are inside the leap smear interval we add the current smear offset to
 		 * the packet receive time, to the packet transmit time, and eventually to the
 		 * reftime to make sure the reftime isn't later than the transmit/receive times.
+		 *
+		 * The system variables come ready converted from
+		 * sys_xmt_template.
 		 */
-		xpkt.li_vn_mode = PKT_LI_VN_MODE(xmt_leap,
-		    PKT_VERSION(rpkt->li_vn_mode), xmode);
+		xpkt->li_vn_mode = PKT_LI_VN_MODE(sys_xmt_template.leap,
+		    version, xmode);
 
-		xpkt.stratum = STRATUM_TO_PKT(sys_stratum);
-		xpkt.ppoll = max(rpkt->ppoll, ntp_minpoll);
-		xpkt.precision = sys_precision;
-		xpkt.refid = sys_refid;
-		xpkt.rootdelay = HTONS_FP(DTOFP(sys_rootdelay));
-		xpkt.rootdisp = HTONS_FP(DTOUFP(sys_rootdisp));
+		xpkt->stratum = sys_xmt_template.stratum;
+		xpkt->ppoll = ppoll;
+		xpkt->precision = sys_xmt_template.precision;
+		xpkt->refid = sys_xmt_template.refid;
+		xpkt->rootdelay = sys_xmt_template.rootdelay;
+		xpkt->rootdisp = sys_xmt_template.rootdisp;
+		xpkt->reftime = sys_xmt_template.reftime;
 
 #ifdef LEAP_SMEAR
-		this_ref_time = sys_reftime;
 		if (leap_smear.in_progress) {
+			this_ref_time = sys_reftime;
 			leap_smear_add_offs(&this_ref_time, NULL);
-			xpkt.refid = convertLFPToRefID(leap_smear.offset);
+			xpkt->refid = convertLFPToRefID(leap_smear.offset);
 			DPRINTF(2, ("fast_xmit: leap_smear.in_progress: refid %8x, smear %s\n",
-				ntohl(xpkt.refid),
+				ntohl(xpkt->refid),
 				lfptoa(&leap_smear.offset, 8)
 				));
+			HTONL_FP(&this_ref_time, &xpkt->reftime);
 		}
-		HTONL_FP(&this_ref_time, &xpkt.reftime);
-#else
-		HTONL_FP(&sys_reftime, &xpkt.reftime);
 #endif
 
-		xpkt.org = rpkt->xmt;
+		xpkt->org = org;
 
 #ifdef LEAP_SMEAR
 		this_recv_time = rbufp->recv_time;
 		if (leap_smear.in_progress)
 			leap_smear_add_offs(&this_recv_time, NULL);
-		HTONL_FP(&this_recv_time, &xpkt.rec);
+		HTONL_FP(&this_recv_time, &xpkt->rec);
 #else
-		HTONL_FP(&rbufp->recv_time, &xpkt.rec);
+		HTONL_FP(&rbufp->recv_time, &xpkt->rec);
 #endif
 
 		get_systime(&xmt_tx);
@@ -4563,12 +4865,67 @@ fast_xmit(
 		if (leap_smear.in_progress)
 			leap_smear_add_offs(&xmt_tx, &this_recv_time);
 #endif
-		HTONL_FP(&xmt_tx, &xpkt.xmt);
+		HTONL_FP(&xmt_tx, &xpkt->xmt);
+	}
+}
+
+
+/*
+ * fast_xmit - Send packet for nonpersistent association. Note that
+ * neither the source or destination can be a broadcast address.
+ *
+ * Server replies are normally written over the request in the receive
+ * buffer and sent from there (see sys_inplace). Other modes, Autokey
+ * and MS-SNTP replies are built in a separate packet since the request
+ * is still needed after the reply is sent.
+ */
+static void
+fast_xmit(
+	struct recvbuf *rbufp,	/* receive packet pointer */
+	int	xmode,		/* receive mode */
+	keyid_t	xkeyid,		/* transmit key ID */
+	int	flags		/* restrict mask */
+	)
+{
+	struct pkt xbuf;	/* transmit packet structure */
+	struct pkt *xpkt;	/* reply, xbuf or the receive buffer */
+	l_fp	xmt_tx, xmt_ty;
+	size_t	sendlen;
+#ifdef AUTOKEY
+	struct pkt *rpkt;	/* receive packet structure */
+	u_int32	temp32;
+#endif
+
+	/*
+	 * Initialize transmit packet header fields from the receive
+	 * buffer provided. We leave the fields intact as received, but
+	 * set the peer poll at the maximum of the receive peer poll and
+	 * the system minimum poll (ntp_minpoll). This is for KoD rate
+	 * control and not strictly specification compliant, but doesn't
+	 * break anything.
+	 *
+	 * If the gazinta was from a multicast address, the gazoutta
+	 * must go out another way.
+	 */
+	if (rbufp->dstadr->flags & INT_MCASTOPEN)
+		rbufp->dstadr = findinterface(&rbufp->recv_srcadr);
+
+	xpkt = &xbuf;
+	if (   sys_inplace
+	    && MODE_SERVER == xmode
+	    && xkeyid <= NTP_MAXKEY
+#ifdef HAVE_NTP_SIGND
+	    && !(flags & RES_MSSNTP)
+#endif
+	    && rbufp->recv_size >= LEN_PKT_NOMAC + MAX_MAC_LEN) {
+		xpkt = &rbufp->recv_pkt;
+		sys_inplace_pkts++;
 	}
+	fast_xmit_fill(rbufp, xpkt, xmode, flags);
 
 #ifdef HAVE_NTP_SIGND
 	if (flags & RES_MSSNTP) {
-		send_via_ntp_signd(rbufp, xmode, xkeyid, flags, &xpkt);
+		send_via_ntp_signd(rbufp, xmode, xkeyid, flags, xpkt);
 		return;
 	}
 #endif /* HAVE_NTP_SIGND */
@@ -4580,7 +4937,7 @@ fast_xmit(
 	 */
 	sendlen = LEN_PKT_NOMAC;
 	if (rbufp->recv_length == sendlen) {
-		sendpkt(&rbufp->recv_srcadr, rbufp->dstadr, 0, &xpkt,
+		sendpkt_deferred(&rbufp->recv_srcadr, rbufp->dstadr, xpkt,
 		    sendlen);
 		DPRINTF(1, ("fast_xmit: at %ld %s->%s mode %d len %lu\n",
 			    current_time, stoa(&rbufp->dstadr->sin),
@@ -4610,6 +4967,7 @@ fast_xmit(
 		 * jerk can decode it. If no extension field is present,
 		 * use the cookie to generate the session key.
 		 */
+		rpkt = &rbufp->recv_pkt;
 		cookie = session_key(&rbufp->recv_srcadr,
 		    &rbufp->dstadr->sin, 0, sys_private, 0);
 		if ((size_t)rbufp->recv_length > sendlen + MAX_MAC_LEN) {
@@ -4617,7 +4975,7 @@ fast_xmit(
 			    &rbufp->recv_srcadr, xkeyid, 0, 2);
 			temp32 = CRYPTO_RESP;
 			rpkt->exten[0] |= htonl(temp32);
-			sendlen += crypto_xmit(NULL, &xpkt, rbufp,
+			sendlen += crypto_xmit(NULL, xpkt, rbufp,
 			    sendlen, (struct exten *)rpkt->exten,
 			    cookie);
 		} else {
@@ -4626,16 +4984,21 @@ fast_xmit(
 		}
 	}
 #endif	/* AUTOKEY */
+	/*
+	 * The reply may only be queued here and sent with the rest of
+	 * its receive batch, so sys_authdelay times the authentication
+	 * alone.
+	 */
 	get_systime(&xmt_tx);
-	sendlen += authencrypt(xkeyid, (u_int32 *)&xpkt, sendlen);
+	sendlen += authencrypt(xkeyid, (u_int32 *)xpkt, sendlen);
 #ifdef AUTOKEY
 	if (xkeyid > NTP_MAXKEY)
 		authtrust(xkeyid, 0);
 #endif	/* AUTOKEY */
-	sendpkt(&rbufp->recv_srcadr, rbufp->dstadr, 0, &xpkt, sendlen);
 	get_systime(&xmt_ty);
 	L_SUB(&xmt_ty, &xmt_tx);
 	sys_authdelay = xmt_ty;
+	sendpkt_deferred(&rbufp->recv_srcadr, rbufp->dstadr, xpkt, sendlen);
 	DPRINTF(1, ("fast_xmit: at %ld %s->%s mode %d keyid %08x len %lu\n",
 		    current_time, ntoa(&rbufp->dstadr->sin),
 		    ntoa(&rbufp->recv_srcadr), xmode, xkeyid,
@@ -4721,7 +5084,7 @@ pool_xmit(
 		sys_ttl[(pool->ttl >= sys_ttlmax) ? sys_ttlmax : pool->ttl],
 		&xpkt, LEN_PKT_NOMAC);
 	pool->sent++;
-	pool->throttle += (1 << pool->minpoll) - 2;
+	pool->throttle = timer_throttle(pool) + (1 << pool->minpoll) - 2;
 	DPRINTF(1, ("pool_xmit: at %ld %s->%s pool\n",
 		    current_time, latoa(lcladr), stoa(rmtadr)));
 	msyslog(LOG_INFO, "Soliciting pool server %s", stoa(rmtadr));
@@ -5054,6 +5417,7 @@ set_sys_tick_precision(
 		i++;
 
 	sys_precision = (s_char)i;
+	update_xmt_template();
 }
 
 
@@ -5079,6 +5443,7 @@ init_proto(void)
 	L_CLR(&sys_reftime);
 	sys_jitter = 0;
 	measure_precision();
+	update_xmt_template();
 	get_systime(&dummy);
 	sys_survivors = 0;
 	sys_manycastserver = 0;
@@ -5290,6 +5655,10 @@ proto_clr_stats(void)
 	sys_badauth = 0;
 	sys_limitrejected = 0;
 	sys_kodsent = 0;
+	sys_fastpath_pkts = 0;
+	sys_inplace_pkts = 0;
+	res_cache_hits = 0;
+	res_cache_misses = 0;
 	sys_lamport = 0;
 	sys_tsrounding = 0;
 }
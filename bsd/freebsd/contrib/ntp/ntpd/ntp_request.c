@@ -1194,6 +1194,7 @@ mem_stats(
 {
 	register struct info_mem_stats *ms;
 	register int i;
+	u_int u;
 
 	ms = (struct info_mem_stats *)prepare_pkt(srcadr, inter, inpkt,
 						  sizeof(struct info_mem_stats));
@@ -1205,9 +1206,18 @@ mem_stats(
 	ms->allocations = htonl((u_int32)peer_allocations);
 	ms->demobilizations = htonl((u_int32)peer_demobilizations);
 
+	/*
+	 * The address hash may have grown past the NTP_HASH_SIZE
+	 * buckets of the reply, fold it.
+	 */
 	for (i = 0; i < NTP_HASH_SIZE; i++)
+		ms->hashcount[i] = 0;
+	for (u = 0; u < peer_hash_size; u++) {
+		i = u & NTP_HASH_MASK;
 		ms->hashcount[i] = (u_char)
-		    max((u_int)peer_hash_count[i], UCHAR_MAX);
+		    min((u_int)ms->hashcount[i] + peer_hash_count[u],
+			UCHAR_MAX);
+	}
 
 	(void) more_pkt();
 	flush_pkt();
@@ -1745,6 +1755,7 @@ list_restrict(
 	 * than they were originally.  To preserve the output semantics,
 	 * dump each list in reverse order. The workers take care of that.
 	 */
+	restrict_sort_lists();
 	list_restrict4(restrictlist4, &ir);
 	if (client_v6_capable)
 		list_restrict6(restrictlist6, &ir);
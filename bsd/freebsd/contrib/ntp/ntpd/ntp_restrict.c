@@ -39,6 +39,19 @@
  * to keep a misbehaving host or two from abusing your primary clock. It
  * has been expanded, however, to suit the needs of those with more
  * restrictive access policies.
+ *
+ * With thousands of entries neither the scan nor the sorted insert
+ * scale, so entries with contiguous masks are kept in a path-compressed
+ * binary trie per address family instead.  A trie node stands for one
+ * prefix (masked address in network byte order and prefix length) and
+ * holds the entries of that prefix linked by nlink, by descending
+ * mflags.  A lookup collects the nodes on the path to the address and
+ * takes the first usable entry of the deepest one, which is the entry
+ * the sorted scan would have found.  Entries with non-contiguous masks
+ * are rare; they are kept on a sorted list of their own, and while
+ * there are any the lookups fall back to the scan.  The restriction
+ * lists are rebuilt from the trie and that list when someone needs to
+ * walk them, see restrict_sort_lists().
  */
 /*
  * We will use two lists, one for IPv4 addresses and one for IPv6
@@ -62,12 +75,29 @@
 #define	INC_RESLIST4	((1024 - 16) / V4_SIZEOF_RESTRICT_U)
 #define	INC_RESLIST6	((1024 - 16) / V6_SIZEOF_RESTRICT_U)
 
+/*
+ * Restriction trie node, see above.  The trie has at most one node per
+ * bit of the address, plus the root.
+ */
+typedef struct res_node_tag res_node;
+struct res_node_tag {
+	res_node *	child[2];	/* by the key bit after the prefix */
+	res_node *	parent;		/* NULL for the root */
+	restrict_u *	res;		/* entries of this prefix */
+	u_char		plen;		/* prefix length in bits */
+	u_char		key[16];	/* prefix, network byte order */
+};
+
+#define	RES_KEYBITS(v6)	((v6) ? 128 : 32)
+#define	INC_RESNODES	((1024 - 16) / sizeof(res_node))
+
 /*
  * The restriction list
  */
 restrict_u *restrictlist4;
 restrict_u *restrictlist6;
 static int restrictcount;	/* count in the restrict lists */
+static int restrictcount_if;	/* of those, interface entries */
 
 /*
  * The free list and associated counters.  Also some uninteresting
@@ -76,10 +106,43 @@ static int restrictcount;	/* count in the restrict lists */
 static restrict_u *resfree4;	/* available entries (free list) */
 static restrict_u *resfree6;
 
+/*
+ * The tries, the entries with non-contiguous masks (linked by nlink)
+ * and the available trie nodes, all indexed by v6 where it matters.
+ */
+static res_node	res_root[2];
+static restrict_u *res_noncontig[2];
+static res_node *res_nodefree;
+static int	restrict_dirty;	/* restrictlist{4|6} need a rebuild */
+
 static u_long res_calls;
 static u_long res_found;
 static u_long res_not_found;
 
+/*
+ * Restriction decision cache.  restrictions() is asked about the same
+ * busy clients over and over, so the entry found for a source address
+ * (and whether its port is the NTP port, for "ntpport" entries) is
+ * remembered in a small direct-mapped table.  A slot is valid while its
+ * generation equals res_generation, which every change to the
+ * restrictions bumps, and while its entry has not expired.
+ */
+#define	RES_CACHE_BITS	7
+#define	RES_CACHE_SIZE	(1 << RES_CACHE_BITS)
+
+typedef struct res_cache_tag {
+	u_int32		gen;		/* res_generation when filled */
+	u_int32		key[4];		/* source address, IPv4 in key[0] */
+	u_char		v6;
+	u_char		ntpport;	/* source port is NTP_PORT */
+	restrict_u *	match;
+} res_cache;
+
+static res_cache	res_cache_tab[RES_CACHE_SIZE];
+static u_int32		res_generation = 1;	/* 0 never valid */
+u_long			res_cache_hits;
+u_long			res_cache_misses;
+
 /*
  * Count number of restriction entries referring to RES_LIMITED, to
  * control implicit activation/deactivation of the MRU monlist.
@@ -108,12 +171,23 @@ static	short		restrict_source_ippeerlimit;
 static restrict_u *	alloc_res4(void);
 static restrict_u *	alloc_res6(void);
 static void		free_res(restrict_u *, int);
+static void		expire_res4(timer_event *);
+static void		expire_res6(timer_event *);
 static void		inc_res_limited(void);
 static void		dec_res_limited(void);
 static restrict_u *	match_restrict4_addr(u_int32, u_short);
 static restrict_u *	match_restrict6_addr(const struct in6_addr *,
 					     u_short);
 static restrict_u *	match_restrict_entry(const restrict_u *, int);
+static restrict_u *	match_restrict_trie(int, const u_char *, u_short);
+static restrict_u *	match_restrict_cached(sockaddr_u *);
+static void		link_res(restrict_u *, int);
+static int		res_entry_key(const restrict_u *, int, u_char *);
+static res_node *	res_node_get(int, const u_char *, int);
+static res_node *	res_node_find(int, const u_char *, int);
+static void		res_node_prune(res_node *);
+static void		res_node_list(res_node *, int, restrict_u ***,
+				      restrict_u **);
 static int		res_sorts_before4(restrict_u *, restrict_u *);
 static int		res_sorts_before6(restrict_u *, restrict_u *);
 static char *		roptoa(restrict_op op);
@@ -123,10 +197,36 @@ void	dump_restricts(void);
 
 #ifdef __rtems__
 #define RTEMS_NTP_CLEAR(_var) memset(&_var, 0, sizeof(_var))
+/*
+ * res_node_free_all - move all nodes below a trie root to res_nodefree
+ */
+static void
+res_node_free_all(
+	res_node *	root
+	)
+{
+	res_node *	rn;
+	res_node *	parent;
+
+	rn = root;
+	while (rn != root || rn->child[0] != NULL || rn->child[1] != NULL) {
+		if (rn->child[0] != NULL) {
+			rn = rn->child[0];
+		} else if (rn->child[1] != NULL) {
+			rn = rn->child[1];
+		} else {
+			parent = rn->parent;
+			parent->child[parent->child[1] == rn] = NULL;
+			LINK_SLIST(res_nodefree, rn, parent);
+			rn = parent;
+		}
+	}
+}
 void rtems_ntp_restrict_globals_fini(void);
 void rtems_ntp_restrict_globals_fini(void) {
 	restrict_u* res;
 	restrict_u* next;
+	restrict_sort_lists();
 	for (res = restrictlist4; res != NULL; res = next) {
 		next = res->link;
 		if (res != &restrict_def4) {
@@ -142,11 +242,22 @@ void rtems_ntp_restrict_globals_fini(void) {
 	restrictlist4 = NULL;
 	restrictlist6 = NULL;
 	restrictcount = 0;
-	/* resfree4 and resfree6 hold free structs to use, leave them */
+	restrictcount_if = 0;
+	res_node_free_all(&res_root[0]);
+	res_node_free_all(&res_root[1]);
+	RTEMS_NTP_CLEAR(res_root);
+	RTEMS_NTP_CLEAR(res_noncontig);
+	restrict_dirty = FALSE;
+	/* resfree4, resfree6 and res_nodefree hold free structs to use,
+	 * now including the trie nodes, leave them */
 	res_calls = 0;
 	res_found = 0;
 	res_not_found = 0;
 	res_limited_refcnt = 0;
+	RTEMS_NTP_CLEAR(res_cache_tab);
+	res_generation = 1;
+	res_cache_hits = 0;
+	res_cache_misses = 0;
 	RTEMS_NTP_CLEAR(restrict_def4);
 	RTEMS_NTP_CLEAR(restrict_def6);
 	restrict_source_enabled = 0;
@@ -195,6 +306,7 @@ dump_restricts(void)
 	restrict_u *	res;
 	restrict_u *	next;
 
+	restrict_sort_lists();
 	mprintf("dump_restrict: restrict_def4: %p\n", &restrict_def4);
 	/* Spit out 'restrict {,-4,-6} default ...' lines, if needed */
 	for (res = &restrict_def4; res != NULL; res = next) {
@@ -257,6 +369,9 @@ init_restrict(void)
 	 * RESM_NTPONLY are sorted earlier so they take precedence over
 	 * any otherwise similar entry without.  Again, this is the same
 	 * behavior as but reversed implementation compared to the docs.
+	 *
+	 * The lookups use the tries, whose roots (the empty prefix)
+	 * hold the default entries.
 	 * 
 	 */
 
@@ -265,7 +380,10 @@ init_restrict(void)
 
 	LINK_SLIST(restrictlist4, &restrict_def4, link);
 	LINK_SLIST(restrictlist6, &restrict_def6, link);
+	LINK_SLIST(res_root[0].res, &restrict_def4, nlink);
+	LINK_SLIST(res_root[1].res, &restrict_def6, nlink);
 	restrictcount = 2;
+	restrict_dirty = FALSE;
 }
 
 
@@ -329,17 +447,36 @@ free_res(
 {
 	restrict_u **	plisthead;
 	restrict_u *	unlinked;
+	res_node *	rn;
+	u_char		key[16];
+	int		plen;
 
 	restrictcount--;
+	if (RESM_INTERFACE & res->mflags)
+		restrictcount_if--;
 	if (RES_LIMITED & res->rflags)
 		dec_res_limited();
+	timer_event_cancel(&res->expire_event);
 
-	if (v6)
-		plisthead = &restrictlist6;
-	else
-		plisthead = &restrictlist4;
-	UNLINK_SLIST(unlinked, *plisthead, res, link, restrict_u);
-	INSIST(unlinked == res);
+	/*
+	 * The entry stays on the restriction list until it is rebuilt,
+	 * so a caller walking that list can go on with res->link taken
+	 * before the call.
+	 */
+	plen = res_entry_key(res, v6, key);
+	if (plen < 0) {
+		UNLINK_SLIST(unlinked, res_noncontig[v6], res, nlink,
+			     restrict_u);
+		INSIST(unlinked == res);
+	} else {
+		rn = res_node_find(v6, key, plen);
+		INSIST(rn != NULL);
+		UNLINK_SLIST(unlinked, rn->res, res, nlink, restrict_u);
+		INSIST(unlinked == res);
+		res_node_prune(rn);
+	}
+	restrict_dirty = TRUE;
+	res_generation++;
 
 	if (v6) {
 		zero_mem(res, V6_SIZEOF_RESTRICT_U);
@@ -352,6 +489,30 @@ free_res(
 }
 
 
+/*
+ * expire_res4/6 - release an entry once its expire time has come, so
+ * fleeting entries do not wait for a lookup to walk past them
+ */
+static void
+expire_res4(
+	timer_event *	ev
+	)
+{
+	free_res((restrict_u *)((char *)ev -
+			       offsetof(restrict_u, expire_event)), 0);
+}
+
+
+static void
+expire_res6(
+	timer_event *	ev
+	)
+{
+	free_res((restrict_u *)((char *)ev -
+			       offsetof(restrict_u, expire_event)), 1);
+}
+
+
 static void
 inc_res_limited(void)
 {
@@ -370,6 +531,409 @@ dec_res_limited(void)
 }
 
 
+static inline int
+res_key_bit(
+	const u_char *	key,
+	int		bit
+	)
+{
+	return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+
+/*
+ * res_prefix_match - TRUE if the first plen bits of a and b agree
+ */
+static inline int
+res_prefix_match(
+	const u_char *	a,
+	const u_char *	b,
+	int		plen
+	)
+{
+	int	bytes = plen >> 3;
+	int	bits = plen & 7;
+
+	if (memcmp(a, b, (size_t)bytes))
+		return FALSE;
+	return (0 == bits ||
+		!((a[bytes] ^ b[bytes]) & (0xff00 >> bits)));
+}
+
+
+/*
+ * res_common_bits - length of the common prefix of a and b, at most
+ *		     maxbits
+ */
+static int
+res_common_bits(
+	const u_char *	a,
+	const u_char *	b,
+	int		maxbits
+	)
+{
+	int	bit;
+	u_char	diff;
+
+	for (bit = 0; bit < maxbits; bit += 8) {
+		diff = a[bit >> 3] ^ b[bit >> 3];
+		if (diff) {
+			while (!(diff & 0x80)) {
+				diff <<= 1;
+				bit++;
+			}
+			break;
+		}
+	}
+	return min(bit, maxbits);
+}
+
+
+static void
+res_key4(
+	u_int32	addr,
+	u_char *key
+	)
+{
+	key[0] = (u_char)(addr >> 24);
+	key[1] = (u_char)(addr >> 16);
+	key[2] = (u_char)(addr >> 8);
+	key[3] = (u_char)addr;
+}
+
+
+/*
+ * res_entry_key - fill key with the address of an entry and return the
+ *		   prefix length, or -1 for a non-contiguous mask.
+ */
+static int
+res_entry_key(
+	const restrict_u *	res,
+	int			v6,
+	u_char *		key
+	)
+{
+	const u_char *	mask;
+	u_int32		inv;
+	int		plen;
+	int		bit;
+
+	memset(key, 0, 16);
+	if (!v6) {
+		inv = ~res->u.v4.mask;
+		if (inv & (inv + 1))
+			return -1;
+		res_key4(res->u.v4.addr, key);
+		for (plen = 0; plen < 32; plen++)
+			if (!(res->u.v4.mask & (0x80000000U >> plen)))
+				break;
+		return plen;
+	}
+
+	memcpy(key, &res->u.v6.addr, 16);
+	mask = (const u_char *)&res->u.v6.mask;
+	for (plen = 0; plen < 128; plen++)
+		if (!res_key_bit(mask, plen))
+			break;
+	for (bit = plen; bit < 128; bit++)
+		if (res_key_bit(mask, bit))
+			return -1;
+	return plen;
+}
+
+
+static res_node *
+alloc_node(void)
+{
+	const size_t	count = INC_RESNODES;
+	res_node *	rl;
+	res_node *	rn;
+	size_t		i;
+
+	UNLINK_HEAD_SLIST(rn, res_nodefree, parent);
+	if (rn != NULL)
+		return rn;
+
+	rl = eallocarray(count, sizeof(*rl));
+	/* link all but the first onto free list */
+	for (i = count - 1; i > 0; i--)
+		LINK_SLIST(res_nodefree, &rl[i], parent);
+	return rl;
+}
+
+
+static res_node *
+res_node_new(
+	const u_char *	key,
+	int		plen,
+	res_node *	parent
+	)
+{
+	res_node *	rn;
+	int		i;
+
+	rn = alloc_node();
+	ZERO(*rn);
+	memcpy(rn->key, key, sizeof(rn->key));
+	i = plen >> 3;
+	if (plen & 7)
+		rn->key[i++] &= 0xff00 >> (plen & 7);
+	for (; i < (int)sizeof(rn->key); i++)
+		rn->key[i] = 0;
+	rn->plen = (u_char)plen;
+	rn->parent = parent;
+	return rn;
+}
+
+
+/*
+ * res_node_get - find or add the trie node of a prefix
+ */
+static res_node *
+res_node_get(
+	int		v6,
+	const u_char *	key,
+	int		plen
+	)
+{
+	res_node *	rn;
+	res_node *	child;
+	res_node *	split;
+	int		b;
+	int		common;
+
+	rn = &res_root[v6];
+	while (rn->plen < plen) {
+		b = res_key_bit(key, rn->plen);
+		child = rn->child[b];
+		if (NULL == child) {
+			child = res_node_new(key, plen, rn);
+			rn->child[b] = child;
+			return child;
+		}
+		common = res_common_bits(child->key, key,
+					 min(child->plen, plen));
+		if (common == child->plen) {
+			rn = child;
+			continue;
+		}
+		/* the prefix and child part ways at bit common */
+		split = res_node_new(key, common, rn);
+		rn->child[b] = split;
+		split->child[res_key_bit(child->key, common)] = child;
+		child->parent = split;
+		if (common == plen)
+			return split;
+		child = res_node_new(key, plen, split);
+		split->child[res_key_bit(key, common)] = child;
+		return child;
+	}
+	return rn;
+}
+
+
+/*
+ * res_node_find - the trie node of a prefix or NULL
+ */
+static res_node *
+res_node_find(
+	int		v6,
+	const u_char *	key,
+	int		plen
+	)
+{
+	res_node *	rn;
+
+	rn = &res_root[v6];
+	while (rn != NULL && rn->plen < plen) {
+		rn = rn->child[res_key_bit(key, rn->plen)];
+		if (rn != NULL &&
+		    (rn->plen > plen ||
+		     !res_prefix_match(rn->key, key, rn->plen)))
+			rn = NULL;
+	}
+	return rn;
+}
+
+
+/*
+ * res_node_prune - release a node and its ancestors while they hold no
+ *		    entries and do not branch.
+ */
+static void
+res_node_prune(
+	res_node *	rn
+	)
+{
+	res_node *	parent;
+	res_node *	child;
+
+	while (rn->parent != NULL && NULL == rn->res &&
+	       (NULL == rn->child[0] || NULL == rn->child[1])) {
+		parent = rn->parent;
+		child = (rn->child[0] != NULL)
+			    ? rn->child[0]
+			    : rn->child[1];
+		parent->child[parent->child[1] == rn] = child;
+		if (child != NULL)
+			child->parent = parent;
+		zero_mem(rn, sizeof(*rn));
+		LINK_SLIST(res_nodefree, rn, parent);
+		rn = parent;
+	}
+}
+
+
+/*
+ * link_res - add a new entry to the trie or the non-contiguous list
+ */
+static void
+link_res(
+	restrict_u *	res,
+	int		v6
+	)
+{
+	res_node *	rn;
+	u_char		key[16];
+	int		plen;
+
+	plen = res_entry_key(res, v6, key);
+	if (plen < 0) {
+		LINK_SORT_SLIST(
+			res_noncontig[v6], res,
+			(v6)
+			  ? res_sorts_before6(res, L_S_S_CUR())
+			  : res_sorts_before4(res, L_S_S_CUR()),
+			nlink, restrict_u);
+	} else {
+		rn = res_node_get(v6, key, plen);
+		LINK_SORT_SLIST(rn->res, res,
+				res->mflags > L_S_S_CUR()->mflags,
+				nlink, restrict_u);
+	}
+	restrict_dirty = TRUE;
+	res_generation++;
+}
+
+
+/*
+ * res_node_list - append the entries of a subtree to a restriction list
+ *		   in its sort order, merging in the entries with
+ *		   non-contiguous masks from *pnc as they come due.
+ *
+ * Descending order is the larger child first, then the smaller one
+ * (same or larger addresses, longer masks), then the node itself.
+ */
+static void
+res_node_list(
+	res_node *	rn,
+	int		v6,
+	restrict_u ***	ppptail,
+	restrict_u **	pnc
+	)
+{
+	restrict_u *	res;
+
+	if (rn->child[1] != NULL)
+		res_node_list(rn->child[1], v6, ppptail, pnc);
+	if (rn->child[0] != NULL)
+		res_node_list(rn->child[0], v6, ppptail, pnc);
+	for (res = rn->res; res != NULL; res = res->nlink) {
+		while (*pnc != NULL &&
+		       ((v6)
+			  ? res_sorts_before6(*pnc, res)
+			  : res_sorts_before4(*pnc, res))) {
+			**ppptail = *pnc;
+			*ppptail = &(*pnc)->link;
+			*pnc = (*pnc)->nlink;
+		}
+		**ppptail = res;
+		*ppptail = &res->link;
+	}
+}
+
+
+/*
+ * restrict_sort_lists - bring restrictlist4 and restrictlist6 up to
+ *			 date after entries were added or removed.
+ */
+void
+restrict_sort_lists(void)
+{
+	restrict_u **	pptail;
+	restrict_u *	nc;
+	int		v6;
+
+	if (!restrict_dirty)
+		return;
+
+	for (v6 = 0; v6 <= 1; v6++) {
+		pptail = (v6)
+			     ? &restrictlist6
+			     : &restrictlist4;
+		nc = res_noncontig[v6];
+		res_node_list(&res_root[v6], v6, &pptail, &nc);
+		for (; nc != NULL; nc = nc->nlink) {
+			*pptail = nc;
+			pptail = &nc->link;
+		}
+		*pptail = NULL;
+	}
+	restrict_dirty = FALSE;
+}
+
+
+/*
+ * match_restrict_trie - the entry of the most specific prefix of key
+ *			 which applies to port.
+ *
+ * Expired entries are skipped, and the first of them met is released.
+ */
+static restrict_u *
+match_restrict_trie(
+	int		v6,
+	const u_char *	key,
+	u_short		port
+	)
+{
+	res_node *	path[129];
+	res_node *	rn;
+	restrict_u *	res;
+	restrict_u *	expired;
+	int		depth;
+
+	depth = 0;
+	rn = &res_root[v6];
+	while (rn != NULL) {
+		if (rn->res != NULL)
+			path[depth++] = rn;
+		if (rn->plen == RES_KEYBITS(v6))
+			break;
+		rn = rn->child[res_key_bit(key, rn->plen)];
+		if (rn != NULL && !res_prefix_match(rn->key, key, rn->plen))
+			break;
+	}
+
+	res = NULL;
+	expired = NULL;
+	while (NULL == res && depth > 0) {
+		for (res = path[--depth]->res; res != NULL; res = res->nlink) {
+			if (res->expire && res->expire <= current_time) {
+				if (NULL == expired)
+					expired = res;
+				continue;
+			}
+			if (   !(RESM_NTPONLY & res->mflags)
+			    || NTP_PORT == port)
+				break;
+		}
+	}
+	if (expired != NULL)
+		free_res(expired, v6);
+	return res;
+}
+
+
 static restrict_u *
 match_restrict4_addr(
 	u_int32	addr,
@@ -379,7 +943,14 @@ match_restrict4_addr(
 	const int	v6 = 0;
 	restrict_u *	res;
 	restrict_u *	next;
+	u_char		key[4];
+
+	if (NULL == res_noncontig[v6]) {
+		res_key4(addr, key);
+		return match_restrict_trie(v6, key, port);
+	}
 
+	restrict_sort_lists();
 	for (res = restrictlist4; res != NULL; res = next) {
 		struct in_addr	sia = { htonl(res->u.v4.addr) };
 
@@ -387,8 +958,10 @@ match_restrict4_addr(
 		DPRINTF(2, ("match_restrict4_addr: Checking %s, port %d ... ",
 			    inet_ntoa(sia), port));
 		if (   res->expire
-		    && res->expire <= current_time)
+		    && res->expire <= current_time) {
 			free_res(res, v6);	/* zeroes the contents */
+			continue;
+		}
 		if (   res->u.v4.addr == (addr & res->u.v4.mask)
 		    && (   !(RESM_NTPONLY & res->mflags)
 			|| NTP_PORT == port)) {
@@ -412,12 +985,18 @@ match_restrict6_addr(
 	restrict_u *	next;
 	struct in6_addr	masked;
 
+	if (NULL == res_noncontig[v6])
+		return match_restrict_trie(v6, addr->s6_addr, port);
+
+	restrict_sort_lists();
 	for (res = restrictlist6; res != NULL; res = next) {
 		next = res->link;
 		INSIST(next != res);
 		if (res->expire &&
-		    res->expire <= current_time)
+		    res->expire <= current_time) {
 			free_res(res, v6);
+			continue;
+		}
 		MASK_IPV6_ADDR(&masked, addr, &res->u.v6.mask);
 		if (ADDR6_EQ(&masked, &res->u.v6.addr)
 		    && (!(RESM_NTPONLY & res->mflags)
@@ -445,17 +1024,27 @@ match_restrict_entry(
 {
 	restrict_u *res;
 	restrict_u *rlist;
+	res_node *rn;
+	u_char key[16];
+	int plen;
 	size_t cb;
 
-	if (v6) {
-		rlist = restrictlist6;
+	if (v6)
 		cb = sizeof(pmatch->u.v6);
-	} else {
-		rlist = restrictlist4;
+	else
 		cb = sizeof(pmatch->u.v4);
+
+	plen = res_entry_key(pmatch, v6, key);
+	if (plen < 0) {
+		rlist = res_noncontig[v6];
+	} else {
+		rn = res_node_find(v6, key, plen);
+		rlist = (rn != NULL)
+			    ? rn->res
+			    : NULL;
 	}
 
-	for (res = rlist; res != NULL; res = res->link)
+	for (res = rlist; res != NULL; res = res->nlink)
 		if (res->mflags == pmatch->mflags &&
 		    !memcmp(&res->u, &pmatch->u, cb))
 			break;
@@ -532,6 +1121,63 @@ res_sorts_before6(
 }
 
 
+/*
+ * match_restrict_cached - match_restrict{4|6}_addr() through the
+ *			   decision cache
+ */
+static restrict_u *
+match_restrict_cached(
+	sockaddr_u *	srcadr
+	)
+{
+	res_cache *	rc;
+	restrict_u *	match;
+	u_int32		key[4];
+	u_int32		hash;
+	u_char		v6;
+	u_char		ntpport;
+
+	v6 = IS_IPV6(srcadr);
+	ntpport = (NTP_PORT == SRCPORT(srcadr));
+	if (v6) {
+		memcpy(key, PSOCK_ADDR6(srcadr), sizeof(key));
+	} else {
+		key[0] = SRCADR(srcadr);
+		key[1] = key[2] = key[3] = 0;
+	}
+	hash = (key[0] ^ key[1] ^ key[2] ^ key[3] ^ ntpport) * 0x9e3779b1U;
+	rc = &res_cache_tab[hash >> (32 - RES_CACHE_BITS)];
+
+	if (   rc->gen == res_generation
+	    && rc->v6 == v6
+	    && rc->ntpport == ntpport
+	    && !memcmp(rc->key, key, sizeof(key))
+	    && (   !rc->match->expire
+		|| rc->match->expire > current_time)) {
+		res_cache_hits++;
+		return rc->match;
+	}
+
+	res_cache_misses++;
+	if (v6)
+		match = match_restrict6_addr(PSOCK_ADDR6(srcadr),
+					     SRCPORT(srcadr));
+	else
+		match = match_restrict4_addr(SRCADR(srcadr),
+					     SRCPORT(srcadr));
+	INSIST(match != NULL);
+
+	/* the lookup may have released expired entries, so fill now */
+	rc->gen = res_generation;
+	memcpy(rc->key, key, sizeof(rc->key));
+	rc->v6 = v6;
+	rc->ntpport = ntpport;
+	rc->match = match;
+
+	return match;
+}
+
+
 /*
  * restrictions - return restrictions for this host in *r4a
  */
@@ -565,11 +1211,7 @@ restrictions(
 			return;
 		}
 
-		match = match_restrict4_addr(SRCADR(srcadr),
-					     SRCPORT(srcadr));
-
-		INSIST(match != NULL);
-
+		match = match_restrict_cached(srcadr);
 		match->count++;
 		/*
 		 * res_not_found counts only use of the final default
@@ -596,8 +1238,7 @@ restrictions(
 		if (IN6_IS_ADDR_MULTICAST(pin6))
 			return;
 
-		match = match_restrict6_addr(pin6, SRCPORT(srcadr));
-		INSIST(match != NULL);
+		match = match_restrict_cached(srcadr);
 		match->count++;
 		if (&restrict_def6 == match)
 			res_not_found++;
@@ -610,6 +1251,36 @@ restrictions(
 }
 
 
+/*
+ * restrict_default_only - TRUE if the restrict lists hold nothing but
+ *			   the IPv4 and IPv6 defaults and those agree,
+ *			   with their flags in *rflags.  The entries
+ *			   ntpd adds for its own addresses do not count;
+ *			   whoever relies on this has to drop datagrams
+ *			   from those addresses itself.
+ */
+int
+restrict_default_only(
+	u_short *rflags
+	)
+{
+	*rflags = restrict_def4.rflags;
+
+	return (2 == restrictcount - restrictcount_if &&
+		restrict_def4.rflags == restrict_def6.rflags);
+}
+
+
+/*
+ * restrict_generation - changes whenever the restrictions do
+ */
+u_int32
+restrict_generation(void)
+{
+	return res_generation;
+}
+
+
 /*
  * roptoa - convert a restrict_op to a string
  */
@@ -646,11 +1317,12 @@ hack_restrict(
 	int		v6;
 	restrict_u	match;
 	restrict_u *	res;
-	restrict_u **	plisthead;
 
 	DPRINTF(1, ("hack_restrict: op %s addr %s mask %s ippeerlimit %d mflags %08x rflags %08x\n",
 		    roptoa(op), stoa(resaddr), stoa(resmask), ippeerlimit, mflags, rflags));
 
+	res_generation++;
+
 	if (NULL == resaddr) {
 		REQUIRE(NULL == resmask);
 		REQUIRE(RESTRICT_FLAGS == op);
@@ -711,22 +1383,24 @@ hack_restrict(
 				res = alloc_res6();
 				memcpy(res, &match,
 				       V6_SIZEOF_RESTRICT_U);
-				plisthead = &restrictlist6;
 			} else {
 				res = alloc_res4();
 				memcpy(res, &match,
 				       V4_SIZEOF_RESTRICT_U);
-				plisthead = &restrictlist4;
 			}
-			LINK_SORT_SLIST(
-				*plisthead, res,
-				(v6)
-				  ? res_sorts_before6(res, L_S_S_CUR())
-				  : res_sorts_before4(res, L_S_S_CUR()),
-				link, restrict_u);
+			link_res(res, v6);
 			restrictcount++;
+			if (RESM_INTERFACE & res->mflags)
+				restrictcount_if++;
 			if (RES_LIMITED & rflags)
 				inc_res_limited();
+			if (res->expire) {
+				res->expire_event.fire = (v6)
+							     ? expire_res6
+							     : expire_res4;
+				timer_event_arm(&res->expire_event,
+						res->expire);
+			}
 		} else {
 			if (   (RES_LIMITED & rflags)
 			    && !(RES_LIMITED & res->rflags))
@@ -9,6 +9,7 @@
 
 #include "ntp_machine.h"
 #include "ntpd.h"
+#include "ntp_lists.h"
 #include "ntp_stdlib.h"
 #include "ntp_calendar.h"
 #include "ntp_leapsec.h"
@@ -35,6 +36,11 @@
 #include <openssl/rand.h>
 #endif	/* AUTOKEY */
 
+#ifdef __rtems__
+#include <rtems.h>
+#include <rtems/ntpd.h>
+#endif /* __rtems__ */
+
 
 /* TC_ERR represents the timer_create() error return value. */
 #ifdef SYS_VXWORKS
@@ -45,6 +51,9 @@
 
 
 static void check_leapsec(u_int32, const time_t*, int/*BOOL*/);
+static void timer_wheel_init(void);
+static void timer_wheel_tick(void);
+static void timer_peer_fire(timer_event *);
 
 /*
  * These routines provide support for the event timer.  The timer is
@@ -102,6 +111,42 @@ u_long timer_timereset;
 u_long timer_overflows;
 u_long timer_xmtcalls;
 
+/*
+ * The timer wheel.  Events due within TW_SLOTS seconds hang off the
+ * first level, one slot per second.  Later events hang off the second
+ * level, one slot per TW_SLOTS seconds, and cascade to the first level
+ * when their slot comes up; those more than TW_SLOTS * TW_SLOTS
+ * seconds ahead stay for another turn.  So a tick only touches the
+ * events which are due, and once every TW_SLOTS seconds a slot of the
+ * second level, no matter how many peers and restrict entries wait.
+ */
+#define	TW_BITS		8
+#define	TW_SLOTS	(1 << TW_BITS)
+#define	TW_MASK		(TW_SLOTS - 1)
+static timer_event tw_wheel[2][TW_SLOTS]; /* list heads */
+static u_long	tw_now;		/* last tick dispatched */
+
+#ifdef __rtems__
+/*
+ * Sub-second polling.  Unicast associations with an address given to
+ * rtems_ntpd_set_subsecond_poll() are polled every poll_ms milliseconds
+ * of the RTEMS uptime clock in addition to their regular polls from the
+ * timer wheel, which keep the reachability accounting.  While
+ * there are any, io_handler() cuts its wait for input short to the next
+ * of these polls, and the alarm for timer() follows the uptime clock,
+ * so the one second housekeeping keeps its pace under the extra input.
+ */
+#define	FAST_MAX	8	/* configured addresses */
+#define	FAST_MIN_MS	10	/* shortest poll interval */
+#define	FAST_MAX_MS	1000	/* longest poll interval */
+static struct fast_cfg {
+	sockaddr_u	addr;
+	u_int		poll_ms;
+} fast_cfg[FAST_MAX];		/* persists across restarts */
+static struct peer *fast_list;	/* peers polled sub-second */
+static u_long	fast_second;	/* uptime (ms) of the next alarm */
+#endif /* __rtems__ */
+
 #if defined(VMS)
 static int vmstimer[2]; 	/* time for next timer AST */
 static int vmsinc[2];		/* timer increment */
@@ -152,6 +197,52 @@ void rtems_ntp_timer_globals_fini(void) {
 	timer_timereset = 0U;
 	timer_overflows = 9U;
 	timer_xmtcalls = 0U;
+	/* the peers and restrict entries have been released by now */
+	memset(tw_wheel, 0, sizeof(tw_wheel));
+	tw_now = 0U;
+	fast_list = NULL;
+	fast_second = 0U;
+}
+
+int
+rtems_ntpd_set_subsecond_poll(const struct sockaddr *addr, int interval_ms)
+{
+	sockaddr_u	sau;
+	struct fast_cfg *free_cfg;
+	size_t		i;
+
+	ZERO(sau);
+	if (AF_INET == addr->sa_family)
+		memcpy(&sau, addr, sizeof(sau.sa4));
+	else if (AF_INET6 == addr->sa_family)
+		memcpy(&sau, addr, sizeof(sau.sa6));
+	else {
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+	if (interval_ms > 0)
+		interval_ms = max(FAST_MIN_MS, min(interval_ms, FAST_MAX_MS));
+	else
+		interval_ms = 0;
+
+	free_cfg = NULL;
+	for (i = 0; i < COUNTOF(fast_cfg); i++) {
+		if (fast_cfg[i].poll_ms && SOCK_EQ(&fast_cfg[i].addr, &sau)) {
+			fast_cfg[i].poll_ms = interval_ms;
+			return 0;
+		}
+		if (!fast_cfg[i].poll_ms && NULL == free_cfg)
+			free_cfg = &fast_cfg[i];
+	}
+	if (0 == interval_ms)
+		return 0;
+	if (NULL == free_cfg) {
+		errno = ENOSPC;
+		return -1;
+	}
+	free_cfg->addr = sau;
+	free_cfg->poll_ms = interval_ms;
+	return 0;
 }
 #endif /* __rtems__ */
 #if !defined(SYS_WINNT) && !defined(VMS)
@@ -314,14 +405,318 @@ intres_timeout_req(
 }
 
 
+/*
+ * timer_wheel_init - set up the list heads of the timer wheel
+ */
+static void
+timer_wheel_init(void)
+{
+	int	l;
+	int	i;
+
+	for (l = 0; l < 2; l++)
+		for (i = 0; i < TW_SLOTS; i++)
+			INIT_DLIST(tw_wheel[l][i], link);
+}
+
+
+/*
+ * timer_event_arm - (re)arm an event to fire at due, or on the next
+ *		     tick if due has passed
+ */
+void
+timer_event_arm(
+	timer_event *	ev,
+	u_long		due
+	)
+{
+	if (NULL == tw_wheel[0][0].link.f)
+		timer_wheel_init();
+
+	timer_event_cancel(ev);
+	if (due <= tw_now)
+		due = tw_now + 1;
+	ev->due = due;
+	if (due - tw_now < TW_SLOTS)
+		LINK_TAIL_DLIST(tw_wheel[0][due & TW_MASK], ev, link);
+	else
+		LINK_TAIL_DLIST(tw_wheel[1][(due >> TW_BITS) & TW_MASK],
+				ev, link);
+}
+
+
+/*
+ * timer_event_cancel - take an event off the wheel, if armed
+ */
+void
+timer_event_cancel(
+	timer_event *	ev
+	)
+{
+	if (ev->link.f != NULL) {
+		UNLINK_DLIST(ev, link);
+		ev->link.f = NULL;
+		ev->link.b = NULL;
+	}
+}
+
+
+/*
+ * timer_wheel_tick - cascade and fire the events due at current_time
+ */
+static void
+timer_wheel_tick(void)
+{
+	timer_event *	head;
+	timer_event *	ev;
+
+	if (NULL == tw_wheel[0][0].link.f)
+		timer_wheel_init();
+
+	tw_now = current_time;
+	if (0 == (tw_now & TW_MASK)) {
+		head = &tw_wheel[1][(tw_now >> TW_BITS) & TW_MASK];
+		ITER_DLIST_BEGIN(*head, ev, link, timer_event)
+			if (ev->due - tw_now < TW_SLOTS) {
+				UNLINK_DLIST(ev, link);
+				LINK_TAIL_DLIST(tw_wheel[0][ev->due & TW_MASK],
+						ev, link);
+			}
+		ITER_DLIST_END()
+	}
+
+	/*
+	 * Take the events off one at a time, as firing one may cancel
+	 * or arm others.  Events armed for now go to the next tick.
+	 */
+	head = &tw_wheel[0][tw_now & TW_MASK];
+	while ((ev = HEAD_DLIST(*head, link)) != NULL) {
+		if (ev->due > tw_now) {
+			timer_event_arm(ev, ev->due);
+			continue;
+		}
+		timer_event_cancel(ev);
+		(*ev->fire)(ev);
+	}
+}
+
+
+/*
+ * timer_peer - arm the poll timer of a peer for its nextdate
+ */
+void
+timer_peer(
+	struct peer *	p
+	)
+{
+	p->poll_event.fire = timer_peer_fire;
+	timer_event_arm(&p->poll_event, p->nextdate);
+}
+
+
+/*
+ * timer_peer_fire - send a poll when the nextdate of a peer comes up
+ */
+static void
+timer_peer_fire(
+	timer_event *	ev
+	)
+{
+	struct peer *	p;
+
+	p = (struct peer *)((char *)ev - offsetof(struct peer, poll_event));
+#ifdef REFCLOCK
+	if (FLAG_REFCLOCK & p->flags)
+		refclock_transmit(p);
+	else
+#endif	/* REFCLOCK */
+		transmit(p);
+
+	/*
+	 * The peer might have been demobilized, or its structure been
+	 * reused, both of which leave fire cleared or the event armed.
+	 * Otherwise poll again on the next tick as long as nextdate
+	 * has not moved on, as the scan of all peers used to.
+	 */
+	if (timer_peer_fire == ev->fire && NULL == ev->link.f)
+		timer_event_arm(ev, p->nextdate);
+}
+
+
+/*
+ * timer_throttle - bring the throttle of a peer up to date and return
+ *		    it.  The throttle drains by one each second, which
+ *		    is applied here when it is looked at instead of by
+ *		    visiting every peer on each tick.
+ */
+int
+timer_throttle(
+	struct peer *	p
+	)
+{
+	u_long	elapsed;
+
+	elapsed = current_time - p->throttle_time;
+	p->throttle_time = current_time;
+	if (p->throttle > 0) {
+		if (elapsed < (u_long)p->throttle)
+			p->throttle -= (int)elapsed;
+		else
+			p->throttle = 0;
+	}
+	return p->throttle;
+}
+
+
+#ifdef __rtems__
+/*
+ * fast_ms - return the RTEMS uptime in milliseconds
+ */
+static u_long
+fast_ms(void)
+{
+	struct timespec	ts;
+
+	rtems_clock_get_uptime(&ts);
+	return (u_long)ts.tv_sec * 1000 + (u_long)ts.tv_nsec / 1000000;
+}
+
+
+/*
+ * timer_fast_peer - poll a new unicast association sub-second if its
+ *		     address was configured for it
+ */
+void
+timer_fast_peer(
+	struct peer *	p
+	)
+{
+	size_t	i;
+
+	if (!(MDF_UCAST & p->cast_flags))
+		return;
+	for (i = 0; i < COUNTOF(fast_cfg); i++)
+		if (fast_cfg[i].poll_ms
+		    && SOCK_EQ(&fast_cfg[i].addr, &p->srcadr))
+			break;
+	if (i == COUNTOF(fast_cfg))
+		return;
+
+	if (NULL == fast_list)
+		fast_second = fast_ms() + 1000;
+	p->poll_ms = fast_cfg[i].poll_ms;
+	p->fast_due = fast_ms() + p->poll_ms;
+	LINK_SLIST(fast_list, p, fast_link);
+	DPRINTF(1, ("timer_fast_peer: %s every %u ms\n",
+		    stoa(&p->srcadr), p->poll_ms));
+}
+
+
+/*
+ * timer_fast_unpeer - take a peer off the sub-second list
+ */
+void
+timer_fast_unpeer(
+	struct peer *	p
+	)
+{
+	struct peer *	unlinked;
+
+	if (p->poll_ms) {
+		UNLINK_SLIST(unlinked, fast_list, p, fast_link,
+			     struct peer);
+		p->poll_ms = 0;
+	}
+}
+
+
+/*
+ * timer_fast - send the sub-second polls which are due
+ */
+void
+timer_fast(void)
+{
+	struct peer *	p;
+	u_long		now;
+
+	if (NULL == fast_list)
+		return;
+
+	now = fast_ms();
+	for (p = fast_list; p != NULL; p = p->fast_link) {
+		if ((long)(now - p->fast_due) < 0)
+			continue;
+		p->fast_due += p->poll_ms;
+		if ((long)(now - p->fast_due) >= 0)
+			p->fast_due = now + p->poll_ms;
+		transmit_fast(p);
+	}
+}
+
+
+/*
+ * timer_fast_wait - cut a wait for input of timeout ms short to the
+ *		     next sub-second poll or alarm
+ */
+int
+timer_fast_wait(
+	int	timeout
+	)
+{
+	struct peer *	p;
+	u_long		now;
+	long		left;
+
+	if (NULL == fast_list)
+		return timeout;
+
+	now = fast_ms();
+	left = max(0, (long)(fast_second - now));
+	timeout = min(timeout, left);
+	for (p = fast_list; p != NULL; p = p->fast_link) {
+		left = max(0, (long)(p->fast_due - now));
+		timeout = min(timeout, left);
+	}
+	return timeout;
+}
+
+
+/*
+ * timer_fast_alarm - return whether the alarm for timer() is due after
+ *		      a wait for input, which timed out if timedout is
+ *		      nonzero
+ */
+int
+timer_fast_alarm(
+	int	timedout
+	)
+{
+	u_long	now;
+
+	if (NULL == fast_list)
+		return timedout;
+
+	now = fast_ms();
+	if ((long)(now - fast_second) < 0)
+		return FALSE;
+	fast_second += 1000;
+	if ((long)(now - fast_second) >= 0)
+		fast_second = now + 1000;
+	return TRUE;
+}
+#endif /* __rtems__ */
+
+
 /*
  * timer - event timer
  */
 void
 timer(void)
 {
+#ifdef REFCLOCK
 	struct peer *	p;
 	struct peer *	next_peer;
+#endif /* REFCLOCK */
 	l_fp		now;
 	time_t          tnow;
 
@@ -344,30 +739,12 @@ timer(void)
 	}
 
 	/*
-	 * Now dispatch any peers whose event timer has expired. Be
-	 * careful here, since the peer structure might go away as the
-	 * result of the call.
+	 * Now dispatch any peers whose event timer has expired, and
+	 * the other events on the timer wheel.  The throttle which
+	 * restrains the non-burst packet rate to not more than one
+	 * packet every 16 seconds drains in timer_throttle().
 	 */
-	for (p = peer_list; p != NULL; p = next_peer) {
-		next_peer = p->p_link;
-
-		/*
-		 * Restrain the non-burst packet rate not more
-		 * than one packet every 16 seconds. This is
-		 * usually tripped using iburst and minpoll of
-		 * 128 s or less.
-		 */
-		if (p->throttle > 0)
-			p->throttle--;
-		if (p->nextdate <= current_time) {
-#ifdef REFCLOCK
-			if (FLAG_REFCLOCK & p->flags)
-				refclock_transmit(p);
-			else
-#endif	/* REFCLOCK */
-				transmit(p);
-		}
-	}
+	timer_wheel_tick();
 
 	/*
 	 * Orphan mode is active when enabled and when no servers less
@@ -392,6 +769,7 @@ timer(void)
 		sys_offset = 0;
 		sys_rootdelay = 0;
 		sys_rootdisp = 0;
+		update_xmt_template();
 	}
 
 	get_systime(&now);
@@ -1481,6 +1481,9 @@ int scmp_sc[] = {
 			was_alarmed = FALSE;
 			BLOCK_IO_AND_ALARM();
 		}
+#ifdef __rtems__
+		timer_fast();
+#endif /* __rtems__ */
 
 # endif		/* !HAVE_IO_COMPLETION_PORT */
 
@@ -1530,6 +1533,9 @@ int scmp_sc[] = {
 				freerecvbuf(rbuf);
 				rbuf = get_full_recv_buffer();
 			}
+			/* send the replies to this batch together */
+			flush_xmit_queue();
+			shard_publish();
 # ifdef DEBUG_TIMING
 			get_systime(&tsb);
 			L_SUB(&tsb, &tsa);
@@ -3962,6 +3962,15 @@ sysstats(
 	VDC_INIT("ss_limited",		"rate limited:         ", NTP_STR),
 	VDC_INIT("ss_kodsent",		"KoD responses:        ", NTP_STR),
 	VDC_INIT("ss_processed",	"processed for time:   ", NTP_STR),
+	VDC_INIT("ss_fastpath",		"client fast path:     ", NTP_STR),
+	VDC_INIT("ss_fullpath",		"full receive path:    ", NTP_STR),
+	VDC_INIT("ss_inplace",		"in-place replies:     ", NTP_STR),
+	VDC_INIT("ss_rescache_hit",	"restrict cache hits:  ", NTP_STR),
+	VDC_INIT("ss_rescache_miss",	"restrict cache misses:", NTP_STR),
+	VDC_INIT("peer_buckets",	"peer hash buckets:    ", NTP_STR),
+	VDC_INIT("peer_longest",	"peer longest chain:   ", NTP_STR),
+	VDC_INIT("assoc_longest",	"assoc longest chain:  ", NTP_STR),
+	VDC_INIT("name_longest",	"name longest chain:   ", NTP_STR),
 #if 0
 	VDC_INIT("ss_lamport",		"Lamport violations:    ", NTP_STR),
 	VDC_INIT("ss_tsrounding",	"bad timestamp rounding:", NTP_STR),
@@ -4055,6 +4064,15 @@ monstats(
 	VDC_INIT("mru_maxage",		"reclaim older than: ", NTP_STR),
 	VDC_INIT("mru_mem",		"kilobytes:          ", NTP_STR),
 	VDC_INIT("mru_maxmem",		"maximum kilobytes:  ", NTP_STR),
+	VDC_INIT("mru_buckets",		"hash buckets:       ", NTP_STR),
+	VDC_INIT("mru_longest",		"longest hash chain: ", NTP_STR),
+	VDC_INIT("mru_avgprobe",	"compares per lookup:", NTP_STR),
+	VDC_INIT("mru_v4bytes",		"IPv4 entry bytes:   ", NTP_STR),
+	VDC_INIT("mru_v6bytes",		"IPv6 entry bytes:   ", NTP_STR),
+	VDC_INIT("mru_allocmem",	"allocated kilobytes:", NTP_STR),
+	VDC_INIT("mru_entrybytes",	"allocated per entry:", NTP_STR),
+	VDC_INIT("mru_sklimited",	"sketch limited:     ", NTP_STR),
+	VDC_INIT("mru_limited",		"entry limited:      ", NTP_STR),
 	VDC_INIT(NULL,			NULL,			0)
     };
 
@@ -4077,6 +4095,12 @@ iostats(
 	VDC_INIT("free_rbuf",		"free receive buffers: ", NTP_STR),
 	VDC_INIT("used_rbuf",		"used receive buffers: ", NTP_STR),
 	VDC_INIT("rbuf_lowater",	"low water refills:    ", NTP_STR),
+	VDC_INIT("rbuf_slab",		"preallocated rbufs:   ", NTP_STR),
+	VDC_INIT("rbuf_small",		"small rbufs:          ", NTP_STR),
+	VDC_INIT("rbuf_promoted",	"small rbuf overflows: ", NTP_STR),
+	VDC_INIT("rbuf_hiwater",	"rbuf high water:      ", NTP_STR),
+	VDC_INIT("rbuf_exhausted",	"rbuf exhaustions:     ", NTP_STR),
+	VDC_INIT("rbuf_dwell",		"rbuf dwell <10us..1s+:", NTP_STR),
 	VDC_INIT("io_dropped",		"dropped packets:      ", NTP_STR),
 	VDC_INIT("io_ignored",		"ignored packets:      ", NTP_STR),
 	VDC_INIT("io_received",		"received packets:     ", NTP_STR),
@@ -4084,6 +4108,13 @@ iostats(
 	VDC_INIT("io_sendfailed",	"packet send failures: ", NTP_STR),
 	VDC_INIT("io_wakeups",		"input wakeups:        ", NTP_STR),
 	VDC_INIT("io_goodwakeups",	"useful input wakeups: ", NTP_STR),
+	VDC_INIT("io_txbatch",		"transmit queue size:  ", NTP_STR),
+	VDC_INIT("io_txflushes",	"transmit flushes:     ", NTP_STR),
+	VDC_INIT("io_txflushfill",	"average flush fill:   ", NTP_STR),
+	VDC_INIT("shards",		"server shards:        ", NTP_STR),
+	VDC_INIT("shard_served",	"shard replies:        ", NTP_STR),
+	VDC_INIT("shard_forwarded",	"shard forwarded:      ", NTP_STR),
+	VDC_INIT("shard_dropped",	"shard drops:          ", NTP_STR),
 	VDC_INIT(NULL,			NULL,			  0)
     };
 
@@ -36,6 +36,13 @@
 #ifndef _RTEMS_NTPD_H
 #define _RTEMS_NTPD_H
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -75,6 +82,413 @@ void rtems_ntpd_stop(void);
  */
 int rtems_ntpd_running(void);
 
+/**
+ * @brief Sets the transmit queue size of the NTP daemon (nptd).
+ *
+ * Server replies produced while a receive batch is processed are queued
+ * and sent together once the batch is done, or as soon as @a count
+ * replies are pending.  The number of flushes and the average replies
+ * per flush are reported by the ``ntpq iostats`` command.  The setting
+ * persists across daemon restarts.
+ *
+ * @param count is the queue size.  It is clamped to the range 0 to 32.  A
+ *   count of zero (the default) sends each reply immediately.
+ */
+void rtems_ntpd_set_tx_batch(int count);
+
+/**
+ * @brief Sets the number of preallocated receive buffers of the NTP daemon
+ * (nptd).
+ *
+ * With a nonzero @a count all receive buffers are carved from one cache
+ * aligned block when the daemon starts, and the pool never grows or uses
+ * the heap afterwards.  The block is reused by later daemon runs.  The
+ * high-water mark, the number of times the pool was exhausted and a
+ * histogram of the buffer dwell times are reported by the
+ * ``ntpq iostats`` command.  The setting takes effect at the next daemon
+ * start.
+ *
+ * @param count is the number of receive buffers.  It is clamped to the
+ *   range 0 to 256.  A count of zero (the default) selects the growing
+ *   pool.
+ */
+void rtems_ntpd_set_recv_slab(int count);
+
+/**
+ * @brief Sets the number of small receive buffers of the NTP daemon
+ * (nptd).
+ *
+ * Small receive buffers only hold a plain NTP packet with a MAC, which is
+ * nearly all traffic, and need a fraction of the memory of a regular
+ * receive buffer.  They are used first; a larger datagram read into a
+ * small buffer is moved to a regular one.  The number of small buffers
+ * and of such moves are reported by the ``ntpq iostats`` command.  The
+ * setting takes effect at the next daemon start.
+ *
+ * @param count is the number of small receive buffers.  It is clamped to
+ *   the range 0 to 256.  The default is 32.  A count of zero reads all
+ *   datagrams into regular receive buffers.
+ */
+void rtems_ntpd_set_recv_small(int count);
+
+/**
+ * @brief Sets the number of server shards of the NTP daemon (nptd).
+ *
+ * Each shard is a worker task pinned to a processor with its own socket
+ * per local unicast address, sharing the port with the daemon through
+ * ``SO_REUSEPORT_LB`` (or ``SO_REUSEPORT``).  The workers answer plain
+ * client requests from a copy of the system variables; everything else
+ * is passed to the daemon task, which keeps peer and clock discipline.
+ * Client requests are only answered by the workers while the restrict
+ * list has just the default entries (besides those the daemon adds for
+ * its own addresses), these need no rate limiting and no association
+ * has a key.  Clients served by a worker are not in the MRU list (``ntpq
+ * mrulist``) and not counted by the ``ntpq sysstats`` command.  The
+ * number of running shards and their replies, forwarded and dropped
+ * packets are reported by the ``ntpq iostats`` command.  The setting
+ * takes effect at the next daemon start.
+ *
+ * @param count is the number of shards.  It is clamped to the range 0 to
+ *   16.  A count of zero (the default) serves all requests from the
+ *   daemon task.
+ *
+ * @retval 0 Successful operation.
+ * @retval -1 The count is not zero and the daemon was built without
+ *   shard support, which needs the poll() backend, POSIX threads and
+ *   ``SO_REUSEPORT``.  The errno is set to ENOTSUP.
+ */
+int rtems_ntpd_set_workers(int count);
+
+/**
+ * @brief Enables or disables the client fast path of the NTP daemon
+ * (nptd).
+ *
+ * Unauthenticated client requests from addresses without an association
+ * are answered right after the restrictions and rate limiting are
+ * applied, skipping the association matching and authentication stages.
+ * Requests from the address of an association always take the full
+ * receive path, so that a keyed association still drops requests which
+ * lack its key.  The number of packets on the fast path and on the full
+ * receive path are reported by the ``ntpq sysstats`` command.  The
+ * setting takes effect immediately and persists across daemon restarts.
+ *
+ * @param enable is nonzero to use the fast path, zero (the default) to
+ *   pass all packets through the full receive path.
+ */
+void rtems_ntpd_set_fast_path(int enable);
+
+/**
+ * @brief Enables or disables the incremental clock selection of the NTP
+ * daemon (nptd).
+ *
+ * Each selection pass starts from the sorted interval endpoints of the
+ * previous pass instead of sorting them from scratch, and the select
+ * jitter used to vote outliers off is computed in linear instead of
+ * quadratic time.  This is meant for configurations with many pool
+ * associations and a raised maximum clock count.  The selected sources
+ * are the same, except that the select jitter may differ from the
+ * default computation by rounding.  The setting takes effect with the
+ * next selection pass and persists across daemon restarts.
+ *
+ * @param enable is nonzero to use the incremental selection, zero (the
+ *   default) to recompute everything on each pass.
+ */
+void rtems_ntpd_set_incremental_select(int enable);
+
+/**
+ * @brief Enables or disables the fast system time reading of the NTP
+ * daemon (nptd).
+ *
+ * The daemon reads the system time for every received and transmitted
+ * packet.  With the fast reading the timecounter is read directly as a
+ * binary time and the random fuzz below the clock resolution is added
+ * in fixed point from a cheap generator, so that no floating point
+ * arithmetic is involved.  Timestamps keep increasing strictly either
+ * way, also across a change of this setting.  The setting takes effect
+ * immediately and persists across daemon restarts.
+ *
+ * @param enable is nonzero to use the fast reading, zero (the default)
+ *   to use the portable one.
+ */
+void rtems_ntpd_set_fast_systime(int enable);
+
+/**
+ * @brief Enables or disables in-place server replies of the NTP daemon
+ * (nptd).
+ *
+ * Replies to client requests are written over the request in its
+ * receive buffer and sent from there instead of being built in a
+ * separate packet first.  Replies with Autokey or MS-SNTP signing
+ * always use a separate packet.  The number of in-place replies is
+ * reported by the ``ntpq sysstats`` command.  The setting takes effect
+ * immediately and persists across daemon restarts.
+ *
+ * @param enable is nonzero (the default) to reply in place.
+ */
+void rtems_ntpd_set_inplace_reply(int enable);
+
+/**
+ * @brief Sets the width of the MRU sketch of the NTP daemon (nptd).
+ *
+ * The sketch counts packets from sources which have no entry in the MRU
+ * list in a fixed amount of memory.  Only sources which send often
+ * enough to matter to rate limiting get an entry, so a flood from many
+ * addresses does not churn the MRU list.  Sources which the sketch
+ * finds too fast while the MRU list is full are rate limited without an
+ * entry.  Sources sending rarely are answered without an entry and do
+ * not show in the ``ntpq mrulist`` output.  The packets limited by the
+ * sketch and by MRU entries are reported by the ``ntpq monstats``
+ * command.  The setting takes effect at the next start of monitoring
+ * and persists across daemon restarts.
+ *
+ * @param width is the number of counters in each of the four rows of
+ *   the sketch.  It is rounded up to a power of two in the range 256 to
+ *   65536.  To tell the sources apart it should be larger than the
+ *   number of packets received in about a minute.  A width of zero (the
+ *   default) disables the sketch.
+ */
+void rtems_ntpd_set_mru_sketch(int width);
+
+/**
+ * @brief Sets the prefix lengths for rate limiting of the NTP daemon
+ * (nptd).
+ *
+ * The MRU list keeps one entry, and so one leaky bucket for the
+ * ``limited`` and ``kod`` restrictions, for each network of the given
+ * prefix length instead of each host address.  A client spreading its
+ * requests over many addresses of a network is then limited as one,
+ * and needs just one entry.  The ``ntpq mrulist`` command shows the
+ * network addresses with the port of the latest request.  The setting
+ * takes effect for new entries and persists across daemon restarts.
+ *
+ * @param prefixlen4 is the prefix length of IPv4 networks.  It is
+ *   clamped to the range 0 to 32.  The default is 32 (host addresses).
+ * @param prefixlen6 is the prefix length of IPv6 networks.  It is
+ *   clamped to the range 0 to 128.  The default is 128 (host
+ *   addresses).  A length of 64 matches the usual subnet size.
+ */
+void rtems_ntpd_set_limit_prefix(int prefixlen4, int prefixlen6);
+
+/**
+ * @brief Sets a sub-second poll interval for a server of the NTP daemon
+ * (nptd).
+ *
+ * A unicast association with the given address is polled at the given
+ * interval of the RTEMS uptime clock in addition to its regular polls
+ * of at least eight seconds.  Reachability and timeouts are still
+ * accounted for at the regular polls, and the extra polls are not
+ * charged to the rate limit of the association.  This fills the clock
+ * filter of a client on a LAN quickly, so it converges and tracks the
+ * server closely.  The clock itself is still updated at most once a
+ * second.  The server has to allow the rate, for example with ``discard
+ * minimum 0`` and without the ``limited`` restriction.  Up to eight
+ * addresses may be set.  The setting takes effect for new associations
+ * and persists across daemon restarts.
+ *
+ * @param addr is the IPv4 or IPv6 address of the server.  The port is
+ *   ignored.
+ * @param interval_ms is the poll interval in milliseconds.  It is
+ *   clamped to the range 10 to 1000.  An interval of zero removes the
+ *   address.
+ *
+ * @retval 0 Successful operation.
+ * @retval -1 The address family is not supported or eight addresses are
+ *   set already.  The errno is set.
+ */
+int rtems_ntpd_set_subsecond_poll(const struct sockaddr *addr,
+    int interval_ms);
+
+/**
+ * @brief This structure describes an entry of the MRU list of the NTP
+ * daemon (nptd).
+ */
+typedef struct {
+  /**
+   * @brief This member is the address and port of the remote host.
+   */
+  union {
+    struct sockaddr sa;
+    struct sockaddr_in sin;
+    struct sockaddr_in6 sin6;
+  } addr;
+
+  /**
+   * @brief This member is the time the first packet was received.
+   */
+  struct timespec first;
+
+  /**
+   * @brief This member is the time the latest packet was received.
+   */
+  struct timespec last;
+
+  /**
+   * @brief This member is the count of packets received.
+   */
+  uint32_t count;
+
+  /**
+   * @brief This member is the restrict flags (RES_*) of the latest
+   *   packet.
+   */
+  uint16_t restrict_flags;
+
+  /**
+   * @brief This member is the mode of the latest packet.
+   */
+  uint8_t mode;
+
+  /**
+   * @brief This member is the version of the latest packet.
+   */
+  uint8_t version;
+} rtems_ntpd_mru_entry;
+
+/**
+ * @brief Copies the MRU list of the NTP daemon (nptd).
+ *
+ * The entries may be copied by any task while the daemon runs.  Each
+ * entry is copied on its own under a sequence lock, so the daemon is
+ * never held up by the copy.  While the daemon changes an entry the copy
+ * waits for a clock tick.  An entry which the daemon moves or reuses
+ * during the copy may be missed or show up twice, like with the ``ntpq
+ * mrulist`` command.  The entries are not in any particular order.
+ *
+ * @param[out] entries is the array to copy the entries to.
+ *
+ * @param max is the number of elements of @a entries.
+ *
+ * @return Returns the number of entries copied.  This is zero if the
+ *   daemon is not monitoring.
+ */
+size_t rtems_ntpd_mru_snapshot(rtems_ntpd_mru_entry *entries, size_t max);
+
+/**
+ * @brief This is the magic of an MRU export of the NTP daemon (nptd).
+ */
+#define RTEMS_NTPD_MRU_MAGIC "NTPMRU\r\n"
+
+/**
+ * @brief This is the format version of an MRU export of the NTP daemon
+ * (nptd).
+ */
+#define RTEMS_NTPD_MRU_VERSION 1
+
+/**
+ * @brief This structure is the header of an MRU export of the NTP daemon
+ * (nptd).
+ *
+ * All members are in network byte order.  The header is followed by
+ * records of @a record_size bytes up to the end of the stream.  Readers
+ * should skip anything past the members they know of a larger record.
+ */
+typedef struct {
+  /**
+   * @brief This member is @ref RTEMS_NTPD_MRU_MAGIC without the
+   *   terminating zero.
+   */
+  char magic[8];
+
+  /**
+   * @brief This member is the format version.
+   */
+  uint16_t version;
+
+  /**
+   * @brief This member is the size of a record.
+   */
+  uint16_t record_size;
+
+  /**
+   * @brief This member is reserved and zero.
+   */
+  uint32_t reserved;
+
+  /**
+   * @brief This member is the seconds of the NTP timestamp the ages of
+   *   the records refer to.
+   */
+  uint32_t ref_seconds;
+
+  /**
+   * @brief This member is the fraction of the NTP timestamp the ages of
+   *   the records refer to.
+   */
+  uint32_t ref_fraction;
+} rtems_ntpd_mru_header;
+
+/**
+ * @brief This structure is a record of an MRU export of the NTP daemon
+ * (nptd).
+ *
+ * All members are in network byte order.  The times are given as ages,
+ * which are fixed point seconds with 8 fraction bits before the
+ * reference time of the header.
+ */
+typedef struct {
+  /**
+   * @brief This member is the IPv6 address or IPv4-mapped IPv6 address of
+   *   the remote host.
+   */
+  uint8_t addr[16];
+
+  /**
+   * @brief This member is the port of the remote host.
+   */
+  uint16_t port;
+
+  /**
+   * @brief This member is 4 for an IPv4 and 6 for an IPv6 host.
+   */
+  uint8_t family;
+
+  /**
+   * @brief This member is the version and mode of the latest packet, as in
+   *   the first octet of an NTP packet without the leap indicator.
+   */
+  uint8_t vn_mode;
+
+  /**
+   * @brief This member is the restrict flags (RES_*) of the latest packet.
+   */
+  uint16_t restrict_flags;
+
+  /**
+   * @brief This member is reserved and zero.
+   */
+  uint16_t reserved;
+
+  /**
+   * @brief This member is the count of packets received.
+   */
+  uint32_t count;
+
+  /**
+   * @brief This member is the age of the first packet received.
+   */
+  uint32_t first_age;
+
+  /**
+   * @brief This member is the age of the latest packet received.
+   */
+  uint32_t last_age;
+} rtems_ntpd_mru_record;
+
+/**
+ * @brief Exports the MRU list of the NTP daemon (nptd).
+ *
+ * Writes an @ref rtems_ntpd_mru_header and a @ref rtems_ntpd_mru_record
+ * for each MRU entry to a file or socket, copying the entries like @ref
+ * rtems_ntpd_mru_snapshot does.  The ``ntp-mru-decode`` host tool prints
+ * the export as text.
+ *
+ * @param fd is the file descriptor to write to.
+ *
+ * @return Returns the number of records written, or -1 with errno set
+ *   if a write failed.
+ */
+ssize_t rtems_ntpd_mru_export(int fd);
+
 
 #ifdef __cplusplus
 }
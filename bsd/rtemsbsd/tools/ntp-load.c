@@ -0,0 +1,365 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file
+ *
+ * @brief Puts a client request load on an NTP server and reports its
+ *   throughput.
+ *
+ * This is a host tool.  It keeps a window of plain client (mode 3)
+ * requests outstanding on each of a number of UDP sockets, so that the
+ * requests come from as many source ports, and sends the next request
+ * of a socket as soon as a reply or a timeout frees a slot.  Once a
+ * second it prints the replies per second, the lost requests, the
+ * kiss-o'-death replies and the median and 99th percentile round trip
+ * time:
+ *
+ *   cc -O2 -o ntp-load bsd/rtemsbsd/tools/ntp-load.c
+ *   ntp-load -c 16 -w 8 -t 60 192.168.1.10
+ *
+ * Run it from a host other than the target, since the daemon ignores
+ * requests from its own addresses.  The ``ntp01`` test with
+ * ``NTP_BENCH_SHARDS`` set steps the number of server shards of the
+ * daemon while this tool runs and prints ``ntpq iostats`` after each
+ * step.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_CONNS 256
+#define MAX_WINDOW 64
+
+/* round trip times in microseconds, the last bucket takes the rest */
+#define RTT_BUCKETS 100000
+
+#define LEN_PKT 48
+#define OFS_STRATUM 1
+#define OFS_ORG 24
+#define OFS_XMT 40
+
+/* version 4, client */
+#define LI_VN_MODE_CLIENT ((4 << 3) | 3)
+#define MODE_SERVER 4
+
+typedef struct {
+  uint64_t tag;
+  uint64_t sent_ns;
+} slot;
+
+typedef struct {
+  int fd;
+  uint32_t seq;
+  slot slots[MAX_WINDOW];
+} conn;
+
+static conn conns[MAX_CONNS];
+static struct pollfd pfds[MAX_CONNS];
+static uint32_t rtt_hist[RTT_BUCKETS];
+
+static int nconns = 8;
+static int window = 4;
+static int timeout_ms = 200;
+
+static uint64_t interval_replies;
+static uint64_t interval_lost;
+static uint64_t interval_kod;
+static uint64_t total_sent;
+static uint64_t total_replies;
+static uint64_t total_lost;
+
+static uint64_t
+now_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void
+put64(unsigned char *p, uint64_t v)
+{
+  int i;
+
+  for (i = 7; i >= 0; i--) {
+    p[i] = (unsigned char)v;
+    v >>= 8;
+  }
+}
+
+static uint64_t
+get64(const unsigned char *p)
+{
+  uint64_t v;
+  int i;
+
+  v = 0;
+  for (i = 0; i < 8; i++) {
+    v = (v << 8) | p[i];
+  }
+  return v;
+}
+
+/*
+ * The transmit timestamp is a tag made of the socket, the slot and a
+ * sequence number.  The server returns it as the origin timestamp.
+ */
+static void
+send_request(int c, int s)
+{
+  unsigned char pkt[LEN_PKT];
+  conn *cn;
+  uint64_t tag;
+
+  cn = &conns[c];
+  tag = ((uint64_t)c << 48) | ((uint64_t)s << 40) | ++cn->seq;
+  memset(pkt, 0, sizeof(pkt));
+  pkt[0] = LI_VN_MODE_CLIENT;
+  put64(&pkt[OFS_XMT], tag);
+  cn->slots[s].tag = tag;
+  cn->slots[s].sent_ns = now_ns();
+  if (send(cn->fd, pkt, sizeof(pkt), 0) == (ssize_t)sizeof(pkt)) {
+    total_sent++;
+  }
+}
+
+static void
+receive_replies(int c)
+{
+  unsigned char pkt[1024];
+  conn *cn;
+  uint64_t tag;
+  uint64_t rtt;
+  ssize_t len;
+  int s;
+
+  cn = &conns[c];
+  for (;;) {
+    len = recv(cn->fd, pkt, sizeof(pkt), 0);
+    if (len < 0) {
+      break;
+    }
+    if (len < LEN_PKT || (pkt[0] & 7) != MODE_SERVER) {
+      continue;
+    }
+    tag = get64(&pkt[OFS_ORG]);
+    if ((int)(tag >> 48) != c) {
+      continue;
+    }
+    s = (int)((tag >> 40) & 0xff);
+    if (s >= window || cn->slots[s].tag != tag) {
+      continue;
+    }
+    if (pkt[OFS_STRATUM] == 0) {
+      interval_kod++;
+    }
+    rtt = (now_ns() - cn->slots[s].sent_ns) / 1000;
+    rtt_hist[rtt < RTT_BUCKETS ? rtt : RTT_BUCKETS - 1]++;
+    interval_replies++;
+    total_replies++;
+    send_request(c, s);
+  }
+}
+
+static void
+expire_requests(uint64_t now)
+{
+  uint64_t limit;
+  int c;
+  int s;
+
+  limit = (uint64_t)timeout_ms * 1000000;
+  for (c = 0; c < nconns; c++) {
+    for (s = 0; s < window; s++) {
+      if (now - conns[c].slots[s].sent_ns > limit) {
+        interval_lost++;
+        total_lost++;
+        send_request(c, s);
+      }
+    }
+  }
+}
+
+static unsigned
+percentile(uint64_t count, unsigned pct)
+{
+  uint64_t want;
+  uint64_t sum;
+  unsigned i;
+
+  want = (count * pct + 99) / 100;
+  sum = 0;
+  for (i = 0; i < RTT_BUCKETS; i++) {
+    sum += rtt_hist[i];
+    if (sum >= want && sum > 0) {
+      return i;
+    }
+  }
+  return 0;
+}
+
+static void
+report(unsigned t, uint64_t elapsed_ns)
+{
+  double rate;
+
+  rate = (double)interval_replies * 1e9 / (double)elapsed_ns;
+  printf("%5u %10.0f %8" PRIu64 " %6" PRIu64 " %8u %8u\n", t, rate,
+    interval_lost, interval_kod, percentile(interval_replies, 50),
+    percentile(interval_replies, 99));
+  fflush(stdout);
+  memset(rtt_hist, 0, sizeof(rtt_hist));
+  interval_replies = 0;
+  interval_lost = 0;
+  interval_kod = 0;
+}
+
+static int
+open_conns(const char *host, const char *port)
+{
+  struct addrinfo hints;
+  struct addrinfo *ai;
+  int rv;
+  int c;
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  rv = getaddrinfo(host, port, &hints, &ai);
+  if (rv != 0) {
+    fprintf(stderr, "ntp-load: %s: %s\n", host, gai_strerror(rv));
+    return -1;
+  }
+  for (c = 0; c < nconns; c++) {
+    conns[c].fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+    if (conns[c].fd < 0 ||
+        connect(conns[c].fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      fprintf(stderr, "ntp-load: socket: %s\n", strerror(errno));
+      freeaddrinfo(ai);
+      return -1;
+    }
+    fcntl(conns[c].fd, F_SETFL, fcntl(conns[c].fd, F_GETFL) | O_NONBLOCK);
+    pfds[c].fd = conns[c].fd;
+    pfds[c].events = POLLIN;
+  }
+  freeaddrinfo(ai);
+  return 0;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+    "usage: ntp-load [-c sockets] [-w window] [-t seconds] "
+    "[-T timeout-ms] host [port]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  uint64_t start;
+  uint64_t last;
+  uint64_t now;
+  unsigned seconds;
+  unsigned t;
+  int opt;
+  int c;
+  int s;
+
+  seconds = 0;
+  while ((opt = getopt(argc, argv, "c:w:t:T:")) != -1) {
+    switch (opt) {
+      case 'c':
+        nconns = atoi(optarg);
+        break;
+      case 'w':
+        window = atoi(optarg);
+        break;
+      case 't':
+        seconds = (unsigned)atoi(optarg);
+        break;
+      case 'T':
+        timeout_ms = atoi(optarg);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (optind >= argc || nconns < 1 || nconns > MAX_CONNS || window < 1 ||
+      window > MAX_WINDOW || timeout_ms < 1) {
+    usage();
+  }
+  if (open_conns(argv[optind], optind + 1 < argc ? argv[optind + 1] :
+      "123") != 0) {
+    return 1;
+  }
+
+  printf("%5s %10s %8s %6s %8s %8s\n", "s", "replies/s", "lost", "kod",
+    "p50/us", "p99/us");
+  for (c = 0; c < nconns; c++) {
+    for (s = 0; s < window; s++) {
+      send_request(c, s);
+    }
+  }
+  start = now_ns();
+  last = start;
+  t = 0;
+  while (seconds == 0 || t < seconds) {
+    if (poll(pfds, (nfds_t)nconns, 10) > 0) {
+      for (c = 0; c < nconns; c++) {
+        if ((pfds[c].revents & POLLIN) != 0) {
+          receive_replies(c);
+        }
+      }
+    }
+    now = now_ns();
+    expire_requests(now);
+    if (now - last >= 1000000000) {
+      report(++t, now - last);
+      last = now;
+    }
+  }
+
+  now = now_ns();
+  printf("sent %" PRIu64 " replies %" PRIu64 " lost %" PRIu64
+    " mean %.0f replies/s\n", total_sent, total_replies, total_lost,
+    (double)total_replies * 1e9 / (double)(now - start));
+  return 0;
+}
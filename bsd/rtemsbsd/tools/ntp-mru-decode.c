@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file
+ *
+ * @brief Prints an MRU export of the NTP daemon as text.
+ *
+ * This is a host tool.  It reads the output of rtems_ntpd_mru_export()
+ * from a file or standard input and prints one line for each record in
+ * the style of the ``ntpq mrulist`` command, newest first:
+ *
+ *   cc -I bsd/rtemsbsd/include -o ntp-mru-decode \
+ *     bsd/rtemsbsd/tools/ntp-mru-decode.c
+ *   ntp-mru-decode mru.bin
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <rtems/ntpd.h>
+
+/* seconds from the NTP epoch (1900) to the UNIX epoch (1970) */
+#define JAN_1970 2208988800UL
+
+/* restrict flags of ntp.h shown in the r column */
+#define RES_LIMITED 0x0040
+#define RES_KOD 0x0800
+
+typedef struct {
+  rtems_ntpd_mru_record rec;
+  double last;
+} mru_row;
+
+static int
+row_compare(const void *a, const void *b)
+{
+  const mru_row *ra = a;
+  const mru_row *rb = b;
+
+  if (ra->last < rb->last) {
+    return -1;
+  }
+  return ra->last > rb->last;
+}
+
+static double
+age(uint32_t a)
+{
+  return ntohl(a) / 256.0;
+}
+
+static void
+print_row(const rtems_ntpd_mru_record *rec)
+{
+  char addr[INET6_ADDRSTRLEN];
+  uint16_t flags = ntohs(rec->restrict_flags);
+  uint32_t count = ntohl(rec->count);
+  double last = age(rec->last_age);
+  double span = age(rec->first_age) - last;
+
+  if (rec->family == 4) {
+    inet_ntop(AF_INET, &rec->addr[12], addr, sizeof(addr));
+  } else {
+    inet_ntop(AF_INET6, rec->addr, addr, sizeof(addr));
+  }
+
+  printf("%6.0f %6.0f %4hx %c %d %d %6u %5u %s\n",
+    last,
+    count > 1 ? span / (count - 1) : 0.0,
+    flags,
+    (flags & RES_KOD) ? 'K' : (flags & RES_LIMITED) ? 'L' : '.',
+    rec->vn_mode & 7,
+    (rec->vn_mode >> 3) & 7,
+    count,
+    ntohs(rec->port),
+    addr);
+}
+
+int
+main(int argc, char **argv)
+{
+  rtems_ntpd_mru_header hdr;
+  mru_row *rows = NULL;
+  size_t nrows = 0;
+  size_t room = 0;
+  size_t size;
+  unsigned char *buf;
+  FILE *in = stdin;
+  time_t ref;
+  size_t i;
+
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [export-file]\n", argv[0]);
+    return 2;
+  }
+  if (argc == 2 && strcmp(argv[1], "-") != 0) {
+    in = fopen(argv[1], "rb");
+    if (in == NULL) {
+      fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+      return 1;
+    }
+  }
+
+  if (fread(&hdr, sizeof(hdr), 1, in) != 1 ||
+      memcmp(hdr.magic, RTEMS_NTPD_MRU_MAGIC, sizeof(hdr.magic)) != 0) {
+    fprintf(stderr, "not an NTP MRU export\n");
+    return 1;
+  }
+  if (ntohs(hdr.version) != RTEMS_NTPD_MRU_VERSION) {
+    fprintf(stderr, "unknown export version %u\n", ntohs(hdr.version));
+    return 1;
+  }
+  size = ntohs(hdr.record_size);
+  if (size < sizeof(rtems_ntpd_mru_record)) {
+    fprintf(stderr, "bad record size %zu\n", size);
+    return 1;
+  }
+  buf = malloc(size);
+  if (buf == NULL) {
+    fprintf(stderr, "out of memory\n");
+    return 1;
+  }
+
+  while (fread(buf, size, 1, in) == 1) {
+    if (nrows == room) {
+      mru_row *more;
+
+      room = room ? 2 * room : 1024;
+      more = realloc(rows, room * sizeof(*rows));
+      if (more == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+      }
+      rows = more;
+    }
+    memcpy(&rows[nrows].rec, buf, sizeof(rows[nrows].rec));
+    rows[nrows].last = age(rows[nrows].rec.last_age);
+    ++nrows;
+  }
+  if (ferror(in)) {
+    fprintf(stderr, "read error: %s\n", strerror(errno));
+    return 1;
+  }
+
+  qsort(rows, nrows, sizeof(*rows), row_compare);
+
+  ref = (time_t)(ntohl(hdr.ref_seconds) - JAN_1970);
+  printf("exported %s", asctime(gmtime(&ref)));
+  printf("lstint avgint rstr r m v  count rport remote address\n");
+  printf("==============================================================\n");
+  for (i = 0; i < nrows; ++i) {
+    print_row(&rows[i].rec);
+  }
+
+  free(buf);
+  free(rows);
+  return 0;
+}
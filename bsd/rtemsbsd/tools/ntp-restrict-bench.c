@@ -0,0 +1,522 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file
+ *
+ * @brief Compares and times the restriction lookups of the NTP daemon.
+ *
+ * This is a host tool.  It fills copies of the IPv4 restriction trie of
+ * ntpd/ntp_restrict.c and of the sorted restriction list it replaced
+ * with the same made up entries, and looks up the same addresses in
+ * both.  Each trie lookup is checked against the first match of the
+ * list scan, which is the entry the daemon used to apply, and both are
+ * timed for each list size given (10, 1000 and 100000 entries by
+ * default).  The restriction decision cache in front of the lookups is
+ * left out, so this is the cost of a cache miss:
+ *
+ *   cc -O2 -o ntp-restrict-bench bsd/rtemsbsd/tools/ntp-restrict-bench.c
+ *   ntp-restrict-bench
+ *   ntp-restrict-bench -n 1000000 -s 7 10 100 1000 10000 100000
+ *
+ * The entries are prefixes of 8 to 32 bits within 10.0.0.0/8, most of
+ * them host entries, plus the default entry, with the match flags the
+ * daemon uses.  Half of the looked up addresses lie in an entry, the
+ * others anywhere in 10.0.0.0/8, and a quarter of them come from the
+ * NTP port.  The exit status is 1 if any result differs.  The copies
+ * here have to follow changes to ntp_restrict.c.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* from ntp.h */
+#define RESM_INTERFACE 0x1000
+#define RESM_NTPONLY 0x2000
+#define RESM_SOURCE 0x4000
+#define NTP_PORT 123
+
+#define KEYBITS 32
+
+/* list scans done per size at most, in entries visited */
+#define SCAN_BUDGET 100000000.0
+
+#define COUNTOF(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct restrict_u restrict_u;
+struct restrict_u {
+  restrict_u *link; /* sorted list */
+  restrict_u *nlink; /* entries of a trie node */
+  uint32_t addr;
+  uint32_t mask;
+  unsigned short mflags;
+};
+
+typedef struct res_node res_node;
+struct res_node {
+  res_node *child[2];
+  res_node *parent;
+  restrict_u *res;
+  unsigned char plen;
+  unsigned char key[16];
+};
+
+typedef struct {
+  uint32_t addr;
+  unsigned short port;
+} lookup;
+
+static restrict_u *entries;
+static size_t nentries;
+static restrict_u *restrictlist4;
+static res_node res_root;
+
+/* keeps the timed lookups */
+static volatile uintptr_t sink;
+
+static const unsigned short mflags_choice[] = {
+  0, 0, 0, 0, RESM_NTPONLY, RESM_SOURCE, RESM_INTERFACE | RESM_NTPONLY
+};
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static uint32_t
+rand32(void)
+{
+  return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static int
+res_key_bit(const unsigned char *key, int bit)
+{
+  return (key[bit >> 3] >> (7 - (bit & 7))) & 1;
+}
+
+static int
+res_prefix_match(const unsigned char *a, const unsigned char *b, int plen)
+{
+  int bytes = plen >> 3;
+  int bits = plen & 7;
+
+  if (memcmp(a, b, (size_t)bytes)) {
+    return 0;
+  }
+  return 0 == bits || !((a[bytes] ^ b[bytes]) & (0xff00 >> bits));
+}
+
+static int
+res_common_bits(const unsigned char *a, const unsigned char *b, int maxbits)
+{
+  int bit;
+  unsigned char diff;
+
+  for (bit = 0; bit < maxbits; bit += 8) {
+    diff = a[bit >> 3] ^ b[bit >> 3];
+    if (diff) {
+      while (!(diff & 0x80)) {
+        diff <<= 1;
+        bit++;
+      }
+      break;
+    }
+  }
+  return bit < maxbits ? bit : maxbits;
+}
+
+static void
+res_key4(uint32_t addr, unsigned char *key)
+{
+  key[0] = (unsigned char)(addr >> 24);
+  key[1] = (unsigned char)(addr >> 16);
+  key[2] = (unsigned char)(addr >> 8);
+  key[3] = (unsigned char)addr;
+}
+
+static res_node *
+res_node_new(const unsigned char *key, int plen, res_node *parent)
+{
+  res_node *rn;
+  int i;
+
+  rn = calloc(1, sizeof(*rn));
+  if (rn == NULL) {
+    perror("ntp-restrict-bench");
+    exit(2);
+  }
+  memcpy(rn->key, key, sizeof(rn->key));
+  i = plen >> 3;
+  if (plen & 7) {
+    rn->key[i++] &= 0xff00 >> (plen & 7);
+  }
+  for (; i < (int)sizeof(rn->key); i++) {
+    rn->key[i] = 0;
+  }
+  rn->plen = (unsigned char)plen;
+  rn->parent = parent;
+  return rn;
+}
+
+/* res_node_get() */
+static res_node *
+res_node_get(const unsigned char *key, int plen)
+{
+  res_node *rn;
+  res_node *child;
+  res_node *split;
+  int b;
+  int common;
+
+  rn = &res_root;
+  while (rn->plen < plen) {
+    b = res_key_bit(key, rn->plen);
+    child = rn->child[b];
+    if (NULL == child) {
+      child = res_node_new(key, plen, rn);
+      rn->child[b] = child;
+      return child;
+    }
+    common = res_common_bits(child->key, key,
+      child->plen < plen ? child->plen : plen);
+    if (common == child->plen) {
+      rn = child;
+      continue;
+    }
+    split = res_node_new(key, common, rn);
+    rn->child[b] = split;
+    split->child[res_key_bit(child->key, common)] = child;
+    child->parent = split;
+    if (common == plen) {
+      return split;
+    }
+    child = res_node_new(key, plen, split);
+    split->child[res_key_bit(key, common)] = child;
+    return child;
+  }
+  return rn;
+}
+
+/* link_res() for a contiguous mask */
+static void
+trie_add(restrict_u *res)
+{
+  unsigned char key[16];
+  restrict_u **pp;
+  res_node *rn;
+  int plen;
+
+  memset(key, 0, sizeof(key));
+  res_key4(res->addr, key);
+  for (plen = 0; plen < 32; plen++) {
+    if (!(res->mask & (0x80000000U >> plen))) {
+      break;
+    }
+  }
+  rn = res_node_get(key, plen);
+  for (pp = &rn->res; *pp != NULL; pp = &(*pp)->nlink) {
+    if (res->mflags > (*pp)->mflags) {
+      break;
+    }
+  }
+  res->nlink = *pp;
+  *pp = res;
+}
+
+/* match_restrict_trie() without the expiry */
+static restrict_u *
+trie_match(uint32_t addr, unsigned short port)
+{
+  res_node *path[KEYBITS + 1];
+  unsigned char key[4];
+  res_node *rn;
+  restrict_u *res;
+  int depth;
+
+  res_key4(addr, key);
+  depth = 0;
+  rn = &res_root;
+  while (rn != NULL) {
+    if (rn->res != NULL) {
+      path[depth++] = rn;
+    }
+    if (rn->plen == KEYBITS) {
+      break;
+    }
+    rn = rn->child[res_key_bit(key, rn->plen)];
+    if (rn != NULL && !res_prefix_match(rn->key, key, rn->plen)) {
+      break;
+    }
+  }
+
+  res = NULL;
+  while (NULL == res && depth > 0) {
+    for (res = path[--depth]->res; res != NULL; res = res->nlink) {
+      if (!(RESM_NTPONLY & res->mflags) || NTP_PORT == port) {
+        break;
+      }
+    }
+  }
+  return res;
+}
+
+/* res_sorts_before4() as a qsort() comparison of entry pointers */
+static int
+res_compare(const void *a, const void *b)
+{
+  const restrict_u *r1 = *(restrict_u *const *)a;
+  const restrict_u *r2 = *(restrict_u *const *)b;
+
+  if (r1->addr != r2->addr) {
+    return r1->addr > r2->addr ? -1 : 1;
+  }
+  if (r1->mask != r2->mask) {
+    return r1->mask > r2->mask ? -1 : 1;
+  }
+  if (r1->mflags != r2->mflags) {
+    return r1->mflags > r2->mflags ? -1 : 1;
+  }
+  return 0;
+}
+
+/* match_restrict4_addr() before the trie, without the expiry */
+static restrict_u *
+list_match(uint32_t addr, unsigned short port)
+{
+  restrict_u *res;
+
+  for (res = restrictlist4; res != NULL; res = res->link) {
+    if (res->addr == (addr & res->mask) &&
+        (!(RESM_NTPONLY & res->mflags) || NTP_PORT == port)) {
+      break;
+    }
+  }
+  return res;
+}
+
+static void
+free_trie(res_node *rn)
+{
+  if (rn->child[0] != NULL) {
+    free_trie(rn->child[0]);
+  }
+  if (rn->child[1] != NULL) {
+    free_trie(rn->child[1]);
+  }
+  if (rn != &res_root) {
+    free(rn);
+  }
+}
+
+/*
+ * Makes n entries plus the default one.  Like hack_restrict(), an entry
+ * with the address, mask and match flags of another one is not added
+ * again, so there may be a few less.
+ */
+static void
+make_entries(size_t n)
+{
+  restrict_u **sorted;
+  restrict_u *res;
+  size_t i, j;
+  int plen;
+
+  free_trie(&res_root);
+  memset(&res_root, 0, sizeof(res_root));
+  free(entries);
+  entries = calloc(n + 1, sizeof(*entries));
+  sorted = calloc(n + 1, sizeof(*sorted));
+  if (entries == NULL || sorted == NULL) {
+    perror("ntp-restrict-bench");
+    exit(2);
+  }
+
+  /* the default entry */
+  sorted[0] = &entries[0];
+  for (i = 1; i <= n; i++) {
+    res = &entries[i];
+    switch (rand() % 8) {
+      case 0:
+        plen = 8 + rand() % 17;
+        break;
+      case 1:
+        plen = 24;
+        break;
+      default:
+        plen = 32;
+        break;
+    }
+    res->mask = ~0U << (32 - plen);
+    res->addr = (0x0a000000U | (rand32() & 0x00ffffffU)) & res->mask;
+    res->mflags = mflags_choice[rand() % COUNTOF(mflags_choice)];
+    sorted[i] = res;
+  }
+  qsort(sorted, n + 1, sizeof(*sorted), res_compare);
+  for (i = 0, j = 0; i <= n; i++) {
+    if (j > 0 && res_compare(&sorted[j - 1], &sorted[i]) == 0) {
+      continue;
+    }
+    sorted[j++] = sorted[i];
+  }
+  nentries = j;
+  restrictlist4 = NULL;
+  for (i = nentries; i > 0; i--) {
+    sorted[i - 1]->link = restrictlist4;
+    restrictlist4 = sorted[i - 1];
+    trie_add(sorted[i - 1]);
+  }
+  free(sorted);
+}
+
+static void
+make_lookups(lookup *lk, size_t n)
+{
+  const restrict_u *res;
+  size_t i;
+
+  for (i = 0; i < n; i++) {
+    if (rand() % 2) {
+      res = &entries[1 + (size_t)rand() % (nentries > 1 ? nentries - 1 : 1)];
+      lk[i].addr = res->addr | (rand32() & ~res->mask);
+    } else {
+      lk[i].addr = 0x0a000000U | (rand32() & 0x00ffffffU);
+    }
+    lk[i].port = (rand() % 4) == 0 ? NTP_PORT : 1024 + rand() % 60000;
+  }
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+    "usage: ntp-restrict-bench [-n lookups] [-s seed] [entries ...]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const size_t default_sizes[] = { 10, 1000, 100000 };
+  const size_t *sizes = default_sizes;
+  size_t nsizes = COUNTOF(default_sizes);
+  size_t *arg_sizes;
+  lookup *lk;
+  size_t nlookups = 1000000;
+  size_t nscan;
+  size_t i, k;
+  unsigned long differ = 0;
+  double t0, t_list, t_trie;
+  int opt;
+
+  srand(1);
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+      case 'n':
+        nlookups = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        srand((unsigned)strtoul(optarg, NULL, 0));
+        break;
+      default:
+        usage();
+    }
+  }
+  if (nlookups == 0) {
+    usage();
+  }
+
+  if (optind < argc) {
+    nsizes = (size_t)(argc - optind);
+    arg_sizes = calloc(nsizes, sizeof(*arg_sizes));
+    if (arg_sizes == NULL) {
+      perror("ntp-restrict-bench");
+      return 2;
+    }
+    for (k = 0; k < nsizes; k++) {
+      arg_sizes[k] = strtoul(argv[optind + (int)k], NULL, 0);
+    }
+    sizes = arg_sizes;
+  }
+
+  lk = calloc(nlookups, sizeof(*lk));
+  if (lk == NULL) {
+    perror("ntp-restrict-bench");
+    return 2;
+  }
+
+  printf("%8s %10s %14s %14s %8s\n", "entries", "checked", "list/s",
+    "trie/s", "speedup");
+  for (k = 0; k < nsizes; k++) {
+    make_entries(sizes[k]);
+    make_lookups(lk, nlookups);
+
+    /* the scan visits about half of the list per lookup */
+    nscan = (size_t)(SCAN_BUDGET / (double)(nentries / 2 + 1));
+    if (nscan > nlookups) {
+      nscan = nlookups;
+    }
+    if (nscan == 0) {
+      nscan = 1;
+    }
+
+    for (i = 0; i < nscan; i++) {
+      if (list_match(lk[i].addr, lk[i].port) !=
+          trie_match(lk[i].addr, lk[i].port)) {
+        if (differ++ < 10) {
+          fprintf(stderr, "differ: %zu entries, address %08x port %u\n",
+            nentries, (unsigned)lk[i].addr, lk[i].port);
+        }
+      }
+    }
+
+    t0 = now();
+    for (i = 0; i < nscan; i++) {
+      sink = (uintptr_t)list_match(lk[i].addr, lk[i].port);
+    }
+    t_list = now() - t0;
+    t0 = now();
+    for (i = 0; i < nlookups; i++) {
+      sink = (uintptr_t)trie_match(lk[i].addr, lk[i].port);
+    }
+    t_trie = now() - t0;
+
+    printf("%8zu %10zu %14.0f %14.0f %7.1fx\n", nentries, nscan,
+      (double)nscan / t_list, (double)nlookups / t_trie,
+      ((double)nlookups / t_trie) / ((double)nscan / t_list));
+  }
+
+  printf("first match differs: %lu\n", differ);
+  free(lk);
+  return differ != 0;
+}
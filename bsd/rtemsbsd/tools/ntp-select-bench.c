@@ -0,0 +1,1031 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file
+ *
+ * @brief Compares and times the selection kernel of the NTP daemon.
+ *
+ * This is a host tool.  It replays a sample stream through a copy of the
+ * sorting part of clock_filter() and through copies of the intersection
+ * part of clock_select() in ntpd/ntp_proto.c, as it is with qsort() and
+ * with the incremental selection, and as it was before with a selection
+ * sort.  The results of both current variants are checked bit for bit
+ * against a plain selection sort with the endpoint order of
+ * endpoint_cmp(), and all are timed on the recorded inputs.  The
+ * previous code orders equal offsets differently, and the passes where
+ * its interval differs are counted.  The stream is read from a
+ * ``peerstats`` file of the daemon, or made up.  Made up values lie on
+ * a grid of 100 microseconds by default, so that equal offsets come up
+ * often.  A grid of zero gives values as from a real clock:
+ *
+ *   cc -O2 -o ntp-select-bench bsd/rtemsbsd/tools/ntp-select-bench.c
+ *   ntp-select-bench peerstats.20240101
+ *   ntp-select-bench -p 64 -n 100000 -s 1
+ *   ntp-select-bench -p 64 -n 100000 -q 0
+ *   ntp-select-bench -p 500 -n 5000 -q 0
+ *
+ * At the end a selection pass over the final peers is run on simulated
+ * ``struct peer`` memory, with the layout and allocation before and
+ * after the hot and cold split.  It reports the cache lines each peer
+ * touches, the time of a pass with warm and with cold caches, and on
+ * Linux the cache misses and cycles of a pass if the performance
+ * counters are available.  The field offsets are those of an LP64 host.
+ *
+ * The exit status is 1 if a current variant differs from the reference.
+ * The copies here have to follow changes to ntp_proto.c.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* from ntp.h */
+#define NTP_SHIFT 8
+#define MAXDISPERSE 16.0
+#define CLOCK_PHI 15e-6
+
+#define MAX_PEERS 1024
+
+/* layout passes and the memory streamed to evict the caches */
+#define WARM_PASSES 2000
+#define COLD_PASSES 200
+#define EVICT_BYTES (64 * 1024 * 1024)
+#define LINE_SIZE 64
+
+/* inputs kept for the timing runs */
+#define MAX_SELECT_CASES 4096
+
+typedef struct {
+  double val;
+  int type;
+  int assoc;
+} endpoint;
+
+typedef struct {
+  char addr[64];
+  double offset[NTP_SHIFT];
+  double delay[NTP_SHIFT];
+  double disp[NTP_SHIFT];
+  int next;
+  double sel_offset;
+  double synch;
+} peer;
+
+typedef struct {
+  double dst[NTP_SHIFT];
+  int ord[NTP_SHIFT];
+} filter_case;
+
+typedef struct {
+  endpoint *ep;
+  int nlist;
+} select_case;
+
+typedef struct {
+  endpoint ep[2 * MAX_PEERS];
+  int last;
+} select_state;
+
+static peer peers[MAX_PEERS];
+static int npeers;
+static unsigned long current_time;
+
+/* the endpoints of the last pass, in peer order */
+static endpoint select_in[2 * MAX_PEERS];
+
+static select_case select_cases[MAX_SELECT_CASES];
+static size_t nselect_cases;
+
+static unsigned long filter_runs;
+static unsigned long select_runs;
+static unsigned long select_old_differ;
+static unsigned long select_differ;
+static unsigned long select_inc_differ;
+
+/* clock_filter() */
+static void
+filter_sort(double *dst, int *ord)
+{
+  double etemp;
+  int i, j, k;
+
+  for (i = 1; i < NTP_SHIFT; i++) {
+    for (j = 0; j < i; j++) {
+      if (dst[j] > dst[i]) {
+        k = ord[j];
+        ord[j] = ord[i];
+        ord[i] = k;
+        etemp = dst[j];
+        dst[j] = dst[i];
+        dst[i] = etemp;
+      }
+    }
+  }
+}
+
+/* clock_select() up to the intersection interval, before */
+static void
+select_old(const endpoint *endp, int nl2, int nlist, double *plow,
+  double *phigh)
+{
+  int indx[2 * MAX_PEERS];
+  double low = 1e9;
+  double high = -1e9;
+  double e;
+  int allow;
+  int i, j, k, n;
+
+  for (i = 0; i < nl2; i++) {
+    indx[i] = i;
+  }
+  for (i = 0; i < nl2; i++) {
+    e = endp[indx[i]].val;
+    k = i;
+    for (j = i + 1; j < nl2; j++) {
+      if (endp[indx[j]].val < e) {
+        e = endp[indx[j]].val;
+        k = j;
+      }
+    }
+    if (k != i) {
+      j = indx[k];
+      indx[k] = indx[i];
+      indx[i] = j;
+    }
+  }
+  for (allow = 0; 2 * allow < nlist; allow++) {
+    n = 0;
+    for (i = 0; i < nl2; i++) {
+      low = endp[indx[i]].val;
+      n -= endp[indx[i]].type;
+      if (n >= nlist - allow) {
+        break;
+      }
+    }
+    n = 0;
+    for (j = nl2 - 1; j >= 0; j--) {
+      high = endp[indx[j]].val;
+      n += endp[indx[j]].type;
+      if (n >= nlist - allow) {
+        break;
+      }
+    }
+    if (high > low) {
+      break;
+    }
+  }
+  *plow = low;
+  *phigh = high;
+}
+
+static int
+endpoint_cmp(const void *a, const void *b)
+{
+  const endpoint *ea = a;
+  const endpoint *eb = b;
+
+  if (ea->val < eb->val) {
+    return -1;
+  }
+  if (ea->val > eb->val) {
+    return 1;
+  }
+  if (ea->type != eb->type) {
+    return ea->type < eb->type ? -1 : 1;
+  }
+  if (ea->assoc != eb->assoc) {
+    return ea->assoc < eb->assoc ? -1 : 1;
+  }
+  return 0;
+}
+
+/*
+ * The intersection interval of clock_select() over endpoints sorted by
+ * endpoint_cmp(), with the scans as they were before.
+ */
+static void
+select_ref(const endpoint *in, int nl2, int nlist, double *plow,
+  double *phigh)
+{
+  endpoint endp[2 * MAX_PEERS];
+  endpoint tmp;
+  double low = 1e9;
+  double high = -1e9;
+  int allow;
+  int i, j, k, n;
+
+  memcpy(endp, in, (size_t)nl2 * sizeof(*endp));
+  for (i = 0; i < nl2; i++) {
+    k = i;
+    for (j = i + 1; j < nl2; j++) {
+      if (endpoint_cmp(&endp[j], &endp[k]) < 0) {
+        k = j;
+      }
+    }
+    tmp = endp[k];
+    endp[k] = endp[i];
+    endp[i] = tmp;
+  }
+  for (allow = 0; 2 * allow < nlist; allow++) {
+    n = 0;
+    for (i = 0; i < nl2; i++) {
+      low = endp[i].val;
+      n -= endp[i].type;
+      if (n >= nlist - allow) {
+        break;
+      }
+    }
+    n = 0;
+    for (j = nl2 - 1; j >= 0; j--) {
+      high = endp[j].val;
+      n += endp[j].type;
+      if (n >= nlist - allow) {
+        break;
+      }
+    }
+    if (high > low) {
+      break;
+    }
+  }
+  *plow = low;
+  *phigh = high;
+}
+
+/*
+ * clock_select() up to the intersection interval, now.  The candidates
+ * are given in peer order by in[], with the endpoints of a candidate
+ * next to each other.  With st the incremental selection is done.
+ */
+static void
+select_new(const endpoint *in, int nl2, int nlist, select_state *st,
+  double *plow, double *phigh)
+{
+  endpoint buf[2 * MAX_PEERS];
+  int lo_reach[MAX_PEERS + 1];
+  int hi_reach[MAX_PEERS + 1];
+  char ends[MAX_PEERS];
+  endpoint *endp;
+  endpoint tmp;
+  double low = 1e9;
+  double high = -1e9;
+  int allow;
+  int i, j, k, n, m;
+
+  if (st != NULL) {
+    endp = st->ep;
+    memset(ends, 0, (size_t)nlist);
+    m = 0;
+    for (i = 0; i < st->last; i++) {
+      k = endp[i].assoc;
+      if (k >= nlist) {
+        continue;
+      }
+      ends[k] = 1;
+      tmp = endp[i];
+      tmp.val = in[2 * k + (tmp.type > 0)].val;
+      endp[m++] = tmp;
+    }
+    for (k = 0; k < nlist; k++) {
+      if (!ends[k]) {
+        endp[m++] = in[2 * k];
+        endp[m++] = in[2 * k + 1];
+      }
+    }
+    for (i = 1; i < nl2; i++) {
+      tmp = endp[i];
+      for (j = i; j > 0 && endpoint_cmp(&endp[j - 1], &tmp) > 0; j--) {
+        endp[j] = endp[j - 1];
+      }
+      endp[j] = tmp;
+    }
+  } else {
+    endp = buf;
+    memcpy(endp, in, (size_t)nl2 * sizeof(*endp));
+    qsort(endp, (size_t)nl2, sizeof(*endp), endpoint_cmp);
+  }
+  if (st != NULL) {
+    st->last = nl2;
+  }
+
+  for (n = 1; n <= nlist; n++) {
+    lo_reach[n] = nl2 - 1;
+    hi_reach[n] = 0;
+  }
+  n = k = 0;
+  for (i = 0; i < nl2; i++) {
+    n -= endp[i].type;
+    while (k < n) {
+      lo_reach[++k] = i;
+    }
+  }
+  n = k = 0;
+  for (j = nl2 - 1; j >= 0; j--) {
+    n += endp[j].type;
+    while (k < n) {
+      hi_reach[++k] = j;
+    }
+  }
+  for (allow = 0; 2 * allow < nlist; allow++) {
+    low = endp[lo_reach[nlist - allow]].val;
+    high = endp[hi_reach[nlist - allow]].val;
+    if (high > low) {
+      break;
+    }
+  }
+  *plow = low;
+  *phigh = high;
+}
+
+static peer *
+find_peer(const char *addr)
+{
+  peer *p;
+  int i;
+
+  for (i = 0; i < npeers; i++) {
+    if (strcmp(peers[i].addr, addr) == 0) {
+      return &peers[i];
+    }
+  }
+  if (npeers == MAX_PEERS) {
+    return NULL;
+  }
+  p = &peers[npeers++];
+  snprintf(p->addr, sizeof(p->addr), "%s", addr);
+  for (i = 0; i < NTP_SHIFT; i++) {
+    p->disp[i] = MAXDISPERSE;
+  }
+  return p;
+}
+
+/* true if the intervals differ in any bit */
+static int
+interval_differs(double lo_a, double hi_a, double lo_b, double hi_b)
+{
+  return memcmp(&lo_a, &lo_b, sizeof(double)) != 0 ||
+    memcmp(&hi_a, &hi_b, sizeof(double)) != 0;
+}
+
+/*
+ * Shift a sample into the register of the peer, sort the register, then
+ * run all selections over all peers seen so far.
+ */
+static void
+add_sample(peer *p, double offset, double delay, double disp,
+  select_state *st)
+{
+  endpoint *in = select_in;
+  filter_case fc;
+  double lo_ref, hi_ref, lo_old, hi_old, lo_new, hi_new, lo_inc, hi_inc;
+  int i, j;
+
+  j = p->next;
+  p->offset[j] = offset;
+  p->delay[j] = delay;
+  p->disp[j] = disp;
+  j = (j + 1) % NTP_SHIFT;
+  p->next = j;
+
+  for (i = NTP_SHIFT - 1; i >= 0; i--) {
+    fc.dst[i] = p->disp[j] >= MAXDISPERSE ? MAXDISPERSE : p->delay[j];
+    fc.ord[i] = j;
+    j = (j + 1) % NTP_SHIFT;
+  }
+  filter_sort(fc.dst, fc.ord);
+  filter_runs++;
+
+  j = fc.ord[0];
+  p->sel_offset = p->offset[j];
+  p->synch = p->delay[j] / 2 + p->disp[j];
+
+  for (i = 0; i < npeers; i++) {
+    in[2 * i].type = -1;
+    in[2 * i].val = peers[i].sel_offset - peers[i].synch;
+    in[2 * i].assoc = i;
+    in[2 * i + 1].type = 1;
+    in[2 * i + 1].val = peers[i].sel_offset + peers[i].synch;
+    in[2 * i + 1].assoc = i;
+  }
+  if (nselect_cases < MAX_SELECT_CASES) {
+    select_case *sc = &select_cases[nselect_cases];
+
+    sc->ep = malloc(2 * (size_t)npeers * sizeof(*sc->ep));
+    if (sc->ep != NULL) {
+      memcpy(sc->ep, in, 2 * (size_t)npeers * sizeof(*sc->ep));
+      sc->nlist = npeers;
+      nselect_cases++;
+    }
+  }
+  select_ref(in, 2 * npeers, npeers, &lo_ref, &hi_ref);
+  select_old(in, 2 * npeers, npeers, &lo_old, &hi_old);
+  select_new(in, 2 * npeers, npeers, NULL, &lo_new, &hi_new);
+  select_new(in, 2 * npeers, npeers, st, &lo_inc, &hi_inc);
+  select_runs++;
+  if (interval_differs(lo_ref, hi_ref, lo_old, hi_old)) {
+    select_old_differ++;
+  }
+  if (interval_differs(lo_ref, hi_ref, lo_new, hi_new)) {
+    select_differ++;
+  }
+  if (interval_differs(lo_ref, hi_ref, lo_inc, hi_inc)) {
+    select_inc_differ++;
+  }
+}
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+static double
+time_select(int mode)
+{
+  static select_state st;
+  double t0, low, high;
+  size_t i;
+
+  st.last = 0;
+  t0 = now();
+  for (i = 0; i < nselect_cases; i++) {
+    const select_case *sc = &select_cases[i];
+
+    if (mode == 0) {
+      select_old(sc->ep, 2 * sc->nlist, sc->nlist, &low, &high);
+    } else {
+      select_new(sc->ep, 2 * sc->nlist, sc->nlist,
+        mode == 2 ? &st : NULL, &low, &high);
+    }
+    __asm__ __volatile__("" : : "r"(&low), "r"(&high) : "memory");
+  }
+  return (now() - t0) / (double)nselect_cases * 1e9;
+}
+
+static int
+read_peerstats(FILE *in, select_state *st)
+{
+  char line[256];
+  char addr[64];
+  double sec, offset, delay, disp, jitter;
+  unsigned status;
+  int day;
+  peer *p;
+
+  while (fgets(line, sizeof(line), in) != NULL) {
+    if (sscanf(line, "%d %lf %63s %x %lf %lf %lf %lf", &day, &sec, addr,
+          &status, &offset, &delay, &disp, &jitter) != 8) {
+      continue;
+    }
+    p = find_peer(addr);
+    if (p == NULL) {
+      fprintf(stderr, "more than %d peers\n", MAX_PEERS);
+      return 1;
+    }
+    add_sample(p, offset, delay, disp, st);
+  }
+  if (ferror(in)) {
+    fprintf(stderr, "read error: %s\n", strerror(errno));
+    return 1;
+  }
+  return 0;
+}
+
+/* uniform in [0, n) steps of quantum, or continuous if that is zero */
+static double
+uniform(int n, double quantum)
+{
+  if (quantum > 0) {
+    return (rand() % n) * quantum;
+  }
+  return rand() / ((double)RAND_MAX + 1) * n * 1e-4;
+}
+
+static void
+make_samples(int np, long count, double quantum, select_state *st)
+{
+  char addr[64];
+  double base[MAX_PEERS];
+  double offset, delay, disp;
+  long n;
+  int i;
+
+  for (i = 0; i < np; i++) {
+    base[i] = (rand() % 21 - 10) * 1e-3;
+  }
+  for (n = 0; n < count; n++) {
+    i = (int)(n % np);
+    snprintf(addr, sizeof(addr), "peer%d", i);
+    offset = base[i] - 1e-3 + uniform(21, quantum);
+    delay = 1e-2 + uniform(50, quantum);
+    disp = uniform(8, quantum);
+    add_sample(find_peer(addr), offset, delay, disp, st);
+  }
+}
+
+/*
+ * The fields of struct peer that clock_select(), peer_unfit() and
+ * root_distance() read or write for each association.  selidx is left
+ * out, since the previous code kept an index array instead.
+ */
+enum {
+  F_P_LINK,
+  F_DSTADR,
+  F_FLAGS,
+  F_HPOLL,
+  F_LEAP,
+  F_STRATUM,
+  F_ASSOCID,
+  F_REFID,
+  F_ROOTDELAY,
+  F_ROOTDISP,
+  F_UPDATE,
+  F_STATUS,
+  F_NEW_STATUS,
+  F_REACH,
+  F_FLASH,
+  F_OFFSET,
+  F_DELAY,
+  F_JITTER,
+  F_DISP,
+  NFIELDS
+};
+
+static const size_t field_size[NFIELDS] = {
+  8, 8, 4, 1, 1, 1, 2, 4, 8, 8, 8, 1, 1, 1, 4, 8, 8, 8, 8
+};
+
+typedef struct {
+  const char *name;
+  size_t size;
+  size_t off[NFIELDS];
+  /* chunked allocation as in getmorepeermem() */
+  int first;
+  int inc;
+  int max;
+  size_t align;
+} layout;
+
+/*
+ * offsetof() of include/ntp.h on x86-64, before the split (8 peers
+ * static, then chunks of 4 from the heap) and now (blocks doubling up
+ * to 256 aligned peers).
+ */
+static const layout layouts[] = {
+  {
+    "before", 920,
+    { 0, 200, 216, 212, 240, 242, 208, 264, 248, 256, 720, 280, 281, 282,
+      284, 624, 632, 640, 648 },
+    8, 4, 4, 16
+  }, {
+    "now", 928,
+    { 0, 16, 152, 159, 160, 162, 166, 168, 176, 184, 192, 200, 201, 208,
+      212, 216, 224, 232, 240 },
+    8, 0, 256, LINE_SIZE
+  }
+};
+
+typedef struct {
+  unsigned char *mem[MAX_PEERS];
+  int nmem;
+  unsigned char *head;
+  int n;
+} peer_pool;
+
+#define FIELD(lo, p, f, type) (*(type *)((p) + (lo)->off[f]))
+
+/*
+ * Allocate n peers the way ntp_peer.c does and link them on a list in
+ * the order newpeer() does, the last allocated first.
+ */
+static int
+pool_make(peer_pool *pool, const layout *lo, int n)
+{
+  unsigned char *p;
+  size_t stride;
+  int chunk;
+  int total;
+  int i;
+
+  memset(pool, 0, sizeof(*pool));
+  stride = (lo->size + lo->align - 1) & ~(lo->align - 1);
+  total = 0;
+  while (total < n) {
+    if (total == 0) {
+      chunk = lo->first;
+    } else if (lo->inc != 0) {
+      chunk = lo->inc;
+    } else {
+      chunk = total < lo->max ? total : lo->max;
+    }
+    if (pool->nmem == (int)(sizeof(pool->mem) / sizeof(pool->mem[0]))) {
+      return -1;
+    }
+    p = aligned_alloc(LINE_SIZE, (chunk * stride + LINE_SIZE) &
+      ~(size_t)(LINE_SIZE - 1));
+    if (p == NULL) {
+      return -1;
+    }
+    memset(p, 0, (size_t)chunk * stride);
+    pool->mem[pool->nmem++] = p;
+    /* the heap aligns only to lo->align */
+    p += lo->align % LINE_SIZE;
+    for (i = 0; i < chunk && total < n; i++, total++) {
+      FIELD(lo, p, F_P_LINK, unsigned char *) = pool->head;
+      pool->head = p;
+      p += stride;
+    }
+  }
+  pool->n = n;
+  return 0;
+}
+
+static void
+pool_free(peer_pool *pool)
+{
+  int i;
+
+  for (i = 0; i < pool->nmem; i++) {
+    free(pool->mem[i]);
+  }
+}
+
+/* fill in the selection state of the peers, so it gives the same interval */
+static void
+pool_fill(peer_pool *pool, const layout *lo)
+{
+  unsigned char *p;
+  int i;
+
+  i = pool->n;
+  for (p = pool->head; p != NULL;
+      p = FIELD(lo, p, F_P_LINK, unsigned char *)) {
+    i--;
+    FIELD(lo, p, F_DSTADR, void *) = p;
+    FIELD(lo, p, F_STRATUM, unsigned char) = 2;
+    FIELD(lo, p, F_REACH, unsigned char) = 0xff;
+    FIELD(lo, p, F_HPOLL, unsigned char) = 6;
+    FIELD(lo, p, F_ASSOCID, unsigned short) = (unsigned short)i;
+    FIELD(lo, p, F_REFID, uint32_t) = 0x7f000001;
+    FIELD(lo, p, F_OFFSET, double) = peers[i].sel_offset;
+    FIELD(lo, p, F_DELAY, double) = peers[i].synch;
+    FIELD(lo, p, F_DISP, double) = peers[i].synch / 2;
+  }
+}
+
+static endpoint layout_endp[2 * MAX_PEERS];
+
+/*
+ * The per peer part of clock_select() with peer_unfit() and
+ * root_distance().  It returns the number of endpoints.
+ */
+static int
+layout_walk(const layout *lo, unsigned char *head)
+{
+  endpoint *endp = layout_endp;
+  unsigned char *p;
+  double f;
+  int nl2;
+
+  nl2 = 0;
+  for (p = head; p != NULL; p = FIELD(lo, p, F_P_LINK, unsigned char *)) {
+    FIELD(lo, p, F_NEW_STATUS, unsigned char) = 0;
+    if (FIELD(lo, p, F_LEAP, unsigned char) == 3 ||
+        FIELD(lo, p, F_STRATUM, unsigned char) >= 16 ||
+        FIELD(lo, p, F_REACH, unsigned char) == 0 ||
+        (FIELD(lo, p, F_FLAGS, unsigned) & 0x1000) != 0 ||
+        FIELD(lo, p, F_DSTADR, void *) == NULL ||
+        FIELD(lo, p, F_REFID, uint32_t) == 0) {
+      FIELD(lo, p, F_FLASH, int) |= 0x100;
+      continue;
+    }
+    FIELD(lo, p, F_FLASH, int) &= ~0x3c0;
+    f = (FIELD(lo, p, F_DELAY, double) +
+      FIELD(lo, p, F_ROOTDELAY, double)) / 2 +
+      FIELD(lo, p, F_DISP, double) + CLOCK_PHI *
+      (double)(current_time - FIELD(lo, p, F_UPDATE, unsigned long)) +
+      FIELD(lo, p, F_ROOTDISP, double) + FIELD(lo, p, F_JITTER, double);
+    FIELD(lo, p, F_NEW_STATUS, unsigned char) =
+      FIELD(lo, p, F_STATUS, unsigned char) | 1;
+    endp[nl2].type = -1;
+    endp[nl2].val = FIELD(lo, p, F_OFFSET, double) - f;
+    endp[nl2].assoc = FIELD(lo, p, F_ASSOCID, unsigned short);
+    nl2++;
+    endp[nl2].type = 1;
+    endp[nl2].val = FIELD(lo, p, F_OFFSET, double) + f;
+    endp[nl2].assoc = FIELD(lo, p, F_ASSOCID, unsigned short);
+    nl2++;
+  }
+  return nl2;
+}
+
+/* the distinct cache lines the fields of a peer lie in, summed up */
+static unsigned long
+layout_lines(const layout *lo, unsigned char *head)
+{
+  uintptr_t line[NFIELDS * 2];
+  uintptr_t a;
+  unsigned long total;
+  unsigned char *p;
+  int nline;
+  int f, i;
+
+  total = 0;
+  for (p = head; p != NULL; p = FIELD(lo, p, F_P_LINK, unsigned char *)) {
+    nline = 0;
+    for (f = 0; f < NFIELDS; f++) {
+      for (a = (uintptr_t)p + lo->off[f];
+          a < (uintptr_t)p + lo->off[f] + field_size[f];
+          a = (a | (LINE_SIZE - 1)) + 1) {
+        for (i = 0; i < nline && line[i] != a / LINE_SIZE; i++) {
+          continue;
+        }
+        if (i == nline) {
+          line[nline++] = a / LINE_SIZE;
+        }
+      }
+    }
+    total += (unsigned long)nline;
+  }
+  return total;
+}
+
+#ifdef __linux__
+static int
+perf_open(uint64_t config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+typedef struct {
+  int fd[2];
+  int error;
+  uint64_t value[2];
+} counters;
+
+static void
+counters_open(counters *c)
+{
+#ifdef __linux__
+  errno = 0;
+  c->fd[0] = perf_open(PERF_COUNT_HW_CACHE_MISSES);
+  c->fd[1] = perf_open(PERF_COUNT_HW_CPU_CYCLES);
+  c->error = errno;
+#else
+  c->fd[0] = -1;
+  c->fd[1] = -1;
+  c->error = ENOSYS;
+#endif
+  c->value[0] = 0;
+  c->value[1] = 0;
+}
+
+static void
+counters_enable(counters *c, int on)
+{
+#ifdef __linux__
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (c->fd[i] >= 0) {
+      ioctl(c->fd[i], on ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+#else
+  (void)c;
+  (void)on;
+#endif
+}
+
+static void
+counters_close(counters *c)
+{
+  int i;
+
+  for (i = 0; i < 2; i++) {
+    if (c->fd[i] >= 0) {
+      if (read(c->fd[i], &c->value[i], sizeof(c->value[i])) !=
+          (ssize_t)sizeof(c->value[i])) {
+        c->value[i] = 0;
+      }
+      close(c->fd[i]);
+    }
+  }
+}
+
+/*
+ * A selection pass, the walk over the peers and then the sort and the
+ * intersection.  The time of the walk is added to walk_time.
+ */
+static void
+layout_pass(const layout *lo, unsigned char *head, double *walk_time,
+  double *plow, double *phigh)
+{
+  double t0;
+  int nl2;
+
+  t0 = now();
+  nl2 = layout_walk(lo, head);
+  *walk_time += now() - t0;
+  select_new(layout_endp, nl2, nl2 / 2, NULL, plow, phigh);
+}
+
+/* time the passes of a layout with warm and with cold caches */
+static int
+run_layout(const layout *lo, int np, double lo_ref, double hi_ref)
+{
+  static unsigned char *evict;
+  counters warm_c, cold_c;
+  peer_pool pool;
+  double low, high, t0, warm, cold, warm_walk, cold_walk;
+  int differ;
+  int i;
+
+  if (evict == NULL) {
+    evict = malloc(EVICT_BYTES);
+    if (evict == NULL) {
+      return -1;
+    }
+  }
+  if (pool_make(&pool, lo, np) != 0) {
+    fprintf(stderr, "layout %s: out of memory\n", lo->name);
+    pool_free(&pool);
+    return -1;
+  }
+  pool_fill(&pool, lo);
+  warm_walk = 0;
+  layout_pass(lo, pool.head, &warm_walk, &low, &high);
+  differ = interval_differs(lo_ref, hi_ref, low, high);
+
+  counters_open(&warm_c);
+  warm_walk = 0;
+  t0 = now();
+  counters_enable(&warm_c, 1);
+  for (i = 0; i < WARM_PASSES; i++) {
+    layout_pass(lo, pool.head, &warm_walk, &low, &high);
+    __asm__ __volatile__("" : : "r"(&low), "r"(&high) : "memory");
+  }
+  counters_enable(&warm_c, 0);
+  warm = (now() - t0) / WARM_PASSES * 1e9;
+  warm_walk = warm_walk / WARM_PASSES * 1e9;
+  counters_close(&warm_c);
+
+  counters_open(&cold_c);
+  cold = 0;
+  cold_walk = 0;
+  for (i = 0; i < COLD_PASSES; i++) {
+    memset(evict, i, EVICT_BYTES);
+    __asm__ __volatile__("" : : "r"(evict) : "memory");
+    t0 = now();
+    counters_enable(&cold_c, 1);
+    layout_pass(lo, pool.head, &cold_walk, &low, &high);
+    counters_enable(&cold_c, 0);
+    cold += now() - t0;
+    __asm__ __volatile__("" : : "r"(&low), "r"(&high) : "memory");
+  }
+  cold = cold / COLD_PASSES * 1e9;
+  cold_walk = cold_walk / COLD_PASSES * 1e9;
+  counters_close(&cold_c);
+
+  printf("layout %s: %zu bytes, %.1f lines per peer%s\n", lo->name,
+    lo->size, (double)layout_lines(lo, pool.head) / np,
+    differ ? ", interval differs" : "");
+  printf("layout %s: pass warm %.0f ns, cold %.0f ns; walk over the peers "
+    "warm %.0f ns, cold %.0f ns\n", lo->name, warm, cold, warm_walk,
+    cold_walk);
+  if (warm_c.fd[0] >= 0 && cold_c.fd[0] >= 0) {
+    printf("layout %s: misses per pass warm %.0f, cold %.0f\n", lo->name,
+      (double)warm_c.value[0] / WARM_PASSES,
+      (double)cold_c.value[0] / COLD_PASSES);
+  }
+  if (warm_c.fd[1] >= 0 && cold_c.fd[1] >= 0) {
+    printf("layout %s: cycles per pass warm %.0f, cold %.0f\n", lo->name,
+      (double)warm_c.value[1] / WARM_PASSES,
+      (double)cold_c.value[1] / COLD_PASSES);
+  }
+  if (warm_c.fd[0] < 0 || warm_c.fd[1] < 0) {
+    printf("layout %s: performance counters unavailable: %s\n", lo->name,
+      strerror(warm_c.error));
+  }
+  pool_free(&pool);
+  return differ;
+}
+
+int
+main(int argc, char **argv)
+{
+  static select_state st;
+  long count = 100000;
+  double quantum = 1e-4;
+  double lo_ref, hi_ref;
+  int np = 16;
+  int rv = 0;
+  FILE *in;
+  size_t i;
+  int c;
+
+  while ((c = getopt(argc, argv, "n:p:q:s:")) != -1) {
+    switch (c) {
+    case 'n':
+      count = strtol(optarg, NULL, 0);
+      break;
+    case 'p':
+      np = atoi(optarg);
+      break;
+    case 'q':
+      quantum = strtod(optarg, NULL);
+      break;
+    case 's':
+      srand((unsigned)strtoul(optarg, NULL, 0));
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-n samples] [-p peers] [-q grid] "
+        "[-s seed] [peerstats-file]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (np < 1 || np > MAX_PEERS || count < 1) {
+    fprintf(stderr, "need 1 to %d peers and some samples\n", MAX_PEERS);
+    return 2;
+  }
+
+  if (optind < argc) {
+    in = strcmp(argv[optind], "-") == 0 ? stdin : fopen(argv[optind], "r");
+    if (in == NULL) {
+      fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+      return 1;
+    }
+    rv = read_peerstats(in, &st);
+  } else {
+    make_samples(np, count, quantum, &st);
+  }
+  if (filter_runs == 0) {
+    fprintf(stderr, "no samples\n");
+    return 1;
+  }
+
+  printf("select: %lu passes over up to %d peers, %lu differ, "
+    "%lu incremental differ, %lu differ before\n", select_runs, npeers,
+    select_differ, select_inc_differ, select_old_differ);
+  printf("select: old %.0f ns, new %.0f ns, incremental %.0f ns\n",
+    time_select(0), time_select(1), time_select(2));
+
+  select_ref(select_in, 2 * npeers, npeers, &lo_ref, &hi_ref);
+  for (i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++) {
+    if (run_layout(&layouts[i], npeers, lo_ref, hi_ref) != 0) {
+      rv = 1;
+    }
+  }
+
+  for (i = 0; i < nselect_cases; i++) {
+    free(select_cases[i].ep);
+  }
+  if (select_differ != 0 || select_inc_differ != 0) {
+    rv = 1;
+  }
+  return rv;
+}
@@ -0,0 +1,525 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+
+/**
+ * @file
+ *
+ * @brief Checks and times the timer wheel of the NTP daemon.
+ *
+ * This is a host tool.  It runs a copy of the timer wheel of
+ * ntpd/ntp_timer.c in two ways.  The check arms, re-arms and cancels
+ * events at random over many ticks and verifies that each armed event
+ * fires exactly on its due tick and a cancelled one never does.  The
+ * timing run polls a number of associations with random poll intervals
+ * of 64 to 1024 seconds, once through the wheel and once by the scan of
+ * all peers on every tick which the wheel replaced, and reports the
+ * cost per tick of both.  The peer structures are as large as on a
+ * 64-bit host with the scanned members at their offsets there, so the
+ * scan touches as much memory as it did in the daemon:
+ *
+ *   cc -O2 -o ntp-wheel-bench bsd/rtemsbsd/tools/ntp-wheel-bench.c
+ *   ntp-wheel-bench -c
+ *   ntp-wheel-bench -t 100000 10 100 1000 5000
+ *
+ * The check defaults to 5000 events over 600000 ticks, the timing run
+ * to 10, 100, 1000 and 5000 associations over 100000 ticks.  Both runs
+ * also compare the polls sent through the wheel and by the scan.  The
+ * exit status is 1 if anything differs.  The copy here has to follow
+ * changes to ntp_timer.c.
+ */
+
+/*
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* from ntp_timer.c */
+#define TW_BITS 8
+#define TW_SLOTS (1 << TW_BITS)
+#define TW_MASK (TW_SLOTS - 1)
+
+#define MINPOLL 6
+#define MAXPOLL 10
+
+#define COUNTOF(a) (sizeof(a) / sizeof((a)[0]))
+
+typedef struct timer_event timer_event;
+struct timer_event {
+  timer_event *f;
+  timer_event *b;
+  unsigned long due;
+  void (*fire)(timer_event *);
+};
+
+/*
+ * struct peer is 944 octets on x86-64 with p_link at 0, throttle at 660,
+ * nextdate at 680 and poll_event at 688.
+ */
+typedef struct peer peer;
+struct peer {
+  peer *p_link;
+  char pad0[652];
+  int throttle;
+  int hpoll;
+  unsigned long throttle_time;
+  unsigned long nextdate;
+  timer_event poll_event;
+  unsigned long polls;
+  char pad1[216];
+};
+
+typedef struct {
+  timer_event ev;
+  unsigned long want; /* due tick, 0 if not armed */
+  unsigned long fired;
+} check_event;
+
+static timer_event tw_wheel[2][TW_SLOTS];
+static unsigned long tw_now;
+static unsigned long current_time;
+
+static peer *peer_list;
+static peer *peers;
+
+static unsigned long check_errors;
+
+static double
+now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+/* INIT_DLIST() and friends from ntp_lists.h, the head is a sentinel */
+static void
+list_init(timer_event *head)
+{
+  head->f = head;
+  head->b = head;
+}
+
+static void
+list_link_tail(timer_event *head, timer_event *ev)
+{
+  ev->f = head;
+  ev->b = head->b;
+  head->b->f = ev;
+  head->b = ev;
+}
+
+static void
+list_unlink(timer_event *ev)
+{
+  ev->b->f = ev->f;
+  ev->f->b = ev->b;
+}
+
+static void
+timer_wheel_init(void)
+{
+  int l;
+  int i;
+
+  for (l = 0; l < 2; l++) {
+    for (i = 0; i < TW_SLOTS; i++) {
+      list_init(&tw_wheel[l][i]);
+    }
+  }
+  tw_now = 0;
+  current_time = 0;
+}
+
+static void
+timer_event_cancel(timer_event *ev)
+{
+  if (ev->f != NULL) {
+    list_unlink(ev);
+    ev->f = NULL;
+    ev->b = NULL;
+  }
+}
+
+static void
+timer_event_arm(timer_event *ev, unsigned long due)
+{
+  timer_event_cancel(ev);
+  if (due <= tw_now) {
+    due = tw_now + 1;
+  }
+  ev->due = due;
+  if (due - tw_now < TW_SLOTS) {
+    list_link_tail(&tw_wheel[0][due & TW_MASK], ev);
+  } else {
+    list_link_tail(&tw_wheel[1][(due >> TW_BITS) & TW_MASK], ev);
+  }
+}
+
+static void
+timer_wheel_tick(void)
+{
+  timer_event *head;
+  timer_event *ev;
+  timer_event *next;
+
+  tw_now = current_time;
+  if (0 == (tw_now & TW_MASK)) {
+    head = &tw_wheel[1][(tw_now >> TW_BITS) & TW_MASK];
+    for (ev = head->f; ev != head; ev = next) {
+      next = ev->f;
+      if (ev->due - tw_now < TW_SLOTS) {
+        list_unlink(ev);
+        list_link_tail(&tw_wheel[0][ev->due & TW_MASK], ev);
+      }
+    }
+  }
+
+  head = &tw_wheel[0][tw_now & TW_MASK];
+  while ((ev = head->f) != head) {
+    if (ev->due > tw_now) {
+      timer_event_arm(ev, ev->due);
+      continue;
+    }
+    timer_event_cancel(ev);
+    (*ev->fire)(ev);
+  }
+}
+
+static void
+check_fire(timer_event *ev)
+{
+  check_event *ce;
+
+  ce = (check_event *)((char *)ev - offsetof(check_event, ev));
+  if (ce->want != current_time) {
+    if (check_errors++ < 10) {
+      fprintf(stderr, "event due %lu fired at %lu\n", ce->want,
+        current_time);
+    }
+  }
+  ce->want = 0;
+  ce->fired++;
+}
+
+/* a due time from the next tick to two turns of the second level */
+static unsigned long
+random_due(void)
+{
+  switch (rand() % 4) {
+    case 0:
+      return current_time + 1 + (unsigned long)(rand() % 4);
+    case 1:
+      return current_time + 1 + (unsigned long)(rand() % TW_SLOTS);
+    default:
+      return current_time + 1 +
+        (unsigned long)(rand() % (2 * TW_SLOTS * TW_SLOTS));
+  }
+}
+
+static int
+run_check(size_t nevents, unsigned long ticks)
+{
+  check_event *ce;
+  unsigned long armed = 0;
+  unsigned long cancelled = 0;
+  unsigned long fired = 0;
+  size_t i;
+  int r;
+
+  ce = calloc(nevents, sizeof(*ce));
+  if (ce == NULL) {
+    perror("ntp-wheel-bench");
+    exit(2);
+  }
+  timer_wheel_init();
+  check_errors = 0;
+  for (i = 0; i < nevents; i++) {
+    ce[i].ev.fire = check_fire;
+    ce[i].want = random_due();
+    timer_event_arm(&ce[i].ev, ce[i].want);
+    armed++;
+  }
+  while (current_time < ticks) {
+    current_time++;
+    timer_wheel_tick();
+    /* a few changes of mind per tick */
+    for (r = rand() % 4; r > 0; r--) {
+      i = (size_t)rand() % nevents;
+      if (ce[i].want != 0 && rand() % 4 == 0) {
+        timer_event_cancel(&ce[i].ev);
+        ce[i].want = 0;
+        cancelled++;
+      } else {
+        ce[i].want = random_due();
+        timer_event_arm(&ce[i].ev, ce[i].want);
+        armed++;
+      }
+    }
+  }
+  for (i = 0; i < nevents; i++) {
+    fired += ce[i].fired;
+    if (ce[i].want != 0 && ce[i].want <= current_time) {
+      if (check_errors++ < 10) {
+        fprintf(stderr, "event due %lu never fired\n", ce[i].want);
+      }
+    }
+  }
+  printf("check: %zu events, %lu ticks, %lu armed, %lu cancelled, "
+    "%lu fired, %lu errors\n", nevents, ticks, armed, cancelled, fired,
+    check_errors);
+  free(ce);
+  return check_errors != 0;
+}
+
+/* timer_throttle() */
+static int
+timer_throttle(peer *p)
+{
+  unsigned long elapsed;
+
+  elapsed = current_time - p->throttle_time;
+  p->throttle_time = current_time;
+  if (elapsed >= (unsigned long)p->throttle) {
+    p->throttle = 0;
+  } else {
+    p->throttle -= (int)elapsed;
+  }
+  return p->throttle;
+}
+
+/*
+ * transmit() as far as the timer sees it: the throttle goes up by one
+ * and the next poll is one poll interval away.
+ */
+static void
+transmit(peer *p, int lazy)
+{
+  if (lazy) {
+    timer_throttle(p);
+  }
+  p->throttle++;
+  p->polls++;
+  p->nextdate = current_time + (1UL << p->hpoll);
+}
+
+static void
+timer_peer_fire(timer_event *ev)
+{
+  peer *p;
+
+  p = (peer *)((char *)ev - offsetof(peer, poll_event));
+  transmit(p, 1);
+  timer_event_arm(ev, p->nextdate);
+}
+
+static void
+make_peers(size_t n)
+{
+  size_t i;
+
+  free(peers);
+  peers = calloc(n, sizeof(*peers));
+  if (peers == NULL) {
+    perror("ntp-wheel-bench");
+    exit(2);
+  }
+  peer_list = NULL;
+  for (i = n; i > 0; i--) {
+    peers[i - 1].p_link = peer_list;
+    peer_list = &peers[i - 1];
+  }
+}
+
+static void
+reset_peers(size_t n, unsigned seed)
+{
+  size_t i;
+
+  srand(seed);
+  for (i = 0; i < n; i++) {
+    peers[i].throttle = 0;
+    peers[i].throttle_time = 0;
+    peers[i].polls = 0;
+    peers[i].hpoll = MINPOLL + rand() % (MAXPOLL - MINPOLL + 1);
+    peers[i].nextdate = 1 + (unsigned long)rand() % (1UL << peers[i].hpoll);
+    memset(&peers[i].poll_event, 0, sizeof(peers[i].poll_event));
+  }
+}
+
+/* the timer() loop before the wheel */
+static double
+time_scan(unsigned long ticks, unsigned long *polls)
+{
+  peer *p;
+  peer *next_peer;
+  double t0;
+
+  current_time = 0;
+  t0 = now();
+  while (current_time < ticks) {
+    current_time++;
+    for (p = peer_list; p != NULL; p = next_peer) {
+      next_peer = p->p_link;
+      if (p->throttle > 0) {
+        p->throttle--;
+      }
+      if (p->nextdate <= current_time) {
+        transmit(p, 0);
+      }
+    }
+  }
+  t0 = now() - t0;
+  *polls = 0;
+  for (p = peer_list; p != NULL; p = p->p_link) {
+    *polls += p->polls;
+  }
+  return t0;
+}
+
+static double
+time_wheel(unsigned long ticks, unsigned long *polls)
+{
+  peer *p;
+  double t0;
+
+  timer_wheel_init();
+  for (p = peer_list; p != NULL; p = p->p_link) {
+    p->poll_event.fire = timer_peer_fire;
+    timer_event_arm(&p->poll_event, p->nextdate);
+  }
+  t0 = now();
+  while (current_time < ticks) {
+    current_time++;
+    timer_wheel_tick();
+  }
+  t0 = now() - t0;
+  *polls = 0;
+  for (p = peer_list; p != NULL; p = p->p_link) {
+    *polls += p->polls;
+  }
+  return t0;
+}
+
+static int
+run_timing(const size_t *sizes, size_t nsizes, unsigned long ticks,
+  unsigned seed)
+{
+  unsigned long polls_scan;
+  unsigned long polls_wheel;
+  double t_scan;
+  double t_wheel;
+  int differ = 0;
+  size_t k;
+
+  printf("%6s %12s %12s %12s %8s\n", "assoc", "polls", "scan ns/tick",
+    "wheel ns/tick", "speedup");
+  for (k = 0; k < nsizes; k++) {
+    make_peers(sizes[k]);
+    reset_peers(sizes[k], seed);
+    t_scan = time_scan(ticks, &polls_scan);
+    reset_peers(sizes[k], seed);
+    t_wheel = time_wheel(ticks, &polls_wheel);
+    if (polls_scan != polls_wheel) {
+      fprintf(stderr, "%zu associations: %lu polls by the scan, %lu by "
+        "the wheel\n", sizes[k], polls_scan, polls_wheel);
+      differ = 1;
+    }
+    printf("%6zu %12lu %12.1f %12.1f %7.1fx\n", sizes[k], polls_wheel,
+      t_scan / (double)ticks * 1e9, t_wheel / (double)ticks * 1e9,
+      t_scan / t_wheel);
+  }
+  return differ;
+}
+
+static void
+usage(void)
+{
+  fprintf(stderr,
+    "usage: ntp-wheel-bench -c [-n events] [-t ticks] [-s seed]\n"
+    "       ntp-wheel-bench [-t ticks] [-s seed] [associations ...]\n");
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  static const size_t default_sizes[] = { 10, 100, 1000, 5000 };
+  size_t *sizes;
+  size_t nevents = 5000;
+  unsigned long ticks = 0;
+  unsigned seed = 1;
+  int check = 0;
+  int opt;
+  int k;
+  int r;
+
+  while ((opt = getopt(argc, argv, "cn:t:s:")) != -1) {
+    switch (opt) {
+      case 'c':
+        check = 1;
+        break;
+      case 'n':
+        nevents = strtoul(optarg, NULL, 0);
+        break;
+      case 't':
+        ticks = strtoul(optarg, NULL, 0);
+        break;
+      case 's':
+        seed = (unsigned)strtoul(optarg, NULL, 0);
+        break;
+      default:
+        usage();
+    }
+  }
+  if (nevents == 0) {
+    usage();
+  }
+
+  if (check) {
+    srand(seed);
+    return run_check(nevents, ticks != 0 ? ticks : 600000);
+  }
+
+  if (ticks == 0) {
+    ticks = 100000;
+  }
+  if (optind == argc) {
+    return run_timing(default_sizes, COUNTOF(default_sizes), ticks, seed);
+  }
+  sizes = calloc((size_t)(argc - optind), sizeof(*sizes));
+  if (sizes == NULL) {
+    perror("ntp-wheel-bench");
+    return 2;
+  }
+  for (k = optind; k < argc; k++) {
+    sizes[k - optind] = strtoul(argv[k], NULL, 0);
+  }
+  r = run_timing(sizes, (size_t)(argc - optind), ticks, seed);
+  free(sizes);
+  return r;
+}
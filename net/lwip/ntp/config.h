@@ -809,6 +809,9 @@
 /* Define to 1 if you have the <setjmp.h> header file. */
 #define HAVE_SETJMP_H 1
 
+/* Define to 1 if you have the `sendmmsg' function. */
+/* #undef HAVE_SENDMMSG */
+
 /* Define to 1 if you have the `setlinebuf' function. */
 #define HAVE_SETLINEBUF 1
 
@@ -1667,6 +1670,9 @@ typedef unsigned int	uintptr_t;
 /* Use OpenSSL's crypto random functions */
 /* #define USE_OPENSSL_CRYPTO_RAND 1 */
 
+/* Use poll() instead of select() in the ntpd I/O loop? */
+/* #undef USE_POLL_IO */
+
 /* OK to use snprintb()? */
 /* #undef USE_SNPRINTB */
 
@@ -134,6 +134,11 @@ def options(opt):
                      action='store_true',
                      dest='ntp_debug',
                      help='Build NTP with DEBUG enabled (default: %default)')
+    copts.add_option('--ntp-select-io',
+                     action='store_true',
+                     dest='ntp_select_io',
+                     help='Use select() in the NTP daemon even where ' +
+                     'poll() is available (default: %default)')
 
 
 def add_flags(flags, new_flags):
@@ -194,6 +199,8 @@ def bsp_configure(conf, arch_bsp):
     conf.env.NTP_DEFINES = []
     if conf.options.ntp_debug:
         conf.env.NTP_DEFINES += ['DEBUG=1']
+    if conf.options.ntp_select_io:
+        conf.env.NTP_DEFINES += ['NTP_SELECT_IO=1']
 
 
 def build(bld):
@@ -29,10 +29,19 @@
  * POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
 #include <stdatomic.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include <rtems/console.h>
 #include <rtems/imfs.h>
@@ -79,6 +88,67 @@ rtems_telnetd_config_table rtems_telnetd_config = {
 #define ntp_str(s) #s
 #define NTP_DEBUG_STR ntp_xstr(NTP_DEBUG)
 
+/*
+ * Server shard benchmark.  The daemon is run with ntp_bench_conf once
+ * for each shard count in ntp_bench_workers for NTP_BENCH_SECS seconds
+ * while bsd/rtemsbsd/tools/ntp-load.c sends client requests from another
+ * host, and the I/O statistics are printed at the end of each run.
+ */
+#define NTP_BENCH_SHARDS 0
+#define NTP_BENCH_SECS 30
+
+/*
+ * MRU snapshot latency test.  Once the daemon runs, mode 6 requests for
+ * a system variable are sent to it on 127.0.0.1, each answered by its
+ * main loop, and their round trip times are reported, first alone and
+ * then while a second task copies the MRU list with
+ * rtems_ntpd_mru_snapshot() without a pause.  Client requests from
+ * other hosts, for example by bsd/rtemsbsd/tools/ntp-load.c, fill the
+ * MRU list.
+ */
+#define NTP_TEST_MRU_LATENCY 0
+#define NTP_LATENCY_PROBES 1000
+#define NTP_SNAPSHOT_MAX 1024
+
+/*
+ * Convergence test.  A first run of the daemon sets the clock.  Then the
+ * clock is moved NTP_CONVERGENCE_STEP_MS ahead and the daemon is started
+ * with the stock polling, and once more with sub-second polls of
+ * NET_CFG_NTP_IP every NTP_CONVERGENCE_POLL_MS.  In both runs the offset
+ * and the leap indicator are read with mode 6 requests on 127.0.0.1 once
+ * a second for NTP_CONVERGENCE_SECS seconds, and the time until the
+ * daemon is synchronized and until the offset stays within
+ * NTP_CONVERGENCE_US is reported.  The server has to allow the poll
+ * rate, see rtems_ntpd_set_subsecond_poll().
+ */
+#define NTP_TEST_CONVERGENCE 0
+#define NTP_CONVERGENCE_SECS 900
+#define NTP_CONVERGENCE_STEP_MS 50
+#define NTP_CONVERGENCE_POLL_MS 125
+#define NTP_CONVERGENCE_US 1000
+
+/*
+ * System time check.  Before the daemon starts, its get_systime() is
+ * called NTP_SYSTIME_CALLS times in a row with the portable and with the
+ * fast reading, see rtems_ntpd_set_fast_systime().  The time per call is
+ * reported, and each timestamp has to come after the previous one.  The
+ * fuzz stands for the one the daemon derives from the clock precision.
+ * It is kept below the time of a call, as otherwise the minimum advance
+ * by the fuzz runs the timestamps ahead of the clock in such a loop.
+ */
+#define NTP_TEST_SYSTIME 1
+#define NTP_SYSTIME_CALLS 100000
+#define NTP_SYSTIME_FUZZ 1e-8
+
+#if NTP_BENCH_SHARDS
+static const int ntp_bench_workers[] = { 0, 1, 2, 4 };
+#define NTP_RUNS ((int) RTEMS_ARRAY_SIZE(ntp_bench_workers))
+#elif NTP_TEST_CONVERGENCE
+#define NTP_RUNS 3
+#else
+#define NTP_RUNS 2
+#endif /* NTP_BENCH_SHARDS */
+
 static const char etc_resolv_conf[] =
     "nameserver " NET_CFG_DNS_IP "\n";
 
@@ -94,6 +164,14 @@ static const char etc_ntp_conf[] =
     "restrict ::1\n"
     "leapfile \"/etc/leap-seconds\"\n";
 
+#if NTP_BENCH_SHARDS
+/* just the default entries without rate limits, so the shards serve */
+static const char etc_ntp_bench_conf[] =
+    "pool " NET_CFG_NTP_IP " iburst\n"
+    "restrict default nomodify notrap nopeer\n"
+    "leapfile \"/etc/leap-seconds\"\n";
+#endif /* NTP_BENCH_SHARDS */
+
 static const char etc_leap_seconds[] =
     "#\n"
     "#	In the following text, the symbol '#' introduces\n"
@@ -359,6 +437,15 @@ static atomic_bool ntp_start;
 static int ntp_run_count;
 static rtems_id ntpd_id;
 
+#if NTP_TEST_MRU_LATENCY
+static atomic_bool mru_snapshot_stop;
+static atomic_bool mru_snapshot_done;
+static uint32_t mru_snapshots;
+static size_t mru_snapshot_entries;
+static rtems_ntpd_mru_entry mru_snapshot[NTP_SNAPSHOT_MAX];
+static uint32_t ntp_latency[NTP_LATENCY_PROBES];
+#endif /* NTP_TEST_MRU_LATENCY */
+
 static void debugger_start(void) {
 #if DEBUGGER
   rtems_printer printer;
@@ -401,6 +488,12 @@ static void setup_etc(void)
       S_IRGRP | S_IROTH, etc_ntp_conf, sizeof(etc_ntp_conf));
   assert(rv == 0);
 
+#if NTP_BENCH_SHARDS
+  rv = IMFS_make_linearfile("/etc/ntp-bench.conf", S_IWUSR | S_IRUSR |
+      S_IRGRP | S_IROTH, etc_ntp_bench_conf, sizeof(etc_ntp_bench_conf));
+  assert(rv == 0);
+#endif /* NTP_BENCH_SHARDS */
+
   rv = IMFS_make_linearfile("/etc/leap-seconds", S_IWUSR | S_IRUSR |
       S_IRGRP | S_IROTH, etc_leap_seconds, sizeof(etc_leap_seconds));
   assert(rv == 0);
@@ -429,14 +522,361 @@ static void ntp_wait_for_start(void) {
   }
 }
 
+#if NTP_TEST_SYSTIME
+/* internal to the daemon, the l_fp is as in ntp_fp.h */
+typedef struct {
+  uint32_t l_ui;
+  uint32_t l_uf;
+} ntp_lfp;
+
+void _ntp_init_systime(void);
+void _ntp_set_sys_fuzz(double fuzz);
+void _ntp_get_systime(ntp_lfp *now);
+extern u_long _ntp_sys_tsrounding;
+
+static void ntp_systime_calls(const char *name, int fast)
+{
+  struct timespec t0;
+  struct timespec t1;
+  ntp_lfp prev;
+  ntp_lfp now;
+  uint64_t ns;
+  u_long rounding;
+  int back = 0;
+  int i;
+
+  rtems_ntpd_set_fast_systime(fast);
+  rounding = _ntp_sys_tsrounding;
+  _ntp_get_systime(&prev);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  for (i = 0; i < NTP_SYSTIME_CALLS; i++) {
+    _ntp_get_systime(&now);
+    if ((int64_t) ((((uint64_t) now.l_ui << 32) | now.l_uf) -
+        (((uint64_t) prev.l_ui << 32) | prev.l_uf)) <= 0) {
+      back++;
+    }
+    prev = now;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  ns = (uint64_t) (t1.tv_sec - t0.tv_sec) * 1000000000 +
+    (uint64_t) (t1.tv_nsec - t0.tv_nsec);
+  printf("systime: %s: %d calls, %" PRIu64 " ns per call, %d not "
+    "increasing, %lu rounded up\n", name, NTP_SYSTIME_CALLS,
+    ns / NTP_SYSTIME_CALLS, back, _ntp_sys_tsrounding - rounding);
+  rtems_test_assert(back == 0);
+}
+
+static void ntp_test_systime(void)
+{
+  _ntp_init_systime();
+  _ntp_set_sys_fuzz(NTP_SYSTIME_FUZZ);
+  ntp_systime_calls("portable", 0);
+  ntp_systime_calls("fast", 1);
+  /* and across the switch back */
+  ntp_systime_calls("portable", 0);
+}
+#endif /* NTP_TEST_SYSTIME */
+
+#if NTP_TEST_MRU_LATENCY || NTP_TEST_CONVERGENCE
+static uint32_t ntp_usecs_since(const struct timespec *t0)
+{
+  struct timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (uint32_t) ((t1.tv_sec - t0->tv_sec) * 1000000 +
+    (t1.tv_nsec - t0->tv_nsec) / 1000);
+}
+
+/* a socket for mode 6 requests to the daemon on 127.0.0.1 */
+static int ntp_control_open(void)
+{
+  struct sockaddr_in sin;
+  struct timeval tv;
+  int fd;
+  int rv;
+
+  fd = socket(AF_INET, SOCK_DGRAM, 0);
+  rtems_test_assert(fd >= 0);
+  tv.tv_sec = 1;
+  tv.tv_usec = 0;
+  rv = setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+  rtems_test_assert(rv == 0);
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_len = sizeof(sin);
+  sin.sin_family = AF_INET;
+  sin.sin_port = htons(123);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  rv = connect(fd, (struct sockaddr *) &sin, sizeof(sin));
+  rtems_test_assert(rv == 0);
+  return fd;
+}
+
+/*
+ * A read variables request for the system variables in the list vars.
+ * The reply data is returned as a string in data, which is empty if
+ * size is zero.  True on a reply in time.
+ */
+static bool ntp_readvar(int fd, uint16_t seq, const char *vars, char *data,
+  size_t size, uint32_t *usecs)
+{
+  uint8_t req[12 + 64];
+  uint8_t rsp[512];
+  struct timespec t0;
+  size_t count;
+  size_t n;
+  ssize_t len;
+
+  n = strlen(vars);
+  rtems_test_assert(n <= sizeof(req) - 12);
+  memset(req, 0, sizeof(req));
+  req[0] = (2 << 3) | 6;
+  req[1] = 2;
+  req[2] = (uint8_t) (seq >> 8);
+  req[3] = (uint8_t) seq;
+  req[11] = (uint8_t) n;
+  memcpy(&req[12], vars, n);
+  /* the request is padded to a multiple of four octets */
+  n = 12 + ((n + 3) & ~(size_t) 3);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  if (send(fd, req, n, 0) != (ssize_t) n) {
+    return false;
+  }
+  for (;;) {
+    len = recv(fd, rsp, sizeof(rsp), 0);
+    if (len < 0) {
+      return false;
+    }
+    if (len >= 12 && (rsp[1] & 0x80) != 0 && rsp[2] == req[2] &&
+        rsp[3] == req[3]) {
+      *usecs = ntp_usecs_since(&t0);
+      break;
+    }
+  }
+  if (size > 0) {
+    count = ((size_t) rsp[10] << 8) | rsp[11];
+    if (count > (size_t) len - 12) {
+      count = (size_t) len - 12;
+    }
+    if (count > size - 1) {
+      count = size - 1;
+    }
+    memcpy(data, &rsp[12], count);
+    data[count] = '\0';
+  }
+  return true;
+}
+#endif /* NTP_TEST_MRU_LATENCY || NTP_TEST_CONVERGENCE */
+
+#if NTP_TEST_MRU_LATENCY
+/* a read variables request for the stratum, true on a reply in time */
+static bool ntp_probe(int fd, uint16_t seq, uint32_t *usecs)
+{
+  return ntp_readvar(fd, seq, "stratum", NULL, 0, usecs);
+}
+
+static int ntp_latency_compare(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *) a;
+  uint32_t y = *(const uint32_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void ntp_latency_phase(const char *name, int fd, uint16_t *seq)
+{
+  size_t n = 0;
+  size_t lost = 0;
+  size_t i;
+
+  for (i = 0; i < NTP_LATENCY_PROBES; i++) {
+    if (ntp_probe(fd, ++*seq, &ntp_latency[n])) {
+      n++;
+    } else {
+      lost++;
+    }
+    usleep(10 * 1000);
+  }
+  if (n == 0) {
+    printf("latency: %s: no replies\n", name);
+    return;
+  }
+  qsort(ntp_latency, n, sizeof(ntp_latency[0]), ntp_latency_compare);
+  printf("latency: %s: %zu replies, %zu lost, us: min %" PRIu32
+    " median %" PRIu32 " p99 %" PRIu32 " max %" PRIu32 "\n", name, n, lost,
+    ntp_latency[0], ntp_latency[n / 2], ntp_latency[(n * 99) / 100],
+    ntp_latency[n - 1]);
+}
+
+static rtems_task mru_snapshot_task(rtems_task_argument argument)
+{
+  (void) argument;
+  while (!mru_snapshot_stop) {
+    mru_snapshot_entries =
+      rtems_ntpd_mru_snapshot(mru_snapshot, NTP_SNAPSHOT_MAX);
+    mru_snapshots++;
+  }
+  mru_snapshot_done = true;
+  rtems_task_delete(RTEMS_SELF);
+}
+
+static void ntp_test_mru_latency(void)
+{
+  rtems_status_code sc;
+  rtems_id id;
+  uint16_t seq = 0;
+  int fd;
+
+  /* let the daemon settle after its start */
+  sleep(5);
+
+  fd = ntp_control_open();
+
+  ntp_latency_phase("alone", fd, &seq);
+
+  /* at the priority of the daemon task, so they share the processor */
+  sc = rtems_task_create(
+    rtems_build_name( 'm', 'r', 'u', 's' ),
+    10,
+    RTEMS_MINIMUM_STACK_SIZE * 4,
+    RTEMS_TIMESLICE,
+    RTEMS_FLOATING_POINT,
+    &id
+  );
+  directive_failed( sc, "rtems_task_create" );
+  sc = rtems_task_start( id, mru_snapshot_task, 0 );
+  directive_failed( sc, "rtems_task_start" );
+
+  ntp_latency_phase("snapshots", fd, &seq);
+
+  mru_snapshot_stop = true;
+  while (!mru_snapshot_done) {
+    usleep(10 * 1000);
+  }
+  printf("latency: %" PRIu32 " snapshots of %zu entries\n", mru_snapshots,
+    mru_snapshot_entries);
+  close(fd);
+}
+#endif /* NTP_TEST_MRU_LATENCY */
+
+#if NTP_TEST_CONVERGENCE
+/* true if the daemon replied and is synchronized */
+static bool ntp_read_offset(int fd, uint16_t seq, double *offset_ms)
+{
+  char data[128];
+  const char *p;
+  uint32_t usecs;
+
+  if (!ntp_readvar(fd, seq, "leap,offset", data, sizeof(data), &usecs)) {
+    return false;
+  }
+  p = strstr(data, "leap=");
+  if (p == NULL || strncmp(p + 5, "11", 2) == 0) {
+    return false;
+  }
+  p = strstr(data, "offset=");
+  if (p == NULL) {
+    return false;
+  }
+  *offset_ms = strtod(p + 7, NULL);
+  return true;
+}
+
+static void ntp_convergence_run(const char *name, int fd, uint16_t *seq)
+{
+  struct timespec ts;
+  double offset_ms = 0.0;
+  double max_ms = 0.0;
+  int synced = -1;
+  int within = -1;
+  int t;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_nsec += NTP_CONVERGENCE_STEP_MS * 1000000L;
+  if (ts.tv_nsec >= 1000000000L) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000L;
+  }
+  rtems_test_assert(clock_settime(CLOCK_REALTIME, &ts) == 0);
+
+  ntp_start = true;
+  ntp_wait_until_running();
+  for (t = 1; t <= NTP_CONVERGENCE_SECS; t++) {
+    sleep(1);
+    if (!ntp_read_offset(fd, ++*seq, &offset_ms)) {
+      within = -1;
+      continue;
+    }
+    if (synced < 0) {
+      synced = t;
+    }
+    if (fabs(offset_ms) * 1000.0 < NTP_CONVERGENCE_US) {
+      if (within < 0) {
+        within = t;
+      }
+    } else {
+      within = -1;
+    }
+    if (t > NTP_CONVERGENCE_SECS - 60 && fabs(offset_ms) > max_ms) {
+      max_ms = fabs(offset_ms);
+    }
+  }
+  printf("convergence: %s: synchronized after %d s, offset within %d us "
+    "after %d s, max offset of the last minute %.3f ms\n", name, synced,
+    NTP_CONVERGENCE_US, within, max_ms);
+
+  ntp_start = false;
+  rtems_ntpd_stop();
+  ntp_wait_until_stopped();
+}
+
+static void ntp_test_convergence(void)
+{
+  struct sockaddr_in sin;
+  uint16_t seq = 0;
+  double offset_ms;
+  int fd;
+  int rv;
+
+  memset(&sin, 0, sizeof(sin));
+  sin.sin_len = sizeof(sin);
+  sin.sin_family = AF_INET;
+  rv = inet_pton(AF_INET, NET_CFG_NTP_IP, &sin.sin_addr);
+  rtems_test_assert(rv == 1);
+  fd = ntp_control_open();
+
+  /* set the clock, so that both runs start from the same offset */
+  ntp_start = true;
+  ntp_wait_until_running();
+  while (!ntp_read_offset(fd, ++seq, &offset_ms)) {
+    sleep(1);
+  }
+  ntp_start = false;
+  rtems_ntpd_stop();
+  ntp_wait_until_stopped();
+
+  ntp_convergence_run("stock polling", fd, &seq);
+
+  rv = rtems_ntpd_set_subsecond_poll((struct sockaddr *) &sin,
+    NTP_CONVERGENCE_POLL_MS);
+  rtems_test_assert(rv == 0);
+  ntp_convergence_run("sub-second polling", fd, &seq);
+
+  rv = rtems_ntpd_set_subsecond_poll((struct sockaddr *) &sin, 0);
+  rtems_test_assert(rv == 0);
+  close(fd);
+}
+#endif /* NTP_TEST_CONVERGENCE */
+
 static rtems_task ntpd_runner(
   rtems_task_argument argument
 )
 {
-  while (ntp_run_count++ < 2) {
+  while (ntp_run_count++ < NTP_RUNS) {
     char *argv[] = {
       "ntpd",
       "-g",
+#if NTP_BENCH_SHARDS
+      "-c",
+      "/etc/ntp-bench.conf",
+#endif /* NTP_BENCH_SHARDS */
 #if NTP_DEBUG
       "--set-debug-level=" NTP_DEBUG_STR,
 #endif
@@ -456,6 +896,38 @@ static rtems_task ntpd_runner(
   rtems_task_delete(RTEMS_SELF);
 }
 
+#if NTP_BENCH_SHARDS
+static void ntp_bench_shards(void)
+{
+  char *argv[] = {
+    "ntpq",
+    "-c",
+    "iostats",
+    "127.0.0.1",
+    NULL
+  };
+  const int argc = ((sizeof(argv) / sizeof(argv[0])) - 1);
+  size_t i;
+
+  for (i = 0; i < RTEMS_ARRAY_SIZE(ntp_bench_workers); i++) {
+    if (rtems_ntpd_set_workers(ntp_bench_workers[i]) != 0) {
+      printf("bench: %d shard(s): %s\n", ntp_bench_workers[i],
+        strerror(errno));
+      break;
+    }
+    ntp_start = true;
+    ntp_wait_until_running();
+    sleep(NTP_BENCH_SECS);
+    printf("bench: %d shard(s) requested\n", ntp_bench_workers[i]);
+    rtems_shell_NTPQ_Command.command(argc, argv);
+    /* keep the runner from restarting before the next count is set */
+    ntp_start = false;
+    rtems_ntpd_stop();
+    ntp_wait_until_stopped();
+  }
+}
+#endif /* NTP_BENCH_SHARDS */
+
 static void run_test(void)
 {
   rtems_status_code sc;
@@ -482,6 +954,10 @@ static void run_test(void)
   directive_failed( sc, "rtems_shell_init" );
   assert(sc == RTEMS_SUCCESSFUL);
 
+#if NTP_TEST_SYSTIME
+  ntp_test_systime();
+#endif /* NTP_TEST_SYSTIME */
+
   sc = rtems_task_create(
     rtems_build_name( 'n', 't', 'p', 'd' ),
     10,
@@ -494,9 +970,23 @@ static void run_test(void)
   sc = rtems_task_start( ntpd_id, ntpd_runner, 0 );
   directive_failed( sc, "rtems_task_start of TA1" );
 
+#if NTP_BENCH_SHARDS
+  ntp_bench_shards();
+  return;
+#endif /* NTP_BENCH_SHARDS */
+
+#if NTP_TEST_CONVERGENCE
+  ntp_test_convergence();
+  return;
+#endif /* NTP_TEST_CONVERGENCE */
+
   ntp_start = true;
   ntp_wait_until_running();
 
+#if NTP_TEST_MRU_LATENCY
+  ntp_test_mru_latency();
+#endif /* NTP_TEST_MRU_LATENCY */
+
   while (rtems_ntpd_running()) {
     sleep(2);
     restart_secs += 2;